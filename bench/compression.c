@@ -0,0 +1,135 @@
+/*
+Copyright:  Copyright Johannes Teichrieb 2015
+License:    opensource.org/licenses/MIT
+*/
+// bytes on wire versus CPU time of the built-in compression per kind of message
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lz.h"
+
+#define SECONDS_PER_CASE 0.3
+
+typedef void (*fill_t)(uint8_t *dest, uint32_t n);
+
+typedef struct {
+    const char *name;
+    uint32_t size;
+    fill_t fill;
+} benchCase_t;
+
+static uint32_t xorshift(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static void fillJson(uint8_t *dest, uint32_t n) {
+    static const char *names[] = { "temperature", "pressure", "humidity", "voltage" };
+    uint32_t state = 1;
+    uint32_t i = 0;
+    char record[128];
+    while (i < n) {
+        int length = snprintf(record, sizeof(record),
+                "{\"id\": %u, \"sensor\": \"%s\", \"value\": %u.%u, \"ok\": true},\n",
+                xorshift(&state) % 10000, names[xorshift(&state) % 4],
+                xorshift(&state) % 1000, xorshift(&state) % 100);
+        for (int k = 0; k < length && i < n; ++k)
+            dest[i++] = (uint8_t) record[k];
+    }
+}
+
+static void fillCsv(uint8_t *dest, uint32_t n) {
+    uint32_t state = 7;
+    uint32_t i = 0;
+    char row[96];
+    while (i < n) {
+        int length = snprintf(row, sizeof(row), "2015-06-%02u,%u,%u.%02u,EUR,settled\n",
+                1 + xorshift(&state) % 28, xorshift(&state) % 100000,
+                xorshift(&state) % 5000, xorshift(&state) % 100);
+        for (int k = 0; k < length && i < n; ++k)
+            dest[i++] = (uint8_t) row[k];
+    }
+}
+
+static void fillRandom(uint8_t *dest, uint32_t n) {
+    uint32_t state = 2463534242u;
+    for (uint32_t i = 0; i < n; ++i)
+        dest[i] = (uint8_t) xorshift(&state);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+static void runCase(const benchCase_t *c) {
+    uint8_t *src = malloc(c->size);
+    uint8_t *compressed = malloc(c->size);
+    uint8_t *decompressed = malloc(c->size);
+    if (!src || !compressed || !decompressed) {
+        fprintf(stderr, "allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    c->fill(src, c->size);
+
+    // as sent: 4 byte uncompressed size + data; incompressible data is sent as is
+    uint32_t compressedSize = 0;
+    size_t iterations = 0;
+    double start = now(), elapsed;
+    do {
+        compressedSize = lz_compress(src, c->size, compressed, c->size - 5);
+        ++iterations;
+    } while ((elapsed = now() - start) < SECONDS_PER_CASE);
+    double compressSpeed = (double) c->size * (double) iterations / elapsed / 1e6;
+
+    bool isCompressed = compressedSize != 0;
+    uint32_t wireSize = isCompressed ? compressedSize + 4 : c->size;
+
+    double decompressSpeed = 0.0;
+    if (isCompressed) {
+        iterations = 0;
+        start = now();
+        do {
+            if (lz_decompress(compressed, compressedSize, decompressed, c->size)) {
+                fprintf(stderr, "%s: decompression failed\n", c->name);
+                exit(EXIT_FAILURE);
+            }
+            ++iterations;
+        } while ((elapsed = now() - start) < SECONDS_PER_CASE);
+        decompressSpeed = (double) c->size * (double) iterations / elapsed / 1e6;
+    }
+
+    printf("%-14s %10u %10u %7.3f %12.1f %12.1f\n", c->name, c->size, wireSize,
+            (double) wireSize / (double) c->size, compressSpeed, decompressSpeed);
+
+    free(src);
+    free(compressed);
+    free(decompressed);
+}
+
+int main(void) {
+    const benchCase_t cases[] = {
+        { "json 128 B", 128, fillJson },
+        { "json 4 KiB", 4 << 10, fillJson },
+        { "json 256 KiB", 256 << 10, fillJson },
+        { "csv 512 KiB", 512 << 10, fillCsv },
+        { "random 64 KiB", 64 << 10, fillRandom },
+    };
+
+    printf("%-14s %10s %10s %7s %12s %12s\n", "message", "size", "wire", "ratio",
+            "comp MB/s", "decomp MB/s");
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i)
+        runCase(cases + i);
+
+    return 0;
+}
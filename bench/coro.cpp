@@ -0,0 +1,188 @@
+/*
+Copyright:  Copyright Johannes Teichrieb 2015
+License:    opensource.org/licenses/MIT
+*/
+/* receive path into a coroutine: resumed directly from the receive thread (nadam::coro)
+   versus the delegate pushing into a queue, which an event loop thread pops to resume the coroutine.  */
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "nadam_coro.hpp"
+
+namespace {
+
+constexpr size_t frameCount = 2000000;
+constexpr size_t hashLength = 4;
+constexpr size_t queueCapacity = 1024;
+constexpr int repetitions = 5;
+
+struct Sample : nadam::fixed<uint64_t> { static constexpr std::string_view name = "sample"; };
+
+// starts at once, destroyed at the end - enough for a consumer
+struct task {
+    struct promise_type {
+        task get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+struct {
+    std::vector<uint8_t> data;
+    size_t pos;
+    std::atomic_bool isDone;
+    uint64_t sum;
+} stream;
+
+int sendDummy(const void *, uint32_t) {
+    return 0;
+}
+
+// handshake byte, frames - fails at the end of the stream
+int recvStream(void *dest, uint32_t n) {
+    if (n > stream.data.size() - stream.pos)
+        return -1;
+
+    std::memcpy(dest, stream.data.data() + stream.pos, n);
+    stream.pos += n;
+    return 0;
+}
+
+void errorDelegate(int) {
+    stream.isDone = true;
+}
+
+void makeStream() {
+    auto id = nadam::id<Sample>;
+    stream.data.push_back(hashLength);
+    for (uint64_t i = 0; i < frameCount; ++i) {
+        stream.data.insert(stream.data.end(), id.begin(), id.begin() + hashLength);
+        auto *value = reinterpret_cast<const uint8_t *>(&i);
+        stream.data.insert(stream.data.end(), value, value + sizeof(i));
+    }
+}
+
+template <typename Connection>
+double receive(Connection &conn) {
+    stream.pos = 0;
+    stream.isDone = false;
+    auto start = std::chrono::steady_clock::now();
+    if (conn.initiate(sendDummy, recvStream, errorDelegate)) {
+        std::fprintf(stderr, "initiate failed\n");
+        std::exit(EXIT_FAILURE);
+    }
+    while (!stream.isDone)
+        std::this_thread::yield();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+task consumeDirectly(nadam::coro::connection<Sample> &conn) {
+    for (size_t i = 0; i < frameCount; ++i)
+        stream.sum += co_await conn.next<Sample>();
+}
+
+double runDirect() {
+    nadam::coro::connection<Sample> conn;
+    conn.init(hashLength);
+    consumeDirectly(conn);
+    double elapsed = receive(conn);
+    conn.stop();
+    return elapsed;
+}
+
+// the bridge - bounded, the delegate waits while it's full
+struct {
+    std::mutex lock;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::deque<uint64_t> values;
+    uint64_t current;
+    std::coroutine_handle<> consumer;
+} bridge;
+
+struct popAwaiter {
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) { bridge.consumer = handle; }
+    uint64_t await_resume() const noexcept { return bridge.current; }
+};
+
+task consumeFromQueue() {
+    for (size_t i = 0; i < frameCount; ++i)
+        stream.sum += co_await popAwaiter{};
+    bridge.consumer = nullptr;
+}
+
+void runEventLoop() {
+    while (bridge.consumer) {
+        {
+            std::unique_lock<std::mutex> guard(bridge.lock);
+            bridge.notEmpty.wait(guard, [] { return !bridge.values.empty(); });
+            bridge.current = bridge.values.front();
+            bridge.values.pop_front();
+        }
+        bridge.notFull.notify_one();
+        bridge.consumer.resume();
+    }
+}
+
+double runBridge() {
+    nadam::connection<Sample> conn;
+    conn.init(hashLength);
+    nadam::on<Sample>(conn, [](const uint64_t &value) {
+        {
+            std::unique_lock<std::mutex> guard(bridge.lock);
+            bridge.notFull.wait(guard, [] { return bridge.values.size() < queueCapacity; });
+            bridge.values.push_back(value);
+        }
+        bridge.notEmpty.notify_one();
+    });
+
+    consumeFromQueue();
+    auto start = std::chrono::steady_clock::now();
+    std::thread loop(runEventLoop);
+    receive(conn);
+    loop.join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    conn.stop();
+    return elapsed;
+}
+
+template <typename Run>
+double best(Run run) {
+    double min = 0.0;
+    for (int r = 0; r < repetitions; ++r) {
+        double elapsed = run();
+        min = (r == 0 || elapsed < min) ? elapsed : min;
+    }
+    return min * 1e9 / frameCount;
+}
+
+} // namespace
+
+int main() {
+    makeStream();
+    uint64_t expected = repetitions * (frameCount * (frameCount - 1) / 2);
+    std::printf("%zu frames, best of %d\n", frameCount, repetitions);
+
+    stream.sum = 0;
+    std::printf("%-28s %8.1f ns/message\n", "co_await conn.next()", best(runDirect));
+    bool isCorrect = stream.sum == expected;
+
+    stream.sum = 0;
+    std::printf("%-28s %8.1f ns/message\n", "delegate + queue + resume", best(runBridge));
+    isCorrect = isCorrect && stream.sum == expected;
+    return isCorrect ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,165 @@
+/*
+Copyright:  Copyright Johannes Teichrieb 2015
+License:    opensource.org/licenses/MIT
+*/
+// receive path per frame: random mix of fixed size types, catalogs of different sizes
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <time.h>
+
+#include "nadam.h"
+
+#define FRAME_COUNT 2000000
+#define MESSAGE_SIZE 8
+#define HASH_LENGTH 4
+#define NAME_LENGTH_MAX 32
+#define REPETITIONS 5
+
+static struct {
+    const uint8_t *src;
+    size_t n;
+    atomic_bool isDone;
+    uint64_t delegateSum;
+} stream;
+
+static uint32_t xorshift(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/* Bijective (murmur3 finalizer) - unique ids without structure. Ids in an arithmetic
+   progression would spread perfectly over tables indexed by the id itself.  */
+static uint32_t mixId(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x85ebca6bu;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35u;
+    x ^= x >> 16;
+    return x;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+static int sendDummy(const void *src, uint32_t n) {
+    return 0;
+}
+
+// handshake byte, frames - fails at the end of the stream
+static int recvStream(void *dest, uint32_t n) {
+    if (n > stream.n)
+        return -1;
+
+    memcpy(dest, stream.src, n);
+    stream.src += n;
+    stream.n -= n;
+    return 0;
+}
+
+static void errorDelegate(int error) {
+    atomic_store(&stream.isDone, true);
+}
+
+static void countingDelegate(void *msg, uint32_t size, const nadam_messageInfo_t *messageInfo) {
+    stream.delegateSum += *(const uint8_t *) msg + size;
+}
+
+static uint8_t *makeStream(const nadam_messageInfo_t *infos, size_t typeCount, size_t *length) {
+    size_t frameLength = HASH_LENGTH + MESSAGE_SIZE;
+    *length = 1 + (size_t) FRAME_COUNT * frameLength;
+    uint8_t *s = malloc(*length);
+    if (s == NULL)
+        return NULL;
+
+    s[0] = HASH_LENGTH;
+    uint32_t state = 2463534242u;
+    uint8_t *frame = s + 1;
+    for (size_t i = 0; i < FRAME_COUNT; ++i, frame += frameLength) {
+        memcpy(frame, infos[xorshift(&state) % typeCount].hash, HASH_LENGTH);
+        memset(frame + HASH_LENGTH, (int) i, MESSAGE_SIZE);
+    }
+    return s;
+}
+
+static double runCase(size_t typeCount) {
+    char (*names)[NAME_LENGTH_MAX] = malloc(typeCount * sizeof(*names));
+    nadam_messageInfo_t *infos = malloc(typeCount * sizeof(nadam_messageInfo_t));
+    if (!names || !infos) {
+        fprintf(stderr, "allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < typeCount; ++i) {
+        snprintf(names[i], NAME_LENGTH_MAX, "type %zu", i);
+        infos[i] = (nadam_messageInfo_t) { .name = names[i], .size = { false, { MESSAGE_SIZE } } };
+    }
+
+    // random ids, unique in their first HASH_LENGTH bytes
+    uint32_t state = 7;
+    for (size_t i = 0; i < typeCount; ++i) {
+        for (size_t k = 0; k < sizeof(infos[i].hash); ++k)
+            infos[i].hash[k] = (uint8_t) xorshift(&state);
+        uint32_t id = mixId((uint32_t) i);
+        memcpy(infos[i].hash, &id, HASH_LENGTH);
+    }
+
+    if (nadam_init(infos, typeCount, HASH_LENGTH)) {
+        fprintf(stderr, "nadam_init failed\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < typeCount; ++i)
+        nadam_setDelegate(names[i], countingDelegate);
+
+    size_t length;
+    uint8_t *s = makeStream(infos, typeCount, &length);
+    if (s == NULL) {
+        fprintf(stderr, "allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    double best = 0.0;
+    for (size_t r = 0; r < REPETITIONS; ++r) {
+        stream.src = s;
+        stream.n = length;
+        atomic_store(&stream.isDone, false);
+
+        double start = now();
+        if (nadam_initiate(sendDummy, recvStream, errorDelegate)) {
+            fprintf(stderr, "nadam_initiate failed\n");
+            exit(EXIT_FAILURE);
+        }
+        while (!atomic_load(&stream.isDone))
+            sched_yield();
+        double elapsed = now() - start;
+        best = (r == 0 || elapsed < best) ? elapsed : best;
+    }
+
+    nadam_stop();
+    free(s);
+    free(infos);
+    free(names);
+    return best * 1e9 / FRAME_COUNT;
+}
+
+int main(void) {
+    const size_t typeCounts[] = { 4, 16, 1000, 10000, 100000 };
+
+    printf("%10s %10s\n", "types", "ns/frame");
+    for (size_t i = 0; i < sizeof(typeCounts) / sizeof(typeCounts[0]); ++i)
+        printf("%10zu %10.1f\n", typeCounts[i], runCase(typeCounts[i]));
+
+    return stream.delegateSum == 0;
+}
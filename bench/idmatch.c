@@ -0,0 +1,124 @@
+/*
+Copyright:  Copyright Johannes Teichrieb 2015
+License:    opensource.org/licenses/MIT
+*/
+/* id lookup alone: idmatch_find() against open addressing with cache line entries (as the dispatch table).
+   The crossover decides IDMATCH_COUNT_MAX in nadam.c.  */
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "idmatch.h"
+#include "catalog.h"
+
+#define LOOKUP_COUNT 20000000
+#define ID_STREAM_LENGTH 4096
+#define REPETITIONS 5
+#define EMPTY UINT32_MAX
+
+typedef struct {
+    _Alignas(64) uint32_t id;
+    uint32_t index;
+    uint8_t rest[56];
+} entry_t;
+
+static uint32_t xorshift(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+static uint32_t probe(const entry_t *table, size_t mask, uint32_t id) {
+    size_t slot = catalog_hashId(id) & mask;
+    for (; table[slot].index != EMPTY; slot = (slot + 1) & mask) {
+        if (table[slot].id == id)
+            return table[slot].index;
+    }
+    return EMPTY;
+}
+
+// ns per lookup of ids in random order, best of REPETITIONS
+static void runCase(uint32_t count, double *matched, double *probed) {
+    uint32_t *ids = aligned_alloc(IDMATCH_ALIGNMENT, IDMATCH_PADDED_COUNT(count) * sizeof(uint32_t));
+    size_t capacity = 2;
+    while (capacity < count * 2)
+        capacity *= 2;
+    entry_t *table = aligned_alloc(64, capacity * sizeof(entry_t));
+    uint32_t *stream = malloc(ID_STREAM_LENGTH * sizeof(uint32_t));
+    if (!ids || !table || !stream) {
+        fprintf(stderr, "allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < IDMATCH_PADDED_COUNT(count); ++i)
+        ids[i] = 0;
+    for (size_t i = 0; i < capacity; ++i)
+        table[i].index = EMPTY;
+    for (uint32_t i = 0; i < count; ++i) {
+        ids[i] = (i + 1) * 2654435761u;
+        size_t slot = catalog_hashId(ids[i]) & (capacity - 1);
+        while (table[slot].index != EMPTY)
+            slot = (slot + 1) & (capacity - 1);
+        table[slot].id = ids[i];
+        table[slot].index = i;
+    }
+
+    uint32_t state = 2463534242u;
+    for (size_t i = 0; i < ID_STREAM_LENGTH; ++i)
+        stream[i] = ids[xorshift(&state) % count];
+
+    uint64_t sum = 0;
+    for (size_t r = 0; r < REPETITIONS; ++r) {
+        // the next id depends on the found position - lookups follow each other as frames do
+        uint32_t position = 0;
+        double start = now();
+        for (size_t i = 0; i < LOOKUP_COUNT; ++i) {
+            position = (position + 1 + (uint32_t) idmatch_find(ids, count, stream[position])) % ID_STREAM_LENGTH;
+            sum += position;
+        }
+        double elapsed = (now() - start) * 1e9 / LOOKUP_COUNT;
+        *matched = (r == 0 || elapsed < *matched) ? elapsed : *matched;
+
+        position = 0;
+        start = now();
+        for (size_t i = 0; i < LOOKUP_COUNT; ++i) {
+            position = (position + 1 + probe(table, capacity - 1, stream[position])) % ID_STREAM_LENGTH;
+            sum -= position;
+        }
+        elapsed = (now() - start) * 1e9 / LOOKUP_COUNT;
+        *probed = (r == 0 || elapsed < *probed) ? elapsed : *probed;
+    }
+
+    // both took the same path through the stream
+    if (sum != 0) {
+        fprintf(stderr, "lookups disagree\n");
+        exit(EXIT_FAILURE);
+    }
+    free(stream);
+    free(table);
+    free(ids);
+}
+
+int main(void) {
+    const uint32_t counts[] = { 2, 4, 8, 12, 16, 24, 32, 48, 64, 96, 128 };
+
+    printf("%8s %14s %14s\n", "types", "idmatch ns", "probing ns");
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); ++i) {
+        double matched = 0.0, probed = 0.0;
+        runCase(counts[i], &matched, &probed);
+        printf("%8u %14.2f %14.2f\n", counts[i], matched, probed);
+    }
+    return 0;
+}
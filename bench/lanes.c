@@ -0,0 +1,156 @@
+/*
+Copyright:  Copyright Johannes Teichrieb 2015
+License:    opensource.org/licenses/MIT
+*/
+/* one-way latency of small control messages while bulk messages are sent on the same connection -
+   bulk type on the priority lane (whole messages) and on the bulk lane (fragments).
+   The receiver is a forked process on the other end of a socket pair.  */
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "nadam.h"
+
+#define BULK_SIZE (16 * 1024 * 1024)
+#define CONTROL_COUNT 2000
+#define CONTROL_INTERVAL_NS 200000
+
+static const nadam_messageInfo_t infos[] = {
+    { .name = "control", .size = { false, { 8 } }, .hash = "ctrl" },
+    { .name = "bulk", .size = { true, { BULK_SIZE } }, .hash = "bulk" }
+};
+
+static int fd;
+static atomic_int controlReceived;
+static nadam_histogram_t latency;
+static atomic_bool isBulkDone;
+
+static int sendAll(const void *src, uint32_t n) {
+    const uint8_t *p = src;
+    while (n) {
+        ssize_t sent = send(fd, p, n, MSG_NOSIGNAL);
+        if (sent <= 0)
+            return -1;
+        p += sent;
+        n -= (uint32_t) sent;
+    }
+    return 0;
+}
+
+static int recvAll(void *dest, uint32_t n) {
+    return recv(fd, dest, n, MSG_WAITALL) == (ssize_t) n ? 0 : -1;
+}
+
+static void ignoreError(int error) { }
+
+// control message is the time it was handed to nadam_send() - waiting for the connection counts
+static void controlDelegate(void *msg, uint32_t size, const nadam_messageInfo_t *messageInfo) {
+    uint64_t sent;
+    memcpy(&sent, msg, sizeof(sent));
+    nadam_histogramRecord(&latency, nadam_timestamp() - sent);
+    atomic_fetch_add(&controlReceived, 1);
+}
+
+static void bulkDelegate(void *msg, uint32_t size, const nadam_messageInfo_t *messageInfo) { }
+
+static void initConnection(int socket) {
+    fd = socket;
+    if (nadam_init(infos, 2, 4) || nadam_setFeatures(NADAM_FEATURE_FRAGMENTS)) {
+        fprintf(stderr, "nadam_init failed\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// prints percentiles of control latency once all control messages arrived
+static void runReceiver(int socket, const char *label) {
+    initConnection(socket);
+    nadam_histogramReset(&latency);
+    nadam_setDelegate("control", controlDelegate);
+    nadam_setDelegate("bulk", bulkDelegate);
+    if (nadam_initiate(sendAll, recvAll, ignoreError)) {
+        fprintf(stderr, "nadam_initiate failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    while (atomic_load(&controlReceived) < CONTROL_COUNT) {
+        struct timespec ts = { .tv_nsec = 1000000 };
+        nanosleep(&ts, NULL);
+    }
+
+    printf("%-22s %10.1f %10.1f %10.1f\n", label, nadam_histogramPercentile(&latency, 50.0) / 1e3,
+            nadam_histogramPercentile(&latency, 99.0) / 1e3, nadam_histogramPercentile(&latency, 100.0) / 1e3);
+    fflush(stdout);
+    _exit(0);
+}
+
+static void *sendBulk(void *arg) {
+    uint8_t *bulk = calloc(1, BULK_SIZE);
+    while (bulk && !atomic_load(&isBulkDone) && !nadam_send("bulk", bulk, BULK_SIZE)) { }
+    free(bulk);
+    return NULL;
+}
+
+static void runSender(int socket, bool hasBulk, nadam_lane_t lane) {
+    initConnection(socket);
+    nadam_setLane("bulk", lane);
+    if (nadam_initiate(sendAll, recvAll, ignoreError)) {
+        fprintf(stderr, "nadam_initiate failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    atomic_store(&isBulkDone, false);
+    pthread_t bulkThread;
+    if (hasBulk)
+        pthread_create(&bulkThread, NULL, sendBulk, NULL);
+
+    for (int i = 0; i < CONTROL_COUNT; ++i) {
+        struct timespec ts = { .tv_nsec = CONTROL_INTERVAL_NS };
+        nanosleep(&ts, NULL);
+        uint64_t now = nadam_timestamp();
+        nadam_send("control", &now, 0);
+    }
+
+    atomic_store(&isBulkDone, true);
+    if (hasBulk)
+        pthread_join(bulkThread, NULL);
+}
+
+static void runCase(const char *label, bool hasBulk, nadam_lane_t lane) {
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets)) {
+        perror("socketpair");
+        exit(EXIT_FAILURE);
+    }
+
+    // the child mustn't inherit buffered output
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(sockets[0]);
+        runReceiver(sockets[1], label);
+    }
+
+    close(sockets[1]);
+    runSender(sockets[0], hasBulk, lane);
+    waitpid(pid, NULL, 0);
+    nadam_stop();
+    close(sockets[0]);
+}
+
+int main(void) {
+    printf("%d control messages, %d MiB bulk messages\n", CONTROL_COUNT, BULK_SIZE / (1024 * 1024));
+    printf("%-22s %10s %10s %10s\n", "control latency", "p50 us", "p99 us", "max us");
+    runCase("no bulk traffic", false, NADAM_LANE_PRIORITY);
+    runCase("bulk on priority lane", true, NADAM_LANE_PRIORITY);
+    runCase("bulk on bulk lane", true, NADAM_LANE_BULK);
+    return 0;
+}
@@ -0,0 +1,92 @@
+/*
+Copyright:  Copyright Johannes Teichrieb 2015
+License:    opensource.org/licenses/MIT
+*/
+// startup cost of message types defined at run time: ids of 100k types and nadam_init() with them
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nadam.h"
+#include "sha1.h"
+
+#define TYPE_COUNT 100000
+#define NAME_LENGTH_MAX 48
+#define REPETITIONS 5
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+static void makeNames(char (*names)[NAME_LENGTH_MAX], nadam_messageInfo_t *infos) {
+    for (size_t i = 0; i < TYPE_COUNT; ++i) {
+        snprintf(names[i], NAME_LENGTH_MAX, "service %zu/telemetry/channel %zu", i % 97, i);
+        infos[i] = (nadam_messageInfo_t) { .name = names[i], .size = { i % 3 == 0, { (uint32_t) (i % 4096 + 1) } } };
+    }
+}
+
+// one input after another - as without the lanes
+static void digestSingly(const nadam_messageInfo_t *infos) {
+    uint8_t input[NAME_LENGTH_MAX + 5];
+    for (size_t i = 0; i < TYPE_COUNT; ++i) {
+        size_t length = strlen(infos[i].name);
+        memcpy(input, infos[i].name, length);
+        input[length] = infos[i].size.isVariable;
+        memcpy(input + length + 1, &infos[i].size.total, 4);
+        uint8_t digest[SHA1_DIGEST_LENGTH];
+        sha1_digest(input, length + 5, digest);
+    }
+}
+
+static double best(double *times) {
+    double min = times[0];
+    for (size_t i = 1; i < REPETITIONS; ++i)
+        min = times[i] < min ? times[i] : min;
+    return min;
+}
+
+int main(void) {
+    char (*names)[NAME_LENGTH_MAX] = malloc(TYPE_COUNT * sizeof(*names));
+    nadam_messageInfo_t *infos = malloc(TYPE_COUNT * sizeof(nadam_messageInfo_t));
+    if (!names || !infos) {
+        fprintf(stderr, "allocation failed\n");
+        return EXIT_FAILURE;
+    }
+    makeNames(names, infos);
+
+    double singly[REPETITIONS], lanes[REPETITIONS], init[REPETITIONS];
+    for (size_t r = 0; r < REPETITIONS; ++r) {
+        double start = now();
+        digestSingly(infos);
+        singly[r] = now() - start;
+
+        start = now();
+        if (nadam_makeMessageInfos(infos, TYPE_COUNT)) {
+            fprintf(stderr, "nadam_makeMessageInfos failed\n");
+            return EXIT_FAILURE;
+        }
+        lanes[r] = now() - start;
+
+        start = now();
+        if (nadam_init(infos, TYPE_COUNT, 4)) {
+            fprintf(stderr, "nadam_init failed\n");
+            return EXIT_FAILURE;
+        }
+        init[r] = now() - start;
+    }
+
+    printf("%d types, best of %d\n", TYPE_COUNT, REPETITIONS);
+    printf("%-26s %8.2f ms %8.1f ns/type\n", "sha1_digest one by one", best(singly) * 1e3, best(singly) * 1e9 / TYPE_COUNT);
+    printf("%-26s %8.2f ms %8.1f ns/type\n", "nadam_makeMessageInfos", best(lanes) * 1e3, best(lanes) * 1e9 / TYPE_COUNT);
+    printf("%-26s %8.2f ms %8.1f ns/type\n", "nadam_init", best(init) * 1e3, best(init) * 1e9 / TYPE_COUNT);
+
+    free(infos);
+    free(names);
+    return 0;
+}
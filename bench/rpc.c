@@ -0,0 +1,152 @@
+/*
+Copyright:  Copyright Johannes Teichrieb 2015
+License:    opensource.org/licenses/MIT
+*/
+/* RPC throughput: each call waits for the previous response (nadam_rpcCallWait) versus
+   calls pipelined with up to a window of them in flight. The server is a forked process
+   on the other end of a socket pair.  */
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "nadam.h"
+
+#define CALL_COUNT 200000
+#define PAYLOAD_SIZE 64
+
+static const nadam_messageInfo_t infos[] = {
+    { .name = "echo request", .size = { false, { 4 + PAYLOAD_SIZE } }, .hash = "ereq" },
+    { .name = "echo response", .size = { false, { 4 + PAYLOAD_SIZE } }, .hash = "eres" }
+};
+
+static int fd;
+static atomic_uint completed;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+static int sendAll(const void *src, uint32_t n) {
+    const uint8_t *p = src;
+    while (n) {
+        ssize_t sent = send(fd, p, n, MSG_NOSIGNAL);
+        if (sent <= 0)
+            return -1;
+        p += sent;
+        n -= (uint32_t) sent;
+    }
+    return 0;
+}
+
+static int recvAll(void *dest, uint32_t n) {
+    return recv(fd, dest, n, MSG_WAITALL) == (ssize_t) n ? 0 : -1;
+}
+
+static void ignoreError(int error) { }
+
+// the client closed the connection
+static void exitServer(int error) {
+    _exit(EXIT_SUCCESS);
+}
+
+static void echoHandler(nadam_rpcReply_t reply, const void *request, uint32_t size, void *context) {
+    nadam_rpcRespond(reply, request, size);
+}
+
+static void countingCompletion(int error, const void *response, uint32_t size, void *context) {
+    atomic_fetch_add(&completed, 1);
+}
+
+static void initConnection(int socket, nadam_rpcHandler_t handler, nadam_errorDelegate_t errorDelegate) {
+    fd = socket;
+    if (nadam_init(infos, 2, 4) || nadam_rpcBind("echo request", "echo response", handler, NULL)
+            || nadam_initiate(sendAll, recvAll, errorDelegate)) {
+        fprintf(stderr, "connection setup failed\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// serves until the client closes the connection
+static void runServer(int socket) {
+    initConnection(socket, echoHandler, exitServer);
+    while (true)
+        pause();
+}
+
+static double runSequential(void) {
+    uint8_t request[PAYLOAD_SIZE] = { 0 }, response[PAYLOAD_SIZE];
+    double start = now();
+    for (uint32_t i = 0; i < CALL_COUNT; ++i) {
+        uint32_t size = sizeof(response);
+        if (nadam_rpcCallWait("echo request", request, sizeof(request), 0, response, &size)) {
+            fprintf(stderr, "nadam_rpcCallWait failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return now() - start;
+}
+
+static double runPipelined(uint32_t window) {
+    uint8_t request[PAYLOAD_SIZE] = { 0 };
+    atomic_store(&completed, 0);
+    double start = now();
+    for (uint32_t i = 0; i < CALL_COUNT; ++i) {
+        while (i - atomic_load(&completed) >= window)
+            sched_yield();
+
+        if (nadam_rpcCall("echo request", request, sizeof(request), 0, countingCompletion, NULL)) {
+            fprintf(stderr, "nadam_rpcCall failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    while (atomic_load(&completed) < CALL_COUNT)
+        sched_yield();
+    return now() - start;
+}
+
+static void printResult(const char *label, double elapsed) {
+    printf("%-22s %10.0f calls/s %8.2f us/call\n", label, CALL_COUNT / elapsed, elapsed * 1e6 / CALL_COUNT);
+}
+
+int main(void) {
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets)) {
+        perror("socketpair");
+        return EXIT_FAILURE;
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(sockets[0]);
+        runServer(sockets[1]);
+    }
+    close(sockets[1]);
+    initConnection(sockets[0], NULL, ignoreError);
+
+    printf("%d calls, %d byte payload\n", CALL_COUNT, PAYLOAD_SIZE);
+    printResult("sequential", runSequential());
+    const uint32_t windows[] = { 16, 256 };
+    for (size_t i = 0; i < sizeof(windows) / sizeof(windows[0]); ++i) {
+        char label[32];
+        snprintf(label, sizeof(label), "pipelined, %u in flight", windows[i]);
+        printResult(label, runPipelined(windows[i]));
+    }
+
+    nadam_stop();
+    shutdown(sockets[0], SHUT_RDWR);
+    close(sockets[0]);
+    waitpid(pid, NULL, 0);
+    return 0;
+}
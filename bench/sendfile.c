@@ -0,0 +1,166 @@
+/*
+Copyright:  Copyright Johannes Teichrieb 2015
+License:    opensource.org/licenses/MIT
+*/
+/* Sending message bodies stored in a file: read() into memory and nadam_send() versus
+   nadam_sendFromFd() moving the body with sendfile(). The receiver is a forked process
+   on the other end of a TCP loopback connection.  */
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "nadam.h"
+
+#define MESSAGE_COUNT 2000
+#define BODY_SIZE (1024 * 1024)
+
+static const char *bodyPath = "/tmp/nadam_bench.body";
+
+static const nadam_messageInfo_t infos[] = {
+    { .name = "file body", .size = { true, { BODY_SIZE } }, .hash = "fbod" }
+};
+
+static int fd;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+static int sendAll(const void *src, uint32_t n) {
+    const uint8_t *p = src;
+    while (n) {
+        ssize_t sent = send(fd, p, n, MSG_NOSIGNAL);
+        if (sent <= 0)
+            return -1;
+        p += sent;
+        n -= (uint32_t) sent;
+    }
+    return 0;
+}
+
+static int recvAll(void *dest, uint32_t n) {
+    return recv(fd, dest, n, MSG_WAITALL) == (ssize_t) n ? 0 : -1;
+}
+
+static void ignoreError(int error) { }
+
+// the sender closed the connection
+static void exitReceiver(int error) {
+    _exit(EXIT_SUCCESS);
+}
+
+static void initConnection(int socket, nadam_errorDelegate_t errorDelegate) {
+    fd = socket;
+    if (nadam_init(infos, 1, 4) || nadam_initiate(sendAll, recvAll, errorDelegate)) {
+        fprintf(stderr, "connection setup failed\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void openConnection(int *client, int *server) {
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t length = sizeof(addr);
+    int listening = socket(AF_INET, SOCK_STREAM, 0);
+    *client = socket(AF_INET, SOCK_STREAM, 0);
+    if (listening < 0 || *client < 0 || bind(listening, (struct sockaddr *) &addr, length)
+            || getsockname(listening, (struct sockaddr *) &addr, &length) || listen(listening, 1)
+            || connect(*client, (struct sockaddr *) &addr, length)
+            || (*server = accept(listening, NULL, NULL)) < 0) {
+        perror("connection");
+        exit(EXIT_FAILURE);
+    }
+    close(listening);
+}
+
+static int makeBodyFile(void) {
+    int body = open(bodyPath, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    uint8_t *content = malloc(BODY_SIZE);
+    if (body < 0 || content == NULL) {
+        perror("body file");
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t i = 0; i < BODY_SIZE; ++i)
+        content[i] = (uint8_t) i;
+    if (write(body, content, BODY_SIZE) != BODY_SIZE) {
+        perror("body file");
+        exit(EXIT_FAILURE);
+    }
+    free(content);
+    return body;
+}
+
+static double runCopying(int body) {
+    uint8_t *buffer = malloc(BODY_SIZE);
+    double start = now();
+    for (uint32_t i = 0; i < MESSAGE_COUNT; ++i) {
+        if (pread(body, buffer, BODY_SIZE, 0) != BODY_SIZE || nadam_send("file body", buffer, BODY_SIZE)) {
+            fprintf(stderr, "copying send failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    double elapsed = now() - start;
+    free(buffer);
+    return elapsed;
+}
+
+static double runSendFromFd(int body) {
+    nadam_setSendFd(fd);
+    double start = now();
+    for (uint32_t i = 0; i < MESSAGE_COUNT; ++i) {
+        if (nadam_sendFromFd("file body", body, 0, BODY_SIZE)) {
+            fprintf(stderr, "nadam_sendFromFd failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return now() - start;
+}
+
+static void printResult(const char *label, double elapsed) {
+    double bytes = (double) MESSAGE_COUNT * BODY_SIZE;
+    printf("%-22s %8.2f GB/s %8.1f us/message\n", label, bytes / elapsed * 1e-9, elapsed * 1e6 / MESSAGE_COUNT);
+}
+
+static void discardDelegate(void *msg, uint32_t size, const nadam_messageInfo_t *mi) { }
+
+int main(void) {
+    int client, server;
+    openConnection(&client, &server);
+    int body = makeBodyFile();
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(client);
+        initConnection(server, exitReceiver);
+        nadam_setDelegate("file body", discardDelegate);
+        while (true)
+            pause();
+    }
+    close(server);
+    initConnection(client, ignoreError);
+
+    printf("%d messages, %d byte bodies\n", MESSAGE_COUNT, BODY_SIZE);
+    printResult("read and nadam_send", runCopying(body));
+    printResult("nadam_sendFromFd", runSendFromFd(body));
+
+    nadam_stop();
+    shutdown(client, SHUT_RDWR);
+    close(client);
+    waitpid(pid, NULL, 0);
+    close(body);
+    unlink(bodyPath);
+    return 0;
+}
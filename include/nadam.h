@@ -7,6 +7,12 @@ License:    opensource.org/licenses/MIT
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 typedef struct {
     bool isVariable;
@@ -36,13 +42,73 @@ typedef struct {
 #define NADAM_ERROR_NULL_POINTER 309
 #define NADAM_ERROR_SEND 310
 #define NADAM_ERROR_SIZE_ARG 311
+#define NADAM_ERROR_HANDSHAKE_EXTENSION 312
+#define NADAM_ERROR_INVALID_ARGUMENT 313
+#define NADAM_ERROR_CAPTURE 314
+#define NADAM_ERROR_BUSY 315
+#define NADAM_ERROR_LOW_LATENCY 316
+#define NADAM_ERROR_CATALOG 317
+#define NADAM_ERROR_CATALOG_UPDATE 318
+#define NADAM_ERROR_RPC_TIMEOUT 319
+#define NADAM_ERROR_DATAGRAM 320
+#define NADAM_ERROR_FILE 321
 // errors passed to the error delegate
 #define NADAM_ERROR_RECV 500
 #define NADAM_ERROR_UNKNOWN_HASH 501
 #define NADAM_ERROR_VARIABLE_SIZE 502
+#define NADAM_ERROR_DECOMPRESS 503
+#define NADAM_ERROR_DELTA 504
+#define NADAM_ERROR_FRAGMENT 505
+
+/* Optional protocol features. Features are offered during the handshake,
+   only those offered by both sides are used on a connection.  */
+#define NADAM_FEATURE_TIMESTAMP 0x1
+#define NADAM_FEATURE_COMPRESSION 0x2
+#define NADAM_FEATURE_DELTA 0x4
+#define NADAM_FEATURE_FRAGMENTS 0x8
+#define NADAM_FEATURE_COMPACT_SIZE 0x10
+
+typedef enum {
+    NADAM_LANE_PRIORITY, // default
+    NADAM_LANE_BULK
+} nadam_lane_t;
+
+typedef enum {
+    NADAM_LATENCY_ONE_WAY, // sender's timestamp -> message received, before its delegate is called
+    NADAM_LATENCY_DELEGATE, // time spent in the delegate
+    NADAM_LATENCY_ROUND_TRIP, // recorded by the user with nadam_recordRoundTrip()
+    NADAM_LATENCY_KIND_COUNT
+} nadam_latencyKind_t;
+
+// log-linear histogram - relative error of percentiles is at most 1 / 2^SUB_BUCKET_BITS
+#define NADAM_HISTOGRAM_SUB_BUCKET_BITS 3
+#define NADAM_HISTOGRAM_BUCKET_COUNT ((64 - NADAM_HISTOGRAM_SUB_BUCKET_BITS + 1) << NADAM_HISTOGRAM_SUB_BUCKET_BITS)
+
+typedef struct {
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+    uint64_t buckets[NADAM_HISTOGRAM_BUCKET_COUNT];
+} nadam_histogram_t;
 
 typedef int (*nadam_send_t)(const void *src, uint32_t n);
 typedef int (*nadam_recv_t)(void *dest, uint32_t n);
+// doesn't block - returns count of received bytes (0 if none are available) or -1 on error
+typedef int32_t (*nadam_recvSome_t)(void *dest, uint32_t n);
+
+typedef struct {
+    // NULL - receive thread blocks in recv
+    nadam_recvSome_t recvSome;
+    // longest time spinning on recvSome before falling back to blocking recv (adaptively shortened)
+    uint64_t spinNs;
+    // -1 - no pinning
+    int cpu;
+    // 0 - normal scheduling, SCHED_FIFO priority otherwise
+    int realtimePriority;
+    bool isMemoryLocked;
+} nadam_lowLatency_t;
+
 /* If a delegate was set with nadam_setDelegate()
    memory pointed to by msg should be considered invalid after it returns.
    Size parmeter will provide the actual size of a variable size message.  */
@@ -68,6 +134,24 @@ typedef void (*nadam_errorDelegate_t)(int error);
 
 // messageInfos will be used continuously - it should be unlimited lifetime const
 int nadam_init(const nadam_messageInfo_t *messageInfos, size_t messageInfoCount, size_t hashLengthMin);
+/* Initializes from a binary catalog written by gennmi -binary. The file is mapped read-only
+   and used in place - its name table replaces the name map and the minimum hash length is
+   the catalog's shortest collision-free one. The mapping is kept until the next init.
+   Invalid catalog (or a big-endian host) fails with NADAM_ERROR_CATALOG.  */
+int nadam_initFromCatalogFile(const char *path);
+/* Computes nameLength and hash of messageInfos from name and size - the same ids the generator writes.
+   Message types defined at run time can be passed to nadam_init() afterwards.  */
+int nadam_makeMessageInfos(nadam_messageInfo_t *messageInfos, size_t messageInfoCount);
+
+/* Replaces the catalog while connected. The new one has to contain every current type unchanged
+   (name, size and hash) and its ids have to be unique at the negotiated hash length -
+   otherwise it fails with NADAM_ERROR_CATALOG_UPDATE and the current catalog stays.
+   Delegates and per type settings carry over, indices refer to the new catalog afterwards.
+   Sends and received frames in progress are not blocked - the call waits for them to finish,
+   so it must not be called from a delegate (NADAM_ERROR_BUSY).
+   Previous messageInfos (or the mapping of the previous catalog file) may be freed once it returns.  */
+int nadam_updateCatalog(const nadam_messageInfo_t *messageInfos, size_t messageInfoCount);
+int nadam_updateFromCatalogFile(const char *path);
 
 /* If the delegate for a message type is not set, messages of this type are ignored (dumped).
    Passing NULL as second argument removes the delegate.
@@ -76,16 +160,215 @@ int nadam_init(const nadam_messageInfo_t *messageInfos, size_t messageInfoCount,
 int nadam_setDelegate(const char *name, nadam_recvDelegate_t delegate);
 int nadam_setDelegateWithRecvBuffer(const char *name, nadam_recvDelegate_t delegate,
         void *buffer, volatile bool *recvStart);
+// index of the type in messageInfos passed to nadam_init() - skips the name lookup
+int nadam_setDelegateByIndex(size_t index, nadam_recvDelegate_t delegate,
+        void *buffer, volatile bool *recvStart);
+/* Receiving into memory chosen per message (a slot of a ring, an arena chunk, a pooled object):
+   once id and size of a message are received, acquire() returns its destination - the delegate gets it
+   with ownership, instead of the type's buffer. size is the message size (the type's maximum size
+   for compressed and fragmented messages). NULL from acquire() drops the message.
+   release() (can be NULL) gets back buffers no delegate will own - the receive failed,
+   or the type has no delegate. Applies to datagram and multicast receiving as well.  */
+typedef struct {
+    void *(*acquire)(uint32_t size, const nadam_messageInfo_t *messageInfo, void *context);
+    void (*release)(void *buffer, void *context);
+    void *context;
+} nadam_bufferProvider_t;
+// NULL provider - the type's buffer is used again
+int nadam_setBufferProvider(const char *name, const nadam_bufferProvider_t *provider);
+// copy of the type's info - its name is valid while the catalog is
+int nadam_getMessageInfo(const char *name, nadam_messageInfo_t *dest);
 
+/* Reconnecting is calling nadam_initiate() again with the new connection.
+   Maps and buffers are reused. After an error the receive thread waits for the next
+   nadam_initiate() instead of exiting, so a reconnect doesn't create a new thread.  */
 int nadam_initiate(nadam_send_t send, nadam_recv_t recv, nadam_errorDelegate_t errorDelegate);
 
 /* nadam_send() can only be used after a successful nadam_initiate() call.
-   Size argument is ignored for constant size messages.  */
+   Size argument is ignored for constant size messages.
+   Sending from several threads is safe - frames don't interleave.  */
 int nadam_send(const char *name, const void *msg, uint32_t size);
 /* Calling this send version (Send With Immutable Name) promises
    that the name is a string literal or memory,
    whose content won't change throughout the life of the program - allows name lookup caching.  */
 int nadam_sendWin(const char *name, const void *msg, uint32_t size);
+int nadam_sendByIndex(size_t index, const void *msg, uint32_t size);
+/* Sends the parts as one message - their summed size is the message size (of a fixed size message
+   it has to be its size). The parts are passed to the send function one by one, with a send fd
+   (nadam_setSendFd()) the whole frame is written by writev. Parts are assembled only if a negotiated
+   feature transforms the body (compression, delta, fragments).  */
+int nadam_sendv(const char *name, const struct iovec *parts, int count);
+/* Descriptor of the connection (socket or pipe) nadam_send_t writes to, without buffering - lets
+   nadam_sendFromFd() move message bodies in the kernel. Has to be set after nadam_init(); -1 unsets.  */
+void nadam_setSendFd(int fd);
+/* Sends length bytes at offset of the regular file fd as the message body. With a send fd the body goes
+   from the page cache to the connection (sendfile), otherwise - or if a negotiated feature transforms
+   the body (compression, delta, fragments) - it is read into memory and sent as by nadam_send().
+   Length of a fixed size message has to be its size. A file shorter than offset + length
+   is NADAM_ERROR_FILE.  */
+int nadam_sendFromFd(const char *name, int fd, off_t offset, uint32_t length);
 
 // stops receiving - connection should be closed after this
 void nadam_stop(void);
+
+/* Features have to be set after nadam_init() and before nadam_initiate().
+   If no feature is set, the plain 1 byte handshake is sent, which is understood by every peer.
+   Offering a feature sends the extended handshake - the peer has to understand it (see README).  */
+int nadam_setFeatures(uint32_t features);
+// valid after nadam_initiate()
+uint32_t nadam_getNegotiatedFeatures(void);
+
+/* Limits are sent in the extended handshake next to the features - 0 is no limit (no preference).
+   Setting a limit sends the extended handshake even without features.  */
+typedef struct {
+    /* Longest data of a variable size frame the participant receives. The peer fragments longer messages
+       of its bulk lane to it (with NADAM_FEATURE_FRAGMENTS), other longer sends fail with NADAM_ERROR_SIZE_ARG.
+       If the peer sent its limits (i.e. knows them), a longer frame received is NADAM_ERROR_VARIABLE_SIZE.  */
+    uint32_t frameMax;
+    // count of messages the participant prefers to get per transport write - a hint for the peer's batching
+    uint32_t batchPreferred;
+} nadam_limits_t;
+
+// has to be set after nadam_init() and before nadam_initiate(), as features
+int nadam_setLimits(const nadam_limits_t *limits);
+// valid after nadam_initiate() - zeros if the peer sent no limits (plain handshake or an older extension)
+int nadam_getPeerLimits(nadam_limits_t *dest);
+
+/* Low latency profile of the receive thread. Has to be set after nadam_init() and
+   takes effect with the next nadam_initiate(). NULL restores the default.
+   The receive thread spins on recvSome - the connection's recv is used only after
+   spinNs without data. recvSome and recv are expected to read from the same stream
+   (e.g. recv() with and without MSG_DONTWAIT on a blocking socket).
+   Receive buffers (including those of nadam_setDelegateWithRecvBuffer()) are prefaulted
+   and optionally locked in memory by nadam_initiate().
+   Pinning, real-time priority and memory locking errors make nadam_initiate() fail
+   with NADAM_ERROR_LOW_LATENCY (real-time priority and locking usually require privileges).  */
+int nadam_setLowLatency(const nadam_lowLatency_t *config);
+
+/* Latency recording is active while NADAM_FEATURE_TIMESTAMP is negotiated.
+   Timestamps are CLOCK_MONOTONIC nanoseconds - one-way latency is only meaningful on the same host.  */
+uint64_t nadam_timestamp(void);
+// sender's timestamp of the message being delivered - only valid inside a delegate
+uint64_t nadam_getRecvTimestamp(void);
+int nadam_recordRoundTrip(const char *name, uint64_t sendTimestamp);
+// copies (exports) the histogram - they can be combined with nadam_histogramMerge()
+int nadam_getLatencyHistogram(const char *name, nadam_latencyKind_t kind, nadam_histogram_t *dest);
+
+/* While NADAM_FEATURE_COMPRESSION is negotiated, variable size messages of this type
+   with at least minSize bytes are sent compressed (unless compression doesn't pay off).
+   minSize 0 disables compression of the type (default). Receiving doesn't require any setting.  */
+int nadam_setCompression(const char *name, uint32_t minSize);
+
+/* While NADAM_FEATURE_DELTA is negotiated, fixed size messages of this type are sent
+   as a delta against the previously sent value. Every fullInterval-th message (and one after
+   nadam_requestFullFrame()) is sent complete. fullInterval 0 disables delta encoding (default).
+   The recipient rebuilds the complete value into the delegate's buffer.  */
+int nadam_setDelta(const char *name, uint32_t fullInterval);
+int nadam_requestFullFrame(const char *name);
+
+/* While NADAM_FEATURE_FRAGMENTS is negotiated, bigger variable size messages of types on the bulk lane
+   are sent in fragments (64 KiB). Messages of the priority lane waiting to be sent go between
+   the fragments - they don't wait for the whole bulk message. Bulk messages are sent one at a time
+   and aren't compressed when fragmented. Only variable size types can be put on the bulk lane.
+   The recipient reassembles the message and calls the delegate once.  */
+int nadam_setLane(const char *name, nadam_lane_t lane);
+
+/* RPC over pairs of message types. Data of both types starts with a 4 byte call id (little-endian)
+   followed by the payload - catalog sizes include the id. A call doesn't wait for the previous ones:
+   any number of calls can be in flight, responses are matched to them by the id.
+   nadam_rpcBind() sets the delegate of the response type and, if handler isn't NULL, of the request type
+   (the side serving the calls). Bindings have to be renewed after nadam_init().  */
+typedef struct {
+    const char *responseName;
+    uint32_t callId;
+} nadam_rpcReply_t;
+// error is 0, NADAM_ERROR_RPC_TIMEOUT or the one passed to nadam_rpcCancelAll(); response is valid during the call
+typedef void (*nadam_rpcCompletion_t)(int error, const void *response, uint32_t size, void *context);
+/* request is valid during the call - the reply can be kept and responded to later, from any thread,
+   also after the binding was renewed  */
+typedef void (*nadam_rpcHandler_t)(nadam_rpcReply_t reply, const void *request, uint32_t size, void *context);
+
+int nadam_rpcBind(const char *requestName, const char *responseName, nadam_rpcHandler_t handler, void *context);
+/* Completion is called once - from the receive thread with the response or after timeoutMs
+   (0 - no timeout) from the RPC timer thread. Size is ignored for fixed size requests.
+   If sending fails, nadam_rpcCall() returns -1 and the completion isn't called.  */
+int nadam_rpcCall(const char *requestName, const void *request, uint32_t size, uint32_t timeoutMs,
+        nadam_rpcCompletion_t completion, void *context);
+/* Waits for the response - must not be called from a delegate. responseSize is the capacity of response
+   on input, size of the response on return. Errors of the completion are returned in errno.  */
+int nadam_rpcCallWait(const char *requestName, const void *request, uint32_t size, uint32_t timeoutMs,
+        void *response, uint32_t *responseSize);
+int nadam_rpcRespond(nadam_rpcReply_t reply, const void *response, uint32_t size);
+// completes every call in flight with error - e.g. from the error delegate after the connection broke
+void nadam_rpcCancelAll(int error);
+
+/* Datagram mode - messages over a UDP socket instead of the connection. There is no handshake
+   (no features): frames have the base form (id, size field of variable size types, data) and are packed
+   into datagrams of up to datagramLength bytes. Sends are batched - nadam_datagramFlush() sends
+   the datagrams packed so far (a full batch is sent on its own). nadam_datagramRecv() receives a batch
+   and calls the delegates; a datagram with an invalid frame is dropped whole and counted.
+   The socket is connected (sending) or bound (receiving) by the caller and stays open after closing.
+   A frame longer than datagramLength can't be sent (NADAM_ERROR_SIZE_ARG).  */
+int nadam_datagramOpen(int fd, uint32_t datagramLength);
+void nadam_datagramClose(void);
+int nadam_datagramSend(const char *name, const void *msg, uint32_t size);
+int nadam_datagramFlush(void);
+/* Waits for the first datagram if the socket blocks - returns count of delivered messages (0 on EAGAIN).
+   Called by a single thread, which also opens and closes the datagram mode - sending isn't bound to it.  */
+int nadam_datagramRecv(void);
+// from any thread
+uint64_t nadam_datagramDroppedCount(void);
+
+/* Multicast publishing on top of the datagram framing - one send reaches every subscriber.
+   Each datagram starts with a 24 byte header: stream, kind, session and sequence number. Subscribers track
+   the sequence per stream and report gaps. Opening the publisher again (e.g. after a restart) starts
+   a later session of the stream, numbered from 0 - subscribers follow it without reporting a gap. With hasSnapshot, the publisher keeps the latest value
+   of every fixed size type published (until nadam_init()); nadam_publishSnapshot() sends them,
+   e.g. periodically - a subscriber takes a single snapshot, the first one matching its stream position.
+   The sockets are set up by the caller: the publisher's connected to the group (IP_MULTICAST_IF,
+   IP_MULTICAST_LOOP for subscribers on the same host), the subscriber's bound and joined (IP_ADD_MEMBERSHIP).  */
+typedef struct {
+    // distinguishes publishers of a group
+    uint32_t stream;
+    uint32_t datagramLength;
+    bool hasSnapshot;
+} nadam_publisherConfig_t;
+// first is the sequence of the first datagram missed - called from nadam_subscriberRecv()
+typedef void (*nadam_gapDelegate_t)(uint32_t stream, uint64_t first, uint64_t count);
+
+int nadam_publisherOpen(int fd, const nadam_publisherConfig_t *config);
+void nadam_publisherClose(void);
+int nadam_publish(const char *name, const void *msg, uint32_t size);
+int nadam_publishFlush(void);
+// flushes the data published so far first
+int nadam_publishSnapshot(void);
+// gapDelegate can be NULL
+int nadam_subscriberOpen(int fd, uint32_t datagramLength, nadam_gapDelegate_t gapDelegate);
+void nadam_subscriberClose(void);
+// as nadam_datagramRecv()
+int nadam_subscriberRecv(void);
+// data datagrams missed in all streams
+uint64_t nadam_subscriberLostCount(void);
+uint64_t nadam_subscriberDroppedCount(void);
+
+void nadam_histogramReset(nadam_histogram_t *h);
+void nadam_histogramRecord(nadam_histogram_t *h, uint64_t value);
+void nadam_histogramMerge(nadam_histogram_t *dest, const nadam_histogram_t *src);
+// percentile in range [0, 100]; returns the upper bound of the matching bucket
+uint64_t nadam_histogramPercentile(const nadam_histogram_t *h, double percentile);
+
+/* Capture appends every received frame with its receive time to a memory-mapped file.
+   Frames are stored in base protocol form (features decoded). Capture survives nadam_init().
+   nadam_stopCapture() writes an index of frame offsets per message type.
+   Errors writing the capture don't affect the connection - they are reported by nadam_stopCapture().  */
+int nadam_startCapture(const char *path);
+int nadam_stopCapture(void);
+/* Feeds captured frames through the receive path: decoding and delegates of the current catalog.
+   Must not be used while receiving (between nadam_initiate() and nadam_stop()).
+   If name isn't NULL, only frames of this type are replayed.
+   Speed is relative to the captured timing (2.0 is twice as fast); 0 replays as fast as possible.  */
+int nadam_replayCapture(const char *path, const char *name, double speed);
+
+#ifdef __cplusplus
+}
+#endif
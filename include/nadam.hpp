@@ -0,0 +1,365 @@
+/*
+Copyright:  Copyright Johannes Teichrieb 2015
+License:    opensource.org/licenses/MIT
+*/
+#pragma once
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#include "nadam.h"
+
+/* Typed C++17 interface. A message type is a C++ type carrying its name and payload:
+
+   struct FooCount : nadam::fixed<uint32_t> { static constexpr std::string_view name = "Foo count"; };
+   struct Ping : nadam::variable<char, 1000> { static constexpr std::string_view name = "ping"; };
+
+   nadam::connection<FooCount, Ping> conn;
+   conn.init(2);
+   nadam::on<FooCount>(conn, [](const uint32_t &count) { ... });
+   conn.initiate(send, recv, errorDelegate);
+   nadam::send<FooCount>(conn, count);
+
+   Request/response pairs of nadam::rpc types are served and called with futures:
+
+   struct Square : nadam::rpc<int32_t> { static constexpr std::string_view name = "Square"; };
+   struct Squared : nadam::rpc<int64_t> { static constexpr std::string_view name = "Squared"; };
+
+   nadam::serve<Square, Squared>(conn, [](const int32_t &x) { return int64_t{x} * x; });
+   nadam::bind<Square, Squared>(conn);
+   std::future<int64_t> squared = nadam::call<Square, Squared>(conn, 7, timeoutMs);
+
+   Ids are computed at compile time the same way gennmi does (nadam/types.d).
+   The message catalog is in template argument order - send and on index it directly.
+   The C implementation has a single state: there should be only one connection at a time.  */
+
+namespace nadam {
+
+template <typename T>
+struct fixed {
+    static_assert(std::is_trivially_copyable_v<T>, "message payload has to be trivially copyable");
+    using value_type = T;
+    static constexpr bool isVariable = false;
+    static constexpr uint32_t size = sizeof(T);
+};
+
+// up to maxCount elements of T
+template <typename T, uint32_t maxCount>
+struct variable {
+    static_assert(std::is_trivially_copyable_v<T>, "message payload has to be trivially copyable");
+    using value_type = T;
+    static constexpr bool isVariable = true;
+    static constexpr uint32_t size = sizeof(T) * maxCount;
+};
+
+// request or response of an RPC - the payload follows the call id (see nadam_rpcBind())
+template <typename T>
+struct rpc {
+    static_assert(std::is_trivially_copyable_v<T>, "message payload has to be trivially copyable");
+    using value_type = T;
+    static constexpr bool isVariable = false;
+    static constexpr uint32_t size = 4 + sizeof(T);
+};
+
+// failed call - error is NADAM_ERROR_RPC_TIMEOUT, an error of sending or the one passed to nadam_rpcCancelAll()
+class rpc_error : public std::runtime_error {
+public:
+    explicit rpc_error(int error) : std::runtime_error("nadam rpc call failed"), error(error) {}
+    int error;
+};
+
+namespace detail {
+
+using digest_t = std::array<uint8_t, 20>;
+
+constexpr uint32_t rotateLeft(uint32_t x, unsigned n) {
+    return x << n | x >> (32 - n);
+}
+
+// byteAt(i) provides the i-th byte of the input
+template <typename ByteAt>
+constexpr digest_t sha1(ByteAt byteAt, uint64_t length) {
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    // 0x80, zeros, 8 byte big-endian bit length
+    uint64_t paddedLength = ((length + 8) / 64 + 1) * 64;
+    for (uint64_t block = 0; block < paddedLength; block += 64) {
+        uint32_t w[80] = {};
+        for (unsigned i = 0; i < 64; ++i) {
+            uint64_t pos = block + i;
+            uint8_t b = 0;
+            if (pos < length)
+                b = byteAt(pos);
+            else if (pos == length)
+                b = 0x80;
+            else if (pos >= paddedLength - 8)
+                b = static_cast<uint8_t>(length * 8 >> (8 * (paddedLength - 1 - pos)));
+
+            w[i / 4] |= uint32_t{b} << (24 - 8 * (i % 4));
+        }
+
+        for (unsigned i = 16; i < 80; ++i)
+            w[i] = rotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (unsigned i = 0; i < 80; ++i) {
+            uint32_t f = 0, k = 0;
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            } else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            } else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+
+            uint32_t temp = rotateLeft(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = rotateLeft(b, 30);
+            b = a;
+            a = temp;
+        }
+
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+
+    digest_t digest = {};
+    for (unsigned i = 0; i < 20; ++i)
+        digest[i] = static_cast<uint8_t>(h[i / 4] >> (24 - 8 * (i % 4)));
+
+    return digest;
+}
+
+constexpr digest_t sha1(std::string_view s) {
+    return sha1([s](uint64_t i) { return static_cast<uint8_t>(s[i]); }, s.size());
+}
+
+// name, isVariable byte, 4 byte size (little-endian) - as MessageInfo in nadam/types.d
+constexpr digest_t messageId(std::string_view name, bool isVariable, uint32_t size) {
+    auto byteAt = [name, isVariable, size](uint64_t i) {
+        if (i < name.size())
+            return static_cast<uint8_t>(name[i]);
+
+        if (i == name.size())
+            return static_cast<uint8_t>(isVariable);
+
+        return static_cast<uint8_t>(size >> (8 * (i - name.size() - 1)));
+    };
+    return sha1(byteAt, name.size() + 1 + 4);
+}
+
+constexpr bool isEqual(const digest_t &a, const digest_t &b) {
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i] != b[i])
+            return false;
+    }
+    return true;
+}
+
+static_assert(isEqual(sha1("abc"), digest_t{ 0xa9, 0x99, 0x3e, 0x36, 0x47, 0x06, 0x81, 0x6a, 0xba, 0x3e,
+            0x25, 0x71, 0x78, 0x50, 0xc2, 0x6c, 0x9c, 0xd0, 0xd8, 0x9d }), "constexpr SHA-1 is broken");
+
+template <typename M, size_t... i>
+constexpr nadam_messageInfo_t makeInfo(const digest_t &id, std::index_sequence<i...>) {
+    // name has to be a string literal - nadam_init() expects it zero terminated
+    return nadam_messageInfo_t{ M::name.data(), M::name.size(), { M::isVariable, { M::size } }, { id[i]... } };
+}
+
+template <typename M>
+constexpr nadam_messageInfo_t makeInfo() {
+    return makeInfo<M>(messageId(M::name, M::isVariable, M::size), std::make_index_sequence<20>());
+}
+
+template <typename M, typename... Messages>
+constexpr size_t indexOf() {
+    constexpr bool isSame[] = { std::is_same_v<M, Messages>... };
+    for (size_t i = 0; i < sizeof...(Messages); ++i) {
+        if (isSame[i])
+            return i;
+    }
+    return sizeof...(Messages);
+}
+
+template <typename M>
+using handler_t = std::conditional_t<M::isVariable,
+      std::function<void(const typename M::value_type *data, size_t count)>,
+      std::function<void(const typename M::value_type &value)>>;
+
+// the C implementation has a single state - per type storage is sufficient
+template <typename M>
+struct storage {
+    static inline handler_t<M> handler;
+    alignas(typename M::value_type) static inline uint8_t buffer[M::size ? M::size : 1];
+};
+
+template <typename M>
+void delegate(void *msg, uint32_t size, const nadam_messageInfo_t *) {
+    using T = typename M::value_type;
+    if constexpr (M::isVariable) {
+        storage<M>::handler(static_cast<const T *>(msg), size / sizeof(T));
+    } else {
+        T value;
+        std::memcpy(&value, msg, sizeof(T));
+        storage<M>::handler(value);
+    }
+}
+
+template <typename M>
+inline constexpr bool isRpc = std::is_base_of_v<rpc<typename M::value_type>, M>;
+
+template <typename Request, typename Response>
+struct rpcStorage {
+    static inline std::function<typename Response::value_type(const typename Request::value_type &)> handler;
+};
+
+template <typename Request, typename Response>
+void rpcHandler(nadam_rpcReply_t reply, const void *request, uint32_t, void *) {
+    typename Request::value_type value;
+    std::memcpy(&value, request, sizeof(value));
+    typename Response::value_type response = rpcStorage<Request, Response>::handler(value);
+    nadam_rpcRespond(reply, &response, sizeof(response));
+}
+
+// context is the promise - it is owned by the call until completed
+template <typename T>
+void completePromise(int error, const void *response, uint32_t, void *context) {
+    auto *promise = static_cast<std::promise<T> *>(context);
+    if (error) {
+        promise->set_exception(std::make_exception_ptr(rpc_error(error)));
+    } else {
+        T value;
+        std::memcpy(&value, response, sizeof(value));
+        promise->set_value(value);
+    }
+    delete promise;
+}
+
+} // namespace detail
+
+template <typename M>
+inline constexpr detail::digest_t id = detail::messageId(M::name, M::isVariable, M::size);
+
+template <typename... Messages>
+class connection {
+    static_assert(sizeof...(Messages) > 0, "connection needs at least one message type");
+
+public:
+    static constexpr nadam_messageInfo_t messageInfos[] = { detail::makeInfo<Messages>()... };
+
+    template <typename M>
+    static constexpr size_t indexOf() {
+        constexpr size_t index = detail::indexOf<M, Messages...>();
+        static_assert(index < sizeof...(Messages), "message type isn't part of the connection");
+        return index;
+    }
+
+    int init(size_t hashLengthMin) {
+        return nadam_init(messageInfos, sizeof...(Messages), hashLengthMin);
+    }
+
+    int initiate(nadam_send_t send, nadam_recv_t recv, nadam_errorDelegate_t errorDelegate) {
+        return nadam_initiate(send, recv, errorDelegate);
+    }
+
+    void stop() {
+        nadam_stop();
+    }
+};
+
+template <typename M, typename Connection>
+int send(Connection &, const typename M::value_type &value) {
+    static_assert(!M::isVariable, "variable size message is sent with data and count");
+    constexpr size_t index = Connection::template indexOf<M>();
+    return nadam_sendByIndex(index, &value, M::size);
+}
+
+template <typename M, typename Connection>
+int send(Connection &, const typename M::value_type *data, size_t count) {
+    static_assert(M::isVariable, "fixed size message is sent by value");
+    constexpr size_t index = Connection::template indexOf<M>();
+    if (count > M::size / sizeof(typename M::value_type)) {
+        errno = NADAM_ERROR_SIZE_ARG;
+        return -1;
+    }
+    return nadam_sendByIndex(index, data, static_cast<uint32_t>(count * sizeof(typename M::value_type)));
+}
+
+template <typename M, typename Connection, size_t count>
+int send(Connection &conn, const std::array<typename M::value_type, count> &data) {
+    static_assert(sizeof(data) <= M::size, "data exceeds maximum size of the message");
+    return send<M>(conn, data.data(), count);
+}
+
+/* Handler of a fixed size message takes (const value_type &).
+   Handler of a variable size message takes (const value_type *data, size_t count).
+   Handlers should be set before initiate() - they are called from the receive thread.  */
+template <typename M, typename Connection, typename F>
+int on(Connection &, F &&handler) {
+    constexpr size_t index = Connection::template indexOf<M>();
+    detail::storage<M>::handler = std::forward<F>(handler);
+    return nadam_setDelegateByIndex(index, detail::delegate<M>, detail::storage<M>::buffer, nullptr);
+}
+
+template <typename M, typename Connection>
+int off(Connection &) {
+    constexpr size_t index = Connection::template indexOf<M>();
+    int error = nadam_setDelegateByIndex(index, nullptr, nullptr, nullptr);
+    detail::storage<M>::handler = nullptr;
+    return error;
+}
+
+// the calling side - responses of Request are matched to the calls
+template <typename Request, typename Response, typename Connection>
+int bind(Connection &) {
+    static_assert(detail::isRpc<Request> && detail::isRpc<Response>, "RPC needs nadam::rpc types");
+    Connection::template indexOf<Request>();
+    Connection::template indexOf<Response>();
+    return nadam_rpcBind(Request::name.data(), Response::name.data(), nullptr, nullptr);
+}
+
+/* The serving side - handler takes (const Request::value_type &) and returns Response::value_type.
+   It is called from the receive thread, the response is sent when it returns.  */
+template <typename Request, typename Response, typename Connection, typename F>
+int serve(Connection &, F &&handler) {
+    static_assert(detail::isRpc<Request> && detail::isRpc<Response>, "RPC needs nadam::rpc types");
+    Connection::template indexOf<Request>();
+    Connection::template indexOf<Response>();
+    detail::rpcStorage<Request, Response>::handler = std::forward<F>(handler);
+    return nadam_rpcBind(Request::name.data(), Response::name.data(), detail::rpcHandler<Request, Response>, nullptr);
+}
+
+/* Doesn't wait for the response - any number of calls can be in flight. The future throws rpc_error
+   if the call fails (timeoutMs 0 - no timeout). Waiting for the future from a handler would block receiving.  */
+template <typename Request, typename Response, typename Connection>
+std::future<typename Response::value_type> call(Connection &, const typename Request::value_type &request,
+        uint32_t timeoutMs = 0) {
+    static_assert(detail::isRpc<Request> && detail::isRpc<Response>, "RPC needs nadam::rpc types");
+    using T = typename Response::value_type;
+    auto *promise = new std::promise<T>;
+    std::future<T> future = promise->get_future();
+    if (nadam_rpcCall(Request::name.data(), &request, sizeof(request), timeoutMs, detail::completePromise<T>, promise)) {
+        promise->set_exception(std::make_exception_ptr(rpc_error(errno)));
+        delete promise;
+    }
+    return future;
+}
+
+} // namespace nadam
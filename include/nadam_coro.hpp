@@ -0,0 +1,265 @@
+/*
+Copyright:  Copyright Johannes Teichrieb 2015
+License:    opensource.org/licenses/MIT
+*/
+#pragma once
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <span>
+
+#include "nadam.hpp"
+
+/* C++20 coroutine interface on top of nadam.hpp:
+
+   nadam::coro::connection<FooCount, Ping> conn;
+   conn.init(2);
+   conn.initiate(send, recv, errorDelegate);
+
+   task consume() {
+       while (true) {
+           const uint32_t &count = co_await conn.next<FooCount>();
+           int error = co_await conn.send<Ping>(text, length);
+       }
+   }
+
+   next() resumes the awaiting coroutines directly from the receive thread - there is no queue.
+   The payload is a view of the receive buffer: const value_type & for fixed size messages,
+   std::span<const value_type> for variable size ones. It is valid until the coroutine suspends again
+   (receiving continues once every resumed coroutine suspended). A message arriving while no coroutine
+   awaits its type is dropped. Any coroutine type can await - the library doesn't provide one.
+
+   send() doesn't block a thread waiting for another send: while one is in progress, the coroutine
+   suspends and is resumed by the thread finishing it, which sends on its behalf first. Only the thread
+   sending occupies the connection. Coroutines are resumed in the order of their sends - the one finishing
+   a send waits for the ones queued before it, not for the ones sending again meanwhile. The result is 0 or a NADAM_ERROR_ code (errno isn't meaningful
+   after resuming on another thread).  */
+
+namespace nadam::coro {
+
+namespace detail {
+
+template <typename M>
+using view_t = std::conditional_t<M::isVariable,
+      std::span<const typename M::value_type>,
+      const typename M::value_type &>;
+
+template <typename M>
+struct recvWaiter {
+    std::coroutine_handle<> handle;
+    const typename M::value_type *data;
+    size_t count;
+    recvWaiter *next;
+};
+
+// coroutines awaiting the next message of M - the waiters live in their frames
+template <typename M>
+struct recvWaiters {
+    static inline std::mutex lock;
+    static inline recvWaiter<M> *head;
+};
+
+template <typename M>
+void resumeDelegate(void *msg, uint32_t size, const nadam_messageInfo_t *) {
+    recvWaiter<M> *w;
+    {
+        std::lock_guard<std::mutex> guard(recvWaiters<M>::lock);
+        w = recvWaiters<M>::head;
+        recvWaiters<M>::head = nullptr;
+    }
+
+    using T = typename M::value_type;
+    const T *data = std::launder(static_cast<const T *>(msg));
+    while (w) {
+        // a resumed coroutine can destroy its waiter - or await again, as a waiter of the next message
+        recvWaiter<M> *next = w->next;
+        w->data = data;
+        w->count = size / sizeof(T);
+        w->handle.resume();
+        w = next;
+    }
+}
+
+struct sendWaiter {
+    std::coroutine_handle<> handle;
+    size_t index;
+    const void *data;
+    uint32_t size;
+    int error;
+    // only to be resumed - sent by its own thread
+    bool isSent;
+    sendWaiter *next;
+};
+
+// the C implementation has a single state - one queue of sends
+struct sendQueue {
+    static inline std::mutex lock;
+    static inline bool isBusy;
+    static inline sendWaiter *head;
+    static inline sendWaiter *tail;
+};
+
+inline int sendNow(const sendWaiter &w) {
+    return nadam_sendByIndex(w.index, w.data, w.size) ? errno : 0;
+}
+
+// true if the caller has to suspend - another send is in progress and will send w
+inline bool enqueueSend(sendWaiter *w) {
+    std::lock_guard<std::mutex> guard(sendQueue::lock);
+    if (!sendQueue::isBusy) {
+        sendQueue::isBusy = true;
+        return false;
+    }
+
+    w->next = nullptr;
+    if (sendQueue::tail)
+        sendQueue::tail->next = w;
+    else
+        sendQueue::head = w;
+    sendQueue::tail = w;
+    return true;
+}
+
+// false if nothing is queued - the caller isn't sending anymore and continues; else w is queued to be resumed
+inline bool queueSent(sendWaiter *w) {
+    std::lock_guard<std::mutex> guard(sendQueue::lock);
+    if (sendQueue::head == nullptr) {
+        sendQueue::isBusy = false;
+        return false;
+    }
+
+    w->isSent = true;
+    w->next = nullptr;
+    sendQueue::tail->next = w;
+    sendQueue::tail = w;
+    return true;
+}
+
+// sends and resumes the queued coroutines - the ones sending again meanwhile are queued, not nested
+inline void drainSends() {
+    while (true) {
+        sendWaiter *w;
+        {
+            std::lock_guard<std::mutex> guard(sendQueue::lock);
+            w = sendQueue::head;
+            if (w == nullptr) {
+                sendQueue::isBusy = false;
+                return;
+            }
+
+            sendQueue::head = w->next;
+            if (sendQueue::head == nullptr)
+                sendQueue::tail = nullptr;
+        }
+
+        // the waiter belongs to the resumed coroutine - it isn't touched afterwards
+        if (!w->isSent)
+            w->error = sendNow(*w);
+        w->handle.resume();
+    }
+}
+
+template <typename M>
+class nextAwaiter {
+public:
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        waiter.handle = handle;
+        std::lock_guard<std::mutex> guard(recvWaiters<M>::lock);
+        waiter.next = recvWaiters<M>::head;
+        recvWaiters<M>::head = &waiter;
+    }
+
+    view_t<M> await_resume() const noexcept {
+        if constexpr (M::isVariable)
+            return view_t<M>(waiter.data, waiter.count);
+        else
+            return *waiter.data;
+    }
+
+private:
+    recvWaiter<M> waiter = {};
+};
+
+class sendAwaiter {
+public:
+    sendAwaiter(size_t index, const void *data, uint32_t size, int error) noexcept
+        : waiter{ {}, index, data, size, error, false, nullptr } {}
+
+    // a send with an invalid argument completes at once
+    bool await_ready() const noexcept {
+        return waiter.error != 0;
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+        waiter.handle = handle;
+        if (enqueueSend(&waiter))
+            return true;
+
+        waiter.error = sendNow(waiter);
+        if (!queueSent(&waiter))
+            return false;
+
+        // this coroutine is resumed in turn - it might be done with the awaiter, before drainSends() returns
+        drainSends();
+        return true;
+    }
+
+    int await_resume() const noexcept {
+        return waiter.error;
+    }
+
+private:
+    sendWaiter waiter;
+};
+
+} // namespace detail
+
+template <typename... Messages>
+class connection : public nadam::connection<Messages...> {
+    using base = nadam::connection<Messages...>;
+
+public:
+    // every type resumes coroutines - nadam::on() can replace that for a type afterwards
+    int init(size_t hashLengthMin) {
+        if (base::init(hashLengthMin))
+            return -1;
+
+        return (listen<Messages>() || ...) ? -1 : 0;
+    }
+
+    template <typename M>
+    detail::nextAwaiter<M> next() {
+        base::template indexOf<M>();
+        return {};
+    }
+
+    template <typename M>
+    detail::sendAwaiter send(const typename M::value_type &value) {
+        static_assert(!M::isVariable, "variable size message is sent with data and count");
+        return detail::sendAwaiter(base::template indexOf<M>(), &value, M::size, 0);
+    }
+
+    template <typename M>
+    detail::sendAwaiter send(const typename M::value_type *data, size_t count) {
+        static_assert(M::isVariable, "fixed size message is sent by value");
+        using T = typename M::value_type;
+        int error = count > M::size / sizeof(T) ? NADAM_ERROR_SIZE_ARG : 0;
+        return detail::sendAwaiter(base::template indexOf<M>(), data, static_cast<uint32_t>(count * sizeof(T)), error);
+    }
+
+private:
+    template <typename M>
+    int listen() {
+        return nadam_setDelegateByIndex(base::template indexOf<M>(), detail::resumeDelegate<M>,
+                nadam::detail::storage<M>::buffer, nullptr);
+    }
+};
+
+} // namespace nadam::coro
@@ -0,0 +1,434 @@
+/*
+Copyright:  Copyright Johannes Teichrieb 2015
+License:    opensource.org/licenses/MIT
+*/
+#define _POSIX_C_SOURCE 200809L
+#include "capture.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "unittestMacros.h"
+
+#define MAP_LENGTH_MIN (1 << 20)
+#define ALIGNMENT 8
+
+typedef struct {
+    uint64_t key;
+    uint64_t offset;
+} indexEntry_t;
+
+struct capture {
+    int fd;
+    uint8_t *map;
+    size_t mapLength;
+    size_t end;
+
+    indexEntry_t *index;
+    size_t indexCount;
+    size_t indexCapacity;
+};
+
+// private declarations
+// -----------------------------------------------------------------------------
+static int reserve(capture_t *c, size_t n);
+static int remap(capture_t *c, size_t length);
+static int putIndexEntry(capture_t *c, uint64_t key, uint64_t offset);
+static int writeIndex(capture_t *c);
+static int compareIndexEntries(const void *a, const void *b);
+static size_t alignUp(size_t n);
+static captureHeader_t *getHeader(const capture_t *c);
+static void freeCapture(capture_t *c);
+static int readIndex(captureReader_t *r, const captureHeader_t *header);
+
+// interface functions
+// -----------------------------------------------------------------------------
+capture_t *capture_open(const char *path) {
+    capture_t *c = calloc(1, sizeof(capture_t));
+    if (c == NULL)
+        return NULL;
+
+    c->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (c->fd < 0 || remap(c, MAP_LENGTH_MIN)) {
+        freeCapture(c);
+        return NULL;
+    }
+
+    captureHeader_t *header = getHeader(c);
+    memcpy(header->magic, CAPTURE_MAGIC, sizeof(header->magic));
+    header->version = CAPTURE_VERSION;
+    c->end = sizeof(captureHeader_t);
+    header->end = c->end;
+    return c;
+}
+
+uint8_t *capture_append(capture_t *c, const captureRecord_t *record, uint32_t id) {
+    size_t recordLength = alignUp(sizeof(captureRecord_t) + record->length);
+    if (reserve(c, recordLength))
+        return NULL;
+
+    if (record->kind == CAPTURE_RECORD_FRAME
+            && putIndexEntry(c, capture_makeKey(record->hashLength, id), c->end))
+        return NULL;
+
+    uint8_t *dest = c->map + c->end;
+    memcpy(dest, record, sizeof(captureRecord_t));
+    c->end += recordLength;
+    // the frame is written by the caller before the next append - readers get only complete records
+    getHeader(c)->end = c->end - recordLength;
+    return dest + sizeof(captureRecord_t);
+}
+
+int capture_close(capture_t *c) {
+    getHeader(c)->end = c->end;
+    int error = writeIndex(c);
+    if (!error)
+        error = msync(c->map, c->end, MS_SYNC);
+
+    if (!error)
+        error = ftruncate(c->fd, (off_t) c->end);
+
+    freeCapture(c);
+    return error ? -1 : 0;
+}
+
+uint64_t capture_makeKey(uint8_t hashLength, uint32_t id) {
+    return (uint64_t) hashLength << 32 | id;
+}
+
+int capture_openReader(captureReader_t *r, const char *path) {
+    memset(r, 0, sizeof(captureReader_t));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) || (size_t) st.st_size < sizeof(captureHeader_t)) {
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    r->map = map;
+    r->mapLength = (size_t) st.st_size;
+    const captureHeader_t *header = map;
+    bool isValid = memcmp(header->magic, CAPTURE_MAGIC, sizeof(header->magic)) == 0
+        && header->version == CAPTURE_VERSION && header->end <= r->mapLength;
+    if (!isValid || readIndex(r, header)) {
+        capture_closeReader(r);
+        return -1;
+    }
+
+    r->end = header->end;
+    return 0;
+}
+
+void capture_closeReader(captureReader_t *r) {
+    if (r->map)
+        munmap((void *) r->map, r->mapLength);
+    memset(r, 0, sizeof(captureReader_t));
+}
+
+const captureRecord_t *capture_recordAt(const captureReader_t *r, size_t offset) {
+    if (offset < sizeof(captureHeader_t) || offset + sizeof(captureRecord_t) > r->end)
+        return NULL;
+
+    const captureRecord_t *record = (const captureRecord_t *) (r->map + offset);
+    if (offset + sizeof(captureRecord_t) + record->length > r->end)
+        return NULL;
+
+    return record;
+}
+
+size_t capture_nextOffset(const captureRecord_t *record, size_t offset) {
+    return offset + alignUp(sizeof(captureRecord_t) + record->length);
+}
+
+const captureIndexGroup_t *capture_findGroup(const captureReader_t *r, uint64_t key) {
+    size_t low = 0, high = r->groupCount;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (r->groups[mid].key < key)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    if (low < r->groupCount && r->groups[low].key == key)
+        return r->groups + low;
+
+    return NULL;
+}
+
+// private functions
+// -----------------------------------------------------------------------------
+static int reserve(capture_t *c, size_t n) {
+    if (c->end + n <= c->mapLength)
+        return 0;
+
+    size_t length = c->mapLength * 2;
+    while (length < c->end + n)
+        length *= 2;
+
+    return remap(c, length);
+}
+
+static int remap(capture_t *c, size_t length) {
+    if (ftruncate(c->fd, (off_t) length))
+        return -1;
+
+    if (c->map)
+        munmap(c->map, c->mapLength);
+
+    c->map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, c->fd, 0);
+    if (c->map == MAP_FAILED) {
+        c->map = NULL;
+        return -1;
+    }
+
+    c->mapLength = length;
+    return 0;
+}
+
+static int putIndexEntry(capture_t *c, uint64_t key, uint64_t offset) {
+    if (c->indexCount == c->indexCapacity) {
+        size_t capacity = c->indexCapacity ? c->indexCapacity * 2 : 1024;
+        indexEntry_t *index = realloc(c->index, capacity * sizeof(indexEntry_t));
+        if (index == NULL)
+            return -1;
+
+        c->index = index;
+        c->indexCapacity = capacity;
+    }
+
+    indexEntry_t entry = { .key = key, .offset = offset };
+    c->index[c->indexCount++] = entry;
+    return 0;
+}
+
+static int writeIndex(capture_t *c) {
+    qsort(c->index, c->indexCount, sizeof(indexEntry_t), compareIndexEntries);
+
+    size_t groupCount = 0;
+    for (size_t i = 0; i < c->indexCount; ++i)
+        if (i == 0 || c->index[i].key != c->index[i - 1].key)
+            ++groupCount;
+
+    size_t indexLength = sizeof(uint64_t) + groupCount * sizeof(captureIndexGroup_t)
+        + c->indexCount * sizeof(uint64_t);
+    if (reserve(c, indexLength))
+        return -1;
+
+    uint8_t *dest = c->map + c->end;
+    uint64_t groupCount64 = groupCount;
+    memcpy(dest, &groupCount64, sizeof(uint64_t));
+    captureIndexGroup_t *groups = (captureIndexGroup_t *) (dest + sizeof(uint64_t));
+    uint64_t *offsets = (uint64_t *) (groups + groupCount);
+
+    size_t group = 0;
+    for (size_t i = 0; i < c->indexCount; ++i) {
+        if (i != 0 && c->index[i].key != c->index[i - 1].key)
+            ++group;
+
+        if (i == 0 || c->index[i].key != c->index[i - 1].key) {
+            groups[group].key = c->index[i].key;
+            groups[group].first = i;
+            groups[group].count = 0;
+        }
+        ++groups[group].count;
+        offsets[i] = c->index[i].offset;
+    }
+
+    getHeader(c)->indexOffset = c->end;
+    c->end += indexLength;
+    return 0;
+}
+
+// sorted by key and offset - replaying a group keeps the original order
+static int compareIndexEntries(const void *a, const void *b) {
+    const indexEntry_t *ea = a, *eb = b;
+    if (ea->key != eb->key)
+        return ea->key < eb->key ? -1 : 1;
+
+    if (ea->offset != eb->offset)
+        return ea->offset < eb->offset ? -1 : 1;
+
+    return 0;
+}
+
+static size_t alignUp(size_t n) {
+    return (n + ALIGNMENT - 1) & ~(size_t) (ALIGNMENT - 1);
+}
+
+static captureHeader_t *getHeader(const capture_t *c) {
+    return (captureHeader_t *) c->map;
+}
+
+static void freeCapture(capture_t *c) {
+    if (c->map)
+        munmap(c->map, c->mapLength);
+    if (c->fd >= 0)
+        close(c->fd);
+    free(c->index);
+    free(c);
+}
+
+static int readIndex(captureReader_t *r, const captureHeader_t *header) {
+    bool isIndexMissing = (header->indexOffset == 0);
+    if (isIndexMissing)
+        return 0;
+
+    size_t offset = header->indexOffset;
+    if (offset < header->end || offset + sizeof(uint64_t) > r->mapLength)
+        return -1;
+
+    uint64_t groupCount;
+    memcpy(&groupCount, r->map + offset, sizeof(uint64_t));
+    if (groupCount > r->mapLength)
+        return -1;
+
+    const captureIndexGroup_t *groups = (const captureIndexGroup_t *) (r->map + offset + sizeof(uint64_t));
+    size_t groupsEnd = offset + sizeof(uint64_t) + groupCount * sizeof(captureIndexGroup_t);
+    if (groupsEnd > r->mapLength)
+        return -1;
+
+    // a corrupt count could wrap the sum - no valid index has more offsets than the file has bytes
+    uint64_t offsetCount = 0;
+    for (size_t i = 0; i < groupCount; ++i) {
+        if (groups[i].count > r->mapLength - offsetCount)
+            return -1;
+        offsetCount += groups[i].count;
+    }
+
+    if (offsetCount > (r->mapLength - groupsEnd) / sizeof(uint64_t))
+        return -1;
+
+    // the offsets of every group lie within the index
+    for (size_t i = 0; i < groupCount; ++i) {
+        if (groups[i].first > offsetCount || groups[i].count > offsetCount - groups[i].first)
+            return -1;
+    }
+
+    r->groups = groups;
+    r->groupCount = groupCount;
+    r->offsets = (const uint64_t *) (r->map + groupsEnd);
+    return 0;
+}
+
+// unittest
+// -----------------------------------------------------------------------------
+#ifdef UNITTEST
+static const char *captureTestPath = "/tmp/nadam_capture_unittest";
+
+static int appendTestRecord(capture_t *c, uint8_t kind, uint32_t id, const char *frame) {
+    captureRecord_t record = { .timestamp = id, .length = (uint32_t) strlen(frame),
+        .kind = kind, .hashLength = 4 };
+    uint8_t *dest = capture_append(c, &record, id);
+    if (dest == NULL)
+        return -1;
+
+    memcpy(dest, frame, record.length);
+    return 0;
+}
+
+int captureRecordsCanBeReadBack(void) {
+    capture_t *c = capture_open(captureTestPath);
+    ASSERT(c);
+    ASSERT(!appendTestRecord(c, CAPTURE_RECORD_HANDSHAKE, 0, "\x04"));
+    ASSERT(!appendTestRecord(c, CAPTURE_RECORD_FRAME, 1, "foo_"));
+    ASSERT(!appendTestRecord(c, CAPTURE_RECORD_FRAME, 2, "barbar"));
+    ASSERT(!capture_close(c));
+
+    captureReader_t r;
+    ASSERT(!capture_openReader(&r, captureTestPath));
+    size_t offset = sizeof(captureHeader_t);
+    const char *expected[] = { "\x04", "foo_", "barbar" };
+    for (size_t i = 0; i < 3; ++i) {
+        const captureRecord_t *record = capture_recordAt(&r, offset);
+        ASSERT(record);
+        ASSERT(record->length == strlen(expected[i]));
+        ASSERT(memcmp(record + 1, expected[i], record->length) == 0);
+        offset = capture_nextOffset(record, offset);
+    }
+    ASSERT(capture_recordAt(&r, offset) == NULL);
+    capture_closeReader(&r);
+    unlink(captureTestPath);
+    return 0;
+}
+
+int captureIndexGroupsFramesByKey(void) {
+    capture_t *c = capture_open(captureTestPath);
+    ASSERT(c);
+    for (uint32_t i = 0; i < 5000; ++i)
+        ASSERT(!appendTestRecord(c, CAPTURE_RECORD_FRAME, i % 3, "0123456789abcdef"));
+    ASSERT(!capture_close(c));
+
+    captureReader_t r;
+    ASSERT(!capture_openReader(&r, captureTestPath));
+    ASSERT(r.groupCount == 3);
+    const captureIndexGroup_t *group = capture_findGroup(&r, capture_makeKey(4, 2));
+    ASSERT(group);
+    ASSERT(group->count == 1666);
+    size_t previous = 0;
+    for (size_t i = 0; i < group->count; ++i) {
+        size_t offset = r.offsets[group->first + i];
+        const captureRecord_t *record = capture_recordAt(&r, offset);
+        ASSERT(record && record->timestamp == 2);
+        ASSERT(offset > previous);
+        previous = offset;
+    }
+    ASSERT(capture_findGroup(&r, capture_makeKey(3, 2)) == NULL);
+    capture_closeReader(&r);
+    unlink(captureTestPath);
+    return 0;
+}
+
+// overwrites the first group of the index with first and count
+static int corruptIndexGroup(uint64_t first, uint64_t count) {
+    int fd = open(captureTestPath, O_RDWR);
+    if (fd < 0)
+        return -1;
+
+    captureHeader_t header;
+    captureIndexGroup_t group;
+    off_t groupOffset = 0;
+    int error = pread(fd, &header, sizeof(header), 0) != sizeof(header);
+    if (!error) {
+        groupOffset = (off_t) (header.indexOffset + sizeof(uint64_t));
+        error = pread(fd, &group, sizeof(group), groupOffset) != sizeof(group);
+    }
+    if (!error) {
+        group.first = first;
+        group.count = count;
+        error = pwrite(fd, &group, sizeof(group), groupOffset) != sizeof(group);
+    }
+    close(fd);
+    return error ? -1 : 0;
+}
+
+int captureWithCorruptIndexIsRejected(void) {
+    const uint64_t corruptGroups[][2] = { { 0, UINT64_MAX }, { 3, 1 }, { UINT64_MAX, 1 }, { 0, 4 } };
+    for (size_t i = 0; i < sizeof(corruptGroups) / sizeof(corruptGroups[0]); ++i) {
+        capture_t *c = capture_open(captureTestPath);
+        ASSERT(c);
+        for (uint32_t j = 0; j < 3; ++j)
+            ASSERT(!appendTestRecord(c, CAPTURE_RECORD_FRAME, j, "0123"));
+        ASSERT(!capture_close(c));
+        ASSERT(!corruptIndexGroup(corruptGroups[i][0], corruptGroups[i][1]));
+
+        captureReader_t r;
+        ASSERT(capture_openReader(&r, captureTestPath));
+        unlink(captureTestPath);
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,69 @@
+/*
+Copyright:  Copyright Johannes Teichrieb 2015
+License:    opensource.org/licenses/MIT
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Capture file layout (host byte order):
+   header | records | index
+   Every record is a captureRecord_t followed by the frame, padded to 8 bytes.
+   Index is written by capture_close(): groupCount, groups sorted by key, offsets of records.
+   A capture which wasn't closed has indexOffset 0 - its records can still be read up to end.  */
+#define CAPTURE_MAGIC "NADAMCAP"
+#define CAPTURE_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t end;
+    uint64_t indexOffset;
+} captureHeader_t;
+
+enum {
+    CAPTURE_RECORD_HANDSHAKE, // frame is the received handshake byte
+    CAPTURE_RECORD_FRAME // frame is id, [4 byte size], data - in base protocol form
+};
+
+typedef struct {
+    uint64_t timestamp;
+    uint32_t length;
+    uint8_t kind;
+    uint8_t hashLength;
+    uint16_t reserved;
+} captureRecord_t;
+
+// key is ((uint64_t) hashLength << 32 | truncated id)
+typedef struct {
+    uint64_t key;
+    uint64_t first;
+    uint64_t count;
+} captureIndexGroup_t;
+
+typedef struct capture capture_t;
+
+typedef struct {
+    const uint8_t *map;
+    size_t mapLength;
+    size_t end;
+    const captureIndexGroup_t *groups;
+    size_t groupCount;
+    const uint64_t *offsets;
+} captureReader_t;
+
+capture_t *capture_open(const char *path);
+// returns the location for the record's frame or NULL, if the file couldn't be grown
+uint8_t *capture_append(capture_t *c, const captureRecord_t *record, uint32_t id);
+int capture_close(capture_t *c);
+
+uint64_t capture_makeKey(uint8_t hashLength, uint32_t id);
+
+int capture_openReader(captureReader_t *r, const char *path);
+void capture_closeReader(captureReader_t *r);
+// returns NULL for an offset beyond the last complete record
+const captureRecord_t *capture_recordAt(const captureReader_t *r, size_t offset);
+size_t capture_nextOffset(const captureRecord_t *record, size_t offset);
+const captureIndexGroup_t *capture_findGroup(const captureReader_t *r, uint64_t key);
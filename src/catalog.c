@@ -0,0 +1,413 @@
+/*
+Copyright:  Copyright Johannes Teichrieb 2015
+License:    opensource.org/licenses/MIT
+*/
+#define _POSIX_C_SOURCE 200809L
+#include "catalog.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "unittestMacros.h"
+
+#define HASH_LENGTH_MAX 4
+#define ALIGNMENT 8
+
+// private declarations
+// -----------------------------------------------------------------------------
+static bool isLittleEndian(void);
+static bool isHeaderValid(const catalogHeader_t *header, size_t mapLength);
+static bool isRegionValid(uint64_t offset, uint64_t length, uint64_t size);
+static bool areEntriesValid(const catalog_t *c);
+static uint32_t getTableCapacity(size_t messageCount);
+static int putName(uint32_t *table, uint32_t capacity, const nadam_messageInfo_t *messageInfos, uint32_t index);
+static int putId(uint32_t *table, uint32_t capacity, const nadam_messageInfo_t *messageInfos,
+        uint32_t index, uint32_t hashLength);
+static uint32_t getCollisionFreeHashLength(uint32_t *table, uint32_t capacity,
+        const nadam_messageInfo_t *messageInfos, uint32_t messageCount);
+static uint32_t truncateHash(const uint8_t *hash, uint32_t hashLength);
+static int writeFile(const char *path, const uint8_t *buf, size_t length);
+static size_t alignUp(size_t n);
+
+// interface functions
+// -----------------------------------------------------------------------------
+int catalog_open(catalog_t *c, const char *path) {
+    memset(c, 0, sizeof(catalog_t));
+    if (!isLittleEndian()) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) || (size_t) st.st_size < sizeof(catalogHeader_t)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    // shared read-only mapping - the pages are shared by all processes using the catalog
+    void *map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    c->map = map;
+    c->mapLength = (size_t) st.st_size;
+    const catalogHeader_t *header = map;
+    if (!isHeaderValid(header, c->mapLength)) {
+        catalog_close(c);
+        errno = EINVAL;
+        return -1;
+    }
+
+    c->header = header;
+    c->entries = (const catalogEntry_t *) (c->map + header->entriesOffset);
+    c->names = (const char *) (c->map + header->namesOffset);
+    c->nameTable = (const uint32_t *) (c->map + header->nameTableOffset);
+    c->idTable = (const uint32_t *) (c->map + header->idTableOffset);
+    if (!areEntriesValid(c)) {
+        catalog_close(c);
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+void catalog_close(catalog_t *c) {
+    if (c->map)
+        munmap((void *) c->map, c->mapLength);
+    memset(c, 0, sizeof(catalog_t));
+}
+
+int catalog_findName(const catalog_t *c, const char *name, size_t *index) {
+    size_t length = strlen(name);
+    uint32_t mask = c->header->tableCapacity - 1;
+    uint32_t slot = catalog_hashName(name, length) & mask;
+    for (uint32_t probe = 0; probe <= mask; ++probe, slot = (slot + 1) & mask) {
+        uint32_t i = c->nameTable[slot];
+        // table content isn't validated on open - it would touch all of its pages
+        if (i == CATALOG_EMPTY_SLOT || i >= c->header->messageCount)
+            return -1;
+
+        const catalogEntry_t *entry = c->entries + i;
+        if (entry->nameLength == length && memcmp(c->names + entry->nameOffset, name, length) == 0) {
+            *index = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int catalog_findId(const catalog_t *c, uint32_t id, size_t *index) {
+    uint32_t mask = c->header->tableCapacity - 1;
+    uint32_t slot = catalog_hashId(id) & mask;
+    for (uint32_t probe = 0; probe <= mask; ++probe, slot = (slot + 1) & mask) {
+        uint32_t i = c->idTable[slot];
+        if (i == CATALOG_EMPTY_SLOT || i >= c->header->messageCount)
+            return -1;
+
+        if (truncateHash(c->entries[i].hash, c->header->hashLength) == id) {
+            *index = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int catalog_write(const char *path, const nadam_messageInfo_t *messageInfos, size_t messageCount) {
+    if (!isLittleEndian() || messageCount == 0 || messageCount > UINT32_MAX / 4) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    uint32_t count = (uint32_t) messageCount;
+    uint32_t capacity = getTableCapacity(count);
+    size_t namesLength = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (messageInfos[i].nameLength >= UINT32_MAX - namesLength) {
+            errno = EINVAL;
+            return -1;
+        }
+        namesLength += messageInfos[i].nameLength + 1;
+    }
+
+    catalogHeader_t header = { .version = CATALOG_VERSION, .messageCount = count, .tableCapacity = capacity };
+    memcpy(header.magic, CATALOG_MAGIC, sizeof(header.magic));
+    header.entriesOffset = sizeof(catalogHeader_t);
+    header.namesOffset = header.entriesOffset + count * sizeof(catalogEntry_t);
+    header.nameTableOffset = alignUp(header.namesOffset + namesLength);
+    header.idTableOffset = header.nameTableOffset + capacity * sizeof(uint32_t);
+    header.size = header.idTableOffset + capacity * sizeof(uint32_t);
+
+    uint8_t *buf = calloc(1, header.size);
+    if (buf == NULL)
+        return -1;
+
+    catalogEntry_t *entries = (catalogEntry_t *) (buf + header.entriesOffset);
+    char *names = (char *) (buf + header.namesOffset);
+    uint32_t *nameTable = (uint32_t *) (buf + header.nameTableOffset);
+    uint32_t *idTable = (uint32_t *) (buf + header.idTableOffset);
+    memset(nameTable, 0xff, capacity * sizeof(uint32_t));
+
+    uint32_t nameOffset = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        const nadam_messageInfo_t *info = messageInfos + i;
+        catalogEntry_t *entry = entries + i;
+        entry->nameOffset = nameOffset;
+        entry->nameLength = (uint32_t) info->nameLength;
+        entry->size = info->size.max;
+        entry->isVariable = info->size.isVariable;
+        memcpy(entry->hash, info->hash, sizeof(entry->hash));
+        memcpy(names + nameOffset, info->name, info->nameLength);
+        nameOffset += entry->nameLength + 1;
+
+        if (putName(nameTable, capacity, messageInfos, i)) {
+            free(buf);
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    header.hashLength = getCollisionFreeHashLength(idTable, capacity, messageInfos, count);
+    if (header.hashLength == 0) {
+        free(buf);
+        errno = EINVAL;
+        return -1;
+    }
+
+    memcpy(buf, &header, sizeof(catalogHeader_t));
+    int error = writeFile(path, buf, header.size);
+    free(buf);
+    return error;
+}
+
+// FNV-1a
+uint32_t catalog_hashName(const char *name, size_t length) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < length; ++i) {
+        h ^= (uint8_t) name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// private functions
+// -----------------------------------------------------------------------------
+static bool isLittleEndian(void) {
+    uint32_t one = 1;
+    uint8_t first;
+    memcpy(&first, &one, 1);
+    return first == 1;
+}
+
+static bool isHeaderValid(const catalogHeader_t *header, size_t mapLength) {
+    if (memcmp(header->magic, CATALOG_MAGIC, sizeof(header->magic)) || header->version != CATALOG_VERSION
+            || header->size != mapLength)
+        return false;
+
+    uint32_t capacity = header->tableCapacity;
+    bool isCapacityValid = capacity != 0 && (capacity & (capacity - 1)) == 0 && capacity > header->messageCount;
+    if (header->messageCount == 0 || !isCapacityValid
+            || header->hashLength == 0 || header->hashLength > HASH_LENGTH_MAX)
+        return false;
+
+    uint64_t tableLength = (uint64_t) capacity * sizeof(uint32_t);
+    return isRegionValid(header->entriesOffset, (uint64_t) header->messageCount * sizeof(catalogEntry_t), header->size)
+        && header->namesOffset <= header->nameTableOffset
+        && isRegionValid(header->namesOffset, header->nameTableOffset - header->namesOffset, header->size)
+        && isRegionValid(header->nameTableOffset, tableLength, header->size)
+        && isRegionValid(header->idTableOffset, tableLength, header->size);
+}
+
+static bool isRegionValid(uint64_t offset, uint64_t length, uint64_t size) {
+    return offset % sizeof(uint32_t) == 0 && offset >= sizeof(catalogHeader_t)
+        && offset <= size && length <= size - offset;
+}
+
+// every name has to end with '\0' inside the pool
+static bool areEntriesValid(const catalog_t *c) {
+    uint64_t namesLength = c->header->nameTableOffset - c->header->namesOffset;
+    for (uint32_t i = 0; i < c->header->messageCount; ++i) {
+        const catalogEntry_t *entry = c->entries + i;
+        uint64_t end = (uint64_t) entry->nameOffset + entry->nameLength;
+        if (end >= namesLength || c->names[end] != '\0')
+            return false;
+    }
+    return true;
+}
+
+// load factor of at most 1/2
+static uint32_t getTableCapacity(size_t messageCount) {
+    uint32_t capacity = 2;
+    while (capacity < messageCount * 2)
+        capacity *= 2;
+    return capacity;
+}
+
+static int putName(uint32_t *table, uint32_t capacity, const nadam_messageInfo_t *messageInfos, uint32_t index) {
+    const nadam_messageInfo_t *info = messageInfos + index;
+    uint32_t mask = capacity - 1;
+    uint32_t slot = catalog_hashName(info->name, info->nameLength) & mask;
+    while (table[slot] != CATALOG_EMPTY_SLOT) {
+        const nadam_messageInfo_t *other = messageInfos + table[slot];
+        bool isNameRepeated = other->nameLength == info->nameLength
+            && memcmp(other->name, info->name, info->nameLength) == 0;
+        if (isNameRepeated)
+            return -1;
+
+        slot = (slot + 1) & mask;
+    }
+    table[slot] = index;
+    return 0;
+}
+
+static int putId(uint32_t *table, uint32_t capacity, const nadam_messageInfo_t *messageInfos,
+        uint32_t index, uint32_t hashLength) {
+    uint32_t id = truncateHash(messageInfos[index].hash, hashLength);
+    uint32_t mask = capacity - 1;
+    uint32_t slot = catalog_hashId(id) & mask;
+    while (table[slot] != CATALOG_EMPTY_SLOT) {
+        if (truncateHash(messageInfos[table[slot]].hash, hashLength) == id)
+            return -1;
+
+        slot = (slot + 1) & mask;
+    }
+    table[slot] = index;
+    return 0;
+}
+
+// fills the id table for the returned length; 0 - even HASH_LENGTH_MAX collides
+static uint32_t getCollisionFreeHashLength(uint32_t *table, uint32_t capacity,
+        const nadam_messageInfo_t *messageInfos, uint32_t messageCount) {
+    for (uint32_t hashLength = 1; hashLength <= HASH_LENGTH_MAX; ++hashLength) {
+        memset(table, 0xff, capacity * sizeof(uint32_t));
+        uint32_t i = 0;
+        while (i < messageCount && !putId(table, capacity, messageInfos, i, hashLength))
+            ++i;
+
+        if (i == messageCount)
+            return hashLength;
+    }
+    return 0;
+}
+
+static uint32_t truncateHash(const uint8_t *hash, uint32_t hashLength) {
+    uint32_t res = 0;
+    memcpy(&res, hash, hashLength);
+    return res;
+}
+
+// replaced by rename - processes which mapped the previous catalog keep using it
+static int writeFile(const char *path, const uint8_t *buf, size_t length) {
+    size_t tmpPathLength = strlen(path) + sizeof(".tmp");
+    char *tmpPath = malloc(tmpPathLength);
+    if (tmpPath == NULL)
+        return -1;
+    snprintf(tmpPath, tmpPathLength, "%s.tmp", path);
+
+    int fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int error = fd < 0 ? -1 : 0;
+    for (size_t written = 0; !error && written < length;) {
+        ssize_t n = write(fd, buf + written, length - written);
+        if (n < 0 && errno != EINTR)
+            error = -1;
+        else if (n > 0)
+            written += (size_t) n;
+    }
+
+    if (fd >= 0 && close(fd))
+        error = -1;
+    if (!error && rename(tmpPath, path))
+        error = -1;
+    if (error && fd >= 0)
+        unlink(tmpPath);
+
+    free(tmpPath);
+    return error;
+}
+
+static size_t alignUp(size_t n) {
+    return (n + ALIGNMENT - 1) & ~(size_t) (ALIGNMENT - 1);
+}
+
+// unittest
+// -----------------------------------------------------------------------------
+#ifdef UNITTEST
+static const char *catalogTestPath = "/tmp/nadam_catalog_unittest";
+
+static nadam_messageInfo_t catalogTestInfos[] = {
+    { "foo", 3, { false, { 4 } }, { 0x01, 0x02, 0x03, 0x04 } },
+    { "bar", 3, { true, { 100 } }, { 0x01, 0x05, 0x03, 0x04 } },
+    { "ping pong", 9, { false, { 0 } }, { 0x02, 0x02, 0x03, 0x04 } },
+};
+
+int catalogRoundTrip(void) {
+    ASSERT(!catalog_write(catalogTestPath, catalogTestInfos, 3));
+
+    catalog_t c;
+    ASSERT(!catalog_open(&c, catalogTestPath));
+    // ids 0x01 0x01 0x02 collide in 1 byte
+    ASSERT(c.header->hashLength == 2);
+    ASSERT(c.header->messageCount == 3);
+    ASSERT(c.entries[1].isVariable && c.entries[1].size == 100);
+    ASSERT(strcmp(c.names + c.entries[2].nameOffset, "ping pong") == 0);
+
+    size_t index;
+    ASSERT(!catalog_findName(&c, "bar", &index) && index == 1);
+    ASSERT(!catalog_findName(&c, "ping pong", &index) && index == 2);
+    ASSERT(catalog_findName(&c, "ping", &index));
+    ASSERT(!catalog_findId(&c, 0x0201, &index) && index == 0);
+    ASSERT(!catalog_findId(&c, 0x0202, &index) && index == 2);
+    ASSERT(catalog_findId(&c, 0x0203, &index));
+
+    catalog_close(&c);
+    unlink(catalogTestPath);
+    return 0;
+}
+
+int catalogWriteErrors(void) {
+    nadam_messageInfo_t infos[2] = { catalogTestInfos[0], catalogTestInfos[0] };
+    // repeated name
+    ASSERT(catalog_write(catalogTestPath, infos, 2));
+
+    // colliding ids
+    infos[1].name = "other";
+    infos[1].nameLength = 5;
+    ASSERT(catalog_write(catalogTestPath, infos, 2));
+    ASSERT(catalog_write(catalogTestPath, infos, 0));
+    return 0;
+}
+
+int catalogOpenRejectsCorruptFiles(void) {
+    catalog_t c;
+    ASSERT(catalog_open(&c, "/tmp/nadam_catalog_unittest_missing"));
+
+    ASSERT(!catalog_write(catalogTestPath, catalogTestInfos, 3));
+    int fd = open(catalogTestPath, O_RDWR);
+    ASSERT(fd >= 0);
+
+    // name without terminating zero
+    uint8_t nonzero = 'x';
+    off_t end = (off_t) (sizeof(catalogHeader_t) + 3 * sizeof(catalogEntry_t) + 3);
+    ASSERT(pwrite(fd, &nonzero, 1, end) == 1);
+    ASSERT(catalog_open(&c, catalogTestPath));
+
+    // truncated
+    ASSERT(!ftruncate(fd, (off_t) sizeof(catalogHeader_t) + 8));
+    ASSERT(catalog_open(&c, catalogTestPath));
+
+    close(fd);
+    unlink(catalogTestPath);
+    return 0;
+}
+#endif
@@ -0,0 +1,72 @@
+/*
+Copyright:  Copyright Johannes Teichrieb 2015
+License:    opensource.org/licenses/MIT
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "nadam.h"
+
+/* Binary catalog layout (little-endian, offsets from the start of the file):
+   header | entries | name pool | name table | id table
+   The catalog is used in place - big-endian hosts reject it.
+   Names in the pool are zero terminated. Both tables have tableCapacity slots (power of 2)
+   of entry indices - CATALOG_EMPTY_SLOT marks an empty one. Collisions are resolved by linear probing.
+   Name table slot: catalog_hashName(name). Id table slot: catalog_hashId(first hashLength bytes of hash).
+   Written by gennmi -binary (nadam/infogen/catalog.d) or catalog_write().  */
+#define CATALOG_MAGIC "NADAMCAT"
+#define CATALOG_VERSION 1
+#define CATALOG_EMPTY_SLOT UINT32_MAX
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t messageCount;
+    // shortest collision-free hash length - the id table is built for it
+    uint32_t hashLength;
+    uint32_t tableCapacity;
+    uint64_t entriesOffset;
+    uint64_t namesOffset;
+    uint64_t nameTableOffset;
+    uint64_t idTableOffset;
+    uint64_t size;
+} catalogHeader_t;
+
+typedef struct {
+    // relative to the name pool
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t size;
+    uint8_t isVariable;
+    uint8_t reserved[3];
+    uint8_t hash[20];
+} catalogEntry_t;
+
+typedef struct {
+    const uint8_t *map;
+    size_t mapLength;
+    const catalogHeader_t *header;
+    const catalogEntry_t *entries;
+    const char *names;
+    const uint32_t *nameTable;
+    const uint32_t *idTable;
+} catalog_t;
+
+// validates the whole catalog - entries and tables can be used without further checks
+int catalog_open(catalog_t *c, const char *path);
+void catalog_close(catalog_t *c);
+int catalog_findName(const catalog_t *c, const char *name, size_t *index);
+// id is the hash truncated to header->hashLength
+int catalog_findId(const catalog_t *c, uint32_t id, size_t *index);
+
+int catalog_write(const char *path, const nadam_messageInfo_t *messageInfos, size_t messageCount);
+
+uint32_t catalog_hashName(const char *name, size_t length);
+// truncated ids are uniformly distributed already, but short ones only fill the low bits - inline for the receive path
+static inline uint32_t catalog_hashId(uint32_t id) {
+    uint32_t h = id * 2654435761u;
+    return h ^ h >> 16;
+}
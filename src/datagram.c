@@ -0,0 +1,442 @@
+/*
+Copyright:  Copyright Johannes Teichrieb 2015
+License:    opensource.org/licenses/MIT
+*/
+#define _GNU_SOURCE
+#include "datagram.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+#include "unittestMacros.h"
+
+// UDP_MAX_SEGMENTS of the kernel
+#define GSO_SEGMENTS_MAX 64
+#define GRO_BUFFER_LENGTH 65535
+
+typedef union {
+    char buf[CMSG_SPACE(sizeof(int))];
+    size_t align;
+} control_t;
+
+struct datagramSender {
+    int fd;
+    uint32_t datagramLength;
+    bool hasGso;
+    uint32_t headerLength;
+    datagram_headerWriter_t headerWriter;
+    void *headerContext;
+    // datagrams of the batch - the last one is being packed
+    uint32_t count;
+    uint32_t lengths[DATAGRAM_BATCH];
+    uint8_t *buffer;
+    struct mmsghdr messages[DATAGRAM_BATCH];
+    // first datagram of every prepared message, one past the last datagram at the end
+    uint32_t messageFirst[DATAGRAM_BATCH + 1];
+    struct iovec iovs[DATAGRAM_BATCH];
+    control_t controls[DATAGRAM_BATCH];
+};
+
+struct datagramReceiver {
+    int fd;
+    uint32_t bufferLength;
+    bool hasGro;
+    uint8_t *buffer;
+    struct mmsghdr messages[DATAGRAM_BATCH];
+    struct iovec iovs[DATAGRAM_BATCH];
+    control_t controls[DATAGRAM_BATCH];
+    // 0 - the buffer holds a single datagram
+    uint32_t segmentLengths[DATAGRAM_BATCH];
+    // position of datagram_next()
+    int count;
+    int current;
+    uint32_t offset;
+    // read by any thread
+    _Atomic(uint64_t) truncated;
+};
+
+// private declarations
+// -----------------------------------------------------------------------------
+static unsigned prepareMessages(datagramSender_t *s, uint32_t first);
+static uint32_t runEnd(const datagramSender_t *s, uint32_t first);
+static void prepareMessage(datagramSender_t *s, unsigned message, uint32_t first, uint32_t end);
+static uint32_t getGroSegmentLength(const struct msghdr *hdr);
+
+// interface functions
+// -----------------------------------------------------------------------------
+datagramSender_t *datagram_openSender(int fd, uint32_t datagramLength) {
+    if (datagramLength == 0 || datagramLength > DATAGRAM_LENGTH_MAX) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    datagramSender_t *s = calloc(1, sizeof(datagramSender_t));
+    if (s == NULL)
+        return NULL;
+
+    s->buffer = malloc((size_t) DATAGRAM_BATCH * datagramLength);
+    if (s->buffer == NULL) {
+        free(s);
+        return NULL;
+    }
+
+    s->fd = fd;
+    s->datagramLength = datagramLength;
+    // segment size 0 doesn't segment - it only probes for GSO support
+    int segment = 0;
+    s->hasGso = setsockopt(fd, IPPROTO_UDP, UDP_SEGMENT, &segment, sizeof(segment)) == 0;
+    return s;
+}
+
+void datagram_closeSender(datagramSender_t *s) {
+    if (s == NULL)
+        return;
+
+    free(s->buffer);
+    free(s);
+}
+
+void datagram_setHeader(datagramSender_t *s, uint32_t length, datagram_headerWriter_t writer, void *context) {
+    s->headerLength = length;
+    s->headerWriter = writer;
+    s->headerContext = context;
+}
+
+uint8_t *datagram_reserve(datagramSender_t *s, uint32_t length) {
+    if (length > s->datagramLength - s->headerLength) {
+        errno = EMSGSIZE;
+        return NULL;
+    }
+
+    if (s->count == 0 || s->lengths[s->count - 1] + length > s->datagramLength) {
+        if (s->count == DATAGRAM_BATCH && datagram_flush(s))
+            return NULL;
+
+        s->lengths[s->count++] = s->headerLength;
+    }
+
+    uint32_t *current = s->lengths + s->count - 1;
+    uint8_t *dest = s->buffer + (size_t) (s->count - 1) * s->datagramLength + *current;
+    *current += length;
+    return dest;
+}
+
+// the batch is dropped on error - datagrams are lossy anyway
+int datagram_flush(datagramSender_t *s) {
+    if (s->headerWriter) {
+        for (uint32_t i = 0; i < s->count; ++i)
+            s->headerWriter(s->buffer + (size_t) i * s->datagramLength, s->headerContext);
+    }
+
+    uint32_t first = 0;
+    int error = 0;
+    while (first < s->count) {
+        unsigned count = prepareMessages(s, first);
+        int sent = sendmmsg(s->fd, s->messages, count, 0);
+        if (sent < 0) {
+            if (errno == EINTR)
+                continue;
+
+            // the device can't segment - the rest goes without GSO
+            if (errno == EIO && s->hasGso) {
+                s->hasGso = false;
+                continue;
+            }
+
+            error = -1;
+            break;
+        }
+        first = s->messageFirst[sent];
+    }
+
+    s->count = 0;
+    return error;
+}
+
+datagramReceiver_t *datagram_openReceiver(int fd, uint32_t datagramLength) {
+    if (datagramLength == 0 || datagramLength > DATAGRAM_LENGTH_MAX) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    datagramReceiver_t *r = calloc(1, sizeof(datagramReceiver_t));
+    if (r == NULL)
+        return NULL;
+
+    int on = 1;
+    r->hasGro = setsockopt(fd, IPPROTO_UDP, UDP_GRO, &on, sizeof(on)) == 0;
+    // coalesced datagrams can fill a whole UDP payload
+    r->bufferLength = r->hasGro ? GRO_BUFFER_LENGTH : datagramLength;
+    r->buffer = malloc((size_t) DATAGRAM_BATCH * r->bufferLength);
+    if (r->buffer == NULL) {
+        free(r);
+        return NULL;
+    }
+
+    r->fd = fd;
+    for (size_t i = 0; i < DATAGRAM_BATCH; ++i) {
+        r->iovs[i] = (struct iovec) { r->buffer + i * r->bufferLength, r->bufferLength };
+        r->messages[i].msg_hdr.msg_iov = r->iovs + i;
+        r->messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    return r;
+}
+
+void datagram_closeReceiver(datagramReceiver_t *r) {
+    if (r == NULL)
+        return;
+
+    free(r->buffer);
+    free(r);
+}
+
+int datagram_recvBatch(datagramReceiver_t *r) {
+    for (size_t i = 0; i < DATAGRAM_BATCH; ++i) {
+        struct msghdr *hdr = &r->messages[i].msg_hdr;
+        hdr->msg_control = r->hasGro ? r->controls + i : NULL;
+        hdr->msg_controllen = r->hasGro ? sizeof(control_t) : 0;
+        hdr->msg_flags = 0;
+    }
+
+    int count;
+    do {
+        count = recvmmsg(r->fd, r->messages, DATAGRAM_BATCH, MSG_WAITFORONE, NULL);
+    } while (count < 0 && errno == EINTR);
+
+    r->count = count < 0 ? 0 : count;
+    r->current = 0;
+    r->offset = 0;
+    for (int i = 0; i < r->count; ++i)
+        r->segmentLengths[i] = r->hasGro ? getGroSegmentLength(&r->messages[i].msg_hdr) : 0;
+    return count;
+}
+
+const uint8_t *datagram_next(datagramReceiver_t *r, uint32_t *length) {
+    while (r->current < r->count) {
+        const struct mmsghdr *m = r->messages + r->current;
+        uint32_t received = m->msg_len;
+        if (m->msg_hdr.msg_flags & MSG_TRUNC) {
+            atomic_fetch_add(&r->truncated, 1);
+            received = 0;
+        }
+
+        if (r->offset < received) {
+            uint32_t segment = r->segmentLengths[r->current];
+            uint32_t rest = received - r->offset;
+            uint32_t n = segment && segment < rest ? segment : rest;
+            const uint8_t *datagram = r->buffer + (size_t) r->current * r->bufferLength + r->offset;
+            r->offset += n;
+            *length = n;
+            return datagram;
+        }
+
+        ++r->current;
+        r->offset = 0;
+    }
+    return NULL;
+}
+
+uint64_t datagram_truncatedCount(const datagramReceiver_t *r) {
+    return atomic_load(&r->truncated);
+}
+
+// private functions
+// -----------------------------------------------------------------------------
+// messages of the datagrams from first on - returns their count
+static unsigned prepareMessages(datagramSender_t *s, uint32_t first) {
+    unsigned count = 0;
+    while (first < s->count) {
+        uint32_t end = s->hasGso ? runEnd(s, first) : first + 1;
+        prepareMessage(s, count, first, end);
+        s->messageFirst[count++] = first;
+        first = end;
+    }
+    s->messageFirst[count] = s->count;
+    return count;
+}
+
+// equally long datagrams, optionally ended by a shorter one - the kernel segments them again
+static uint32_t runEnd(const datagramSender_t *s, uint32_t first) {
+    uint32_t length = s->lengths[first];
+    uint32_t total = length;
+    uint32_t end = first + 1;
+    while (end < s->count && end - first < GSO_SEGMENTS_MAX) {
+        uint32_t next = s->lengths[end];
+        if (next > length || total + next > DATAGRAM_LENGTH_MAX)
+            break;
+
+        total += next;
+        ++end;
+        if (next < length)
+            break;
+    }
+    return end;
+}
+
+static void prepareMessage(datagramSender_t *s, unsigned message, uint32_t first, uint32_t end) {
+    for (uint32_t i = first; i < end; ++i)
+        s->iovs[i] = (struct iovec) { s->buffer + (size_t) i * s->datagramLength, s->lengths[i] };
+
+    struct msghdr *hdr = &s->messages[message].msg_hdr;
+    *hdr = (struct msghdr) { .msg_iov = s->iovs + first, .msg_iovlen = end - first };
+    if (end - first == 1)
+        return;
+
+    control_t *control = s->controls + message;
+    hdr->msg_control = control;
+    hdr->msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr);
+    cmsg->cmsg_level = IPPROTO_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    uint16_t segment = (uint16_t) s->lengths[first];
+    memcpy(CMSG_DATA(cmsg), &segment, sizeof(segment));
+}
+
+// 0 if the datagrams weren't coalesced
+static uint32_t getGroSegmentLength(const struct msghdr *hdr) {
+    for (const struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr); cmsg; cmsg = CMSG_NXTHDR((struct msghdr *) hdr, (struct cmsghdr *) cmsg)) {
+        if (cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_GRO) {
+            int segment;
+            memcpy(&segment, CMSG_DATA(cmsg), sizeof(segment));
+            return segment > 0 ? (uint32_t) segment : 0;
+        }
+    }
+    return 0;
+}
+
+// unittest
+// -----------------------------------------------------------------------------
+#ifdef UNITTEST
+#include <unistd.h>
+#include <arpa/inet.h>
+
+// receiving end is bound to an ephemeral loopback port, the sending end is connected to it
+static int openLoopbackPair(int fds[2]) {
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t length = sizeof(addr);
+    fds[0] = socket(AF_INET, SOCK_DGRAM, 0);
+    fds[1] = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fds[0] < 0 || fds[1] < 0 || bind(fds[0], (struct sockaddr *) &addr, length)
+            || getsockname(fds[0], (struct sockaddr *) &addr, &length)
+            || connect(fds[1], (struct sockaddr *) &addr, length))
+        return -1;
+    return 0;
+}
+
+int datagramsArePackedAndReceivedInOrder(void) {
+    int fds[2];
+    ASSERT(!openLoopbackPair(fds));
+    datagramSender_t *s = datagram_openSender(fds[1], 100);
+    datagramReceiver_t *r = datagram_openReceiver(fds[0], 100);
+    ASSERT(s && r);
+
+    // 40 byte pieces - 2 per datagram; 70 byte pieces - 1 per datagram
+    const uint32_t pieces[] = { 40, 40, 40, 40, 40, 70, 70, 40 };
+    const uint32_t expected[] = { 80, 80, 40, 70, 70, 40 };
+    for (size_t i = 0; i < sizeof(pieces) / sizeof(pieces[0]); ++i) {
+        uint8_t *dest = datagram_reserve(s, pieces[i]);
+        ASSERT(dest);
+        memset(dest, (int) i, pieces[i]);
+    }
+    ASSERT(!datagram_flush(s));
+
+    size_t received = 0;
+    while (received < sizeof(expected) / sizeof(expected[0])) {
+        ASSERT(datagram_recvBatch(r) > 0);
+        const uint8_t *datagram;
+        uint32_t length;
+        while ((datagram = datagram_next(r, &length))) {
+            ASSERT(received < sizeof(expected) / sizeof(expected[0]));
+            ASSERT(length == expected[received]);
+            ++received;
+        }
+    }
+
+    datagram_closeSender(s);
+    datagram_closeReceiver(r);
+    close(fds[0]);
+    close(fds[1]);
+    return 0;
+}
+
+int runsOfEqualDatagramsAreOneMessage(void) {
+    datagramSender_t *s = datagram_openSender(-1, 100);
+    ASSERT(s);
+    s->hasGso = true;
+    const uint32_t lengths[] = { 80, 80, 80, 30, 90, 90, 95 };
+    s->count = sizeof(lengths) / sizeof(lengths[0]);
+    memcpy(s->lengths, lengths, sizeof(lengths));
+
+    ASSERT(prepareMessages(s, 0) == 3);
+    ASSERT(s->messages[0].msg_hdr.msg_iovlen == 4);
+    ASSERT(s->messages[0].msg_hdr.msg_controllen);
+    ASSERT(s->messages[1].msg_hdr.msg_iovlen == 2);
+    ASSERT(s->messages[2].msg_hdr.msg_iovlen == 1);
+    ASSERT(s->messages[2].msg_hdr.msg_controllen == 0);
+    ASSERT(s->messageFirst[2] == 6 && s->messageFirst[3] == 7);
+
+    s->hasGso = false;
+    ASSERT(prepareMessages(s, 2) == 5);
+    datagram_closeSender(s);
+    return 0;
+}
+
+static void countingHeaderWriter(uint8_t *header, void *context) {
+    uint8_t *count = context;
+    *header = (*count)++;
+}
+
+int headersAreWrittenInSendOrder(void) {
+    int fds[2];
+    ASSERT(!openLoopbackPair(fds));
+    datagramSender_t *s = datagram_openSender(fds[1], 10);
+    datagramReceiver_t *r = datagram_openReceiver(fds[0], 10);
+    ASSERT(s && r);
+    uint8_t count = 0;
+    datagram_setHeader(s, 1, countingHeaderWriter, &count);
+
+    errno = 0;
+    ASSERT(datagram_reserve(s, 10) == NULL);
+    ASSERT(errno == EMSGSIZE);
+    for (uint8_t i = 0; i < 3; ++i)
+        memset(datagram_reserve(s, 9), 'a' + i, 9);
+    ASSERT(!datagram_flush(s));
+    ASSERT(count == 3);
+
+    uint8_t received = 0;
+    while (received < 3) {
+        ASSERT(datagram_recvBatch(r) > 0);
+        const uint8_t *datagram;
+        uint32_t length;
+        while ((datagram = datagram_next(r, &length))) {
+            ASSERT(length == 10);
+            ASSERT(datagram[0] == received && datagram[1] == 'a' + received);
+            ++received;
+        }
+    }
+
+    datagram_closeSender(s);
+    datagram_closeReceiver(r);
+    close(fds[0]);
+    close(fds[1]);
+    return 0;
+}
+
+int reserveBeyondDatagramLengthError(void) {
+    datagramSender_t *s = datagram_openSender(-1, 100);
+    ASSERT(s);
+    errno = 0;
+    ASSERT(datagram_reserve(s, 101) == NULL);
+    ASSERT(errno == EMSGSIZE);
+    ASSERT(datagram_reserve(s, 100));
+    datagram_closeSender(s);
+    return 0;
+}
+#endif
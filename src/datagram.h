@@ -0,0 +1,45 @@
+/*
+Copyright:  Copyright Johannes Teichrieb 2015
+License:    opensource.org/licenses/MIT
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Batches of UDP datagrams on a socket. The sender packs data into datagrams of up to
+   datagramLength bytes and sends a batch with a single sendmmsg - a run of equally long
+   datagrams (optionally followed by a shorter one) goes as one UDP GSO message.
+   The receiver gets a batch with a single recvmmsg - with UDP GRO a buffer can hold
+   several datagrams of the same length, datagram_next() splits them.
+   GSO and GRO are used where the kernel supports them.  */
+#define DATAGRAM_BATCH 32
+// UDP payload over IPv4
+#define DATAGRAM_LENGTH_MAX 65507
+
+typedef struct datagramSender datagramSender_t;
+typedef struct datagramReceiver datagramReceiver_t;
+// writes the header of a datagram about to be sent - datagrams of a flush are passed in order
+typedef void (*datagram_headerWriter_t)(uint8_t *header, void *context);
+
+// fd is a connected UDP socket
+datagramSender_t *datagram_openSender(int fd, uint32_t datagramLength);
+void datagram_closeSender(datagramSender_t *s);
+// every datagram starts with length bytes written by writer - has to be set before reserving
+void datagram_setHeader(datagramSender_t *s, uint32_t length, datagram_headerWriter_t writer, void *context);
+/* Returns the location for length bytes in the current datagram. A new datagram is started
+   if they don't fit, a full batch is sent before. NULL if length exceeds datagramLength
+   (without the header) or sending the batch failed (errno of sendmmsg).  */
+uint8_t *datagram_reserve(datagramSender_t *s, uint32_t length);
+// sends the datagrams packed so far
+int datagram_flush(datagramSender_t *s);
+
+datagramReceiver_t *datagram_openReceiver(int fd, uint32_t datagramLength);
+void datagram_closeReceiver(datagramReceiver_t *r);
+/* Waits for the first datagram if the socket blocks, takes the others available.
+   Returns count of received buffers or -1 (errno of recvmmsg).  */
+int datagram_recvBatch(datagramReceiver_t *r);
+// next datagram of the batch or NULL - truncated datagrams are skipped and counted
+const uint8_t *datagram_next(datagramReceiver_t *r, uint32_t *length);
+uint64_t datagram_truncatedCount(const datagramReceiver_t *r);
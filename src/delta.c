@@ -0,0 +1,169 @@
+/*
+Copyright:  Copyright Johannes Teichrieb 2015
+License:    opensource.org/licenses/MIT
+*/
+#include "delta.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "unittestMacros.h"
+
+/* A changed run is continued over unchanged stretches shorter than this -
+   restarting a run would cost 2 length bytes.  */
+#define UNCHANGED_RUN_MIN 3
+
+// private declarations
+// -----------------------------------------------------------------------------
+static bool isUnchangedRun(const uint8_t *previous, const uint8_t *current, uint32_t i, uint32_t n);
+static int putVarint(uint8_t *dest, uint32_t capacity, uint32_t *pos, uint32_t val);
+static int readVarint(const uint8_t *src, uint32_t length, uint32_t *pos, uint32_t *val);
+
+// interface functions
+// -----------------------------------------------------------------------------
+int delta_encode(const uint8_t *previous, const uint8_t *current, uint32_t n,
+        uint8_t *dest, uint32_t capacity, uint32_t *length) {
+    uint32_t pos = 0;
+    uint32_t i = 0;
+    while (true) {
+        uint32_t unchangedStart = i;
+        while (i < n && previous[i] == current[i])
+            ++i;
+
+        if (i == n)
+            break;
+
+        uint32_t changedStart = i;
+        while (i < n && !isUnchangedRun(previous, current, i, n))
+            ++i;
+
+        uint32_t changedLength = i - changedStart;
+        if (putVarint(dest, capacity, &pos, changedStart - unchangedStart)
+                || putVarint(dest, capacity, &pos, changedLength)
+                || capacity - pos < changedLength)
+            return -1;
+
+        for (uint32_t k = changedStart; k < i; ++k)
+            dest[pos++] = (uint8_t) (previous[k] ^ current[k]);
+    }
+
+    *length = pos;
+    return 0;
+}
+
+int delta_apply(uint8_t *value, uint32_t n, const uint8_t *delta, uint32_t length) {
+    uint32_t pos = 0;
+    uint32_t i = 0;
+    while (pos < length) {
+        uint32_t unchangedLength, changedLength;
+        if (readVarint(delta, length, &pos, &unchangedLength) || readVarint(delta, length, &pos, &changedLength))
+            return -1;
+
+        if (unchangedLength > n - i)
+            return -1;
+
+        i += unchangedLength;
+        if (changedLength > n - i || changedLength > length - pos)
+            return -1;
+
+        for (uint32_t k = 0; k < changedLength; ++k)
+            value[i + k] ^= delta[pos + k];
+
+        i += changedLength;
+        pos += changedLength;
+    }
+    return 0;
+}
+
+// private functions
+// -----------------------------------------------------------------------------
+static bool isUnchangedRun(const uint8_t *previous, const uint8_t *current, uint32_t i, uint32_t n) {
+    for (uint32_t k = i; k < i + UNCHANGED_RUN_MIN && k < n; ++k)
+        if (previous[k] != current[k])
+            return false;
+
+    return true;
+}
+
+static int putVarint(uint8_t *dest, uint32_t capacity, uint32_t *pos, uint32_t val) {
+    do {
+        if (*pos == capacity)
+            return -1;
+
+        uint8_t b = val & 0x7F;
+        val >>= 7;
+        dest[(*pos)++] = val ? (uint8_t) (b | 0x80) : b;
+    } while (val);
+    return 0;
+}
+
+static int readVarint(const uint8_t *src, uint32_t length, uint32_t *pos, uint32_t *val) {
+    uint32_t res = 0;
+    for (unsigned int shift = 0; shift < 35; shift += 7) {
+        if (*pos == length)
+            return -1;
+
+        uint8_t b = src[(*pos)++];
+        res |= (uint32_t) (b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            *val = res;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// unittest
+// -----------------------------------------------------------------------------
+#ifdef UNITTEST
+int deltaOfIdenticalValuesIsEmpty(void) {
+    uint8_t value[64] = { 1, 2, 3 };
+    uint8_t delta[8];
+    uint32_t length = 42;
+    ASSERT(!delta_encode(value, value, sizeof(value), delta, sizeof(delta), &length));
+    ASSERT(length == 0);
+    return 0;
+}
+
+int deltaRoundTripOfSparseChange(void) {
+    uint8_t previous[1000], current[1000], rebuilt[1000];
+    for (size_t i = 0; i < sizeof(previous); ++i)
+        previous[i] = (uint8_t) (i * 7);
+    memcpy(current, previous, sizeof(current));
+    current[0] ^= 0xFF;
+    current[500] = 42;
+    current[502] = 43;
+    current[999] = 0;
+
+    uint8_t delta[32];
+    uint32_t length;
+    ASSERT(!delta_encode(previous, current, sizeof(current), delta, sizeof(delta), &length));
+    ASSERT(length > 0 && length < 16);
+
+    memcpy(rebuilt, previous, sizeof(rebuilt));
+    ASSERT(!delta_apply(rebuilt, sizeof(rebuilt), delta, length));
+    ASSERT(memcmp(rebuilt, current, sizeof(current)) == 0);
+    return 0;
+}
+
+int deltaOfDenseChangeDoesntFit(void) {
+    uint8_t previous[100] = { 0 }, current[100];
+    memset(current, 0xAA, sizeof(current));
+    uint8_t delta[99];
+    uint32_t length;
+    ASSERT(delta_encode(previous, current, sizeof(current), delta, sizeof(delta), &length));
+    return 0;
+}
+
+int malformedDeltaError(void) {
+    uint8_t value[4] = { 0 };
+    const uint8_t beyondEnd[] = { 3, 2, 0xFF, 0xFF };
+    ASSERT(delta_apply(value, sizeof(value), beyondEnd, sizeof(beyondEnd)));
+    const uint8_t truncated[] = { 0, 3, 0xFF };
+    ASSERT(delta_apply(value, sizeof(value), truncated, sizeof(truncated)));
+    const uint8_t unterminatedVarint[] = { 0x80 };
+    ASSERT(delta_apply(value, sizeof(value), unterminatedVarint, sizeof(unterminatedVarint)));
+    return 0;
+}
+#endif
@@ -0,0 +1,17 @@
+/*
+Copyright:  Copyright Johannes Teichrieb 2015
+License:    opensource.org/licenses/MIT
+*/
+#pragma once
+
+#include <stdint.h>
+
+/* XOR delta of two equally sized values:
+   sequence of runs - unchanged byte count, changed byte count (both LEB128), changed bytes XOR previous.
+   Trailing unchanged bytes are omitted - identical values produce an empty delta.  */
+
+// returns -1 if the delta doesn't fit into capacity
+int delta_encode(const uint8_t *previous, const uint8_t *current, uint32_t n,
+        uint8_t *dest, uint32_t capacity, uint32_t *length);
+// applies the delta to value in place; returns -1 for a malformed delta
+int delta_apply(uint8_t *value, uint32_t n, const uint8_t *delta, uint32_t length);
@@ -0,0 +1,155 @@
+/*
+Copyright:  Copyright Johannes Teichrieb 2015
+License:    opensource.org/licenses/MIT
+*/
+#include "nadam.h"
+
+#include <string.h>
+
+#include "unittestMacros.h"
+
+/* Log-linear bucketing (as in HdrHistogram):
+   values below SUB_BUCKET_COUNT get a bucket each, above that every power of 2 range
+   is split into SUB_BUCKET_COUNT linear buckets - relative error is at most 1 / SUB_BUCKET_COUNT.  */
+#define SUB_BUCKET_BITS NADAM_HISTOGRAM_SUB_BUCKET_BITS
+#define SUB_BUCKET_COUNT (1u << SUB_BUCKET_BITS)
+
+// private declarations
+// -----------------------------------------------------------------------------
+static size_t getBucketIndex(uint64_t value);
+static uint64_t getBucketUpperBound(size_t index);
+static unsigned int getLog2(uint64_t value);
+
+// interface functions
+// -----------------------------------------------------------------------------
+void nadam_histogramReset(nadam_histogram_t *h) {
+    memset(h, 0, sizeof(nadam_histogram_t));
+    h->min = UINT64_MAX;
+}
+
+void nadam_histogramRecord(nadam_histogram_t *h, uint64_t value) {
+    ++h->buckets[getBucketIndex(value)];
+    ++h->count;
+    h->sum += value;
+    if (value < h->min)
+        h->min = value;
+    if (value > h->max)
+        h->max = value;
+}
+
+void nadam_histogramMerge(nadam_histogram_t *dest, const nadam_histogram_t *src) {
+    for (size_t i = 0; i < NADAM_HISTOGRAM_BUCKET_COUNT; ++i)
+        dest->buckets[i] += src->buckets[i];
+
+    dest->count += src->count;
+    dest->sum += src->sum;
+    if (src->min < dest->min)
+        dest->min = src->min;
+    if (src->max > dest->max)
+        dest->max = src->max;
+}
+
+uint64_t nadam_histogramPercentile(const nadam_histogram_t *h, double percentile) {
+    if (h->count == 0)
+        return 0;
+
+    if (percentile <= 0.0)
+        return h->min;
+
+    uint64_t rank = (uint64_t) (percentile / 100.0 * (double) h->count + 0.5);
+    if (rank == 0)
+        rank = 1;
+
+    uint64_t accumulated = 0;
+    for (size_t i = 0; i < NADAM_HISTOGRAM_BUCKET_COUNT; ++i) {
+        accumulated += h->buckets[i];
+        if (accumulated >= rank) {
+            uint64_t upperBound = getBucketUpperBound(i);
+            return upperBound < h->max ? upperBound : h->max;
+        }
+    }
+    return h->max;
+}
+
+// private functions
+// -----------------------------------------------------------------------------
+static size_t getBucketIndex(uint64_t value) {
+    if (value < SUB_BUCKET_COUNT)
+        return (size_t) value;
+
+    unsigned int log2 = getLog2(value);
+    unsigned int shift = log2 - SUB_BUCKET_BITS;
+    size_t subBucket = (size_t) (value >> shift) & (SUB_BUCKET_COUNT - 1);
+    return (shift + 1) * SUB_BUCKET_COUNT + subBucket;
+}
+
+static uint64_t getBucketUpperBound(size_t index) {
+    if (index < SUB_BUCKET_COUNT)
+        return index;
+
+    unsigned int shift = (unsigned int) (index / SUB_BUCKET_COUNT) - 1;
+    uint64_t subBucket = index % SUB_BUCKET_COUNT;
+    uint64_t lowerBound = (SUB_BUCKET_COUNT + subBucket) << shift;
+    return lowerBound + ((uint64_t) 1 << shift) - 1;
+}
+
+static unsigned int getLog2(uint64_t value) {
+    return 63 - (unsigned int) __builtin_clzll(value);
+}
+
+// unittest
+// -----------------------------------------------------------------------------
+#ifdef UNITTEST
+int histogramSmallValuesAreExact(void) {
+    nadam_histogram_t h;
+    nadam_histogramReset(&h);
+    for (uint64_t i = 0; i < SUB_BUCKET_COUNT; ++i)
+        nadam_histogramRecord(&h, i);
+
+    ASSERT(h.count == SUB_BUCKET_COUNT);
+    ASSERT(h.min == 0);
+    ASSERT(h.max == SUB_BUCKET_COUNT - 1);
+    ASSERT(nadam_histogramPercentile(&h, 50.0) == SUB_BUCKET_COUNT / 2 - 1);
+    return 0;
+}
+
+int histogramBucketBoundsAreConsistent(void) {
+    uint64_t values[] = { 8, 9, 15, 16, 17, 1000, 123456789, UINT64_MAX };
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+        size_t index = getBucketIndex(values[i]);
+        ASSERT(index < NADAM_HISTOGRAM_BUCKET_COUNT);
+        ASSERT(getBucketUpperBound(index) >= values[i]);
+        ASSERT(index == 0 || getBucketUpperBound(index - 1) < values[i]);
+    }
+    return 0;
+}
+
+int histogramPercentileWithinPrecision(void) {
+    nadam_histogram_t h;
+    nadam_histogramReset(&h);
+    for (uint64_t i = 1; i <= 1000; ++i)
+        nadam_histogramRecord(&h, i * 1000);
+
+    uint64_t p99 = nadam_histogramPercentile(&h, 99.0);
+    ASSERT(p99 >= 990000);
+    ASSERT(p99 <= 990000 + 990000 / SUB_BUCKET_COUNT);
+    ASSERT(nadam_histogramPercentile(&h, 100.0) == 1000000);
+    return 0;
+}
+
+int histogramMergeAddsUp(void) {
+    nadam_histogram_t a, b;
+    nadam_histogramReset(&a);
+    nadam_histogramReset(&b);
+    nadam_histogramRecord(&a, 5);
+    nadam_histogramRecord(&b, 500);
+    nadam_histogramRecord(&b, 50);
+
+    nadam_histogramMerge(&a, &b);
+    ASSERT(a.count == 3);
+    ASSERT(a.sum == 555);
+    ASSERT(a.min == 5);
+    ASSERT(a.max == 500);
+    return 0;
+}
+#endif
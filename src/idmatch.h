@@ -0,0 +1,50 @@
+/*
+Copyright:  Copyright Johannes Teichrieb 2015
+License:    opensource.org/licenses/MIT
+*/
+#pragma once
+
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/* Search of a truncated id in a short array - SSE2 compares 4 ids at once, AVX2 (if the build targets it) 8.
+   The array has to be IDMATCH_ALIGNMENT aligned and readable up to count rounded up to IDMATCH_GROUP.
+   Values past count are never reported.
+   Inline - on the receive path a call costs about as much as the match.  */
+#define IDMATCH_ALIGNMENT 32
+#define IDMATCH_GROUP 8
+#define IDMATCH_PADDED_COUNT(count) (((count) + IDMATCH_GROUP - 1) / IDMATCH_GROUP * IDMATCH_GROUP)
+
+// bit per id of the group equal to id
+static inline uint32_t idmatch_compareGroup(const uint32_t *group, uint32_t id) {
+#if defined(__AVX2__)
+    __m256i eq = _mm256_cmpeq_epi32(_mm256_load_si256((const __m256i *) group), _mm256_set1_epi32((int) id));
+    return (uint32_t) _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+#elif defined(__SSE2__)
+    __m128i needle = _mm_set1_epi32((int) id);
+    __m128i low = _mm_cmpeq_epi32(_mm_load_si128((const __m128i *) group), needle);
+    __m128i high = _mm_cmpeq_epi32(_mm_load_si128((const __m128i *) (group + 4)), needle);
+    return (uint32_t) _mm_movemask_ps(_mm_castsi128_ps(low)) | (uint32_t) _mm_movemask_ps(_mm_castsi128_ps(high)) << 4;
+#else
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < IDMATCH_GROUP; ++i)
+        mask |= (uint32_t) (group[i] == id) << i;
+    return mask;
+#endif
+}
+
+// position of id in ids, -1 if it isn't there
+static inline int idmatch_find(const uint32_t *ids, uint32_t count, uint32_t id) {
+    for (uint32_t i = 0; i < count; i += IDMATCH_GROUP) {
+        uint32_t mask = idmatch_compareGroup(ids + i, id);
+        if (mask) {
+            // only the last group has values past count - a match there can't hide a real one
+            uint32_t position = i + (uint32_t) __builtin_ctz(mask);
+            return position < count ? (int) position : -1;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,271 @@
+/*
+Copyright:  Copyright Johannes Teichrieb 2015
+License:    opensource.org/licenses/MIT
+*/
+#include "lz.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "unittestMacros.h"
+
+#define MIN_MATCH 4
+// matches don't reach the end of input - the last sequence always has some literals
+#define LAST_LITERALS 5
+#define OFFSET_MAX 65535
+#define TOKEN_LENGTH_MAX 15
+#define HASH_BITS 12
+
+typedef struct {
+    uint8_t *p;
+    uint8_t *end;
+} output_t;
+
+// private declarations
+// -----------------------------------------------------------------------------
+static bool putSequence(output_t *o, const uint8_t *literals, uint32_t literalLength,
+        uint32_t offset, uint32_t matchLength);
+static bool putLength(output_t *o, uint32_t length);
+static int readLength(const uint8_t **p, const uint8_t *end, uint32_t *length);
+static uint32_t read32(const uint8_t *p);
+static uint32_t hashSequence(uint32_t sequence);
+static uint32_t min32(uint32_t a, uint32_t b);
+
+// interface functions
+// -----------------------------------------------------------------------------
+uint32_t lz_compress(const uint8_t *src, uint32_t n, uint8_t *dest, uint32_t destCapacity) {
+    output_t o = { .p = dest, .end = dest + destCapacity };
+    uint32_t table[1 << HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    uint32_t anchor = 0;
+    if (n > MIN_MATCH + LAST_LITERALS) {
+        uint32_t matchEnd = n - LAST_LITERALS;
+        uint32_t i = 0;
+        while (i + MIN_MATCH <= matchEnd) {
+            uint32_t sequence = read32(src + i);
+            uint32_t h = hashSequence(sequence);
+            uint32_t candidate = table[h];
+            table[h] = i;
+
+            bool isMatch = candidate < i && i - candidate <= OFFSET_MAX && read32(src + candidate) == sequence;
+            if (!isMatch) {
+                // skip faster through incompressible data
+                i += 1 + ((i - anchor) >> 6);
+                continue;
+            }
+
+            uint32_t matchLength = MIN_MATCH;
+            while (i + matchLength < matchEnd && src[candidate + matchLength] == src[i + matchLength])
+                ++matchLength;
+
+            if (!putSequence(&o, src + anchor, i - anchor, i - candidate, matchLength))
+                return 0;
+
+            i += matchLength;
+            anchor = i;
+        }
+    }
+
+    if (!putSequence(&o, src + anchor, n - anchor, 0, 0))
+        return 0;
+
+    return (uint32_t) (o.p - dest);
+}
+
+int lz_decompress(const uint8_t *src, uint32_t srcLength, uint8_t *dest, uint32_t n) {
+    const uint8_t *p = src, *end = src + srcLength;
+    uint8_t *op = dest, *oend = dest + n;
+    while (true) {
+        if (p == end)
+            return -1;
+
+        uint8_t token = *p++;
+        uint32_t literalLength = token >> 4;
+        if (literalLength == TOKEN_LENGTH_MAX && readLength(&p, end, &literalLength))
+            return -1;
+
+        if ((size_t) (end - p) < literalLength || (size_t) (oend - op) < literalLength)
+            return -1;
+
+        memcpy(op, p, literalLength);
+        op += literalLength;
+        p += literalLength;
+
+        bool isLastSequence = (p == end);
+        if (isLastSequence)
+            return op == oend ? 0 : -1;
+
+        if (end - p < 2)
+            return -1;
+
+        uint32_t offset = (uint32_t) p[0] | (uint32_t) p[1] << 8;
+        p += 2;
+        if (offset == 0 || offset > (size_t) (op - dest))
+            return -1;
+
+        uint32_t matchLength = token & TOKEN_LENGTH_MAX;
+        if (matchLength == TOKEN_LENGTH_MAX && readLength(&p, end, &matchLength))
+            return -1;
+
+        matchLength += MIN_MATCH;
+        if ((size_t) (oend - op) < matchLength)
+            return -1;
+
+        const uint8_t *match = op - offset;
+        if (offset >= matchLength) {
+            memcpy(op, match, matchLength);
+        } else {
+            // overlapping copy repeats the pattern
+            for (uint32_t i = 0; i < matchLength; ++i)
+                op[i] = match[i];
+        }
+        op += matchLength;
+    }
+}
+
+// private functions
+// -----------------------------------------------------------------------------
+// matchLength 0 marks the last sequence
+static bool putSequence(output_t *o, const uint8_t *literals, uint32_t literalLength,
+        uint32_t offset, uint32_t matchLength) {
+    if (o->p == o->end)
+        return false;
+
+    uint32_t matchLengthCode = matchLength ? matchLength - MIN_MATCH : 0;
+    uint8_t *token = o->p++;
+    *token = (uint8_t) (min32(literalLength, TOKEN_LENGTH_MAX) << 4 | min32(matchLengthCode, TOKEN_LENGTH_MAX));
+
+    if (literalLength >= TOKEN_LENGTH_MAX && !putLength(o, literalLength))
+        return false;
+
+    if ((size_t) (o->end - o->p) < literalLength)
+        return false;
+
+    memcpy(o->p, literals, literalLength);
+    o->p += literalLength;
+
+    if (matchLength == 0)
+        return true;
+
+    if (o->end - o->p < 2)
+        return false;
+
+    *o->p++ = (uint8_t) offset;
+    *o->p++ = (uint8_t) (offset >> 8);
+    return matchLengthCode < TOKEN_LENGTH_MAX || putLength(o, matchLengthCode);
+}
+
+static bool putLength(output_t *o, uint32_t length) {
+    uint32_t remainder = length - TOKEN_LENGTH_MAX;
+    for (; remainder >= UINT8_MAX; remainder -= UINT8_MAX) {
+        if (o->p == o->end)
+            return false;
+        *o->p++ = UINT8_MAX;
+    }
+
+    if (o->p == o->end)
+        return false;
+    *o->p++ = (uint8_t) remainder;
+    return true;
+}
+
+static int readLength(const uint8_t **p, const uint8_t *end, uint32_t *length) {
+    uint8_t b;
+    do {
+        if (*p == end)
+            return -1;
+
+        b = *(*p)++;
+        if (*length > UINT32_MAX - b)
+            return -1;
+
+        *length += b;
+    } while (b == UINT8_MAX);
+    return 0;
+}
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t val;
+    memcpy(&val, p, 4);
+    return val;
+}
+
+static uint32_t hashSequence(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static uint32_t min32(uint32_t a, uint32_t b) {
+    return a < b ? a : b;
+}
+
+// unittest
+// -----------------------------------------------------------------------------
+#ifdef UNITTEST
+static uint8_t lzTestSrc[70000];
+static uint8_t lzTestCompressed[80000];
+static uint8_t lzTestDecompressed[70000];
+
+static void fillRepetitive(uint8_t *dest, uint32_t n) {
+    const char *pattern = "{\"id\": 1234, \"name\": \"sensor\", \"value\": 42.5},\n";
+    size_t patternLength = strlen(pattern);
+    for (uint32_t i = 0; i < n; ++i)
+        dest[i] = (uint8_t) pattern[i % patternLength];
+}
+
+static void fillPseudoRandom(uint8_t *dest, uint32_t n) {
+    uint32_t x = 2463534242u;
+    for (uint32_t i = 0; i < n; ++i) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        dest[i] = (uint8_t) x;
+    }
+}
+
+int lzRoundTripOfRepetitiveData(void) {
+    uint32_t n = sizeof(lzTestSrc);
+    fillRepetitive(lzTestSrc, n);
+    uint32_t compressedLength = lz_compress(lzTestSrc, n, lzTestCompressed, sizeof(lzTestCompressed));
+    ASSERT(compressedLength);
+    ASSERT(compressedLength < n / 10);
+    ASSERT(!lz_decompress(lzTestCompressed, compressedLength, lzTestDecompressed, n));
+    ASSERT(memcmp(lzTestSrc, lzTestDecompressed, n) == 0);
+    return 0;
+}
+
+int lzRoundTripOfShortAndEmptyInput(void) {
+    const uint8_t *src = (const uint8_t *) "abcabcabca";
+    for (uint32_t n = 0; n <= 10; ++n) {
+        uint32_t compressedLength = lz_compress(src, n, lzTestCompressed, sizeof(lzTestCompressed));
+        ASSERT(compressedLength);
+        ASSERT(!lz_decompress(lzTestCompressed, compressedLength, lzTestDecompressed, n));
+        ASSERT(memcmp(src, lzTestDecompressed, n) == 0);
+    }
+    return 0;
+}
+
+int lzIncompressibleDataDoesntFit(void) {
+    uint32_t n = 4096;
+    fillPseudoRandom(lzTestSrc, n);
+    ASSERT(lz_compress(lzTestSrc, n, lzTestCompressed, n) == 0);
+
+    uint32_t compressedLength = lz_compress(lzTestSrc, n, lzTestCompressed, sizeof(lzTestCompressed));
+    ASSERT(compressedLength);
+    ASSERT(!lz_decompress(lzTestCompressed, compressedLength, lzTestDecompressed, n));
+    ASSERT(memcmp(lzTestSrc, lzTestDecompressed, n) == 0);
+    return 0;
+}
+
+int lzCorruptInputError(void) {
+    uint32_t n = 1000;
+    fillRepetitive(lzTestSrc, n);
+    uint32_t compressedLength = lz_compress(lzTestSrc, n, lzTestCompressed, sizeof(lzTestCompressed));
+    ASSERT(compressedLength);
+    ASSERT(lz_decompress(lzTestCompressed, compressedLength - 1, lzTestDecompressed, n));
+    ASSERT(lz_decompress(lzTestCompressed, compressedLength, lzTestDecompressed, n - 1));
+    ASSERT(lz_decompress(lzTestCompressed, compressedLength, lzTestDecompressed, n + 1));
+    return 0;
+}
+#endif
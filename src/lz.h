@@ -0,0 +1,17 @@
+/*
+Copyright:  Copyright Johannes Teichrieb 2015
+License:    opensource.org/licenses/MIT
+*/
+#pragma once
+
+#include <stdint.h>
+
+/* Byte oriented LZ77 (LZ4-like block format):
+   sequence of token (literal length << 4 | match length - 4), [literal length bytes], literals,
+   2 byte little-endian offset, [match length bytes]. The last sequence has only literals.
+   Length of 15 in a token is continued by bytes, which are added up until one is smaller than 255.  */
+
+// returns compressed length or 0 if the result doesn't fit into destCapacity
+uint32_t lz_compress(const uint8_t *src, uint32_t n, uint8_t *dest, uint32_t destCapacity);
+// returns 0 if src decompresses to exactly n bytes
+int lz_decompress(const uint8_t *src, uint32_t srcLength, uint8_t *dest, uint32_t n);
@@ -0,0 +1,222 @@
+/*
+Copyright:  Copyright Johannes Teichrieb 2015
+License:    opensource.org/licenses/MIT
+*/
+#include "multicast.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "khash.h"
+
+#include "unittestMacros.h"
+
+typedef struct {
+    uint64_t session;
+    // sequence of the next data datagram
+    uint64_t expected;
+    bool hasSnapshot;
+    uint64_t snapshotSequence;
+} streamState_t;
+
+KHASH_MAP_INIT_INT(streams, streamState_t)
+
+struct multicastStreams {
+    khash_t(streams) *map;
+};
+
+// private declarations
+// -----------------------------------------------------------------------------
+static void acceptData(streamState_t *state, uint64_t sequence, bool *isAccepted, uint64_t *lost);
+static bool acceptSnapshot(streamState_t *state, uint64_t sequence);
+static void writeLittleEndian(uint8_t *dest, uint64_t val, unsigned length);
+static uint64_t readLittleEndian(const uint8_t *src, unsigned length);
+
+// interface functions
+// -----------------------------------------------------------------------------
+void multicast_writeHeader(uint8_t *dest, const multicastHeader_t *h) {
+    writeLittleEndian(dest, h->stream, 4);
+    writeLittleEndian(dest + 4, h->kind, 4);
+    writeLittleEndian(dest + 8, h->session, 8);
+    writeLittleEndian(dest + 16, h->sequence, 8);
+}
+
+int multicast_readHeader(const uint8_t *src, uint32_t length, multicastHeader_t *h) {
+    if (length < MULTICAST_HEADER_LENGTH)
+        return -1;
+
+    h->stream = (uint32_t) readLittleEndian(src, 4);
+    h->kind = (uint32_t) readLittleEndian(src + 4, 4);
+    h->session = readLittleEndian(src + 8, 8);
+    h->sequence = readLittleEndian(src + 16, 8);
+    return (h->kind == MULTICAST_KIND_DATA || h->kind == MULTICAST_KIND_SNAPSHOT) ? 0 : -1;
+}
+
+multicastStreams_t *multicast_openStreams(void) {
+    multicastStreams_t *s = malloc(sizeof(multicastStreams_t));
+    if (s == NULL)
+        return NULL;
+
+    s->map = kh_init(streams);
+    if (s->map == NULL) {
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+void multicast_closeStreams(multicastStreams_t *s) {
+    if (s == NULL)
+        return;
+
+    kh_destroy(streams, s->map);
+    free(s);
+}
+
+int multicast_accept(multicastStreams_t *s, const multicastHeader_t *h, bool *isAccepted, uint64_t *lost) {
+    *lost = 0;
+    int ret;
+    khiter_t k = kh_put(streams, s->map, h->stream, &ret);
+    if (ret == -1)
+        return -1;
+
+    streamState_t *state = &kh_value(s->map, k);
+    bool isNew = (ret != 0);
+    if (!isNew && h->session < state->session) {
+        *isAccepted = false;
+        return 0;
+    }
+
+    // the publisher was opened again - its sequence starts over
+    if (isNew || h->session > state->session)
+        *state = (streamState_t) { .session = h->session, .expected = h->sequence };
+
+    if (h->kind == MULTICAST_KIND_SNAPSHOT)
+        *isAccepted = acceptSnapshot(state, h->sequence);
+    else
+        acceptData(state, h->sequence, isAccepted, lost);
+    return 0;
+}
+
+// private functions
+// -----------------------------------------------------------------------------
+static void acceptData(streamState_t *state, uint64_t sequence, bool *isAccepted, uint64_t *lost) {
+    *isAccepted = (sequence >= state->expected);
+    if (!*isAccepted)
+        return;
+
+    *lost = sequence - state->expected;
+    state->expected = sequence + 1;
+}
+
+// a snapshot spanning several datagrams is taken as long as no data came between them
+static bool acceptSnapshot(streamState_t *state, uint64_t sequence) {
+    if (sequence != state->expected)
+        return false;
+
+    if (state->hasSnapshot && state->snapshotSequence != sequence)
+        return false;
+
+    state->hasSnapshot = true;
+    state->snapshotSequence = sequence;
+    return true;
+}
+
+static void writeLittleEndian(uint8_t *dest, uint64_t val, unsigned length) {
+    for (unsigned i = 0; i < length; ++i)
+        dest[i] = (uint8_t) (val >> (8 * i));
+}
+
+static uint64_t readLittleEndian(const uint8_t *src, unsigned length) {
+    uint64_t val = 0;
+    for (unsigned i = 0; i < length; ++i)
+        val |= (uint64_t) src[i] << (8 * i);
+    return val;
+}
+
+// unittest
+// -----------------------------------------------------------------------------
+#ifdef UNITTEST
+static int acceptSessionSequence(multicastStreams_t *s, uint64_t session, uint64_t sequence,
+        bool *isAccepted, uint64_t *lost) {
+    multicastHeader_t h = { .stream = 7, .kind = MULTICAST_KIND_DATA, .session = session, .sequence = sequence };
+    return multicast_accept(s, &h, isAccepted, lost);
+}
+
+static int acceptSequence(multicastStreams_t *s, uint32_t kind, uint64_t sequence, bool *isAccepted, uint64_t *lost) {
+    multicastHeader_t h = { .stream = 7, .kind = kind, .session = 1, .sequence = sequence };
+    return multicast_accept(s, &h, isAccepted, lost);
+}
+
+int multicastHeaderRoundTrip(void) {
+    multicastHeader_t h = { .stream = 0x01020304, .kind = MULTICAST_KIND_SNAPSHOT, .session = 0x0a0b0c0d0e0f1011,
+        .sequence = 0x1122334455667788 };
+    uint8_t buf[MULTICAST_HEADER_LENGTH];
+    multicast_writeHeader(buf, &h);
+    ASSERT(buf[0] == 0x04 && buf[8] == 0x11 && buf[16] == 0x88);
+
+    multicastHeader_t read;
+    ASSERT(!multicast_readHeader(buf, sizeof(buf), &read));
+    ASSERT(read.stream == h.stream && read.kind == h.kind && read.session == h.session
+        && read.sequence == h.sequence);
+    ASSERT(multicast_readHeader(buf, sizeof(buf) - 1, &read));
+    buf[4] = 9;
+    ASSERT(multicast_readHeader(buf, sizeof(buf), &read));
+    return 0;
+}
+
+int multicastGapsAndDuplicates(void) {
+    multicastStreams_t *s = multicast_openStreams();
+    ASSERT(s);
+    bool isAccepted;
+    uint64_t lost;
+    // joining in the middle of the stream isn't a gap
+    ASSERT(!acceptSequence(s, MULTICAST_KIND_DATA, 100, &isAccepted, &lost));
+    ASSERT(isAccepted && lost == 0);
+    ASSERT(!acceptSequence(s, MULTICAST_KIND_DATA, 101, &isAccepted, &lost));
+    ASSERT(isAccepted && lost == 0);
+    ASSERT(!acceptSequence(s, MULTICAST_KIND_DATA, 104, &isAccepted, &lost));
+    ASSERT(isAccepted && lost == 2);
+    ASSERT(!acceptSequence(s, MULTICAST_KIND_DATA, 102, &isAccepted, &lost));
+    ASSERT(!isAccepted && lost == 0);
+
+    // the publisher restarted - a new session from 0, no gap
+    ASSERT(!acceptSessionSequence(s, 2, 0, &isAccepted, &lost));
+    ASSERT(isAccepted && lost == 0);
+    ASSERT(!acceptSessionSequence(s, 2, 2, &isAccepted, &lost));
+    ASSERT(isAccepted && lost == 1);
+    // a late datagram of the previous session
+    ASSERT(!acceptSessionSequence(s, 1, 105, &isAccepted, &lost));
+    ASSERT(!isAccepted && lost == 0);
+    ASSERT(!acceptSessionSequence(s, 2, 3, &isAccepted, &lost));
+    ASSERT(isAccepted && lost == 0);
+
+    multicastHeader_t other = { .stream = 8, .sequence = 5 };
+    ASSERT(!multicast_accept(s, &other, &isAccepted, &lost));
+    ASSERT(isAccepted && lost == 0);
+    multicast_closeStreams(s);
+    return 0;
+}
+
+int multicastStreamTakesASingleSnapshot(void) {
+    multicastStreams_t *s = multicast_openStreams();
+    ASSERT(s);
+    bool isAccepted;
+    uint64_t lost;
+    ASSERT(!acceptSequence(s, MULTICAST_KIND_DATA, 10, &isAccepted, &lost));
+    // older than the data delivered
+    ASSERT(!acceptSequence(s, MULTICAST_KIND_SNAPSHOT, 10, &isAccepted, &lost));
+    ASSERT(!isAccepted);
+    // a snapshot of two datagrams
+    ASSERT(!acceptSequence(s, MULTICAST_KIND_SNAPSHOT, 11, &isAccepted, &lost));
+    ASSERT(isAccepted);
+    ASSERT(!acceptSequence(s, MULTICAST_KIND_SNAPSHOT, 11, &isAccepted, &lost));
+    ASSERT(isAccepted);
+    ASSERT(!acceptSequence(s, MULTICAST_KIND_DATA, 11, &isAccepted, &lost));
+    ASSERT(isAccepted && lost == 0);
+    ASSERT(!acceptSequence(s, MULTICAST_KIND_SNAPSHOT, 12, &isAccepted, &lost));
+    ASSERT(!isAccepted);
+    multicast_closeStreams(s);
+    return 0;
+}
+#endif
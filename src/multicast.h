@@ -0,0 +1,42 @@
+/*
+Copyright:  Copyright Johannes Teichrieb 2015
+License:    opensource.org/licenses/MIT
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Every multicast datagram starts with a header (little-endian): stream (4 bytes), kind (4 bytes),
+   session (8 bytes) and sequence (8 bytes). Data datagrams of a stream are numbered consecutively.
+   Snapshot datagrams carry the sequence of the next data datagram - they hold the state before it.
+   A publisher opened again starts a later session, numbered from 0 again.  */
+#define MULTICAST_HEADER_LENGTH 24
+
+enum {
+    MULTICAST_KIND_DATA,
+    MULTICAST_KIND_SNAPSHOT
+};
+
+typedef struct {
+    uint32_t stream;
+    uint32_t kind;
+    uint64_t session;
+    uint64_t sequence;
+} multicastHeader_t;
+
+void multicast_writeHeader(uint8_t *dest, const multicastHeader_t *h);
+// returns -1 for a datagram without a valid header
+int multicast_readHeader(const uint8_t *src, uint32_t length, multicastHeader_t *h);
+
+typedef struct multicastStreams multicastStreams_t;
+
+multicastStreams_t *multicast_openStreams(void);
+void multicast_closeStreams(multicastStreams_t *s);
+/* Tracks the sequence of the header's stream. isAccepted is false for a data datagram already
+   passed (duplicate or reordered) and for a snapshot not matching the state delivered so far -
+   a stream takes a single snapshot. lost is the count of data datagrams missed before this one.
+   The first datagram of a stream doesn't report a gap - nor does the first one of a later session,
+   which starts the tracking over. Datagrams of an earlier session aren't accepted.
+   Returns -1 if allocation fails.  */
+int multicast_accept(multicastStreams_t *s, const multicastHeader_t *h, bool *isAccepted, uint64_t *lost);
@@ -2,17 +2,35 @@
 Copyright:  Copyright Johannes Teichrieb 2015
 License:    opensource.org/licenses/MIT
 */
+// pthread affinity
+#define _GNU_SOURCE
 #include "nadam.h"
 
 #include <pthread.h>
+#include <sched.h>
 #include <errno.h>
 #include <assert.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <poll.h>
 
 #include "khash.h"
+#include "capture.h"
+#include "catalog.h"
+#include "lz.h"
+#include "delta.h"
+#include "sha1.h"
+#include "idmatch.h"
+#include "datagram.h"
+#include "multicast.h"
 
 #include "unittestMacros.h"
 
-KHASH_MAP_INIT_INT(m32, size_t)
 KHASH_MAP_INIT_STR(mStr, size_t)
 
 /* For initial implementation let's assume that
@@ -20,6 +38,67 @@ KHASH_MAP_INIT_STR(mStr, size_t)
    TODO extension for lengths (4,8] with uint64_t keys  */
 #define HASH_LENGTH_MAX 4
 
+/* Extended handshake: hash length byte has the highest bit set and is followed by
+   extension length byte and the extension - little-endian feature bitmap, frameMax and batchPreferred.
+   Peers sending only the bitmap don't know limits.  */
+#define HANDSHAKE_EXTENDED 0x80
+#define HANDSHAKE_FEATURES_LENGTH 4
+#define HANDSHAKE_EXTENSION_LENGTH 12
+#define FEATURES_SUPPORTED (NADAM_FEATURE_TIMESTAMP | NADAM_FEATURE_COMPRESSION | NADAM_FEATURE_DELTA \
+        | NADAM_FEATURE_FRAGMENTS | NADAM_FEATURE_COMPACT_SIZE)
+
+#define TIMESTAMP_LENGTH 8
+
+// shortest spin before falling back to blocking recv in low latency profile
+#define SPIN_NS_MIN 1000
+
+/* With compression negotiated, the highest bit of variable size marks compressed data.
+   It is preceded by 4 byte uncompressed size.  */
+#define SIZE_COMPRESSED_FLAG 0x80000000u
+#define UNCOMPRESSED_SIZE_LENGTH 4
+
+/* With fragments negotiated, the second highest bit of variable size marks a fragment -
+   the message continues in the next frame of the type. Its last frame has the bit cleared.  */
+#define SIZE_FRAGMENT_FLAG 0x40000000u
+#define FRAGMENT_LENGTH (64 * 1024)
+
+/* With compact size negotiated, the size field (flags included) is LEB128 -
+   7 bits per byte, least significant group first, the highest bit marks a following byte.  */
+#define COMPACT_SIZE_LENGTH_MAX 5
+#define COMPACT_SIZE_CONTINUATION 0x80u
+#define COMPACT_SIZE_GROUP 0x7Fu
+
+// file bodies sendfile() can't move are copied in chunks
+#define FILE_CHUNK_LENGTH 4096
+
+// id, timestamp and size field
+#define FRAME_HEADER_LENGTH_MAX (HASH_LENGTH_MAX + TIMESTAMP_LENGTH + COMPACT_SIZE_LENGTH_MAX)
+// frames of more parts go to the send function part by part
+#define SENDV_PARTS_MAX 64
+
+#define CACHE_LINE_SIZE 64
+#define DISPATCH_ENTRY_SIZE (CACHE_LINE_SIZE / 2)
+// index of an empty dispatch slot
+#define DISPATCH_EMPTY UINT32_MAX
+/* Catalogs up to this many types find dispatch entries by comparing all ids side by side (idmatch.h).
+   Crossover with probing measured by bench/idmatch.c.  */
+#define ID_MATCH_COUNT_MAX 8
+// probing catalogs get up to this many bytes of dispatch table to keep probes short
+#define DISPATCH_SPARSE_SIZE_MAX 32768
+#define DISPATCH_SPARSE_LOAD_DIVISOR 8
+
+// id is the digest of name, isVariable byte and 4 byte size
+#define ID_SUFFIX_LENGTH 5
+// inputs of a batch up to this length are built on the stack
+#define ID_INPUTS_STACK_LENGTH 1024
+
+/* With delta negotiated, fixed size data is preceded by a frame kind byte.
+   Delta frame continues with 4 byte delta length and the delta (see delta.h).  */
+enum {
+    FRAME_KIND_FULL,
+    FRAME_KIND_DELTA
+};
+
 typedef struct {
     nadam_recvDelegate_t delegate;
     void *buffer;
@@ -27,53 +106,372 @@ typedef struct {
 } recvDelegateRelated_t;
 
 typedef struct {
-    khash_t(mStr) *nameKeyMap;
-    khash_t(m32) *hashKeyMap;
+    nadam_histogram_t kinds[NADAM_LATENCY_KIND_COUNT];
+    // odd while the receive thread records - it does so without latencyLock
+    _Atomic(uint32_t) recvSequence;
+} latencyHistograms_t;
 
-    void *commonRecvBuffer;
-    recvDelegateRelated_t *delegates;
-    bool nullRecvStart;
+typedef struct {
+    uint32_t fullInterval;
+    uint32_t sentSinceFull;
+    bool isFullRequested;
+    bool hasLast;
+    uint8_t last[];
+} deltaSendState_t;
+
+// state of a message type - shared by all catalog generations containing the type
+typedef struct {
+    recvDelegateRelated_t delegate;
+    // allocated with the feature buffers if timestamps are negotiated, else on first use
+    latencyHistograms_t *latencies;
+    // 0 - don't compress
+    uint32_t compressionMinSize;
+    // NULL for types without delta encoding
+    deltaSendState_t *deltaSendState;
+    // last received value of a fixed size type - allocated on first use
+    uint8_t *deltaBase;
+    bool isBulk;
+    // bulk message being reassembled into target (the delegate's buffer or fragmentBuffer)
+    uint8_t *fragmentTarget;
+    uint32_t fragmentedLength;
+    /* For delegates using the common buffer - allocated with the feature buffers for every
+       variable size type, its delegate may switch to the common buffer any time.  */
+    uint8_t *fragmentBuffer;
+    // acquire NULL - messages go to the delegate's buffer
+    nadam_bufferProvider_t provider;
+    // fragmentTarget was acquired from the provider
+    bool isFragmentProvided;
+    // last published value of a fixed size type - allocated on first use by a snapshotting publisher
+    uint8_t *snapshot;
+} typeState_t;
+
+// states of the types a generation introduced - kept until nadam_init()
+typedef struct typeBlock {
+    struct typeBlock *next;
+    size_t count;
+    typeState_t states[];
+} typeBlock_t;
+
+/* The hot fields of a type for the receive path - two entries share a cache line.
+   Message info and type state are reached through index (getEntryInfo(), getEntryState()).
+   Copies of the type's delegate are refreshed whenever it changes.  */
+typedef struct {
+    _Alignas(DISPATCH_ENTRY_SIZE) uint32_t id;
+    uint32_t index;
+    uint32_t size;
+    bool isVariable;
+    // messages are received via recvIntoProvided()
+    bool hasProvider;
+    // the delegate passed its own recvStart - it's kept in the type state
+    bool hasRecvStart;
+    nadam_recvDelegate_t delegate;
+    // the common receive buffer for delegates without their own
+    void *buffer;
+} dispatchEntry_t;
+
+_Static_assert(sizeof(dispatchEntry_t) == DISPATCH_ENTRY_SIZE, "dispatch entry has to fill half a cache line");
+
+/* Everything depending on the catalog. Readers see a generation through generation.tables -
+   nadam_updateCatalog() publishes a new one and frees the previous one after a grace period.  */
+typedef struct {
+    khash_t(mStr) *nameKeyMap;
+    /* Open addressing by truncated id (catalog_hashId(), linear probing) -
+       at most half of the slots are used, an eighth while the table is small (allocateDispatch()).
+       Filled for dispatchHashLength.  */
+    dispatchEntry_t *dispatch;
+    size_t dispatchCapacity;
+    size_t dispatchHashLength;
+    /* Small catalogs only (NULL otherwise): entries are taken in order and their ids kept here -
+       the search replaces probing.  */
+    uint32_t *dispatchIds;
+    uint32_t dispatchIdCount;
 
     const nadam_messageInfo_t *messageInfos;
     size_t messageCount;
+    uint32_t maxMessageSize;
+    typeState_t **types;
+
+    // lookups use the tables of a mapped catalog instead of the maps
+    bool hasCatalog;
+    catalog_t catalog;
+    nadam_messageInfo_t *catalogInfos;
+
+    // delegates without their own buffer receive into commonRecvBuffer
+    void *commonRecvBuffer;
+    uint8_t *compressSendBuffer;
+    uint8_t *compressRecvBuffer;
+    uint8_t *deltaSendBuffer;
+    uint8_t *deltaRecvBuffer;
+} tables_t;
+
+typedef struct {
+    bool nullRecvStart;
     size_t hashLength;
+    typeBlock_t *typeBlocks;
 
     nadam_send_t send;
     nadam_recv_t recv;
+    // -1 - bodies from files are copied
+    int sendFd;
+
+    bool isLowLatency;
+    nadam_lowLatency_t lowLatency;
+    // recv of the connection while recv spins on recvSome
+    nadam_recv_t recvBlocking;
+    // adapted between SPIN_NS_MIN and lowLatency.spinNs
+    uint64_t spinNs;
 
     nadam_errorDelegate_t errorDelegate;
 
+    uint32_t features;
+    uint32_t negotiatedFeatures;
+    uint32_t fragmentLength;
+
+    nadam_limits_t limits;
+    nadam_limits_t peerLimits;
+    // limits.frameMax if the peer knows it, 0 otherwise
+    uint32_t recvFrameMax;
+
+    uint64_t recvTimestamp;
+
+    uint8_t peerHandshake;
+
     pthread_t threadId;
     bool isThreadRunning;
+    // after an error the receive thread waits for the next nadam_initiate() on wakeFd
+    int wakeFd;
+    atomic_bool isThreadParked;
 } nadamMembers_t;
 
 // private declarations
 // -----------------------------------------------------------------------------
 static int testInitIn(size_t infoCount, size_t hashLengthMin);
+static void initMembers(tables_t *t, typeBlock_t *block, size_t hashLength);
+static int makeMessageIds(nadam_messageInfo_t *messageInfos, size_t count);
 static void freeMembers(void);
-static int allocateMembers(void);
 static int allocate(void **dest, size_t size);
-static uint32_t getMaxMessageSize(void);
-static void initDelegates(void);
+static uint32_t getMaxMessageSize(const nadam_messageInfo_t *messageInfos, size_t messageCount);
+static int allocateFeatureBuffers(tables_t *t);
+static int allocateFragmentBuffers(tables_t *t);
+static void resetDeltaStates(tables_t *t);
+static void resetFragments(tables_t *t);
+static int prefaultRecvBuffers(tables_t *t);
+static int prefault(void *p, size_t size);
 static recvDelegateRelated_t getDelegateInit(void);
-static void initMaps(void);
-static int fillNameMap(void);
-static void fillHashMap(void);
-static int getIndexForName(const char *name, size_t *index);
+static void setTypeDelegate(typeState_t *ts, nadam_recvDelegate_t delegate, void *buffer, volatile bool *recvStart);
+static int setDelegateByName(const char *name, nadam_recvDelegate_t delegate, void *buffer, volatile bool *recvStart);
+static int setDelta(typeState_t *ts, const nadam_messageInfo_t *mi, uint32_t fullInterval);
+// catalog generations
+static tables_t *makeTables(const nadam_messageInfo_t *messageInfos, size_t messageCount);
+static tables_t *makeCatalogTables(const char *path);
+static nadam_messageInfo_t *makeCatalogInfos(const catalog_t *catalog);
+static void freeTables(tables_t *t);
+static void freeTypeState(typeState_t *ts);
+static int addTypes(tables_t *t, const tables_t *previous, typeBlock_t **block);
+static bool isSameType(const nadam_messageInfo_t *a, const nadam_messageInfo_t *b);
+static int publishTables(tables_t *t);
+static void waitForReaders(void);
+static tables_t *getTables(void);
+static tables_t *enterTables(unsigned *epoch);
+static void leaveTables(unsigned epoch);
+static void leaveTablesOnCancel(void *epoch);
+static void initMaps(tables_t *t);
+static int fillNameMap(tables_t *t);
+static int allocateDispatch(tables_t *t);
+static int fillDispatch(tables_t *t);
+static int updateDispatch(tables_t *t);
+static dispatchEntry_t *findDispatchSlot(const tables_t *t, uint32_t id);
+static void setDispatchDelegate(const tables_t *t, dispatchEntry_t *entry);
+static typeState_t *getEntryState(const tables_t *t, const dispatchEntry_t *entry);
+static const nadam_messageInfo_t *getEntryInfo(const tables_t *t, const dispatchEntry_t *entry);
+static void setRecvStart(const tables_t *t, const dispatchEntry_t *entry);
+static void refreshDispatchEntry(const tables_t *t, size_t index);
+static void refreshDispatch(const tables_t *t);
+static int getIndexForName(const tables_t *t, const char *name, size_t *index);
+static int testIndex(const tables_t *t, size_t index);
 static void nullDelegate(void *msg, uint32_t size, const nadam_messageInfo_t *messageInfo);
 static int handshakeSendHashLength(void);
 static int handshakeHandleHashLengthRecv(void);
-static int sendFixedSize(const nadam_messageInfo_t *mi, const void *msg);
-static int sendVariableSize(const nadam_messageInfo_t *mi, const void *msg, uint32_t size);
+static int handshakeRecvExtension(uint32_t *peerFeatures, bool *hasLimits);
+static void applyPeerLimits(bool hasLimits);
+static void writeLittleEndian32(uint8_t *dest, uint32_t val);
+static uint32_t readLittleEndian32(const uint8_t *src);
+static bool isNegotiated(uint32_t feature);
+static int sendByIndex(const tables_t *t, size_t index, const void *msg, uint32_t size);
+static int sendFrame(const tables_t *t, size_t index, const void *msg, uint32_t size);
+static int sendBulk(const tables_t *t, size_t index, const void *msg, uint32_t size);
+static bool shouldFragment(uint32_t size);
+static int sendFragmented(const tables_t *t, size_t index, const void *msg, uint32_t size);
+static void waitForPriority(void);
+static int sendFixedSize(const tables_t *t, size_t index, const void *msg);
+static int sendVariableSize(const tables_t *t, size_t index, const void *msg, uint32_t size);
+static int testBodySize(const nadam_messageInfo_t *mi, uint64_t size);
+static int testSizeField(const nadam_messageInfo_t *mi, uint32_t size);
+static bool fitsSizeField(uint32_t size);
+static bool isBodySentAsIs(const tables_t *t, size_t index, uint32_t size);
+static void lockSending(bool isBulk);
+static void unlockSending(bool isBulk);
+static int sendFromFdByIndex(const tables_t *t, size_t index, int fd, off_t offset, uint32_t length);
+static int testFileLength(int fd, off_t offset, uint32_t length);
+static int sendFileFrame(const nadam_messageInfo_t *mi, int fd, off_t offset, uint32_t length);
+static int sendFileBody(int fd, off_t offset, uint32_t length);
+static int copyFileBody(int fd, off_t offset, uint32_t length);
+static int sendFileCopy(const tables_t *t, size_t index, int fd, off_t offset, uint32_t length);
+static int sendPartsByIndex(const tables_t *t, size_t index, const struct iovec *parts, int count);
+static int sendPartsFrame(const nadam_messageInfo_t *mi, const struct iovec *parts, int count, uint32_t size);
+static int writePartsFrame(const nadam_messageInfo_t *mi, const struct iovec *parts, int count, uint32_t size);
+static uint32_t encodeFrameHeader(const nadam_messageInfo_t *mi, uint32_t size, uint8_t *dest);
+static int writevAll(struct iovec *iov, int count);
+static int sendPartsAssembled(const tables_t *t, size_t index, const struct iovec *parts, int count, uint32_t size);
+static int sendHeader(const nadam_messageInfo_t *mi);
+static int sendSizeField(uint32_t sizeField);
+static uint32_t encodeCompactSize(uint32_t sizeField, uint8_t *dest);
+static bool shouldCompress(const typeState_t *ts, uint32_t size);
+static int sendCompressed(const tables_t *t, const nadam_messageInfo_t *mi, const void *msg, uint32_t size);
+static int sendFixedSizeWithKind(const tables_t *t, size_t index, const void *msg);
+static bool trySendDelta(const tables_t *t, const nadam_messageInfo_t *mi, deltaSendState_t *ds,
+        const void *msg, int *errorCollector);
+static latencyHistograms_t *getLatencyHistograms(typeState_t *ts);
+static int allocateLatencyHistograms(tables_t *t);
+static void recordRecvLatencies(latencyHistograms_t *lh, uint64_t oneWay, uint64_t delegate);
+static void copyLatencyHistogram(const latencyHistograms_t *lh, nadam_latencyKind_t kind, nadam_histogram_t *dest);
 // recv group -- errors are reported via error delegate
 static void *recvWorker(void *arg);
-static int getIndexForHash(const uint8_t *hash, size_t *index);
+static int recvFrame(void);
+static int recvFrameOfType(const tables_t *t, const uint8_t *hash);
+static void callDelegateRecordingLatency(const tables_t *t, const dispatchEntry_t *entry,
+        void *buffer, uint32_t size);
+static const dispatchEntry_t *findDispatchEntry(const tables_t *t, uint32_t id);
 static uint32_t truncateHash(const uint8_t *hash);
-static int getMessageSize(const nadam_messageInfo_t *mi, uint32_t *size);
-static void createRecvThread(void);
+static uint32_t truncateHashToLength(const uint8_t *hash, size_t length);
+static int getMessageSize(const dispatchEntry_t *entry, uint32_t *size, bool *isCompressed, bool *isFragment);
+static int recvSizeField(uint32_t *sizeField);
+static int recvCompactSizeRest(uint8_t first, uint32_t *sizeField);
+static bool isReassembled(const tables_t *t, const dispatchEntry_t *entry, bool isFragment);
+static int recvFragment(const tables_t *t, const dispatchEntry_t *entry, bool isFragment,
+        void **buffer, uint32_t *size);
+static int recvCompressed(const tables_t *t, const dispatchEntry_t *entry, void *buffer, uint32_t *size);
+static int recvWithKind(const tables_t *t, typeState_t *ts, void *buffer, uint32_t size);
+static int recvDelta(const tables_t *t, typeState_t *ts, void *buffer, uint32_t size);
+static int storeDeltaBase(typeState_t *ts, const void *buffer, uint32_t size);
+static int recvIntoProvided(const tables_t *t, const dispatchEntry_t *entry, uint32_t size,
+        bool isCompressed, bool isFragment);
+static void *acquireProvided(const tables_t *t, const dispatchEntry_t *entry, uint32_t size);
+static void deliverProvided(const tables_t *t, const dispatchEntry_t *entry, void *buffer, uint32_t size);
+static void releaseProvided(const nadam_bufferProvider_t *provider, void *buffer);
+static int recvSpinning(void *dest, uint32_t n);
+static int32_t spinRecvSome(void *dest, uint32_t n);
+static void cpuRelax(void);
+static bool parkRecvThread(void);
+static int createRecvThread(void);
+static int initRecvThreadAttr(pthread_attr_t *attr);
 static void cancelRecvThread(void);
+static void wakeRecvThread(void);
+// capture
+static int captureHandshake(void);
+static void captureFrame(const nadam_messageInfo_t *mi, const void *buffer, uint32_t size);
+static void failCapture(void);
+static int replayAll(const captureReader_t *r, double speed);
+static int replayFiltered(const captureReader_t *r, const uint8_t *hash, double speed);
+static int replayScanFiltered(const captureReader_t *r, const uint8_t *hash, double speed);
+static bool isRecordOfType(const captureRecord_t *record, const uint8_t *hash);
+static int replayRecord(const captureRecord_t *record, uint64_t start, uint64_t firstTimestamp, double speed);
+static void replayPace(uint64_t start, uint64_t firstTimestamp, uint64_t timestamp, double speed);
+static int replayRecv(void *dest, uint32_t n);
+// datagram
+static void closeDatagram(void);
+static int packDatagramFrame(datagramSender_t *s, const nadam_messageInfo_t *mi, const void *msg, uint32_t size);
+static int prepareDatagramRecv(datagramReceiver_t *r);
+static bool isDatagramValid(const tables_t *t, const uint8_t *src, uint32_t length);
+static int deliverDatagram(const tables_t *t, const uint8_t *src, uint32_t length);
+static uint32_t parseDatagramFrame(const tables_t *t, const uint8_t *src, uint32_t length,
+        const dispatchEntry_t **entry, uint32_t *size);
+// multicast
+static void closePublisher(void);
+static void writePublisherHeader(uint8_t *header, void *context);
+static uint64_t makePublisherSession(uint64_t previous);
+static int keepSnapshotValue(typeState_t *ts, const nadam_messageInfo_t *mi, const void *msg);
+static int packSnapshot(const tables_t *t);
+static void closeSubscriber(void);
+static int recvSubscribed(const tables_t *t, const uint8_t *d, uint32_t length);
 
 static nadamMembers_t mbr;
+static pthread_mutex_t latencyLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Readers count themselves per epoch parity. An update publishes the new tables and flips
+   the epoch twice - once both parities drained, no reader can hold the previous tables.
+   Every thread counts in a slot of its own cache line (threads beyond READER_SLOT_COUNT share) -
+   senders and the receive thread don't bounce one line between them.  */
+#define READER_SLOT_COUNT 32
+
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t readers[2];
+} readerSlot_t;
+
+static struct {
+    _Atomic(tables_t *) tables;
+    atomic_uint epoch;
+    atomic_uint slotCount;
+    pthread_mutex_t updateLock;
+    readerSlot_t slots[READER_SLOT_COUNT];
+} generation = { .updateLock = PTHREAD_MUTEX_INITIALIZER };
+
+// an update from inside a read-side section (e.g. a delegate) would wait for itself
+static _Thread_local unsigned readDepth;
+// assigned on the thread's first read
+static _Thread_local readerSlot_t *readerSlot;
+
+/* Every frame is sent under lock. A bulk message holds bulkLock for all its fragments
+   and lets waiting priority senders take lock before each of them.  */
+static struct {
+    pthread_mutex_t lock;
+    pthread_mutex_t bulkLock;
+    atomic_uint priorityWaiting;
+} sending = { .lock = PTHREAD_MUTEX_INITIALIZER, .bulkLock = PTHREAD_MUTEX_INITIALIZER };
+
+static struct {
+    pthread_mutex_t lock;
+    atomic_bool isActive;
+    capture_t *capture;
+    bool hasFailed;
+} capture = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static struct {
+    const uint8_t *src;
+    size_t n;
+} replaySource;
+
+/* Sending is serialized by lock, receiving is up to the single receiving thread.
+   The lock keeps the receiver open for readers of its counts.  */
+static struct {
+    pthread_mutex_t lock;
+    datagramSender_t *sender;
+    datagramReceiver_t *receiver;
+    _Atomic(uint64_t) dropped;
+} datagram = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static struct {
+    pthread_mutex_t lock;
+    datagramSender_t *sender;
+    uint32_t stream;
+    // kept after closing - the next open starts a later one
+    uint64_t session;
+    // of the next data datagram
+    uint64_t sequence;
+    bool hasSnapshot;
+    // datagrams being packed are a snapshot
+    bool isSnapshotting;
+} publisher = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+// lock guards opening, closing and the counts - receiving is up to the single receiving thread
+static struct {
+    pthread_mutex_t lock;
+    datagramReceiver_t *receiver;
+    multicastStreams_t *streams;
+    nadam_gapDelegate_t gapDelegate;
+    _Atomic(uint64_t) lost;
+    _Atomic(uint64_t) dropped;
+} subscriber = { .lock = PTHREAD_MUTEX_INITIALIZER };
 
 // interface functions
 // -----------------------------------------------------------------------------
@@ -81,48 +479,138 @@ int nadam_init(const nadam_messageInfo_t *messageInfos, size_t messageCount, siz
     if (testInitIn(messageCount, hashLengthMin))
         return -1;
 
-    cancelRecvThread();
-    freeMembers();
-    memset(&mbr, 0, sizeof(nadamMembers_t));
+    tables_t *t = makeTables(messageInfos, messageCount);
+    if (t == NULL)
+        return -1;
+
+    typeBlock_t *block;
+    if (fillNameMap(t) || addTypes(t, NULL, &block)) {
+        freeTables(t);
+        return -1;
+    }
+
+    initMembers(t, block, hashLengthMin);
+    return 0;
+}
+
+int nadam_initFromCatalogFile(const char *path) {
+    tables_t *t = makeCatalogTables(path);
+    if (t == NULL)
+        return -1;
+
+    typeBlock_t *block;
+    if (addTypes(t, NULL, &block)) {
+        freeTables(t);
+        return -1;
+    }
+
+    initMembers(t, block, t->catalog.header->hashLength);
+    return 0;
+}
+
+int nadam_makeMessageInfos(nadam_messageInfo_t *messageInfos, size_t messageCount) {
+    if (messageInfos == NULL && messageCount) {
+        errno = NADAM_ERROR_NULL_POINTER;
+        return -1;
+    }
+
+    for (size_t i = 0; i < messageCount; i += SHA1_LANES) {
+        size_t count = messageCount - i < SHA1_LANES ? messageCount - i : SHA1_LANES;
+        if (makeMessageIds(messageInfos + i, count))
+            return -1;
+    }
+    return 0;
+}
+
+int nadam_updateCatalog(const nadam_messageInfo_t *messageInfos, size_t messageCount) {
+    if (messageCount == 0) {
+        errno = NADAM_ERROR_EMPTY_MESSAGE_INFOS;
+        return -1;
+    }
+
+    tables_t *t = makeTables(messageInfos, messageCount);
+    if (t == NULL)
+        return -1;
 
-    mbr.messageInfos = messageInfos;
-    mbr.messageCount = messageCount;
-    mbr.hashLength = hashLengthMin;
+    if (fillNameMap(t)) {
+        freeTables(t);
+        return -1;
+    }
+    return publishTables(t);
+}
 
-    if (allocateMembers())
+int nadam_updateFromCatalogFile(const char *path) {
+    tables_t *t = makeCatalogTables(path);
+    if (t == NULL)
         return -1;
 
-    initDelegates();
-    initMaps();
-    return fillNameMap();
+    return publishTables(t);
 }
 
 int nadam_setDelegate(const char *name, nadam_recvDelegate_t delegate) {
-    return nadam_setDelegateWithRecvBuffer(name, delegate, mbr.commonRecvBuffer, NULL);
+    return setDelegateByName(name, delegate, NULL, NULL);
 }
 
 int nadam_setDelegateWithRecvBuffer(const char *name, nadam_recvDelegate_t delegate,
         void *buffer, volatile bool *recvStart) {
-    size_t index;
-    if (getIndexForName(name, &index))
+    if (delegate && buffer == NULL) {
+        errno = NADAM_ERROR_DELEGATE_BUFFER;
         return -1;
+    }
+
+    return setDelegateByName(name, delegate, buffer, recvStart);
+}
 
-    recvDelegateRelated_t *dp = mbr.delegates + index;
+int nadam_setDelegateByIndex(size_t index, nadam_recvDelegate_t delegate,
+        void *buffer, volatile bool *recvStart) {
+    if (delegate && buffer == NULL) {
+        errno = NADAM_ERROR_DELEGATE_BUFFER;
+        return -1;
+    }
 
-    if (delegate == NULL) {
-        *dp = getDelegateInit();
-        return 0;
+    unsigned epoch;
+    tables_t *t = enterTables(&epoch);
+    int error = testIndex(t, index);
+    if (!error) {
+        setTypeDelegate(t->types[index], delegate, buffer, recvStart);
+        refreshDispatchEntry(t, index);
     }
+    leaveTables(epoch);
+    return error;
+}
 
-    if (buffer == NULL) {
-        errno = NADAM_ERROR_DELEGATE_BUFFER;
+int nadam_setBufferProvider(const char *name, const nadam_bufferProvider_t *provider) {
+    if (provider && provider->acquire == NULL) {
+        errno = NADAM_ERROR_NULL_POINTER;
         return -1;
     }
 
-    dp->recvStart = recvStart ? recvStart : &mbr.nullRecvStart;
-    dp->buffer = buffer;
-    dp->delegate = delegate;
-    return 0;
+    unsigned epoch;
+    tables_t *t = enterTables(&epoch);
+    size_t index;
+    int error = getIndexForName(t, name, &index);
+    if (!error) {
+        t->types[index]->provider = provider ? *provider : (nadam_bufferProvider_t) { NULL, NULL, NULL };
+        refreshDispatchEntry(t, index);
+    }
+    leaveTables(epoch);
+    return error;
+}
+
+int nadam_getMessageInfo(const char *name, nadam_messageInfo_t *dest) {
+    if (dest == NULL) {
+        errno = NADAM_ERROR_NULL_POINTER;
+        return -1;
+    }
+
+    unsigned epoch;
+    tables_t *t = enterTables(&epoch);
+    size_t index;
+    int error = getIndexForName(t, name, &index);
+    if (!error)
+        *dest = t->messageInfos[index];
+    leaveTables(epoch);
+    return error;
 }
 
 int nadam_initiate(nadam_send_t send, nadam_recv_t recv, nadam_errorDelegate_t errorDelegate) {
@@ -134,6 +622,11 @@ int nadam_initiate(nadam_send_t send, nadam_recv_t recv, nadam_errorDelegate_t e
     mbr.send = send;
     mbr.recv = recv;
     mbr.errorDelegate = errorDelegate;
+    if (mbr.isLowLatency && mbr.lowLatency.recvSome) {
+        mbr.recvBlocking = recv;
+        mbr.recv = recvSpinning;
+        mbr.spinNs = mbr.lowLatency.spinNs;
+    }
 
     if (handshakeSendHashLength())
         return -1;
@@ -141,593 +634,5055 @@ int nadam_initiate(nadam_send_t send, nadam_recv_t recv, nadam_errorDelegate_t e
     if (handshakeHandleHashLengthRecv())
         return -1;
 
-    kh_clear(m32, mbr.hashKeyMap);
-    fillHashMap();
+    pthread_mutex_lock(&generation.updateLock);
+    tables_t *t = getTables();
+    int error = allocateFeatureBuffers(t);
+    if (!error) {
+        resetDeltaStates(t);
+        resetFragments(t);
+        updateDispatch(t);
+        if (mbr.isLowLatency)
+            error = prefaultRecvBuffers(t);
+    }
+    pthread_mutex_unlock(&generation.updateLock);
+    if (error)
+        return -1;
+
+    // maps, buffers and the parked receive thread of the previous connection are reused
+    if (mbr.isThreadRunning && atomic_load(&mbr.isThreadParked)) {
+        wakeRecvThread();
+        return 0;
+    }
+
     cancelRecvThread();
-    createRecvThread();
-    return 0;
+    return createRecvThread();
 }
 
 int nadam_send(const char *name, const void *msg, uint32_t size) {
+    unsigned epoch;
+    tables_t *t = enterTables(&epoch);
     size_t index;
-    if (getIndexForName(name, &index))
-        return -1;
-
-    const nadam_messageInfo_t *mi = mbr.messageInfos + index;
-    bool isFixedSize = !mi->size.isVariable;
-    if(isFixedSize)
-        return sendFixedSize(mi, msg);
-    else
-        return sendVariableSize(mi, msg, size);
+    int error = getIndexForName(t, name, &index);
+    if (!error)
+        error = sendByIndex(t, index, msg, size);
+    leaveTables(epoch);
+    return error;
 }
 
 int nadam_sendWin(const char *name, const void *msg, uint32_t size) {
     return nadam_send(name, msg, size); // TODO caching
 }
 
-void nadam_stop(void) {
-    cancelRecvThread();
+int nadam_sendByIndex(size_t index, const void *msg, uint32_t size) {
+    unsigned epoch;
+    tables_t *t = enterTables(&epoch);
+    int error = sendByIndex(t, index, msg, size);
+    leaveTables(epoch);
+    return error;
 }
 
-// private functions
-// -----------------------------------------------------------------------------
-static int testInitIn(size_t infoCount, size_t hashLengthMin) {
-    if (infoCount == 0) {
-        errno = NADAM_ERROR_EMPTY_MESSAGE_INFOS;
+void nadam_setSendFd(int fd) {
+    mbr.sendFd = fd;
+}
+
+int nadam_sendv(const char *name, const struct iovec *parts, int count) {
+    if (parts == NULL && count > 0) {
+        errno = NADAM_ERROR_NULL_POINTER;
         return -1;
     }
 
-    if (hashLengthMin == 0 || hashLengthMin > HASH_LENGTH_MAX) {
-        errno = NADAM_ERROR_MIN_HASH_LENGTH;
+    if (count < 0) {
+        errno = NADAM_ERROR_INVALID_ARGUMENT;
         return -1;
     }
-    return 0;
+
+    unsigned epoch;
+    tables_t *t = enterTables(&epoch);
+    size_t index;
+    int error = getIndexForName(t, name, &index);
+    if (!error)
+        error = sendPartsByIndex(t, index, parts, count);
+    leaveTables(epoch);
+    return error;
 }
 
-static void freeMembers(void) {
-    kh_destroy(mStr, mbr.nameKeyMap);
-    kh_destroy(m32, mbr.hashKeyMap);
-    free(mbr.commonRecvBuffer);
-    free(mbr.delegates);
-    // messageInfos are not ours to free
+int nadam_sendFromFd(const char *name, int fd, off_t offset, uint32_t length) {
+    unsigned epoch;
+    tables_t *t = enterTables(&epoch);
+    size_t index;
+    int error = getIndexForName(t, name, &index);
+    if (!error)
+        error = sendFromFdByIndex(t, index, fd, offset, length);
+    leaveTables(epoch);
+    return error;
 }
 
-static int allocateMembers(void) {
-    // + 1 allows a delegate that uses common buffer to safely do msg[size] = '\0';
-    if (allocate(&mbr.commonRecvBuffer, getMaxMessageSize() + 1)) 
+void nadam_stop(void) {
+    cancelRecvThread();
+}
+
+int nadam_setFeatures(uint32_t features) {
+    if (features & ~(uint32_t) FEATURES_SUPPORTED) {
+        errno = NADAM_ERROR_INVALID_ARGUMENT;
         return -1;
+    }
 
-    if (allocate((void **) &mbr.delegates, sizeof(recvDelegateRelated_t) * mbr.messageCount))
+    mbr.features = features;
+    return 0;
+}
+
+uint32_t nadam_getNegotiatedFeatures(void) {
+    return mbr.negotiatedFeatures;
+}
+
+int nadam_setLimits(const nadam_limits_t *limits) {
+    if (limits == NULL) {
+        errno = NADAM_ERROR_NULL_POINTER;
         return -1;
+    }
 
+    mbr.limits = *limits;
     return 0;
 }
 
-static int allocate(void **dest, size_t size) {
-    *dest = malloc(size);
-    if (*dest == NULL) {
-        errno = NADAM_ERROR_ALLOC_FAILED;
+int nadam_getPeerLimits(nadam_limits_t *dest) {
+    if (dest == NULL) {
+        errno = NADAM_ERROR_NULL_POINTER;
         return -1;
     }
-    memset(*dest, 0, size);
+
+    *dest = mbr.peerLimits;
     return 0;
 }
 
-static uint32_t getMaxMessageSize(void) {
-    uint32_t maxSize = 0;
-    for (size_t i = 0; i < mbr.messageCount; ++i) {
-        uint32_t currentSize = mbr.messageInfos[i].size.total;
-        if (currentSize > maxSize)
-            maxSize = currentSize;
+int nadam_setLowLatency(const nadam_lowLatency_t *config) {
+    if (config && (config->cpu < -1 || config->cpu >= CPU_SETSIZE
+            || config->realtimePriority < 0 || config->realtimePriority > sched_get_priority_max(SCHED_FIFO))) {
+        errno = NADAM_ERROR_INVALID_ARGUMENT;
+        return -1;
     }
-    return maxSize;
+
+    if (mbr.isThreadRunning && !atomic_load(&mbr.isThreadParked)) {
+        errno = NADAM_ERROR_BUSY;
+        return -1;
+    }
+
+    // the next nadam_initiate() creates a thread with the new profile
+    cancelRecvThread();
+    mbr.isLowLatency = config != NULL;
+    if (config)
+        mbr.lowLatency = *config;
+
+    return 0;
 }
 
-static void initDelegates(void) {
-    for (size_t i = 0; i < mbr.messageCount; ++i)
-        mbr.delegates[i] = getDelegateInit();
+uint64_t nadam_timestamp(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
 }
 
-static recvDelegateRelated_t getDelegateInit(void) {
-    recvDelegateRelated_t init = { .delegate = nullDelegate,
-        .buffer = mbr.commonRecvBuffer,
-        .recvStart = &mbr.nullRecvStart };
-    return init;
+uint64_t nadam_getRecvTimestamp(void) {
+    return mbr.recvTimestamp;
 }
 
-static void initMaps(void) {
-    mbr.nameKeyMap = kh_init(mStr);
-    mbr.hashKeyMap = kh_init(m32);
+int nadam_recordRoundTrip(const char *name, uint64_t sendTimestamp) {
+    uint64_t now = nadam_timestamp();
+    unsigned epoch;
+    tables_t *t = enterTables(&epoch);
+    size_t index;
+    int error = getIndexForName(t, name, &index);
+    if (!error) {
+        pthread_mutex_lock(&latencyLock);
+        latencyHistograms_t *lh = getLatencyHistograms(t->types[index]);
+        if (lh)
+            nadam_histogramRecord(&lh->kinds[NADAM_LATENCY_ROUND_TRIP],
+                    now > sendTimestamp ? now - sendTimestamp : 0);
+        pthread_mutex_unlock(&latencyLock);
+
+        if (lh == NULL) {
+            errno = NADAM_ERROR_ALLOC_FAILED;
+            error = -1;
+        }
+    }
+    leaveTables(epoch);
+    return error;
 }
 
-static int fillNameMap(void) {
-    for (size_t i = 0; i < mbr.messageCount; ++i) {
-        int ret;
-        khiter_t k = kh_put(mStr, mbr.nameKeyMap, mbr.messageInfos[i].name, &ret);
-        assert(ret != -1);
+int nadam_getLatencyHistogram(const char *name, nadam_latencyKind_t kind, nadam_histogram_t *dest) {
+    if (dest == NULL) {
+        errno = NADAM_ERROR_NULL_POINTER;
+        return -1;
+    }
 
-        bool keyWasPresent = !ret;
-        if (keyWasPresent) {
-            errno = NADAM_ERROR_NAME_COLLISION;
-            return -1;
-        }
+    if (kind >= NADAM_LATENCY_KIND_COUNT) {
+        errno = NADAM_ERROR_INVALID_ARGUMENT;
+        return -1;
+    }
 
-        kh_val(mbr.nameKeyMap, k) = i;
+    unsigned epoch;
+    tables_t *t = enterTables(&epoch);
+    size_t index;
+    int error = getIndexForName(t, name, &index);
+    if (!error) {
+        pthread_mutex_lock(&latencyLock);
+        const latencyHistograms_t *lh = t->types[index]->latencies;
+        if (lh)
+            copyLatencyHistogram(lh, kind, dest);
+        else
+            nadam_histogramReset(dest);
+        pthread_mutex_unlock(&latencyLock);
     }
-    return 0;
+    leaveTables(epoch);
+    return error;
 }
 
-static void fillHashMap(void) {
-    for (size_t i = 0; i < mbr.messageCount; ++i) {
-        int ret;
-        uint32_t hash = truncateHash(mbr.messageInfos[i].hash);
-        khiter_t k = kh_put(m32, mbr.hashKeyMap, hash, &ret);
-        assert(ret != -1);
+int nadam_setCompression(const char *name, uint32_t minSize) {
+    unsigned epoch;
+    tables_t *t = enterTables(&epoch);
+    size_t index;
+    int error = getIndexForName(t, name, &index);
+    if (!error && !t->messageInfos[index].size.isVariable) {
+        errno = NADAM_ERROR_INVALID_ARGUMENT;
+        error = -1;
+    }
+
+    if (!error)
+        t->types[index]->compressionMinSize = minSize;
+    leaveTables(epoch);
+    return error;
+}
+
+int nadam_setDelta(const char *name, uint32_t fullInterval) {
+    unsigned epoch;
+    tables_t *t = enterTables(&epoch);
+    size_t index;
+    int error = getIndexForName(t, name, &index);
+    if (!error)
+        error = setDelta(t->types[index], t->messageInfos + index, fullInterval);
+    leaveTables(epoch);
+    return error;
+}
 
-        kh_val(mbr.hashKeyMap, k) = i;
+int nadam_requestFullFrame(const char *name) {
+    unsigned epoch;
+    tables_t *t = enterTables(&epoch);
+    size_t index;
+    int error = getIndexForName(t, name, &index);
+    if (!error) {
+        deltaSendState_t *ds = t->types[index]->deltaSendState;
+        if (ds)
+            ds->isFullRequested = true;
     }
+    leaveTables(epoch);
+    return error;
 }
 
-static int getIndexForName(const char *name, size_t *index) {
-    khiter_t k = kh_get(mStr, mbr.nameKeyMap, name);
+int nadam_setLane(const char *name, nadam_lane_t lane) {
+    if (lane != NADAM_LANE_PRIORITY && lane != NADAM_LANE_BULK) {
+        errno = NADAM_ERROR_INVALID_ARGUMENT;
+        return -1;
+    }
 
-    bool nameNotFound = (k == kh_end(mbr.nameKeyMap));
-    if (nameNotFound) {
-        errno = NADAM_ERROR_UNKNOWN_NAME;
+    unsigned epoch;
+    tables_t *t = enterTables(&epoch);
+    size_t index;
+    int error = getIndexForName(t, name, &index);
+    if (!error && lane == NADAM_LANE_BULK && !t->messageInfos[index].size.isVariable) {
+        errno = NADAM_ERROR_INVALID_ARGUMENT;
+        error = -1;
+    }
+
+    if (!error)
+        t->types[index]->isBulk = lane == NADAM_LANE_BULK;
+    leaveTables(epoch);
+    return error;
+}
+
+int nadam_datagramOpen(int fd, uint32_t datagramLength) {
+    if (datagramLength == 0 || datagramLength > DATAGRAM_LENGTH_MAX) {
+        errno = NADAM_ERROR_INVALID_ARGUMENT;
         return -1;
     }
 
-    *index = kh_val(mbr.nameKeyMap, k);
+    pthread_mutex_lock(&datagram.lock);
+    int error = 0;
+    if (datagram.sender) {
+        error = NADAM_ERROR_BUSY;
+    } else {
+        datagram.sender = datagram_openSender(fd, datagramLength);
+        datagram.receiver = datagram_openReceiver(fd, datagramLength);
+        atomic_store(&datagram.dropped, 0);
+        if (datagram.sender == NULL || datagram.receiver == NULL) {
+            closeDatagram();
+            error = NADAM_ERROR_ALLOC_FAILED;
+        }
+    }
+    pthread_mutex_unlock(&datagram.lock);
+
+    if (error) {
+        errno = error;
+        return -1;
+    }
     return 0;
 }
 
-static void nullDelegate(void *msg, uint32_t size, const nadam_messageInfo_t *messageInfo) { }
+void nadam_datagramClose(void) {
+    pthread_mutex_lock(&datagram.lock);
+    closeDatagram();
+    pthread_mutex_unlock(&datagram.lock);
+}
 
-static int handshakeSendHashLength(void) {
-    const uint8_t hashLength = (uint8_t) mbr.hashLength;
-    if (mbr.send(&hashLength, 1)) {
-        errno = NADAM_ERROR_HANDSHAKE_SEND;
+int nadam_datagramSend(const char *name, const void *msg, uint32_t size) {
+    if (msg == NULL) {
+        errno = NADAM_ERROR_NULL_POINTER;
         return -1;
     }
-    return 0;
+
+    unsigned epoch;
+    tables_t *t = enterTables(&epoch);
+    size_t index;
+    int error = getIndexForName(t, name, &index);
+    if (!error) {
+        pthread_mutex_lock(&datagram.lock);
+        error = packDatagramFrame(datagram.sender, t->messageInfos + index, msg, size);
+        pthread_mutex_unlock(&datagram.lock);
+    }
+    leaveTables(epoch);
+    return error;
 }
 
-static int handshakeHandleHashLengthRecv(void) {
-    uint8_t hashLength;
-    if (mbr.recv(&hashLength, 1)) {
-        errno = NADAM_ERROR_HANDSHAKE_RECV;
+int nadam_datagramFlush(void) {
+    pthread_mutex_lock(&datagram.lock);
+    int error = 0;
+    if (datagram.sender == NULL)
+        error = NADAM_ERROR_DATAGRAM;
+    else if (datagram_flush(datagram.sender))
+        error = NADAM_ERROR_SEND;
+    pthread_mutex_unlock(&datagram.lock);
+
+    if (error) {
+        errno = error;
         return -1;
     }
+    return 0;
+}
 
-    if (hashLength > HASH_LENGTH_MAX) {
-        errno = NADAM_ERROR_HANDSHAKE_HASH_LENGTH;
+int nadam_datagramRecv(void) {
+    datagramReceiver_t *r = datagram.receiver;
+    if (r == NULL) {
+        errno = NADAM_ERROR_DATAGRAM;
         return -1;
     }
 
-    if (hashLength > mbr.hashLength)
-        mbr.hashLength = hashLength;
+    int count = prepareDatagramRecv(r);
+    if (count <= 0)
+        return count;
+
+    int delivered = 0;
+    unsigned epoch;
+    const tables_t *t = enterTables(&epoch);
+    const uint8_t *d;
+    uint32_t length;
+    while ((d = datagram_next(r, &length))) {
+        if (isDatagramValid(t, d, length))
+            delivered += deliverDatagram(t, d, length);
+        else
+            atomic_fetch_add(&datagram.dropped, 1);
+    }
+    leaveTables(epoch);
+    return delivered;
+}
 
-    return 0;
+uint64_t nadam_datagramDroppedCount(void) {
+    pthread_mutex_lock(&datagram.lock);
+    datagramReceiver_t *r = datagram.receiver;
+    uint64_t truncated = r ? datagram_truncatedCount(r) : 0;
+    pthread_mutex_unlock(&datagram.lock);
+    return atomic_load(&datagram.dropped) + truncated;
 }
 
-static int sendFixedSize(const nadam_messageInfo_t *mi, const void *msg) {
-    int errorCollector = mbr.send(mi->hash, (uint32_t) mbr.hashLength);
-    errorCollector |= mbr.send(msg, mi->size.total);
+int nadam_publisherOpen(int fd, const nadam_publisherConfig_t *config) {
+    if (config == NULL) {
+        errno = NADAM_ERROR_NULL_POINTER;
+        return -1;
+    }
 
-    if (errorCollector) {
-        errno = NADAM_ERROR_SEND;
+    uint32_t length = config->datagramLength;
+    if (length <= MULTICAST_HEADER_LENGTH || length > DATAGRAM_LENGTH_MAX) {
+        errno = NADAM_ERROR_INVALID_ARGUMENT;
+        return -1;
+    }
+
+    pthread_mutex_lock(&publisher.lock);
+    int error = 0;
+    if (publisher.sender) {
+        error = NADAM_ERROR_BUSY;
+    } else {
+        publisher.sender = datagram_openSender(fd, length);
+        if (publisher.sender == NULL) {
+            error = NADAM_ERROR_ALLOC_FAILED;
+        } else {
+            datagram_setHeader(publisher.sender, MULTICAST_HEADER_LENGTH, writePublisherHeader, NULL);
+            publisher.stream = config->stream;
+            publisher.session = makePublisherSession(publisher.session);
+            publisher.sequence = 0;
+            publisher.hasSnapshot = config->hasSnapshot;
+        }
+    }
+    pthread_mutex_unlock(&publisher.lock);
+
+    if (error) {
+        errno = error;
         return -1;
     }
     return 0;
 }
 
-static int sendVariableSize(const nadam_messageInfo_t *mi, const void *msg, uint32_t size) {
-    if (size > mi->size.max) {
-        errno = NADAM_ERROR_SIZE_ARG;
+void nadam_publisherClose(void) {
+    pthread_mutex_lock(&publisher.lock);
+    closePublisher();
+    pthread_mutex_unlock(&publisher.lock);
+}
+
+int nadam_publish(const char *name, const void *msg, uint32_t size) {
+    if (msg == NULL) {
+        errno = NADAM_ERROR_NULL_POINTER;
         return -1;
     }
-    int errorCollector = mbr.send(mi->hash, (uint32_t) mbr.hashLength);
-    errorCollector |= mbr.send(&size, 4);
-    errorCollector |= mbr.send(msg, size);
 
-    if (errorCollector) {
-        errno = NADAM_ERROR_SEND;
+    unsigned epoch;
+    tables_t *t = enterTables(&epoch);
+    size_t index;
+    int error = getIndexForName(t, name, &index);
+    if (!error) {
+        const nadam_messageInfo_t *mi = t->messageInfos + index;
+        pthread_mutex_lock(&publisher.lock);
+        error = packDatagramFrame(publisher.sender, mi, msg, size);
+        if (!error && publisher.hasSnapshot && !mi->size.isVariable)
+            error = keepSnapshotValue(t->types[index], mi, msg);
+        pthread_mutex_unlock(&publisher.lock);
+    }
+    leaveTables(epoch);
+    return error;
+}
+
+int nadam_publishFlush(void) {
+    pthread_mutex_lock(&publisher.lock);
+    int error = 0;
+    if (publisher.sender == NULL)
+        error = NADAM_ERROR_DATAGRAM;
+    else if (datagram_flush(publisher.sender))
+        error = NADAM_ERROR_SEND;
+    pthread_mutex_unlock(&publisher.lock);
+
+    if (error) {
+        errno = error;
         return -1;
     }
     return 0;
 }
 
-// recv
-static void *recvWorker(void *arg) {
-    uint8_t hash[HASH_LENGTH_MAX];
-    while (true) {
-        if (mbr.recv(hash, (uint32_t) mbr.hashLength)) {
-            mbr.errorDelegate(NADAM_ERROR_RECV);
-            return NULL;
+int nadam_publishSnapshot(void) {
+    unsigned epoch;
+    const tables_t *t = enterTables(&epoch);
+    pthread_mutex_lock(&publisher.lock);
+    int error = 0;
+    if (publisher.sender == NULL)
+        error = NADAM_ERROR_DATAGRAM;
+    else if (!publisher.hasSnapshot)
+        error = NADAM_ERROR_INVALID_ARGUMENT;
+    // the snapshot follows the data published so far
+    else if (datagram_flush(publisher.sender))
+        error = NADAM_ERROR_SEND;
+    else
+        error = packSnapshot(t);
+    pthread_mutex_unlock(&publisher.lock);
+    leaveTables(epoch);
+
+    if (error) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+int nadam_subscriberOpen(int fd, uint32_t datagramLength, nadam_gapDelegate_t gapDelegate) {
+    if (datagramLength <= MULTICAST_HEADER_LENGTH || datagramLength > DATAGRAM_LENGTH_MAX) {
+        errno = NADAM_ERROR_INVALID_ARGUMENT;
+        return -1;
+    }
+
+    pthread_mutex_lock(&subscriber.lock);
+    int error = 0;
+    if (subscriber.receiver) {
+        error = NADAM_ERROR_BUSY;
+    } else {
+        subscriber.receiver = datagram_openReceiver(fd, datagramLength);
+        subscriber.streams = multicast_openStreams();
+        subscriber.gapDelegate = gapDelegate;
+        atomic_store(&subscriber.lost, 0);
+        atomic_store(&subscriber.dropped, 0);
+        if (subscriber.receiver == NULL || subscriber.streams == NULL) {
+            closeSubscriber();
+            error = NADAM_ERROR_ALLOC_FAILED;
+        }
+    }
+    pthread_mutex_unlock(&subscriber.lock);
+
+    if (error) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+void nadam_subscriberClose(void) {
+    pthread_mutex_lock(&subscriber.lock);
+    closeSubscriber();
+    pthread_mutex_unlock(&subscriber.lock);
+}
+
+int nadam_subscriberRecv(void) {
+    datagramReceiver_t *r = subscriber.receiver;
+    if (r == NULL) {
+        errno = NADAM_ERROR_DATAGRAM;
+        return -1;
+    }
+
+    int count = prepareDatagramRecv(r);
+    if (count <= 0)
+        return count;
+
+    int delivered = 0;
+    unsigned epoch;
+    const tables_t *t = enterTables(&epoch);
+    const uint8_t *d;
+    uint32_t length;
+    while ((d = datagram_next(r, &length))) {
+        int n = recvSubscribed(t, d, length);
+        if (n < 0) {
+            delivered = -1;
+            break;
         }
+        delivered += n;
+    }
+    leaveTables(epoch);
+    return delivered;
+}
+
+uint64_t nadam_subscriberLostCount(void) {
+    return atomic_load(&subscriber.lost);
+}
+
+uint64_t nadam_subscriberDroppedCount(void) {
+    pthread_mutex_lock(&subscriber.lock);
+    datagramReceiver_t *r = subscriber.receiver;
+    uint64_t truncated = r ? datagram_truncatedCount(r) : 0;
+    pthread_mutex_unlock(&subscriber.lock);
+    return atomic_load(&subscriber.dropped) + truncated;
+}
+
+int nadam_startCapture(const char *path) {
+    if (path == NULL) {
+        errno = NADAM_ERROR_NULL_POINTER;
+        return -1;
+    }
+
+    pthread_mutex_lock(&capture.lock);
+    int error = 0;
+    if (capture.capture) {
+        error = NADAM_ERROR_BUSY;
+    } else {
+        capture.capture = capture_open(path);
+        capture.hasFailed = false;
+        if (capture.capture == NULL || captureHandshake())
+            error = NADAM_ERROR_CAPTURE;
+    }
+
+    if (!error)
+        atomic_store(&capture.isActive, true);
+    pthread_mutex_unlock(&capture.lock);
+
+    if (error) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+int nadam_stopCapture(void) {
+    pthread_mutex_lock(&capture.lock);
+    atomic_store(&capture.isActive, false);
+    bool hasFailed = capture.hasFailed;
+    if (capture.capture)
+        hasFailed |= (capture_close(capture.capture) != 0);
+    capture.capture = NULL;
+    capture.hasFailed = false;
+    pthread_mutex_unlock(&capture.lock);
+
+    if (hasFailed) {
+        errno = NADAM_ERROR_CAPTURE;
+        return -1;
+    }
+    return 0;
+}
+
+int nadam_replayCapture(const char *path, const char *name, double speed) {
+    if (path == NULL) {
+        errno = NADAM_ERROR_NULL_POINTER;
+        return -1;
+    }
+
+    if (mbr.isThreadRunning) {
+        errno = NADAM_ERROR_BUSY;
+        return -1;
+    }
 
+    uint8_t hash[sizeof(((nadam_messageInfo_t *) NULL)->hash)];
+    if (name) {
+        unsigned epoch;
+        tables_t *t = enterTables(&epoch);
         size_t index;
-        int error = getIndexForHash(hash, &index);
-        if (error) {
-            mbr.errorDelegate(error);
-            return NULL;
+        int error = getIndexForName(t, name, &index);
+        if (!error)
+            memcpy(hash, t->messageInfos[index].hash, sizeof(hash));
+        leaveTables(epoch);
+        if (error)
+            return -1;
+    }
+
+    captureReader_t r;
+    if (capture_openReader(&r, path)) {
+        errno = NADAM_ERROR_CAPTURE;
+        return -1;
+    }
+
+    nadam_recv_t recv = mbr.recv;
+    size_t hashLength = mbr.hashLength;
+    uint32_t negotiatedFeatures = mbr.negotiatedFeatures;
+    uint32_t recvFrameMax = mbr.recvFrameMax;
+    // captured frames are in base protocol form - whole messages, without limits
+    mbr.recv = replayRecv;
+    mbr.negotiatedFeatures = 0;
+    mbr.recvFrameMax = 0;
+
+    int error = name ? replayFiltered(&r, hash, speed) : replayAll(&r, speed);
+
+    mbr.recv = recv;
+    mbr.negotiatedFeatures = negotiatedFeatures;
+    mbr.recvFrameMax = recvFrameMax;
+    pthread_mutex_lock(&generation.updateLock);
+    mbr.hashLength = hashLength;
+    updateDispatch(getTables());
+    pthread_mutex_unlock(&generation.updateLock);
+    capture_closeReader(&r);
+
+    if (error) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+// private functions
+// -----------------------------------------------------------------------------
+static int testInitIn(size_t infoCount, size_t hashLengthMin) {
+    if (infoCount == 0) {
+        errno = NADAM_ERROR_EMPTY_MESSAGE_INFOS;
+        return -1;
+    }
+
+    if (hashLengthMin == 0 || hashLengthMin > HASH_LENGTH_MAX) {
+        errno = NADAM_ERROR_MIN_HASH_LENGTH;
+        return -1;
+    }
+    return 0;
+}
+
+// count is at most SHA1_LANES - the ids are computed side by side
+static int makeMessageIds(nadam_messageInfo_t *messageInfos, size_t count) {
+    size_t inputsLength = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (messageInfos[i].name == NULL) {
+            errno = NADAM_ERROR_NULL_POINTER;
+            return -1;
         }
+        messageInfos[i].nameLength = strlen(messageInfos[i].name);
+        inputsLength += messageInfos[i].nameLength + ID_SUFFIX_LENGTH;
+    }
 
-        const nadam_messageInfo_t *messageInfo = mbr.messageInfos + index;
-        uint32_t size;
-        error = getMessageSize(messageInfo, &size);
-        if (error) {
-            mbr.errorDelegate(error);
-            return NULL;
+    uint8_t stackInputs[ID_INPUTS_STACK_LENGTH];
+    uint8_t *inputs = stackInputs;
+    if (inputsLength > sizeof(stackInputs) && allocate((void **) &inputs, inputsLength))
+        return -1;
+
+    // as MessageInfo in nadam/types.d - size in little-endian
+    const uint8_t *data[SHA1_LANES] = { NULL };
+    size_t lengths[SHA1_LANES] = { 0 };
+    uint8_t *dest = inputs;
+    for (size_t i = 0; i < count; ++i) {
+        const nadam_messageInfo_t *mi = messageInfos + i;
+        memcpy(dest, mi->name, mi->nameLength);
+        dest[mi->nameLength] = mi->size.isVariable;
+        writeLittleEndian32(dest + mi->nameLength + 1, mi->size.total);
+        data[i] = dest;
+        lengths[i] = mi->nameLength + ID_SUFFIX_LENGTH;
+        dest += lengths[i];
+    }
+
+    uint8_t digests[SHA1_LANES][SHA1_DIGEST_LENGTH];
+    sha1_digestLanes(data, lengths, count, digests);
+    for (size_t i = 0; i < count; ++i)
+        memcpy(messageInfos[i].hash, digests[i], sizeof(messageInfos[i].hash));
+
+    if (inputs != stackInputs)
+        free(inputs);
+    return 0;
+}
+
+static void initMembers(tables_t *t, typeBlock_t *block, size_t hashLength) {
+    cancelRecvThread();
+    freeMembers();
+    memset(&mbr, 0, sizeof(nadamMembers_t));
+
+    mbr.hashLength = hashLength;
+    mbr.typeBlocks = block;
+    mbr.fragmentLength = FRAGMENT_LENGTH;
+    mbr.sendFd = -1;
+    // datagrams have no handshake - changes of the hash length update the dispatch themselves
+    fillDispatch(t);
+    atomic_store(&generation.tables, t);
+}
+
+static void freeMembers(void) {
+    freeTables(getTables());
+    atomic_store(&generation.tables, NULL);
+
+    typeBlock_t *block = mbr.typeBlocks;
+    while (block) {
+        for (size_t i = 0; i < block->count; ++i)
+            freeTypeState(block->states + i);
+
+        typeBlock_t *next = block->next;
+        free(block);
+        block = next;
+    }
+}
+
+static int allocate(void **dest, size_t size) {
+    *dest = malloc(size);
+    if (*dest == NULL) {
+        errno = NADAM_ERROR_ALLOC_FAILED;
+        return -1;
+    }
+    memset(*dest, 0, size);
+    return 0;
+}
+
+static uint32_t getMaxMessageSize(const nadam_messageInfo_t *messageInfos, size_t messageCount) {
+    uint32_t maxSize = 0;
+    for (size_t i = 0; i < messageCount; ++i) {
+        uint32_t currentSize = messageInfos[i].size.total;
+        if (currentSize > maxSize)
+            maxSize = currentSize;
+    }
+    return maxSize;
+}
+
+// buffers of negotiated features are kept until nadam_init()
+static int allocateFeatureBuffers(tables_t *t) {
+    if (isNegotiated(NADAM_FEATURE_COMPRESSION) && t->compressSendBuffer == NULL) {
+        // data which doesn't get smaller is sent uncompressed - it fits into the maximum size
+        if (allocate((void **) &t->compressSendBuffer, t->maxMessageSize)
+                || allocate((void **) &t->compressRecvBuffer, t->maxMessageSize))
+            return -1;
+    }
+
+    if (isNegotiated(NADAM_FEATURE_DELTA) && t->deltaSendBuffer == NULL) {
+        if (allocate((void **) &t->deltaSendBuffer, t->maxMessageSize)
+                || allocate((void **) &t->deltaRecvBuffer, t->maxMessageSize))
+            return -1;
+    }
+
+    if (isNegotiated(NADAM_FEATURE_FRAGMENTS) && allocateFragmentBuffers(t))
+        return -1;
+
+    if (isNegotiated(NADAM_FEATURE_TIMESTAMP))
+        return allocateLatencyHistograms(t);
+    return 0;
+}
+
+// reassembling doesn't allocate - not zeroed, pages of unused buffers aren't touched
+static int allocateFragmentBuffers(tables_t *t) {
+    for (size_t i = 0; i < t->messageCount; ++i) {
+        const nadam_messageInfo_t *mi = t->messageInfos + i;
+        typeState_t *ts = t->types[i];
+        if (!mi->size.isVariable || ts->fragmentBuffer)
+            continue;
+
+        // + 1 as in the common buffer
+        ts->fragmentBuffer = malloc((size_t) mi->size.max + 1);
+        if (ts->fragmentBuffer == NULL) {
+            errno = NADAM_ERROR_ALLOC_FAILED;
+            return -1;
         }
+    }
+    return 0;
+}
 
-        const recvDelegateRelated_t *delegate = mbr.delegates + index;
-        void *buffer = delegate->buffer;
-        *delegate->recvStart = true;
-        if (mbr.recv(buffer, size)) {
-            mbr.errorDelegate(NADAM_ERROR_RECV);
-            return NULL;
+// a new connection starts without delta bases on either side
+static void resetDeltaStates(tables_t *t) {
+    for (size_t i = 0; i < t->messageCount; ++i) {
+        typeState_t *ts = t->types[i];
+        if (ts->deltaSendState)
+            ts->deltaSendState->hasLast = false;
+
+        free(ts->deltaBase);
+        ts->deltaBase = NULL;
+    }
+}
+
+// a message left incomplete by the previous connection is dropped
+static void resetFragments(tables_t *t) {
+    for (size_t i = 0; i < t->messageCount; ++i) {
+        typeState_t *ts = t->types[i];
+        if (ts->isFragmentProvided)
+            releaseProvided(&ts->provider, ts->fragmentTarget);
+
+        ts->fragmentTarget = NULL;
+        ts->isFragmentProvided = false;
+    }
+}
+
+// first message shouldn't page-fault: everything the receive path writes is touched in advance
+static int prefaultRecvBuffers(tables_t *t) {
+    if (prefault(t->commonRecvBuffer, t->maxMessageSize + 1))
+        return -1;
+
+    if (t->compressRecvBuffer && prefault(t->compressRecvBuffer, t->maxMessageSize))
+        return -1;
+
+    if (t->deltaRecvBuffer && prefault(t->deltaRecvBuffer, t->maxMessageSize))
+        return -1;
+
+    if (prefault(t->dispatch, t->dispatchCapacity * sizeof(dispatchEntry_t)))
+        return -1;
+
+    for (size_t i = 0; i < t->messageCount; ++i) {
+        const nadam_messageInfo_t *mi = t->messageInfos + i;
+        typeState_t *ts = t->types[i];
+        // total and max share the same storage
+        uint32_t size = mi->size.total;
+        void *buffer = ts->delegate.buffer;
+        if (buffer && prefault(buffer, size))
+            return -1;
+
+        if (ts->latencies && prefault(ts->latencies, sizeof(latencyHistograms_t)))
+            return -1;
+
+        if (isNegotiated(NADAM_FEATURE_DELTA) && !mi->size.isVariable) {
+            if (ts->deltaBase == NULL && allocate((void **) &ts->deltaBase, size))
+                return -1;
+            if (prefault(ts->deltaBase, size))
+                return -1;
         }
 
-        delegate->delegate(buffer, size, messageInfo);
+        // allocated with the feature buffers
+        if (buffer == NULL && ts->fragmentBuffer && prefault(ts->fragmentBuffer, (size_t) size + 1))
+            return -1;
     }
+    return 0;
 }
 
-static int getIndexForHash(const uint8_t *hash, size_t *index) {
-    khiter_t k = kh_get(m32, mbr.hashKeyMap, truncateHash(hash));
+// content is preserved - delegate buffers may hold user data
+static int prefault(void *p, size_t size) {
+    if (mbr.lowLatency.isMemoryLocked && mlock(p, size)) {
+        errno = NADAM_ERROR_LOW_LATENCY;
+        return -1;
+    }
 
-    bool hashNotFound = (k == kh_end(mbr.hashKeyMap));
-    if (hashNotFound)
-        return NADAM_ERROR_UNKNOWN_HASH;
+    volatile uint8_t *bytes = p;
+    uintptr_t pageSize = (uintptr_t) sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t) p;
+    // every page the range reaches - the first one begins before p unless it's aligned
+    for (uintptr_t page = start & ~(pageSize - 1); page < start + size; page += pageSize) {
+        size_t i = page < start ? 0 : page - start;
+        bytes[i] = bytes[i];
+    }
 
-    *index = kh_val(mbr.hashKeyMap, k);
     return 0;
 }
 
-static uint32_t truncateHash(const uint8_t *hash) {
-    uint32_t res = 0;
-    memcpy(&res, hash, mbr.hashLength);
-    return res;
+// buffer NULL - the common receive buffer of the current generation
+static recvDelegateRelated_t getDelegateInit(void) {
+    recvDelegateRelated_t init = { .delegate = nullDelegate,
+        .buffer = NULL,
+        .recvStart = &mbr.nullRecvStart };
+    return init;
 }
 
-static int getMessageSize(const nadam_messageInfo_t *mi, uint32_t *size) {
-    nadam_messageSize_t ms = mi->size;
-    uint32_t s;
-    if (ms.isVariable) {
-        if (mbr.recv(&s, 4))
-            return NADAM_ERROR_RECV;
+static void setTypeDelegate(typeState_t *ts, nadam_recvDelegate_t delegate, void *buffer, volatile bool *recvStart) {
+    if (delegate == NULL) {
+        ts->delegate = getDelegateInit();
+        return;
+    }
 
-        if (s > ms.max)
-            return NADAM_ERROR_VARIABLE_SIZE;
-    } else {
-        s = ms.total;
+    ts->delegate.recvStart = recvStart ? recvStart : &mbr.nullRecvStart;
+    ts->delegate.buffer = buffer;
+    ts->delegate.delegate = delegate;
+}
+
+static int setDelegateByName(const char *name, nadam_recvDelegate_t delegate, void *buffer, volatile bool *recvStart) {
+    unsigned epoch;
+    tables_t *t = enterTables(&epoch);
+    size_t index;
+    int error = getIndexForName(t, name, &index);
+    if (!error) {
+        setTypeDelegate(t->types[index], delegate, buffer, recvStart);
+        refreshDispatchEntry(t, index);
+    }
+    leaveTables(epoch);
+    return error;
+}
+
+static int setDelta(typeState_t *ts, const nadam_messageInfo_t *mi, uint32_t fullInterval) {
+    if (mi->size.isVariable) {
+        errno = NADAM_ERROR_INVALID_ARGUMENT;
+        return -1;
     }
 
-    *size = s;
+    free(ts->deltaSendState);
+    ts->deltaSendState = NULL;
+    if (fullInterval == 0)
+        return 0;
+
+    deltaSendState_t *ds;
+    if (allocate((void **) &ds, sizeof(deltaSendState_t) + mi->size.total))
+        return -1;
+
+    ds->fullInterval = fullInterval;
+    ts->deltaSendState = ds;
     return 0;
 }
 
-static void createRecvThread(void) {
-    assert(!mbr.isThreadRunning);
+// catalog generations
+static tables_t *makeTables(const nadam_messageInfo_t *messageInfos, size_t messageCount) {
+    tables_t *t;
+    if (allocate((void **) &t, sizeof(tables_t)))
+        return NULL;
 
-    int error = pthread_create(&mbr.threadId, NULL, recvWorker, NULL);
-    assert(!error);
-    mbr.isThreadRunning = true;
+    t->messageInfos = messageInfos;
+    t->messageCount = messageCount;
+    t->maxMessageSize = getMaxMessageSize(messageInfos, messageCount);
+    initMaps(t);
+
+    // + 1 allows a delegate that uses common buffer to safely do msg[size] = '\0';
+    if (allocate(&t->commonRecvBuffer, t->maxMessageSize + 1)
+            || allocate((void **) &t->types, sizeof(typeState_t *) * messageCount)
+            || allocateDispatch(t)) {
+        freeTables(t);
+        return NULL;
+    }
+    return t;
 }
 
-static void cancelRecvThread(void) {
-    if (!mbr.isThreadRunning)
+static tables_t *makeCatalogTables(const char *path) {
+    catalog_t catalog;
+    if (catalog_open(&catalog, path)) {
+        errno = NADAM_ERROR_CATALOG;
+        return NULL;
+    }
+
+    nadam_messageInfo_t *infos = makeCatalogInfos(&catalog);
+    tables_t *t = infos ? makeTables(infos, catalog.header->messageCount) : NULL;
+    if (t == NULL) {
+        free(infos);
+        catalog_close(&catalog);
+        errno = NADAM_ERROR_ALLOC_FAILED;
+        return NULL;
+    }
+
+    t->hasCatalog = true;
+    t->catalog = catalog;
+    t->catalogInfos = infos;
+    return t;
+}
+
+// names point into the mapped name pool
+static nadam_messageInfo_t *makeCatalogInfos(const catalog_t *catalog) {
+    size_t count = catalog->header->messageCount;
+    nadam_messageInfo_t *infos = malloc(count * sizeof(nadam_messageInfo_t));
+    if (infos == NULL)
+        return NULL;
+
+    for (size_t i = 0; i < count; ++i) {
+        const catalogEntry_t *entry = catalog->entries + i;
+        infos[i].name = catalog->names + entry->nameOffset;
+        infos[i].nameLength = entry->nameLength;
+        infos[i].size.isVariable = entry->isVariable;
+        infos[i].size.max = entry->size;
+        memcpy(infos[i].hash, entry->hash, sizeof(infos[i].hash));
+    }
+    return infos;
+}
+
+// type states are owned by the type blocks
+static void freeTables(tables_t *t) {
+    if (t == NULL)
         return;
 
-    int error = pthread_cancel(mbr.threadId);
-    assert(!error);
-    error = pthread_join(mbr.threadId, NULL);
-    assert(!error);
-    mbr.isThreadRunning = false;
+    kh_destroy(mStr, t->nameKeyMap);
+    free(t->dispatch);
+    free(t->dispatchIds);
+    free(t->types);
+    free(t->commonRecvBuffer);
+    free(t->compressSendBuffer);
+    free(t->compressRecvBuffer);
+    free(t->deltaSendBuffer);
+    free(t->deltaRecvBuffer);
+    // messageInfos are not ours to free - unless they were made for a catalog
+    free(t->catalogInfos);
+    if (t->hasCatalog)
+        catalog_close(&t->catalog);
+    free(t);
 }
 
-// unittest
-// -----------------------------------------------------------------------------
-#ifdef UNITTEST
-// nadam_init
-int initWithPlausibleArgs(void) {
-    nadam_messageInfo_t infos[] = { { .name = "foo" }, 
-        { .name = "funhun" } };
-    errno = 0;
-    ASSERT(!nadam_init(infos, 2, 4));
-    ASSERT(!errno);
-    return 0;
+static void freeTypeState(typeState_t *ts) {
+    free(ts->latencies);
+    free(ts->deltaSendState);
+    free(ts->deltaBase);
+    free(ts->fragmentBuffer);
+    free(ts->snapshot);
 }
 
-int initWithEmptyMessageInfos(void) {
-    errno = 0;
-    ASSERT(nadam_init(NULL, 0, 4));
-    ASSERT(errno == NADAM_ERROR_EMPTY_MESSAGE_INFOS);
+/* Types of the previous generation keep their state (delegate, settings, delta bases) -
+   the new catalog has to contain every one of them unchanged. Other types get a new state.  */
+static int addTypes(tables_t *t, const tables_t *previous, typeBlock_t **block) {
+    *block = NULL;
+    size_t keptCount = 0;
+    if (previous) {
+        for (size_t i = 0; i < previous->messageCount; ++i) {
+            const nadam_messageInfo_t *mi = previous->messageInfos + i;
+            size_t index;
+            if (getIndexForName(t, mi->name, &index) || !isSameType(mi, t->messageInfos + index)) {
+                errno = NADAM_ERROR_CATALOG_UPDATE;
+                return -1;
+            }
+            t->types[index] = previous->types[i];
+        }
+        keptCount = previous->messageCount;
+    }
+
+    size_t count = t->messageCount - keptCount;
+    if (count == 0)
+        return 0;
+
+    if (allocate((void **) block, sizeof(typeBlock_t) + count * sizeof(typeState_t)))
+        return -1;
+
+    (*block)->count = count;
+    typeState_t *ts = (*block)->states;
+    for (size_t i = 0; i < t->messageCount; ++i) {
+        if (t->types[i])
+            continue;
+
+        ts->delegate = getDelegateInit();
+        t->types[i] = ts++;
+    }
     return 0;
 }
 
-int initWithWrongHashLength(void) {
-    nadam_messageInfo_t info = { .name = "foo" };
-    errno = 0;
-    ASSERT(nadam_init(&info, 1, 0));
-    ASSERT(errno == NADAM_ERROR_MIN_HASH_LENGTH);
-    errno = 0;
-    ASSERT(nadam_init(&info, 1, 9));
-    ASSERT(errno == NADAM_ERROR_MIN_HASH_LENGTH);
+static bool isSameType(const nadam_messageInfo_t *a, const nadam_messageInfo_t *b) {
+    return a->size.isVariable == b->size.isVariable && a->size.total == b->size.total
+        && memcmp(a->hash, b->hash, sizeof(a->hash)) == 0;
+}
+
+// takes ownership of t; the previous tables are freed after all their readers left
+static int publishTables(tables_t *t) {
+    if (readDepth) {
+        freeTables(t);
+        errno = NADAM_ERROR_BUSY;
+        return -1;
+    }
+
+    pthread_mutex_lock(&generation.updateLock);
+    tables_t *previous = getTables();
+    typeBlock_t *block = NULL;
+    int error = 0;
+    if (previous == NULL) {
+        errno = NADAM_ERROR_CATALOG_UPDATE;
+        error = -1;
+    }
+
+    if (!error)
+        error = addTypes(t, previous, &block);
+
+    // ids of the new types have to be unique at the negotiated hash length
+    if (!error && updateDispatch(t)) {
+        errno = NADAM_ERROR_CATALOG_UPDATE;
+        error = -1;
+    }
+
+    if (!error)
+        error = allocateFeatureBuffers(t);
+
+    if (error) {
+        pthread_mutex_unlock(&generation.updateLock);
+        free(block);
+        freeTables(t);
+        return -1;
+    }
+
+    if (block) {
+        block->next = mbr.typeBlocks;
+        mbr.typeBlocks = block;
+    }
+
+    atomic_store(&generation.tables, t);
+    waitForReaders();
+    // delegates set through the previous tables in the meantime
+    refreshDispatch(t);
+    freeTables(previous);
+    pthread_mutex_unlock(&generation.updateLock);
+    return 0;
+}
+
+/* A reader, which read the epoch before the previous update's flips, could have
+   counted itself to either parity - waiting for the current one only isn't enough.  */
+static void waitForReaders(void) {
+    for (int flip = 0; flip < 2; ++flip) {
+        unsigned parity = atomic_fetch_add(&generation.epoch, 1) & 1;
+        for (size_t i = 0; i < READER_SLOT_COUNT; ++i) {
+            while (atomic_load(&generation.slots[i].readers[parity]))
+                sched_yield();
+        }
+    }
+}
+
+// control path - callers don't run concurrently with updates
+static tables_t *getTables(void) {
+    return atomic_load(&generation.tables);
+}
+
+/* Read-side section without a lock: the tables stay valid until leaveTables().
+   The tables are read after the reader counted itself - an update either waits for it,
+   or the reader sees the new tables.  */
+static tables_t *enterTables(unsigned *epoch) {
+    if (readerSlot == NULL)
+        readerSlot = &generation.slots[atomic_fetch_add(&generation.slotCount, 1) % READER_SLOT_COUNT];
+
+    *epoch = atomic_load(&generation.epoch) & 1;
+    atomic_fetch_add(&readerSlot->readers[*epoch], 1);
+    ++readDepth;
+    return atomic_load(&generation.tables);
+}
+
+static void leaveTables(unsigned epoch) {
+    --readDepth;
+    atomic_fetch_sub(&readerSlot->readers[epoch], 1);
+}
+
+static void leaveTablesOnCancel(void *epoch) {
+    leaveTables(*(unsigned *) epoch);
+}
+
+static void initMaps(tables_t *t) {
+    t->nameKeyMap = kh_init(mStr);
+}
+
+static int fillNameMap(tables_t *t) {
+    for (size_t i = 0; i < t->messageCount; ++i) {
+        int ret;
+        khiter_t k = kh_put(mStr, t->nameKeyMap, t->messageInfos[i].name, &ret);
+        assert(ret != -1);
+
+        bool keyWasPresent = !ret;
+        if (keyWasPresent) {
+            errno = NADAM_ERROR_NAME_COLLISION;
+            return -1;
+        }
+
+        kh_val(t->nameKeyMap, k) = i;
+    }
+    return 0;
+}
+
+static int allocateDispatch(tables_t *t) {
+    size_t capacity = 2;
+    while (capacity < t->messageCount * 2)
+        capacity *= 2;
+    // a lookup in a table this small costs its probes rather than cache misses
+    while (t->messageCount > ID_MATCH_COUNT_MAX && capacity < t->messageCount * DISPATCH_SPARSE_LOAD_DIVISOR
+            && capacity * 2 * sizeof(dispatchEntry_t) <= DISPATCH_SPARSE_SIZE_MAX)
+        capacity *= 2;
+
+    t->dispatch = aligned_alloc(CACHE_LINE_SIZE, capacity * sizeof(dispatchEntry_t));
+    if (t->dispatch == NULL) {
+        errno = NADAM_ERROR_ALLOC_FAILED;
+        return -1;
+    }
+
+    t->dispatchCapacity = capacity;
+    for (size_t i = 0; i < capacity; ++i)
+        t->dispatch[i].index = DISPATCH_EMPTY;
+
+    if (t->messageCount > ID_MATCH_COUNT_MAX)
+        return 0;
+
+    // whole groups are compared - padding is zeroed to keep the reads defined
+    size_t idsSize = IDMATCH_PADDED_COUNT(t->messageCount > 0 ? t->messageCount : 1) * sizeof(uint32_t);
+    t->dispatchIds = aligned_alloc(IDMATCH_ALIGNMENT, idsSize);
+    if (t->dispatchIds == NULL) {
+        errno = NADAM_ERROR_ALLOC_FAILED;
+        return -1;
+    }
+    memset(t->dispatchIds, 0, idsSize);
+    return 0;
+}
+
+// for the negotiated hash length - returns -1 if truncated ids collide (the later type wins)
+static int fillDispatch(tables_t *t) {
+    for (size_t i = 0; i < t->dispatchCapacity; ++i)
+        t->dispatch[i].index = DISPATCH_EMPTY;
+
+    t->dispatchHashLength = mbr.hashLength;
+    t->dispatchIdCount = 0;
+    int collision = 0;
+    for (size_t i = 0; i < t->messageCount; ++i) {
+        const nadam_messageInfo_t *mi = t->messageInfos + i;
+        uint32_t id = truncateHash(mi->hash);
+        dispatchEntry_t *entry = findDispatchSlot(t, id);
+        if (entry->index != DISPATCH_EMPTY)
+            collision = -1;
+        else if (t->dispatchIds)
+            t->dispatchIds[t->dispatchIdCount++] = id;
+
+        entry->id = id;
+        entry->index = (uint32_t) i;
+        // total and max share the same storage
+        entry->size = mi->size.total;
+        entry->isVariable = mi->size.isVariable;
+        setDispatchDelegate(t, entry);
+    }
+    return collision;
+}
+
+static int updateDispatch(tables_t *t) {
+    if (t->dispatchHashLength == mbr.hashLength)
+        return 0;
+
+    return fillDispatch(t);
+}
+
+// entry of the id or the empty slot, where it belongs
+static dispatchEntry_t *findDispatchSlot(const tables_t *t, uint32_t id) {
+    if (t->dispatchIds) {
+        int position = idmatch_find(t->dispatchIds, t->dispatchIdCount, id);
+        return t->dispatch + (position < 0 ? t->dispatchIdCount : (uint32_t) position);
+    }
+
+    size_t mask = t->dispatchCapacity - 1;
+    size_t slot = catalog_hashId(id) & mask;
+    for (; t->dispatch[slot].index != DISPATCH_EMPTY; slot = (slot + 1) & mask) {
+        if (t->dispatch[slot].id == id)
+            break;
+    }
+    return t->dispatch + slot;
+}
+
+static void setDispatchDelegate(const tables_t *t, dispatchEntry_t *entry) {
+    const typeState_t *ts = getEntryState(t, entry);
+    entry->delegate = ts->delegate.delegate;
+    entry->buffer = ts->delegate.buffer ? ts->delegate.buffer : t->commonRecvBuffer;
+    entry->hasRecvStart = ts->delegate.recvStart != &mbr.nullRecvStart;
+    entry->hasProvider = ts->provider.acquire != NULL;
+}
+
+static typeState_t *getEntryState(const tables_t *t, const dispatchEntry_t *entry) {
+    return t->types[entry->index];
+}
+
+static const nadam_messageInfo_t *getEntryInfo(const tables_t *t, const dispatchEntry_t *entry) {
+    return t->messageInfos + entry->index;
+}
+
+static void setRecvStart(const tables_t *t, const dispatchEntry_t *entry) {
+    if (entry->hasRecvStart)
+        *getEntryState(t, entry)->delegate.recvStart = true;
+}
+
+static void refreshDispatchEntry(const tables_t *t, size_t index) {
+    if (t->dispatchHashLength == 0)
+        return;
+
+    uint32_t id = truncateHashToLength(t->messageInfos[index].hash, t->dispatchHashLength);
+    dispatchEntry_t *entry = findDispatchSlot(t, id);
+    // a colliding type might have taken the slot
+    if (entry->index == index)
+        setDispatchDelegate(t, entry);
+}
+
+// the receive thread may already read the entries - only the ones changed meanwhile are written
+static void refreshDispatch(const tables_t *t) {
+    for (size_t i = 0; i < t->dispatchCapacity; ++i) {
+        dispatchEntry_t *entry = t->dispatch + i;
+        if (entry->index == DISPATCH_EMPTY)
+            continue;
+
+        dispatchEntry_t current = *entry;
+        setDispatchDelegate(t, &current);
+        if (current.delegate != entry->delegate || current.buffer != entry->buffer
+                || current.hasRecvStart != entry->hasRecvStart || current.hasProvider != entry->hasProvider)
+            setDispatchDelegate(t, entry);
+    }
+}
+
+static int getIndexForName(const tables_t *t, const char *name, size_t *index) {
+    if (t->hasCatalog) {
+        if (catalog_findName(&t->catalog, name, index)) {
+            errno = NADAM_ERROR_UNKNOWN_NAME;
+            return -1;
+        }
+        return 0;
+    }
+
+    khiter_t k = kh_get(mStr, t->nameKeyMap, name);
+
+    bool nameNotFound = (k == kh_end(t->nameKeyMap));
+    if (nameNotFound) {
+        errno = NADAM_ERROR_UNKNOWN_NAME;
+        return -1;
+    }
+
+    *index = kh_val(t->nameKeyMap, k);
+    return 0;
+}
+
+static int testIndex(const tables_t *t, size_t index) {
+    if (index >= t->messageCount) {
+        errno = NADAM_ERROR_UNKNOWN_NAME;
+        return -1;
+    }
+    return 0;
+}
+
+static void nullDelegate(void *msg, uint32_t size, const nadam_messageInfo_t *messageInfo) { }
+
+static int handshakeSendHashLength(void) {
+    uint8_t handshake[2 + HANDSHAKE_EXTENSION_LENGTH];
+    handshake[0] = (uint8_t) mbr.hashLength;
+    uint32_t handshakeLength = 1;
+    if (mbr.features || mbr.limits.frameMax || mbr.limits.batchPreferred) {
+        handshake[0] |= HANDSHAKE_EXTENDED;
+        handshake[1] = HANDSHAKE_EXTENSION_LENGTH;
+        writeLittleEndian32(handshake + 2, mbr.features);
+        writeLittleEndian32(handshake + 6, mbr.limits.frameMax);
+        writeLittleEndian32(handshake + 10, mbr.limits.batchPreferred);
+        handshakeLength += 1 + HANDSHAKE_EXTENSION_LENGTH;
+    }
+
+    if (mbr.send(handshake, handshakeLength)) {
+        errno = NADAM_ERROR_HANDSHAKE_SEND;
+        return -1;
+    }
+    return 0;
+}
+
+static int handshakeHandleHashLengthRecv(void) {
+    uint8_t handshake;
+    if (mbr.recv(&handshake, 1)) {
+        errno = NADAM_ERROR_HANDSHAKE_RECV;
+        return -1;
+    }
+
+    uint8_t hashLength = handshake & (uint8_t) ~HANDSHAKE_EXTENDED;
+    if (hashLength > HASH_LENGTH_MAX) {
+        errno = NADAM_ERROR_HANDSHAKE_HASH_LENGTH;
+        return -1;
+    }
+
+    uint32_t peerFeatures = 0;
+    bool hasLimits = false;
+    bool isExtended = handshake & HANDSHAKE_EXTENDED;
+    if (isExtended && handshakeRecvExtension(&peerFeatures, &hasLimits))
+        return -1;
+
+    mbr.negotiatedFeatures = mbr.features & peerFeatures;
+    applyPeerLimits(hasLimits);
+
+    if (hashLength > mbr.hashLength)
+        mbr.hashLength = hashLength;
+
+    mbr.peerHandshake = handshake;
+    if (atomic_load(&capture.isActive)) {
+        pthread_mutex_lock(&capture.lock);
+        if (capture.capture && captureHandshake())
+            failCapture();
+        pthread_mutex_unlock(&capture.lock);
+    }
+    return 0;
+}
+
+static int handshakeRecvExtension(uint32_t *peerFeatures, bool *hasLimits) {
+    uint8_t length;
+    if (mbr.recv(&length, 1)) {
+        errno = NADAM_ERROR_HANDSHAKE_RECV;
+        return -1;
+    }
+
+    if (length < HANDSHAKE_FEATURES_LENGTH) {
+        errno = NADAM_ERROR_HANDSHAKE_EXTENSION;
+        return -1;
+    }
+
+    // trailing bytes are reserved for future extensions - received and ignored
+    uint8_t extension[UINT8_MAX];
+    if (mbr.recv(extension, length)) {
+        errno = NADAM_ERROR_HANDSHAKE_RECV;
+        return -1;
+    }
+
+    *peerFeatures = readLittleEndian32(extension);
+    *hasLimits = length >= HANDSHAKE_EXTENSION_LENGTH;
+    if (*hasLimits) {
+        mbr.peerLimits.frameMax = readLittleEndian32(extension + 4);
+        mbr.peerLimits.batchPreferred = readLittleEndian32(extension + 8);
+    }
+    return 0;
+}
+
+// fragments fit the peer's frames; own frameMax is enforced only if the peer knows it
+static void applyPeerLimits(bool hasLimits) {
+    if (!hasLimits)
+        mbr.peerLimits = (nadam_limits_t) { 0 };
+
+    uint32_t frameMax = mbr.peerLimits.frameMax;
+    mbr.fragmentLength = frameMax && frameMax < FRAGMENT_LENGTH ? frameMax : FRAGMENT_LENGTH;
+    mbr.recvFrameMax = hasLimits ? mbr.limits.frameMax : 0;
+}
+
+static void writeLittleEndian32(uint8_t *dest, uint32_t val) {
+    for (size_t i = 0; i < 4; ++i)
+        dest[i] = (uint8_t) (val >> (i * 8));
+}
+
+static uint32_t readLittleEndian32(const uint8_t *src) {
+    uint32_t val = 0;
+    for (size_t i = 0; i < 4; ++i)
+        val |= (uint32_t) src[i] << (i * 8);
+    return val;
+}
+
+static bool isNegotiated(uint32_t feature) {
+    return mbr.negotiatedFeatures & feature;
+}
+
+static int sendByIndex(const tables_t *t, size_t index, const void *msg, uint32_t size) {
+    if (testIndex(t, index))
+        return -1;
+
+    if (t->types[index]->isBulk)
+        return sendBulk(t, index, msg, size);
+
+    atomic_fetch_add(&sending.priorityWaiting, 1);
+    pthread_mutex_lock(&sending.lock);
+    atomic_fetch_sub(&sending.priorityWaiting, 1);
+    int error = sendFrame(t, index, msg, size);
+    pthread_mutex_unlock(&sending.lock);
+    return error;
+}
+
+// caller has to hold sending.lock
+static int sendFrame(const tables_t *t, size_t index, const void *msg, uint32_t size) {
+    bool isFixedSize = !t->messageInfos[index].size.isVariable;
+    if(isFixedSize)
+        return sendFixedSize(t, index, msg);
+    else
+        return sendVariableSize(t, index, msg, size);
+}
+
+static int sendFixedSize(const tables_t *t, size_t index, const void *msg) {
+    if (isNegotiated(NADAM_FEATURE_DELTA))
+        return sendFixedSizeWithKind(t, index, msg);
+
+    const nadam_messageInfo_t *mi = t->messageInfos + index;
+    int errorCollector = sendHeader(mi);
+    errorCollector |= mbr.send(msg, mi->size.total);
+
+    if (errorCollector) {
+        errno = NADAM_ERROR_SEND;
+        return -1;
+    }
+    return 0;
+}
+
+static int sendVariableSize(const tables_t *t, size_t index, const void *msg, uint32_t size) {
+    const nadam_messageInfo_t *mi = t->messageInfos + index;
+    uint32_t frameMax = mbr.peerLimits.frameMax;
+    if (size > mi->size.max || (frameMax && size > frameMax) || !fitsSizeField(size)) {
+        errno = NADAM_ERROR_SIZE_ARG;
+        return -1;
+    }
+
+    if (shouldCompress(t->types[index], size)) {
+        int ret = sendCompressed(t, mi, msg, size);
+        bool isIncompressible = (ret == 1);
+        if (!isIncompressible)
+            return ret;
+    }
+
+    int errorCollector = sendHeader(mi);
+    errorCollector |= sendSizeField(size);
+    errorCollector |= mbr.send(msg, size);
+
+    if (errorCollector) {
+        errno = NADAM_ERROR_SEND;
+        return -1;
+    }
+    return 0;
+}
+
+// size of a body sent in pieces - the size argument of a fixed size message isn't ignored
+static int testBodySize(const nadam_messageInfo_t *mi, uint64_t size) {
+    uint32_t frameMax = mbr.peerLimits.frameMax;
+    bool isSizeValid = mi->size.isVariable
+        ? size <= mi->size.max && !(frameMax && size > frameMax)
+        : size == mi->size.total;
+    if (!isSizeValid) {
+        errno = NADAM_ERROR_SIZE_ARG;
+        return -1;
+    }
+    return 0;
+}
+
+// size of a body sent as a single frame
+static int testSizeField(const nadam_messageInfo_t *mi, uint32_t size) {
+    if (mi->size.isVariable && !fitsSizeField(size)) {
+        errno = NADAM_ERROR_SIZE_ARG;
+        return -1;
+    }
+    return 0;
+}
+
+// the flags of the negotiated features take the high bits of the size field - sizes reaching them would be misread
+static bool fitsSizeField(uint32_t size) {
+    if (isNegotiated(NADAM_FEATURE_FRAGMENTS))
+        return size < SIZE_FRAGMENT_FLAG;
+    return !isNegotiated(NADAM_FEATURE_COMPRESSION) || size < SIZE_COMPRESSED_FLAG;
+}
+
+// no negotiated feature transforms the body - it can go to the connection in pieces
+static bool isBodySentAsIs(const tables_t *t, size_t index, uint32_t size) {
+    const typeState_t *ts = t->types[index];
+    if (!t->messageInfos[index].size.isVariable)
+        return !isNegotiated(NADAM_FEATURE_DELTA);
+
+    return !shouldCompress(ts, size) && !(ts->isBulk && shouldFragment(size));
+}
+
+// as sendByIndex() for a frame, which isn't fragmented
+static void lockSending(bool isBulk) {
+    if (isBulk) {
+        pthread_mutex_lock(&sending.bulkLock);
+        waitForPriority();
+        pthread_mutex_lock(&sending.lock);
+        return;
+    }
+
+    atomic_fetch_add(&sending.priorityWaiting, 1);
+    pthread_mutex_lock(&sending.lock);
+    atomic_fetch_sub(&sending.priorityWaiting, 1);
+}
+
+static void unlockSending(bool isBulk) {
+    pthread_mutex_unlock(&sending.lock);
+    if (isBulk)
+        pthread_mutex_unlock(&sending.bulkLock);
+}
+
+static int sendFromFdByIndex(const tables_t *t, size_t index, int fd, off_t offset, uint32_t length) {
+    if (testIndex(t, index))
+        return -1;
+
+    const nadam_messageInfo_t *mi = t->messageInfos + index;
+    if (testBodySize(mi, length))
+        return -1;
+
+    // once the header is sent, the body has to follow
+    if (testFileLength(fd, offset, length))
+        return -1;
+
+    if (mbr.sendFd < 0 || !isBodySentAsIs(t, index, length))
+        return sendFileCopy(t, index, fd, offset, length);
+
+    if (testSizeField(mi, length))
+        return -1;
+
+    bool isBulk = t->types[index]->isBulk;
+    lockSending(isBulk);
+    int error = sendFileFrame(mi, fd, offset, length);
+    unlockSending(isBulk);
+    return error;
+}
+
+static int testFileLength(int fd, off_t offset, uint32_t length) {
+    struct stat st;
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode) || offset < 0 || st.st_size - offset < (off_t) length) {
+        errno = NADAM_ERROR_FILE;
+        return -1;
+    }
+    return 0;
+}
+
+// caller has to hold sending.lock
+static int sendFileFrame(const nadam_messageInfo_t *mi, int fd, off_t offset, uint32_t length) {
+    int errorCollector = sendHeader(mi);
+    if (mi->size.isVariable)
+        errorCollector |= sendSizeField(length);
+    if (!errorCollector)
+        errorCollector = sendFileBody(fd, offset, length);
+
+    if (errorCollector) {
+        errno = NADAM_ERROR_SEND;
+        return -1;
+    }
+    return 0;
+}
+
+/* sendfile() splices the pages to a socket or pipe. Descriptors it doesn't support
+   get the rest of the body through the send function.  */
+static int sendFileBody(int fd, off_t offset, uint32_t length) {
+    while (length) {
+        ssize_t n = sendfile(mbr.sendFd, fd, &offset, length);
+        if (n > 0) {
+            length -= (uint32_t) n;
+            continue;
+        }
+
+        // the file was truncated meanwhile
+        if (n == 0)
+            return -1;
+
+        if (errno == EINTR)
+            continue;
+
+        if (errno == EAGAIN) {
+            struct pollfd pfd = { .fd = mbr.sendFd, .events = POLLOUT };
+            poll(&pfd, 1, -1);
+            continue;
+        }
+
+        if (errno == EINVAL || errno == ENOSYS)
+            return copyFileBody(fd, offset, length);
+        return -1;
+    }
+    return 0;
+}
+
+static int copyFileBody(int fd, off_t offset, uint32_t length) {
+    uint8_t chunk[FILE_CHUNK_LENGTH];
+    while (length) {
+        size_t n = length < sizeof(chunk) ? length : sizeof(chunk);
+        ssize_t r = pread(fd, chunk, n, offset);
+        if (r < 0 && errno == EINTR)
+            continue;
+
+        if (r <= 0 || mbr.send(chunk, (uint32_t) r))
+            return -1;
+
+        offset += r;
+        length -= (uint32_t) r;
+    }
+    return 0;
+}
+
+// whole body in memory - the regular send path applies the features
+static int sendFileCopy(const tables_t *t, size_t index, int fd, off_t offset, uint32_t length) {
+    uint8_t *body;
+    if (allocate((void **) &body, length ? length : 1))
+        return -1;
+
+    int error = 0;
+    for (uint32_t done = 0; done < length && !error;) {
+        ssize_t r = pread(fd, body + done, length - done, offset + done);
+        if (r < 0 && errno == EINTR)
+            continue;
+
+        if (r <= 0) {
+            errno = NADAM_ERROR_FILE;
+            error = -1;
+        } else {
+            done += (uint32_t) r;
+        }
+    }
+
+    if (!error)
+        error = sendByIndex(t, index, body, length);
+    free(body);
+    return error;
+}
+
+static int sendPartsByIndex(const tables_t *t, size_t index, const struct iovec *parts, int count) {
+    if (testIndex(t, index))
+        return -1;
+
+    uint64_t size = 0;
+    for (int i = 0; i < count; ++i) {
+        if (parts[i].iov_base == NULL && parts[i].iov_len) {
+            errno = NADAM_ERROR_NULL_POINTER;
+            return -1;
+        }
+        size += parts[i].iov_len;
+    }
+
+    const nadam_messageInfo_t *mi = t->messageInfos + index;
+    if (testBodySize(mi, size))
+        return -1;
+
+    if (!isBodySentAsIs(t, index, (uint32_t) size))
+        return sendPartsAssembled(t, index, parts, count, (uint32_t) size);
+
+    if (testSizeField(mi, (uint32_t) size))
+        return -1;
+
+    bool isBulk = t->types[index]->isBulk;
+    lockSending(isBulk);
+    int error = sendPartsFrame(mi, parts, count, (uint32_t) size);
+    unlockSending(isBulk);
+    return error;
+}
+
+// caller has to hold sending.lock
+static int sendPartsFrame(const nadam_messageInfo_t *mi, const struct iovec *parts, int count, uint32_t size) {
+    int errorCollector;
+    if (mbr.sendFd >= 0 && count < SENDV_PARTS_MAX) {
+        errorCollector = writePartsFrame(mi, parts, count, size);
+    } else {
+        errorCollector = sendHeader(mi);
+        if (mi->size.isVariable)
+            errorCollector |= sendSizeField(size);
+        for (int i = 0; i < count && !errorCollector; ++i) {
+            if (parts[i].iov_len)
+                errorCollector = mbr.send(parts[i].iov_base, (uint32_t) parts[i].iov_len);
+        }
+    }
+
+    if (errorCollector) {
+        errno = NADAM_ERROR_SEND;
+        return -1;
+    }
+    return 0;
+}
+
+// the whole frame with a single writev, unless the connection takes it partially
+static int writePartsFrame(const nadam_messageInfo_t *mi, const struct iovec *parts, int count, uint32_t size) {
+    uint8_t header[FRAME_HEADER_LENGTH_MAX];
+    struct iovec iov[SENDV_PARTS_MAX];
+    iov[0] = (struct iovec) { header, encodeFrameHeader(mi, size, header) };
+    if (count)
+        memcpy(iov + 1, parts, (size_t) count * sizeof(struct iovec));
+    return writevAll(iov, count + 1);
+}
+
+// the bytes sendHeader() and sendSizeField() send
+static uint32_t encodeFrameHeader(const nadam_messageInfo_t *mi, uint32_t size, uint8_t *dest) {
+    uint32_t length = (uint32_t) mbr.hashLength;
+    memcpy(dest, mi->hash, length);
+    if (isNegotiated(NADAM_FEATURE_TIMESTAMP)) {
+        uint64_t timestamp = nadam_timestamp();
+        memcpy(dest + length, &timestamp, TIMESTAMP_LENGTH);
+        length += TIMESTAMP_LENGTH;
+    }
+
+    if (!mi->size.isVariable)
+        return length;
+
+    if (isNegotiated(NADAM_FEATURE_COMPACT_SIZE))
+        return length + encodeCompactSize(size, dest + length);
+
+    memcpy(dest + length, &size, 4);
+    return length + 4;
+}
+
+// iov is consumed
+static int writevAll(struct iovec *iov, int count) {
+    while (count) {
+        ssize_t n = writev(mbr.sendFd, iov, count);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+
+            if (errno != EAGAIN)
+                return -1;
+
+            struct pollfd pfd = { .fd = mbr.sendFd, .events = POLLOUT };
+            poll(&pfd, 1, -1);
+            continue;
+        }
+
+        size_t written = (size_t) n;
+        while (count && written >= iov->iov_len) {
+            written -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+
+        if (count) {
+            iov->iov_base = (uint8_t *) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+// the features need the body in one piece
+static int sendPartsAssembled(const tables_t *t, size_t index, const struct iovec *parts, int count, uint32_t size) {
+    uint8_t *body;
+    if (allocate((void **) &body, size ? size : 1))
+        return -1;
+
+    uint8_t *dest = body;
+    for (int i = 0; i < count; ++i) {
+        if (parts[i].iov_len)
+            memcpy(dest, parts[i].iov_base, parts[i].iov_len);
+        dest += parts[i].iov_len;
+    }
+
+    int error = sendByIndex(t, index, body, size);
+    free(body);
+    return error;
+}
+
+// one bulk message at a time - frames of a type must not get between its fragments
+static int sendBulk(const tables_t *t, size_t index, const void *msg, uint32_t size) {
+    pthread_mutex_lock(&sending.bulkLock);
+    int error;
+    if (shouldFragment(size)) {
+        error = sendFragmented(t, index, msg, size);
+    } else {
+        waitForPriority();
+        pthread_mutex_lock(&sending.lock);
+        error = sendFrame(t, index, msg, size);
+        pthread_mutex_unlock(&sending.lock);
+    }
+    pthread_mutex_unlock(&sending.bulkLock);
+    return error;
+}
+
+static bool shouldFragment(uint32_t size) {
+    return isNegotiated(NADAM_FEATURE_FRAGMENTS) && size > mbr.fragmentLength;
+}
+
+// caller has to hold sending.bulkLock
+static int sendFragmented(const tables_t *t, size_t index, const void *msg, uint32_t size) {
+    const nadam_messageInfo_t *mi = t->messageInfos + index;
+    if (size > mi->size.max) {
+        errno = NADAM_ERROR_SIZE_ARG;
+        return -1;
+    }
+
+    const uint8_t *data = msg;
+    uint32_t remaining = size;
+    int errorCollector = 0;
+    do {
+        uint32_t length = remaining < mbr.fragmentLength ? remaining : mbr.fragmentLength;
+        remaining -= length;
+        uint32_t sizeField = length | (remaining ? SIZE_FRAGMENT_FLAG : 0);
+
+        waitForPriority();
+        pthread_mutex_lock(&sending.lock);
+        errorCollector = sendHeader(mi);
+        errorCollector |= sendSizeField(sizeField);
+        errorCollector |= mbr.send(data, length);
+        pthread_mutex_unlock(&sending.lock);
+        data += length;
+    } while (remaining && !errorCollector);
+
+    if (errorCollector) {
+        errno = NADAM_ERROR_SEND;
+        return -1;
+    }
+    return 0;
+}
+
+// a priority sender, which came after the check, waits for one fragment at most
+static void waitForPriority(void) {
+    while (atomic_load(&sending.priorityWaiting))
+        sched_yield();
+}
+
+// sender's timestamp follows the id
+static int sendHeader(const nadam_messageInfo_t *mi) {
+    int errorCollector = mbr.send(mi->hash, (uint32_t) mbr.hashLength);
+    if (isNegotiated(NADAM_FEATURE_TIMESTAMP)) {
+        uint64_t timestamp = nadam_timestamp();
+        errorCollector |= mbr.send(&timestamp, TIMESTAMP_LENGTH);
+    }
+    return errorCollector;
+}
+
+// size of a variable size frame - 4 bytes host byte order, LEB128 with compact size
+static int sendSizeField(uint32_t sizeField) {
+    if (!isNegotiated(NADAM_FEATURE_COMPACT_SIZE))
+        return mbr.send(&sizeField, 4);
+
+    uint8_t compact[COMPACT_SIZE_LENGTH_MAX];
+    return mbr.send(compact, encodeCompactSize(sizeField, compact));
+}
+
+static uint32_t encodeCompactSize(uint32_t sizeField, uint8_t *dest) {
+    uint32_t length = 0;
+    while (sizeField >= COMPACT_SIZE_CONTINUATION) {
+        dest[length++] = (uint8_t) (sizeField | COMPACT_SIZE_CONTINUATION);
+        sizeField >>= 7;
+    }
+    dest[length++] = (uint8_t) sizeField;
+    return length;
+}
+
+static bool shouldCompress(const typeState_t *ts, uint32_t size) {
+    if (!isNegotiated(NADAM_FEATURE_COMPRESSION))
+        return false;
+
+    uint32_t minSize = ts->compressionMinSize;
+    return minSize && size >= minSize && size > UNCOMPRESSED_SIZE_LENGTH;
+}
+
+// returns 1 if the message doesn't get smaller - it should be sent uncompressed
+static int sendCompressed(const tables_t *t, const nadam_messageInfo_t *mi, const void *msg, uint32_t size) {
+    uint8_t *buffer = t->compressSendBuffer;
+    uint32_t capacity = size - UNCOMPRESSED_SIZE_LENGTH - 1;
+    uint32_t compressedSize = lz_compress(msg, size, buffer + UNCOMPRESSED_SIZE_LENGTH, capacity);
+    if (compressedSize == 0)
+        return 1;
+
+    memcpy(buffer, &size, UNCOMPRESSED_SIZE_LENGTH);
+    uint32_t wireSize = UNCOMPRESSED_SIZE_LENGTH + compressedSize;
+    uint32_t sizeField = wireSize | SIZE_COMPRESSED_FLAG;
+
+    int errorCollector = sendHeader(mi);
+    errorCollector |= sendSizeField(sizeField);
+    errorCollector |= mbr.send(buffer, wireSize);
+
+    if (errorCollector) {
+        errno = NADAM_ERROR_SEND;
+        return -1;
+    }
+    return 0;
+}
+
+static int sendFixedSizeWithKind(const tables_t *t, size_t index, const void *msg) {
+    const nadam_messageInfo_t *mi = t->messageInfos + index;
+    deltaSendState_t *ds = t->types[index]->deltaSendState;
+    int errorCollector = 0;
+    if (ds == NULL || !trySendDelta(t, mi, ds, msg, &errorCollector)) {
+        const uint8_t kind = FRAME_KIND_FULL;
+        errorCollector = sendHeader(mi);
+        errorCollector |= mbr.send(&kind, 1);
+        errorCollector |= mbr.send(msg, mi->size.total);
+        if (ds) {
+            ds->sentSinceFull = 0;
+            ds->isFullRequested = false;
+        }
+    }
+
+    if (ds) {
+        memcpy(ds->last, msg, mi->size.total);
+        // after a failed send, state of the recipient is unknown
+        ds->hasLast = !errorCollector;
+    }
+
+    if (errorCollector) {
+        errno = NADAM_ERROR_SEND;
+        return -1;
+    }
+    return 0;
+}
+
+// returns false if a full frame should be sent instead
+static bool trySendDelta(const tables_t *t, const nadam_messageInfo_t *mi, deltaSendState_t *ds,
+        const void *msg, int *errorCollector) {
+    bool isFullDue = !ds->hasLast || ds->isFullRequested || ds->sentSinceFull + 1 >= ds->fullInterval;
+    if (isFullDue)
+        return false;
+
+    // delta has to be smaller than the data including its length
+    uint32_t size = mi->size.total;
+    if (size <= 4)
+        return false;
+
+    uint32_t deltaLength;
+    if (delta_encode(ds->last, msg, size, t->deltaSendBuffer, size - 4 - 1, &deltaLength))
+        return false;
+
+    const uint8_t kind = FRAME_KIND_DELTA;
+    *errorCollector = sendHeader(mi);
+    *errorCollector |= mbr.send(&kind, 1);
+    *errorCollector |= mbr.send(&deltaLength, 4);
+    *errorCollector |= mbr.send(t->deltaSendBuffer, deltaLength);
+    ++ds->sentSinceFull;
+    return true;
+}
+
+// caller has to hold latencyLock
+static latencyHistograms_t *getLatencyHistograms(typeState_t *ts) {
+    latencyHistograms_t *lh = ts->latencies;
+    if (lh)
+        return lh;
+
+    lh = malloc(sizeof(latencyHistograms_t));
+    if (lh == NULL)
+        return NULL;
+
+    for (size_t i = 0; i < NADAM_LATENCY_KIND_COUNT; ++i)
+        nadam_histogramReset(&lh->kinds[i]);
+
+    atomic_init(&lh->recvSequence, 0);
+    ts->latencies = lh;
+    return lh;
+}
+
+// the receive path records without allocating
+static int allocateLatencyHistograms(tables_t *t) {
+    int error = 0;
+    pthread_mutex_lock(&latencyLock);
+    for (size_t i = 0; i < t->messageCount && !error; ++i) {
+        if (getLatencyHistograms(t->types[i]) == NULL) {
+            errno = NADAM_ERROR_ALLOC_FAILED;
+            error = -1;
+        }
+    }
+    pthread_mutex_unlock(&latencyLock);
+    return error;
+}
+
+// only the receive thread writes these kinds - readers retry around it
+static void recordRecvLatencies(latencyHistograms_t *lh, uint64_t oneWay, uint64_t delegate) {
+    uint32_t sequence = atomic_load_explicit(&lh->recvSequence, memory_order_relaxed);
+    atomic_store_explicit(&lh->recvSequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    nadam_histogramRecord(&lh->kinds[NADAM_LATENCY_ONE_WAY], oneWay);
+    nadam_histogramRecord(&lh->kinds[NADAM_LATENCY_DELEGATE], delegate);
+    atomic_store_explicit(&lh->recvSequence, sequence + 2, memory_order_release);
+}
+
+// caller has to hold latencyLock
+static void copyLatencyHistogram(const latencyHistograms_t *lh, nadam_latencyKind_t kind, nadam_histogram_t *dest) {
+    uint32_t sequence;
+    do {
+        sequence = atomic_load_explicit(&lh->recvSequence, memory_order_acquire);
+        *dest = lh->kinds[kind];
+        atomic_thread_fence(memory_order_acquire);
+    } while ((sequence & 1) || atomic_load_explicit(&lh->recvSequence, memory_order_relaxed) != sequence);
+}
+
+// recv
+// arg NULL - return on error instead of parking
+static void *recvWorker(void *arg) {
+    while (true) {
+        int error = recvFrame();
+        if (!error)
+            continue;
+
+        if (arg)
+            atomic_store(&mbr.isThreadParked, true);
+
+        mbr.errorDelegate(error);
+        if (arg == NULL || !parkRecvThread())
+            return NULL;
+    }
+}
+
+static int recvFrame(void) {
+    // the bytes past hashLength stay zero - the whole array is the truncated id
+    uint8_t hash[HASH_LENGTH_MAX] = { 0 };
+    if (mbr.recv(hash, (uint32_t) mbr.hashLength))
+        return NADAM_ERROR_RECV;
+
+    // the frame is received with the tables current at its start - an update waits for it
+    unsigned epoch;
+    int error;
+    const tables_t *t = enterTables(&epoch);
+    pthread_cleanup_push(leaveTablesOnCancel, &epoch);
+    error = recvFrameOfType(t, hash);
+    pthread_cleanup_pop(1);
+    return error;
+}
+
+// everything but the slow paths comes from the type's dispatch entry
+static int recvFrameOfType(const tables_t *t, const uint8_t *hash) {
+    uint32_t id;
+    memcpy(&id, hash, sizeof(id));
+    const dispatchEntry_t *entry = findDispatchEntry(t, id);
+    if (entry == NULL)
+        return NADAM_ERROR_UNKNOWN_HASH;
+
+    bool isTimestamped = isNegotiated(NADAM_FEATURE_TIMESTAMP);
+    if (isTimestamped && mbr.recv(&mbr.recvTimestamp, TIMESTAMP_LENGTH))
+        return NADAM_ERROR_RECV;
+
+    uint32_t size;
+    bool isCompressed, isFragment;
+    int error = getMessageSize(entry, &size, &isCompressed, &isFragment);
+    if (error)
+        return error;
+
+    if (entry->hasProvider)
+        return recvIntoProvided(t, entry, size, isCompressed, isFragment);
+
+    void *buffer = entry->buffer;
+    setRecvStart(t, entry);
+    if (isReassembled(t, entry, isFragment)) {
+        // fragmented messages aren't compressed
+        error = isCompressed ? NADAM_ERROR_FRAGMENT : recvFragment(t, entry, isFragment, &buffer, &size);
+        // the delegate gets the whole message with its last frame
+        if (error || isFragment)
+            return error;
+    } else if (isCompressed)
+        error = recvCompressed(t, entry, buffer, &size);
+    else if (!entry->isVariable && isNegotiated(NADAM_FEATURE_DELTA))
+        error = recvWithKind(t, getEntryState(t, entry), buffer, size);
+    else if (mbr.recv(buffer, size))
+        error = NADAM_ERROR_RECV;
+
+    if (error)
+        return error;
+
+    if (atomic_load_explicit(&capture.isActive, memory_order_relaxed))
+        captureFrame(getEntryInfo(t, entry), buffer, size);
+
+    if (isTimestamped)
+        callDelegateRecordingLatency(t, entry, buffer, size);
+    else
+        entry->delegate(buffer, size, getEntryInfo(t, entry));
+
+    return 0;
+}
+
+static void callDelegateRecordingLatency(const tables_t *t, const dispatchEntry_t *entry,
+        void *buffer, uint32_t size) {
+    uint64_t start = nadam_timestamp();
+    entry->delegate(buffer, size, getEntryInfo(t, entry));
+    uint64_t end = nadam_timestamp();
+
+    // allocated with the feature buffers at initiate
+    latencyHistograms_t *lh = getEntryState(t, entry)->latencies;
+    if (lh)
+        recordRecvLatencies(lh, start > mbr.recvTimestamp ? start - mbr.recvTimestamp : 0, end - start);
+}
+
+// NULL for an unknown id
+static const dispatchEntry_t *findDispatchEntry(const tables_t *t, uint32_t id) {
+    const dispatchEntry_t *entry = findDispatchSlot(t, id);
+    return entry->index == DISPATCH_EMPTY ? NULL : entry;
+}
+
+static uint32_t truncateHash(const uint8_t *hash) {
+    return truncateHashToLength(hash, mbr.hashLength);
+}
+
+static uint32_t truncateHashToLength(const uint8_t *hash, size_t length) {
+    uint32_t res = 0;
+    memcpy(&res, hash, length);
+    return res;
+}
+
+static int getMessageSize(const dispatchEntry_t *entry, uint32_t *size, bool *isCompressed, bool *isFragment) {
+    uint32_t s;
+    *isCompressed = false;
+    *isFragment = false;
+    if (entry->isVariable) {
+        int error = recvSizeField(&s);
+        if (error)
+            return error;
+
+        if (isNegotiated(NADAM_FEATURE_COMPRESSION)) {
+            *isCompressed = s & SIZE_COMPRESSED_FLAG;
+            s &= ~SIZE_COMPRESSED_FLAG;
+        }
+
+        if (isNegotiated(NADAM_FEATURE_FRAGMENTS)) {
+            *isFragment = s & SIZE_FRAGMENT_FLAG;
+            s &= ~SIZE_FRAGMENT_FLAG;
+        }
+
+        if (s > entry->size || (mbr.recvFrameMax && s > mbr.recvFrameMax))
+            return NADAM_ERROR_VARIABLE_SIZE;
+    } else {
+        s = entry->size;
+    }
+
+    *size = s;
+    return 0;
+}
+
+// sizes below 128 take a single byte - their path is one recv and one branch
+static int recvSizeField(uint32_t *sizeField) {
+    if (!isNegotiated(NADAM_FEATURE_COMPACT_SIZE))
+        return mbr.recv(sizeField, 4) ? NADAM_ERROR_RECV : 0;
+
+    uint8_t first;
+    if (mbr.recv(&first, 1))
+        return NADAM_ERROR_RECV;
+
+    if (first < COMPACT_SIZE_CONTINUATION) {
+        *sizeField = first;
+        return 0;
+    }
+    return recvCompactSizeRest(first, sizeField);
+}
+
+// more than 5 bytes or bits beyond 32 are malformed
+static int recvCompactSizeRest(uint8_t first, uint32_t *sizeField) {
+    uint32_t s = first & COMPACT_SIZE_GROUP;
+    uint8_t b = first;
+    for (unsigned shift = 7; b & COMPACT_SIZE_CONTINUATION; shift += 7) {
+        if (shift >= 7 * COMPACT_SIZE_LENGTH_MAX)
+            return NADAM_ERROR_VARIABLE_SIZE;
+
+        if (mbr.recv(&b, 1))
+            return NADAM_ERROR_RECV;
+
+        uint32_t group = b & COMPACT_SIZE_GROUP;
+        if (shift == 28 && group > 0xF)
+            return NADAM_ERROR_VARIABLE_SIZE;
+
+        s |= group << shift;
+    }
+
+    *sizeField = s;
+    return 0;
+}
+
+// a fragment or the last frame of a message being reassembled
+static bool isReassembled(const tables_t *t, const dispatchEntry_t *entry, bool isFragment) {
+    return isFragment || (entry->isVariable && isNegotiated(NADAM_FEATURE_FRAGMENTS)
+            && getEntryState(t, entry)->fragmentTarget);
+}
+
+/* Appends the frame's data to the message of the type. With the last frame
+   buffer and size are set to the whole message.  */
+static int recvFragment(const tables_t *t, const dispatchEntry_t *entry, bool isFragment,
+        void **buffer, uint32_t *size) {
+    typeState_t *ts = getEntryState(t, entry);
+    if (ts->fragmentTarget == NULL) {
+        // priority messages arriving in between could overwrite the common buffer
+        if (entry->buffer == t->commonRecvBuffer) {
+            ts->fragmentTarget = ts->fragmentBuffer;
+        } else {
+            ts->fragmentTarget = entry->buffer;
+        }
+        ts->fragmentedLength = 0;
+    }
+
+    if (*size > entry->size - ts->fragmentedLength)
+        return NADAM_ERROR_VARIABLE_SIZE;
+
+    if (mbr.recv(ts->fragmentTarget + ts->fragmentedLength, *size))
+        return NADAM_ERROR_RECV;
+
+    ts->fragmentedLength += *size;
+    if (!isFragment) {
+        *buffer = ts->fragmentTarget;
+        *size = ts->fragmentedLength;
+        ts->fragmentTarget = NULL;
+    }
+    return 0;
+}
+
+// size is updated from compressed to actual size
+static int recvCompressed(const tables_t *t, const dispatchEntry_t *entry, void *buffer, uint32_t *size) {
+    uint32_t wireSize = *size;
+    if (wireSize < UNCOMPRESSED_SIZE_LENGTH)
+        return NADAM_ERROR_DECOMPRESS;
+
+    uint8_t *compressed = t->compressRecvBuffer;
+    if (mbr.recv(compressed, wireSize))
+        return NADAM_ERROR_RECV;
+
+    uint32_t uncompressedSize;
+    memcpy(&uncompressedSize, compressed, UNCOMPRESSED_SIZE_LENGTH);
+    if (uncompressedSize > entry->size)
+        return NADAM_ERROR_VARIABLE_SIZE;
+
+    if (lz_decompress(compressed + UNCOMPRESSED_SIZE_LENGTH, wireSize - UNCOMPRESSED_SIZE_LENGTH,
+                buffer, uncompressedSize))
+        return NADAM_ERROR_DECOMPRESS;
+
+    *size = uncompressedSize;
+    return 0;
+}
+
+static int recvWithKind(const tables_t *t, typeState_t *ts, void *buffer, uint32_t size) {
+    uint8_t kind;
+    if (mbr.recv(&kind, 1))
+        return NADAM_ERROR_RECV;
+
+    if (kind == FRAME_KIND_DELTA)
+        return recvDelta(t, ts, buffer, size);
+
+    if (kind != FRAME_KIND_FULL)
+        return NADAM_ERROR_DELTA;
+
+    if (mbr.recv(buffer, size))
+        return NADAM_ERROR_RECV;
+
+    return storeDeltaBase(ts, buffer, size);
+}
+
+static int recvDelta(const tables_t *t, typeState_t *ts, void *buffer, uint32_t size) {
+    uint32_t deltaLength;
+    if (mbr.recv(&deltaLength, 4))
+        return NADAM_ERROR_RECV;
+
+    if (deltaLength > size)
+        return NADAM_ERROR_DELTA;
+
+    if (mbr.recv(t->deltaRecvBuffer, deltaLength))
+        return NADAM_ERROR_RECV;
+
+    uint8_t *base = ts->deltaBase;
+    if (base == NULL || delta_apply(base, size, t->deltaRecvBuffer, deltaLength))
+        return NADAM_ERROR_DELTA;
+
+    memcpy(buffer, base, size);
+    return 0;
+}
+
+// the delegate's buffer might be shared or changed by the user - base is kept separately
+static int storeDeltaBase(typeState_t *ts, const void *buffer, uint32_t size) {
+    if (ts->deltaBase == NULL) {
+        ts->deltaBase = malloc(size);
+        if (ts->deltaBase == NULL)
+            return NADAM_ERROR_ALLOC_FAILED;
+    }
+
+    memcpy(ts->deltaBase, buffer, size);
+    return 0;
+}
+
+// as recvFrameOfType() with the provider's buffer - a dropped message is received into the common buffer
+static int recvIntoProvided(const tables_t *t, const dispatchEntry_t *entry, uint32_t size,
+        bool isCompressed, bool isFragment) {
+    typeState_t *ts = getEntryState(t, entry);
+    bool isReassembling = isReassembled(t, entry, isFragment);
+    if (isReassembling && isCompressed)
+        return NADAM_ERROR_FRAGMENT;
+
+    // fragments of a message continue in its buffer
+    void *buffer = isReassembling ? ts->fragmentTarget : NULL;
+    if (buffer == NULL) {
+        buffer = acquireProvided(t, entry, (isCompressed || isReassembling) ? entry->size : size);
+        if (isReassembling) {
+            ts->fragmentTarget = buffer;
+            ts->fragmentedLength = 0;
+            ts->isFragmentProvided = (buffer != t->commonRecvBuffer);
+        }
+    }
+    bool isDropped = (buffer == t->commonRecvBuffer);
+
+    int error = 0;
+    if (isReassembling) {
+        error = recvFragment(t, entry, isFragment, &buffer, &size);
+        if (error || !isFragment)
+            ts->isFragmentProvided = false;
+        if (error)
+            ts->fragmentTarget = NULL;
+        else if (isFragment)
+            return 0;
+    } else if (isCompressed) {
+        error = recvCompressed(t, entry, buffer, &size);
+    } else if (!entry->isVariable && isNegotiated(NADAM_FEATURE_DELTA)) {
+        error = recvWithKind(t, ts, buffer, size);
+    } else if (mbr.recv(buffer, size)) {
+        error = NADAM_ERROR_RECV;
+    }
+
+    if (isDropped)
+        return error;
+
+    if (error) {
+        releaseProvided(&ts->provider, buffer);
+        return error;
+    }
+
+    if (atomic_load_explicit(&capture.isActive, memory_order_relaxed))
+        captureFrame(getEntryInfo(t, entry), buffer, size);
+    deliverProvided(t, entry, buffer, size);
+    return 0;
+}
+
+// the common buffer if the provider drops the message
+static void *acquireProvided(const tables_t *t, const dispatchEntry_t *entry, uint32_t size) {
+    const nadam_bufferProvider_t *provider = &getEntryState(t, entry)->provider;
+    void *buffer = provider->acquire(size, getEntryInfo(t, entry), provider->context);
+    return buffer ? buffer : t->commonRecvBuffer;
+}
+
+// the delegate owns the buffer from now on
+static void deliverProvided(const tables_t *t, const dispatchEntry_t *entry, void *buffer, uint32_t size) {
+    if (entry->delegate == nullDelegate)
+        releaseProvided(&getEntryState(t, entry)->provider, buffer);
+    else if (isNegotiated(NADAM_FEATURE_TIMESTAMP))
+        callDelegateRecordingLatency(t, entry, buffer, size);
+    else
+        entry->delegate(buffer, size, getEntryInfo(t, entry));
+}
+
+static void releaseProvided(const nadam_bufferProvider_t *provider, void *buffer) {
+    if (provider->release)
+        provider->release(buffer, provider->context);
+}
+
+// recv interface on top of recvSome: spins, backs off to blocking recv if nothing arrives
+static int recvSpinning(void *dest, uint32_t n) {
+    uint8_t *p = dest;
+    while (n) {
+        int32_t received = spinRecvSome(p, n);
+        if (received < 0 || (uint32_t) received > n)
+            return -1;
+
+        if (received == 0)
+            return mbr.recvBlocking(p, n);
+
+        p += received;
+        n -= (uint32_t) received;
+    }
+    return 0;
+}
+
+/* Spin time halves whenever it expires without data and doubles (up to lowLatency.spinNs)
+   whenever data arrives while spinning - an idle link costs less CPU.  */
+static int32_t spinRecvSome(void *dest, uint32_t n) {
+    int32_t received = mbr.lowLatency.recvSome(dest, n);
+    if (received)
+        return received;
+
+    uint64_t start = nadam_timestamp();
+    while (true) {
+        cpuRelax();
+        received = mbr.lowLatency.recvSome(dest, n);
+        if (received) {
+            uint64_t doubled = mbr.spinNs * 2;
+            mbr.spinNs = doubled < mbr.lowLatency.spinNs ? doubled : mbr.lowLatency.spinNs;
+            return received;
+        }
+
+        if (nadam_timestamp() - start >= mbr.spinNs) {
+            uint64_t halved = mbr.spinNs / 2;
+            mbr.spinNs = halved > SPIN_NS_MIN ? halved : SPIN_NS_MIN;
+            return 0;
+        }
+    }
+}
+
+static void cpuRelax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield");
+#endif
+}
+
+// returns false if the thread should exit
+static bool parkRecvThread(void) {
+    uint64_t wakeCount;
+    while (read(mbr.wakeFd, &wakeCount, sizeof(wakeCount)) < 0) {
+        if (errno != EINTR)
+            return false;
+    }
+    return true;
+}
+
+static int createRecvThread(void) {
+    assert(!mbr.isThreadRunning);
+
+    pthread_attr_t attr;
+    if (initRecvThreadAttr(&attr))
+        return -1;
+
+    // without eventfd the thread exits on error - the next nadam_initiate() creates a new one
+    mbr.wakeFd = eventfd(0, EFD_CLOEXEC);
+    atomic_store(&mbr.isThreadParked, false);
+    void *arg = mbr.wakeFd < 0 ? NULL : &mbr;
+    int error = pthread_create(&mbr.threadId, &attr, recvWorker, arg);
+    pthread_attr_destroy(&attr);
+    if (error) {
+        // only low latency attributes can be refused (e.g. real-time priority without privileges)
+        if (mbr.wakeFd >= 0)
+            close(mbr.wakeFd);
+        errno = NADAM_ERROR_LOW_LATENCY;
+        return -1;
+    }
+
+    mbr.isThreadRunning = true;
+    return 0;
+}
+
+static int initRecvThreadAttr(pthread_attr_t *attr) {
+    int error = pthread_attr_init(attr);
+    assert(!error);
+    if (!mbr.isLowLatency)
+        return 0;
+
+    if (mbr.lowLatency.cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET((size_t) mbr.lowLatency.cpu, &cpus);
+        error |= pthread_attr_setaffinity_np(attr, sizeof(cpus), &cpus);
+    }
+
+    if (mbr.lowLatency.realtimePriority) {
+        struct sched_param param = { .sched_priority = mbr.lowLatency.realtimePriority };
+        error |= pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+        error |= pthread_attr_setschedpolicy(attr, SCHED_FIFO);
+        error |= pthread_attr_setschedparam(attr, &param);
+    }
+
+    if (error) {
+        pthread_attr_destroy(attr);
+        errno = NADAM_ERROR_LOW_LATENCY;
+        return -1;
+    }
+    return 0;
+}
+
+static void cancelRecvThread(void) {
+    if (!mbr.isThreadRunning)
+        return;
+
+    int error = pthread_cancel(mbr.threadId);
+    assert(!error);
+    error = pthread_join(mbr.threadId, NULL);
+    assert(!error);
+    mbr.isThreadRunning = false;
+
+    if (mbr.wakeFd >= 0)
+        close(mbr.wakeFd);
+}
+
+static void wakeRecvThread(void) {
+    atomic_store(&mbr.isThreadParked, false);
+    const uint64_t wakeCount = 1;
+    ssize_t written = write(mbr.wakeFd, &wakeCount, sizeof(wakeCount));
+    assert(written == sizeof(wakeCount));
+    (void) written;
+}
+
+// capture -- callers have to hold capture.lock
+static int captureHandshake(void) {
+    bool isInitiated = (mbr.send != NULL);
+    if (!isInitiated)
+        return 0;
+
+    captureRecord_t record = { .timestamp = nadam_timestamp(), .length = 1,
+        .kind = CAPTURE_RECORD_HANDSHAKE, .hashLength = (uint8_t) mbr.hashLength };
+    uint8_t *dest = capture_append(capture.capture, &record, 0);
+    if (dest == NULL)
+        return -1;
+
+    *dest = mbr.peerHandshake;
+    return 0;
+}
+
+static void captureFrame(const nadam_messageInfo_t *mi, const void *buffer, uint32_t size) {
+    pthread_mutex_lock(&capture.lock);
+    if (capture.capture == NULL) {
+        pthread_mutex_unlock(&capture.lock);
+        return;
+    }
+
+    uint32_t hashLength = (uint32_t) mbr.hashLength;
+    uint32_t sizeLength = mi->size.isVariable ? 4 : 0;
+    captureRecord_t record = { .timestamp = nadam_timestamp(),
+        .length = hashLength + sizeLength + size,
+        .kind = CAPTURE_RECORD_FRAME, .hashLength = (uint8_t) hashLength };
+
+    uint8_t *dest = capture_append(capture.capture, &record, truncateHash(mi->hash));
+    if (dest) {
+        memcpy(dest, mi->hash, hashLength);
+        memcpy(dest + hashLength, &size, sizeLength);
+        memcpy(dest + hashLength + sizeLength, buffer, size);
+    } else {
+        failCapture();
+    }
+    pthread_mutex_unlock(&capture.lock);
+}
+
+// whatever was captured so far is kept
+static void failCapture(void) {
+    atomic_store(&capture.isActive, false);
+    capture_close(capture.capture);
+    capture.capture = NULL;
+    capture.hasFailed = true;
+}
+
+// replay
+static int replayAll(const captureReader_t *r, double speed) {
+    uint64_t start = nadam_timestamp();
+    uint64_t firstTimestamp = 0;
+    size_t offset = sizeof(captureHeader_t);
+    const captureRecord_t *record;
+    for (; (record = capture_recordAt(r, offset)); offset = capture_nextOffset(record, offset)) {
+        if (offset == sizeof(captureHeader_t))
+            firstTimestamp = record->timestamp;
+
+        int error = replayRecord(record, start, firstTimestamp, speed);
+        if (error)
+            return error;
+    }
+    return 0;
+}
+
+/* Frames of a type are found with the index. The negotiated hash length
+   might have changed between connections - every length has its own group.  */
+static int replayFiltered(const captureReader_t *r, const uint8_t *hash, double speed) {
+    bool isIndexMissing = (r->groups == NULL);
+    if (isIndexMissing)
+        return replayScanFiltered(r, hash, speed);
+
+    const captureIndexGroup_t *groups[HASH_LENGTH_MAX];
+    size_t next[HASH_LENGTH_MAX] = { 0 };
+    for (size_t i = 0; i < HASH_LENGTH_MAX; ++i) {
+        uint8_t hashLength = (uint8_t) (i + 1);
+        groups[i] = capture_findGroup(r, capture_makeKey(hashLength, truncateHashToLength(hash, hashLength)));
+    }
+
+    uint64_t start = nadam_timestamp();
+    uint64_t firstTimestamp = 0;
+    bool isFirst = true;
+    while (true) {
+        size_t group = HASH_LENGTH_MAX;
+        for (size_t i = 0; i < HASH_LENGTH_MAX; ++i) {
+            if (groups[i] == NULL || next[i] == groups[i]->count)
+                continue;
+
+            bool isEarlier = (group == HASH_LENGTH_MAX)
+                || r->offsets[groups[i]->first + next[i]] < r->offsets[groups[group]->first + next[group]];
+            if (isEarlier)
+                group = i;
+        }
+
+        if (group == HASH_LENGTH_MAX)
+            return 0;
+
+        const captureRecord_t *record = capture_recordAt(r, r->offsets[groups[group]->first + next[group]]);
+        if (record == NULL)
+            return NADAM_ERROR_CAPTURE;
+
+        ++next[group];
+        if (isFirst) {
+            firstTimestamp = record->timestamp;
+            isFirst = false;
+        }
+
+        int error = replayRecord(record, start, firstTimestamp, speed);
+        if (error)
+            return error;
+    }
+}
+
+static int replayScanFiltered(const captureReader_t *r, const uint8_t *hash, double speed) {
+    uint64_t start = nadam_timestamp();
+    uint64_t firstTimestamp = 0;
+    bool isFirst = true;
+    size_t offset = sizeof(captureHeader_t);
+    const captureRecord_t *record;
+    for (; (record = capture_recordAt(r, offset)); offset = capture_nextOffset(record, offset)) {
+        if (!isRecordOfType(record, hash))
+            continue;
+
+        if (isFirst) {
+            firstTimestamp = record->timestamp;
+            isFirst = false;
+        }
+
+        int error = replayRecord(record, start, firstTimestamp, speed);
+        if (error)
+            return error;
+    }
+    return 0;
+}
+
+static bool isRecordOfType(const captureRecord_t *record, const uint8_t *hash) {
+    if (record->kind != CAPTURE_RECORD_FRAME || record->hashLength > HASH_LENGTH_MAX
+            || record->length < record->hashLength)
+        return false;
+
+    return memcmp(record + 1, hash, record->hashLength) == 0;
+}
+
+static int replayRecord(const captureRecord_t *record, uint64_t start, uint64_t firstTimestamp, double speed) {
+    if (record->kind != CAPTURE_RECORD_FRAME)
+        return 0;
+
+    if (record->hashLength == 0 || record->hashLength > HASH_LENGTH_MAX)
+        return NADAM_ERROR_CAPTURE;
+
+    // updates of the catalog change the map as well
+    pthread_mutex_lock(&generation.updateLock);
+    mbr.hashLength = record->hashLength;
+    updateDispatch(getTables());
+    pthread_mutex_unlock(&generation.updateLock);
+
+    replayPace(start, firstTimestamp, record->timestamp, speed);
+
+    replaySource.src = (const uint8_t *) (record + 1);
+    replaySource.n = record->length;
+    int error = recvFrame();
+    if (!error && replaySource.n)
+        error = NADAM_ERROR_CAPTURE;
+
+    return error;
+}
+
+static void replayPace(uint64_t start, uint64_t firstTimestamp, uint64_t timestamp, double speed) {
+    if (speed <= 0.0 || timestamp <= firstTimestamp)
+        return;
+
+    uint64_t due = start + (uint64_t) ((double) (timestamp - firstTimestamp) / speed);
+    struct timespec ts = { .tv_sec = (time_t) (due / 1000000000u), .tv_nsec = (long) (due % 1000000000u) };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+static int replayRecv(void *dest, uint32_t n) {
+    if (n > replaySource.n)
+        return -1;
+
+    memcpy(dest, replaySource.src, n);
+    replaySource.src += n;
+    replaySource.n -= n;
+    return 0;
+}
+
+// datagram
+// caller has to hold datagram.lock
+static void closeDatagram(void) {
+    datagram_closeSender(datagram.sender);
+    datagram_closeReceiver(datagram.receiver);
+    datagram.sender = NULL;
+    datagram.receiver = NULL;
+}
+
+/* Base protocol form - id, size field of a variable size type, data.
+   Caller has to hold the lock of s (NULL if it isn't open).  */
+static int packDatagramFrame(datagramSender_t *s, const nadam_messageInfo_t *mi, const void *msg, uint32_t size) {
+    bool isVariable = mi->size.isVariable;
+    int error = 0;
+    if (s == NULL)
+        error = NADAM_ERROR_DATAGRAM;
+    else if (isVariable && size > mi->size.max)
+        error = NADAM_ERROR_SIZE_ARG;
+
+    if (error) {
+        errno = error;
+        return -1;
+    }
+
+    if (!isVariable)
+        size = mi->size.total;
+
+    uint32_t hashLength = (uint32_t) mbr.hashLength;
+    uint32_t headerLength = hashLength + (isVariable ? 4 : 0);
+    uint8_t *dest = datagram_reserve(s, headerLength + size);
+    if (dest == NULL) {
+        errno = (errno == EMSGSIZE) ? NADAM_ERROR_SIZE_ARG : NADAM_ERROR_SEND;
+        return -1;
+    }
+
+    memcpy(dest, mi->hash, hashLength);
+    if (isVariable)
+        memcpy(dest + hashLength, &size, 4);
+    memcpy(dest + headerLength, msg, size);
+    return 0;
+}
+
+// returns count of received datagrams, 0 if none is available (non-blocking socket)
+static int prepareDatagramRecv(datagramReceiver_t *r) {
+    int count = datagram_recvBatch(r);
+    if (count < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+
+        errno = NADAM_ERROR_DATAGRAM;
+        return -1;
+    }
+    return count;
+}
+
+// a datagram is delivered whole or not at all
+static bool isDatagramValid(const tables_t *t, const uint8_t *src, uint32_t length) {
+    const dispatchEntry_t *entry;
+    uint32_t size;
+    for (uint32_t offset = 0; offset < length;) {
+        uint32_t frameLength = parseDatagramFrame(t, src + offset, length - offset, &entry, &size);
+        if (frameLength == 0)
+            return false;
+
+        offset += frameLength;
+    }
+    return true;
+}
+
+// returns count of frames - the datagram has to be valid
+static int deliverDatagram(const tables_t *t, const uint8_t *src, uint32_t length) {
+    int count = 0;
+    const dispatchEntry_t *entry = NULL;
+    uint32_t size = 0;
+    for (uint32_t offset = 0; offset < length; ++count) {
+        uint32_t frameLength = parseDatagramFrame(t, src + offset, length - offset, &entry, &size);
+        const uint8_t *data = src + offset + frameLength - size;
+        offset += frameLength;
+
+        if (entry->hasProvider) {
+            void *buffer = acquireProvided(t, entry, size);
+            if (buffer != t->commonRecvBuffer) {
+                memcpy(buffer, data, size);
+                deliverProvided(t, entry, buffer, size);
+            }
+            continue;
+        }
+
+        // the delegate gets its own buffer, as with a connection
+        setRecvStart(t, entry);
+        memcpy(entry->buffer, data, size);
+        if (atomic_load_explicit(&capture.isActive, memory_order_relaxed))
+            captureFrame(getEntryInfo(t, entry), entry->buffer, size);
+        entry->delegate(entry->buffer, size, getEntryInfo(t, entry));
+    }
+    return count;
+}
+
+// returns length of the frame at src or 0 if it's invalid
+static uint32_t parseDatagramFrame(const tables_t *t, const uint8_t *src, uint32_t length,
+        const dispatchEntry_t **entry, uint32_t *size) {
+    uint32_t headerLength = (uint32_t) mbr.hashLength;
+    if (length < headerLength)
+        return 0;
+
+    *entry = findDispatchEntry(t, truncateHash(src));
+    if (*entry == NULL)
+        return 0;
+
+    if ((*entry)->isVariable) {
+        if (length - headerLength < 4)
+            return 0;
+
+        memcpy(size, src + headerLength, 4);
+        headerLength += 4;
+        if (*size > (*entry)->size)
+            return 0;
+    } else {
+        *size = (*entry)->size;
+    }
+
+    if (length - headerLength < *size)
+        return 0;
+    return headerLength + *size;
+}
+
+// multicast
+// caller has to hold publisher.lock
+static void closePublisher(void) {
+    datagram_closeSender(publisher.sender);
+    publisher.sender = NULL;
+}
+
+// called by the flush - publisher.lock is held
+static void writePublisherHeader(uint8_t *header, void *context) {
+    multicastHeader_t h = { .stream = publisher.stream, .session = publisher.session, .sequence = publisher.sequence };
+    if (publisher.isSnapshotting)
+        h.kind = MULTICAST_KIND_SNAPSHOT;
+    else
+        ++publisher.sequence;
+    multicast_writeHeader(header, &h);
+}
+
+// wall clock - a restarted process starts a later session, unless the clock was set back meanwhile
+static uint64_t makePublisherSession(uint64_t previous) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t now = (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+    return now > previous ? now : previous + 1;
+}
+
+static int keepSnapshotValue(typeState_t *ts, const nadam_messageInfo_t *mi, const void *msg) {
+    if (ts->snapshot == NULL && allocate((void **) &ts->snapshot, mi->size.total))
+        return -1;
+
+    memcpy(ts->snapshot, msg, mi->size.total);
+    return 0;
+}
+
+// caller has to hold publisher.lock - returns a NADAM_ERROR_ code
+static int packSnapshot(const tables_t *t) {
+    publisher.isSnapshotting = true;
+    int error = 0;
+    for (size_t i = 0; i < t->messageCount && !error; ++i) {
+        const uint8_t *value = t->types[i]->snapshot;
+        if (value && packDatagramFrame(publisher.sender, t->messageInfos + i, value, 0))
+            error = errno;
+    }
+
+    if (!error && datagram_flush(publisher.sender))
+        error = NADAM_ERROR_SEND;
+    publisher.isSnapshotting = false;
+    return error;
+}
+
+// caller has to hold subscriber.lock
+static void closeSubscriber(void) {
+    datagram_closeReceiver(subscriber.receiver);
+    multicast_closeStreams(subscriber.streams);
+    subscriber.receiver = NULL;
+    subscriber.streams = NULL;
+}
+
+// returns count of delivered frames or -1
+static int recvSubscribed(const tables_t *t, const uint8_t *d, uint32_t length) {
+    multicastHeader_t h;
+    if (multicast_readHeader(d, length, &h)) {
+        atomic_fetch_add(&subscriber.dropped, 1);
+        return 0;
+    }
+
+    bool isAccepted;
+    uint64_t lost;
+    if (multicast_accept(subscriber.streams, &h, &isAccepted, &lost)) {
+        errno = NADAM_ERROR_ALLOC_FAILED;
+        return -1;
+    }
+
+    if (lost) {
+        atomic_fetch_add(&subscriber.lost, lost);
+        if (subscriber.gapDelegate)
+            subscriber.gapDelegate(h.stream, h.sequence - lost, lost);
+    }
+
+    if (!isAccepted)
+        return 0;
+
+    const uint8_t *frames = d + MULTICAST_HEADER_LENGTH;
+    uint32_t framesLength = length - MULTICAST_HEADER_LENGTH;
+    if (!isDatagramValid(t, frames, framesLength)) {
+        atomic_fetch_add(&subscriber.dropped, 1);
+        return 0;
+    }
+    return deliverDatagram(t, frames, framesLength);
+}
+
+// unittest
+// -----------------------------------------------------------------------------
+#ifdef UNITTEST
+// nadam_init
+int initWithPlausibleArgs(void) {
+    nadam_messageInfo_t infos[] = { { .name = "foo" }, 
+        { .name = "funhun" } };
+    errno = 0;
+    ASSERT(!nadam_init(infos, 2, 4));
+    ASSERT(!errno);
+    return 0;
+}
+
+int initWithEmptyMessageInfos(void) {
+    errno = 0;
+    ASSERT(nadam_init(NULL, 0, 4));
+    ASSERT(errno == NADAM_ERROR_EMPTY_MESSAGE_INFOS);
+    return 0;
+}
+
+int initWithWrongHashLength(void) {
+    nadam_messageInfo_t info = { .name = "foo" };
+    errno = 0;
+    ASSERT(nadam_init(&info, 1, 0));
+    ASSERT(errno == NADAM_ERROR_MIN_HASH_LENGTH);
+    errno = 0;
+    ASSERT(nadam_init(&info, 1, 9));
+    ASSERT(errno == NADAM_ERROR_MIN_HASH_LENGTH);
+    return 0;
+}
+
+int initWithDuplicateName(void) {
+    nadam_messageInfo_t infos[] = { { .name = "foo" }, 
+        { .name = "foo" } };
+    errno = 0;
+    ASSERT(nadam_init(infos, 2, 4));
+    ASSERT(errno == NADAM_ERROR_NAME_COLLISION);
+    return 0;
+}
+
+// nadam_setDelegateWithRecvBuffer
+// and nadam_setDelegate as long as it simply forwards
+static void recvDelegateDummy(void *msg, uint32_t size, const nadam_messageInfo_t *mi) { }
+
+int normalSetDelegateUse(void) {
+    nadam_messageInfo_t infos[] = { { .name = "ZERO" }, { .name = "ONE" } };
+    nadam_init(infos, 2, 4);
+
+    int buffer;
+    volatile bool recvStart;
+    recvDelegateRelated_t d = { .delegate = recvDelegateDummy, .buffer = &buffer,
+        .recvStart = &recvStart };
+    ASSERT(!nadam_setDelegateWithRecvBuffer("ONE", d.delegate, d.buffer, d.recvStart));
+    recvDelegateRelated_t *verify = &getTables()->types[1]->delegate;
+    ASSERT(memcmp(&d, verify, sizeof(recvDelegateRelated_t)) == 0);
+    return 0;
+}
+
+int setDelegateOfUnknownMessageError(void) {
+    nadam_messageInfo_t info = { .name = "[+]" };
+    nadam_init(&info, 1, 4);
+
+    errno = 0;
+    int nonNull;
+    ASSERT(nadam_setDelegateWithRecvBuffer("[-]", recvDelegateDummy, &nonNull, NULL));
+    ASSERT(errno == NADAM_ERROR_UNKNOWN_NAME);
+    return 0;
+}
+
+int nullBufferForNonNullDelegateError(void) {
+    nadam_messageInfo_t info = { .name = "hi there" };
+    nadam_init(&info, 1, 4);
+
+    errno = 0;
+    ASSERT(nadam_setDelegateWithRecvBuffer("hi there", recvDelegateDummy, NULL, NULL));
+    ASSERT(errno == NADAM_ERROR_DELEGATE_BUFFER);
+    return 0;
+}
+
+int removingADelegateClearsItsData(void) {
+    nadam_messageInfo_t info = { .name = "brown fox" };
+    nadam_init(&info, 1, 4);
+    recvDelegateRelated_t delegateInit = getDelegateInit();
+
+    recvDelegateRelated_t *delegate = &getTables()->types[0]->delegate;
+    memset(delegate, 0xA5, sizeof(recvDelegateRelated_t));
+    ASSERT(!nadam_setDelegateWithRecvBuffer("brown fox", NULL, NULL, NULL));
+    ASSERT(memcmp(delegate, &delegateInit, sizeof(recvDelegateRelated_t)) == 0);
+    return 0;
+}
+
+int passingNullForDelegatesRecvStartUsesInitValue(void) {
+    nadam_messageInfo_t info = { .name = "Scorpio" };
+    nadam_init(&info, 1, 4);
+
+    int nonNull;
+    ASSERT(!nadam_setDelegateWithRecvBuffer("Scorpio", recvDelegateDummy, &nonNull, NULL));
+    ASSERT(getTables()->types[0]->delegate.recvStart != NULL);
+    return 0;
+}
+
+// nadam_send
+static struct {
+    bool sendWasCalled;
+    size_t n;
+    uint8_t buf[64];
+} sendMockupMbr;
+
+static int sendMockup(const void *src, uint32_t n) {
+    assert(sendMockupMbr.n + n <= sizeof(sendMockupMbr.buf));
+
+    sendMockupMbr.sendWasCalled = true;
+    memcpy(sendMockupMbr.buf + sendMockupMbr.n, src, n);
+    sendMockupMbr.n += n;
+    return 0;
+}
+
+static int failingSendMockup(const void *src, uint32_t n) {
+    return -1;
+}
+
+static void fakeSendInitiate(nadam_send_t send) {
+    memset(&sendMockupMbr, 0, sizeof(sendMockupMbr));
+    mbr.send = send;
+    mbr.hashLength = 4;
+}
+// nadam_send helper - end
+
+int sendFixedSizeMessageBasic(void) {
+    nadam_messageInfo_t info = { .name = "Aries", .size = { false, { 5 } }, .hash = "Arie" };
+    nadam_init(&info, 1, 4);
+    fakeSendInitiate(sendMockup);
+
+    const char *msg = "Hello";
+    const char *expected = "ArieHello";
+    ASSERT(!nadam_send("Aries", msg, 0));
+    ASSERT(sendMockupMbr.n == strlen(expected));
+    ASSERT(memcmp(sendMockupMbr.buf, expected, sendMockupMbr.n) == 0);
+    return 0;
+}
+
+int sendVariableSizeMessageBasic(void) {
+    nadam_messageInfo_t info = { .name = "Taurus", .size = { true, { 2 } }, .hash = "Taur" };
+    nadam_init(&info, 1, 4);
+    fakeSendInitiate(sendMockup);
+
+    const char *msg = "Hi";
+    const uint32_t msgLength = 2;
+    const char expected[] = "Taur\x02\x00\x00\x00Hi";
+    size_t expectedSize = sizeof(expected) - 1;
+
+    ASSERT(!nadam_send("Taurus", msg, msgLength));
+    ASSERT(sendMockupMbr.n == expectedSize);
+    ASSERT(memcmp(sendMockupMbr.buf, expected, expectedSize) == 0);
+    return 0;
+}
+
+int sendUnknownMessageError(void) {
+    nadam_messageInfo_t info = { .name = "Gemini", .size = { false, { 5 } }, .hash = "Gemi" };
+    nadam_init(&info, 1, 4);
+    fakeSendInitiate(sendMockup);
+
+    const char *msg = "don't care";
+    errno = 0;
+    ASSERT(nadam_send("something went wrong", msg, 0));
+    ASSERT(errno == NADAM_ERROR_UNKNOWN_NAME);
+    ASSERT(!sendMockupMbr.sendWasCalled);
+    return 0;
+}
+
+int sendByIndexBasic(void) {
+    nadam_messageInfo_t infos[] = { { .name = "Cancer", .size = { false, { 1 } }, .hash = "Canc" },
+        { .name = "Leo", .size = { false, { 2 } }, .hash = "Leo_" } };
+    nadam_init(infos, 2, 4);
+    fakeSendInitiate(sendMockup);
+
+    const char *expected = "Leo_Hi";
+    ASSERT(!nadam_sendByIndex(1, "Hi", 0));
+    ASSERT(sendMockupMbr.n == strlen(expected));
+    ASSERT(memcmp(sendMockupMbr.buf, expected, sendMockupMbr.n) == 0);
+
+    errno = 0;
+    ASSERT(nadam_sendByIndex(2, "Hi", 0));
+    ASSERT(errno == NADAM_ERROR_UNKNOWN_NAME);
+    return 0;
+}
+
+int sendCommunicationError(void) {
+    nadam_messageInfo_t info = { .name = "Virgo" };
+    nadam_init(&info, 1, 4);
+    fakeSendInitiate(failingSendMockup);
+
+    const char *msg = "don't care";
+    errno = 0;
+    ASSERT(nadam_send("Virgo", msg, 0));
+    ASSERT(errno == NADAM_ERROR_SEND);
+    return 0;
+}
+
+int sendVariableSizeExceedingLengthError(void) {
+    nadam_messageInfo_t info = { .name = "Libra", .size = { true, { 7 } } };
+    nadam_init(&info, 1, 4);
+    fakeSendInitiate(sendMockup);
+
+    const char msg[] = "size of this message has somehow swollen";
+    const uint32_t msgSize = (uint32_t) sizeof(msg) - 1;
+    errno = 0;
+    ASSERT(nadam_send("Libra", msg, msgSize));
+    ASSERT(errno == NADAM_ERROR_SIZE_ARG);
+    ASSERT(!sendMockupMbr.sendWasCalled);
+    return 0;
+}
+
+int sendSizeReachingFlagsError(void) {
+    nadam_messageInfo_t info = { .name = "Pyxis", .size = { true, { 8 } }, .hash = "Pyxi" };
+    nadam_init(&info, 1, 4);
+    fakeSendInitiate(sendMockup);
+    // a maximum this large isn't allocated - the size is rejected before the message is read
+    info.size.max = UINT32_MAX;
+    char msg[1] = { 0 };
+
+    mbr.negotiatedFeatures = 0;
+    ASSERT(fitsSizeField(UINT32_MAX));
+
+    mbr.negotiatedFeatures = NADAM_FEATURE_COMPRESSION;
+    ASSERT(fitsSizeField(SIZE_COMPRESSED_FLAG - 1) && !fitsSizeField(SIZE_COMPRESSED_FLAG));
+    errno = 0;
+    ASSERT(nadam_send("Pyxis", msg, SIZE_COMPRESSED_FLAG));
+    ASSERT(errno == NADAM_ERROR_SIZE_ARG);
+
+    mbr.negotiatedFeatures = NADAM_FEATURE_FRAGMENTS | NADAM_FEATURE_COMPRESSION;
+    ASSERT(fitsSizeField(SIZE_FRAGMENT_FLAG - 1) && !fitsSizeField(SIZE_FRAGMENT_FLAG));
+    errno = 0;
+    ASSERT(nadam_send("Pyxis", msg, SIZE_FRAGMENT_FLAG));
+    ASSERT(errno == NADAM_ERROR_SIZE_ARG);
+
+    mbr.negotiatedFeatures = NADAM_FEATURE_FRAGMENTS;
+    struct iovec parts[] = { { msg, SIZE_FRAGMENT_FLAG } };
+    errno = 0;
+    ASSERT(nadam_sendv("Pyxis", parts, 1));
+    ASSERT(errno == NADAM_ERROR_SIZE_ARG);
+    ASSERT(!sendMockupMbr.sendWasCalled);
+    mbr.negotiatedFeatures = 0;
+    return 0;
+}
+
+// nadam_sendv
+int sendvPassesPartsToSend(void) {
+    nadam_messageInfo_t info = { .name = "Taurus", .size = { true, { 8 } }, .hash = "Taur" };
+    nadam_init(&info, 1, 4);
+    fakeSendInitiate(sendMockup);
+
+    char he[] = "He", llo[] = "llo";
+    struct iovec parts[] = { { he, 2 }, { NULL, 0 }, { llo, 3 } };
+    const char expected[] = "Taur\x05\x00\x00\x00Hello";
+    ASSERT(!nadam_sendv("Taurus", parts, 3));
+    ASSERT(sendMockupMbr.n == sizeof(expected) - 1);
+    ASSERT(memcmp(sendMockupMbr.buf, expected, sizeof(expected) - 1) == 0);
+    return 0;
+}
+
+int sendvWritesFrameToSendFd(void) {
+    nadam_messageInfo_t info = { .name = "Taurus", .size = { false, { 5 } }, .hash = "Taur" };
+    nadam_init(&info, 1, 4);
+    int p[2];
+    ASSERT(!pipe(p));
+    // the send function isn't used
+    fakeSendInitiate(failingSendMockup);
+    nadam_setSendFd(p[1]);
+
+    char hel[] = "Hel", lo[] = "lo";
+    struct iovec parts[] = { { hel, 3 }, { lo, 2 } };
+    ASSERT(!nadam_sendv("Taurus", parts, 2));
+    char buf[16];
+    ASSERT(read(p[0], buf, sizeof(buf)) == 9);
+    ASSERT(memcmp(buf, "TaurHello", 9) == 0);
+    close(p[0]);
+    close(p[1]);
+    return 0;
+}
+
+int sendvSizeErrors(void) {
+    nadam_messageInfo_t infos[] = { { .name = "Taurus", .size = { false, { 5 } }, .hash = "Taur" },
+        { .name = "Gemini", .size = { true, { 4 } }, .hash = "Gemi" } };
+    nadam_init(infos, 2, 4);
+    fakeSendInitiate(sendMockup);
+
+    char hel[] = "Hel", lo[] = "lo!";
+    struct iovec parts[] = { { hel, 3 }, { lo, 3 } };
+    errno = 0;
+    ASSERT(nadam_sendv("Taurus", parts, 1));
+    ASSERT(errno == NADAM_ERROR_SIZE_ARG);
+    errno = 0;
+    ASSERT(nadam_sendv("Gemini", parts, 2));
+    ASSERT(errno == NADAM_ERROR_SIZE_ARG);
+    errno = 0;
+    ASSERT(nadam_sendv("Gemini", parts, -1));
+    ASSERT(errno == NADAM_ERROR_INVALID_ARGUMENT);
+    ASSERT(!sendMockupMbr.sendWasCalled);
+    return 0;
+}
+
+// nadam_sendFromFd
+#include <fcntl.h>
+
+static const char *sendFileTestPath = "/tmp/nadam_unittest.body";
+static int pipeSendFd;
+
+static int pipeSendMockup(const void *src, uint32_t n) {
+    return write(pipeSendFd, src, n) == (ssize_t) n ? 0 : -1;
+}
+
+static int openTestBody(const char *content) {
+    int fd = open(sendFileTestPath, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    size_t length = strlen(content);
+    if (fd < 0 || write(fd, content, length) != (ssize_t) length)
+        return -1;
+    return fd;
+}
+
+int sendFromFdMovesBodyToPipe(void) {
+    nadam_messageInfo_t info = { .name = "Draco", .size = { true, { 16 } }, .hash = "Drac" };
+    nadam_init(&info, 1, 4);
+    int p[2];
+    ASSERT(!pipe(p));
+    fakeSendInitiate(pipeSendMockup);
+    pipeSendFd = p[1];
+    nadam_setSendFd(p[1]);
+    int fd = openTestBody("xxHelloWorld");
+    ASSERT(fd >= 0);
+
+    ASSERT(!nadam_sendFromFd("Draco", fd, 2, 10));
+    const char expected[] = "Drac\x0a\x00\x00\x00HelloWorld";
+    char buf[sizeof(expected)];
+    ASSERT(read(p[0], buf, sizeof(buf)) == sizeof(expected) - 1);
+    ASSERT(memcmp(buf, expected, sizeof(expected) - 1) == 0);
+
+    close(fd);
+    close(p[0]);
+    close(p[1]);
+    unlink(sendFileTestPath);
+    return 0;
+}
+
+int sendFromFdWithoutSendFdCopies(void) {
+    nadam_messageInfo_t info = { .name = "Draco", .size = { false, { 5 } }, .hash = "Drac" };
+    nadam_init(&info, 1, 4);
+    fakeSendInitiate(sendMockup);
+    int fd = openTestBody("Hello");
+    ASSERT(fd >= 0);
+
+    ASSERT(!nadam_sendFromFd("Draco", fd, 0, 5));
+    ASSERT(sendMockupMbr.n == 9);
+    ASSERT(memcmp(sendMockupMbr.buf, "DracHello", 9) == 0);
+    close(fd);
+    unlink(sendFileTestPath);
+    return 0;
+}
+
+int sendFromFdArgumentErrors(void) {
+    nadam_messageInfo_t infos[] = { { .name = "Draco", .size = { false, { 5 } }, .hash = "Drac" },
+        { .name = "Lupus", .size = { true, { 4 } }, .hash = "Lupu" } };
+    nadam_init(infos, 2, 4);
+    fakeSendInitiate(sendMockup);
+    int fd = openTestBody("Hello");
+    ASSERT(fd >= 0);
+
+    errno = 0;
+    ASSERT(nadam_sendFromFd("Draco", fd, 0, 4));
+    ASSERT(errno == NADAM_ERROR_SIZE_ARG);
+    errno = 0;
+    ASSERT(nadam_sendFromFd("Lupus", fd, 0, 5));
+    ASSERT(errno == NADAM_ERROR_SIZE_ARG);
+    errno = 0;
+    ASSERT(nadam_sendFromFd("Lupus", fd, 2, 4));
+    ASSERT(errno == NADAM_ERROR_FILE);
+    ASSERT(!sendMockupMbr.sendWasCalled);
+    close(fd);
+    unlink(sendFileTestPath);
+    return 0;
+}
+
+// recvWorker
+static struct {
+    int error;
+    size_t n;
+    uint8_t buf[256];
+    size_t bufIndex;
+    uint32_t nRecv;
+    uint8_t bufRecv[256];
+    bool delegateCalled;
+} recvMockupMbr;
+
+static int recvMockup(void *dest, uint32_t n) {
+    if (n > recvMockupMbr.n)
+        return -1;
+
+    memcpy(dest, recvMockupMbr.buf + recvMockupMbr.bufIndex, n);
+    recvMockupMbr.n -= n;
+    recvMockupMbr.bufIndex += n;
+    return 0;
+}
+
+static void errorDelegateMockup(int error) {
+    recvMockupMbr.error = error;
+}
+
+static void fakeRecvContent(const void *recvContent, size_t n) {
+    assert(n <= sizeof(recvMockupMbr.buf));
+
+    memset(&recvMockupMbr, 0, sizeof(recvMockupMbr));
+    memcpy(recvMockupMbr.buf, recvContent, n);
+    recvMockupMbr.n = n;
+
+    mbr.recv = recvMockup;
+    mbr.errorDelegate = errorDelegateMockup;
+    mbr.hashLength = 4;
+}
+
+static void fakeRecvInitiate(const void *recvContent, size_t n) {
+    fakeRecvContent(recvContent, n);
+    allocateFeatureBuffers(getTables());
+    fillDispatch(getTables());
+    recvWorker(NULL);
+}
+
+static void recvDelegateMockup(void *msg, uint32_t size, const nadam_messageInfo_t *mi) {
+    recvMockupMbr.delegateCalled = true;
+    memcpy(recvMockupMbr.bufRecv + recvMockupMbr.nRecv, msg, size);
+    recvMockupMbr.nRecv += size;
+}
+// recvWorker helper - end
+
+int recvFixedSizeMessageBasic(void) {
+    nadam_messageInfo_t info = { .name = "Sagittarius", .size = { false, { 5 } }, .hash = "Sagi" };
+    nadam_init(&info, 1, 4);
+    nadam_setDelegate("Sagittarius", recvDelegateMockup);
+
+    const char *recvContent = "Sagi54321";
+    size_t recvContentLength = strlen(recvContent);
+    const char *expected = "54321";
+    size_t expectedLength = strlen(expected);
+    fakeRecvInitiate(recvContent, recvContentLength);
+
+    ASSERT(recvMockupMbr.error == NADAM_ERROR_RECV);
+    ASSERT(recvMockupMbr.nRecv == expectedLength);
+    ASSERT(memcmp(recvMockupMbr.bufRecv, expected, expectedLength) == 0);
+    return 0;
+}
+
+int recvVariableSizeMessageBasic(void) {
+    nadam_messageInfo_t info = { .name = "Capricorn", .size = { true, { 8 } }, .hash = "Capr" };
+    nadam_init(&info, 1, 4);
+    nadam_setDelegate("Capricorn", recvDelegateMockup);
+
+    const char recvContent[] = "Capr\x08\x00\x00\x00hi there";
+    size_t recvContentLength = sizeof(recvContent) - 1;
+    const char *expected = "hi there";
+    size_t expectedLength = strlen(expected);
+    fakeRecvInitiate(recvContent, recvContentLength);
+
+    ASSERT(recvMockupMbr.error == NADAM_ERROR_RECV);
+    ASSERT(recvMockupMbr.nRecv == expectedLength);
+    ASSERT(memcmp(recvMockupMbr.bufRecv, expected, expectedLength) == 0);
+    return 0;
+}
+
+int recvUnknownHashError(void) {
+    nadam_messageInfo_t info = { .name = "Cancer", .size = { false, { 5 } }, .hash = "Canc" };
+    nadam_init(&info, 1, 4);
+    nadam_setDelegate("Cancer", recvDelegateMockup);
+
+    const char *recvContent = "wrongHash";
+    size_t recvContentLength = strlen(recvContent);
+    fakeRecvInitiate(recvContent, recvContentLength);
+
+    ASSERT(recvMockupMbr.error == NADAM_ERROR_UNKNOWN_HASH);
+    ASSERT(!recvMockupMbr.delegateCalled);
+    return 0;
+}
+
+int recvVariableSizeError(void) {
+    nadam_messageInfo_t info = { .name = "Aquarius", .size = { true, { 5 } }, .hash = "Aqua" };
+    nadam_init(&info, 1, 4);
+    nadam_setDelegate("Aquarius", recvDelegateMockup);
+
+    const char recvContent[] = "Aqua\x06\x00\x00\x00hello!";
+    size_t recvContentLength = sizeof(recvContent) - 1;
+    fakeRecvInitiate(recvContent, recvContentLength);
+
+    ASSERT(recvMockupMbr.error == NADAM_ERROR_VARIABLE_SIZE);
+    ASSERT(!recvMockupMbr.delegateCalled);
+    return 0;
+}
+
+// buffer provider
+static struct {
+    uint8_t slots[2][16];
+    int acquireCount;
+    int dropAt;
+    uint32_t acquiredSize;
+    void *released;
+    void *delivered;
+} providerMockupMbr;
+
+static void *acquireMockup(uint32_t size, const nadam_messageInfo_t *mi, void *context) {
+    int n = providerMockupMbr.acquireCount++;
+    providerMockupMbr.acquiredSize = size;
+    return n == providerMockupMbr.dropAt ? NULL : providerMockupMbr.slots[n % 2];
+}
+
+static void releaseMockup(void *buffer, void *context) {
+    providerMockupMbr.released = buffer;
+}
+
+static void providedDelegateMockup(void *msg, uint32_t size, const nadam_messageInfo_t *mi) {
+    providerMockupMbr.delivered = msg;
+    recvDelegateMockup(msg, size, mi);
+}
+
+static void setProviderMockup(const char *name, int dropAt) {
+    memset(&providerMockupMbr, 0, sizeof(providerMockupMbr));
+    providerMockupMbr.dropAt = dropAt;
+    nadam_bufferProvider_t provider = { acquireMockup, releaseMockup, NULL };
+    nadam_setDelegate(name, providedDelegateMockup);
+    nadam_setBufferProvider(name, &provider);
+}
+
+int recvIntoProvidedBuffer(void) {
+    nadam_messageInfo_t info = { .name = "Capricorn", .size = { true, { 8 } }, .hash = "Capr" };
+    nadam_init(&info, 1, 4);
+    setProviderMockup("Capricorn", -1);
+
+    const char recvContent[] = "Capr\x02\x00\x00\x00hi" "Capr\x03\x00\x00\x00you";
+    fakeRecvInitiate(recvContent, sizeof(recvContent) - 1);
+
+    ASSERT(recvMockupMbr.error == NADAM_ERROR_RECV);
+    ASSERT(providerMockupMbr.acquireCount == 2);
+    ASSERT(providerMockupMbr.acquiredSize == 3);
+    ASSERT(providerMockupMbr.delivered == providerMockupMbr.slots[1]);
+    ASSERT(memcmp(providerMockupMbr.slots[0], "hi", 2) == 0);
+    ASSERT(memcmp(recvMockupMbr.bufRecv, "hiyou", 5) == 0);
+    ASSERT(providerMockupMbr.released == NULL);
+    return 0;
+}
+
+int messageWithoutProvidedBufferIsDropped(void) {
+    nadam_messageInfo_t info = { .name = "Sagittarius", .size = { false, { 5 } }, .hash = "Sagi" };
+    nadam_init(&info, 1, 4);
+    setProviderMockup("Sagittarius", 0);
+
+    const char *recvContent = "Sagi54321Sagi12345";
+    fakeRecvInitiate(recvContent, strlen(recvContent));
+
+    ASSERT(recvMockupMbr.error == NADAM_ERROR_RECV);
+    ASSERT(recvMockupMbr.nRecv == 5);
+    ASSERT(memcmp(recvMockupMbr.bufRecv, "12345", 5) == 0);
+    ASSERT(providerMockupMbr.delivered == providerMockupMbr.slots[1]);
+    return 0;
+}
+
+int providedBufferIsReleasedOnRecvError(void) {
+    nadam_messageInfo_t info = { .name = "Sagittarius", .size = { false, { 5 } }, .hash = "Sagi" };
+    nadam_init(&info, 1, 4);
+    setProviderMockup("Sagittarius", -1);
+
+    const char *recvContent = "Sagi543";
+    fakeRecvInitiate(recvContent, strlen(recvContent));
+
+    ASSERT(recvMockupMbr.error == NADAM_ERROR_RECV);
+    ASSERT(!recvMockupMbr.delegateCalled);
+    ASSERT(providerMockupMbr.released == providerMockupMbr.slots[0]);
+    return 0;
+}
+
+int fragmentsAreReassembledInProvidedBuffer(void) {
+    nadam_messageInfo_t info = { .name = "Cetus", .size = { true, { 6 } }, .hash = "Cetu" };
+    nadam_init(&info, 1, 4);
+    mbr.negotiatedFeatures = NADAM_FEATURE_FRAGMENTS;
+    setProviderMockup("Cetus", -1);
+
+    const char recvContent[] = "Cetu\x02\x00\x00\x40" "ab" "Cetu\x03\x00\x00\x00" "cde";
+    fakeRecvInitiate(recvContent, sizeof(recvContent) - 1);
+
+    ASSERT(recvMockupMbr.error == NADAM_ERROR_RECV);
+    // room for the whole message
+    ASSERT(providerMockupMbr.acquireCount == 1);
+    ASSERT(providerMockupMbr.acquiredSize == 6);
+    ASSERT(providerMockupMbr.delivered == providerMockupMbr.slots[0]);
+    ASSERT(recvMockupMbr.nRecv == 5);
+    ASSERT(memcmp(recvMockupMbr.bufRecv, "abcde", 5) == 0);
+    return 0;
+}
+
+int setBufferProviderErrors(void) {
+    nadam_messageInfo_t info = { .name = "Sagittarius", .size = { false, { 5 } }, .hash = "Sagi" };
+    nadam_init(&info, 1, 4);
+    nadam_bufferProvider_t provider = { NULL, releaseMockup, NULL };
+    errno = 0;
+    ASSERT(nadam_setBufferProvider("Sagittarius", &provider));
+    ASSERT(errno == NADAM_ERROR_NULL_POINTER);
+
+    provider.acquire = acquireMockup;
+    ASSERT(nadam_setBufferProvider("Sirius", &provider));
+    ASSERT(!nadam_setBufferProvider("Sagittarius", &provider));
+    ASSERT(!nadam_setBufferProvider("Sagittarius", NULL));
+    return 0;
+}
+
+// handshake
+int plainHandshakeWithoutFeatures(void) {
+    nadam_messageInfo_t info = { .name = "Pisces" };
+    nadam_init(&info, 1, 3);
+    fakeSendInitiate(sendMockup);
+    mbr.hashLength = 3;
+
+    ASSERT(!handshakeSendHashLength());
+    ASSERT(sendMockupMbr.n == 1);
+    ASSERT(sendMockupMbr.buf[0] == 3);
+    return 0;
+}
+
+int extendedHandshakeWithFeatures(void) {
+    nadam_messageInfo_t info = { .name = "Pisces" };
+    nadam_init(&info, 1, 3);
+    ASSERT(!nadam_setFeatures(NADAM_FEATURE_TIMESTAMP));
+    fakeSendInitiate(sendMockup);
+    mbr.hashLength = 3;
+
+    const uint8_t expected[] = { 0x83, 12, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+    ASSERT(!handshakeSendHashLength());
+    ASSERT(sendMockupMbr.n == sizeof(expected));
+    ASSERT(memcmp(sendMockupMbr.buf, expected, sizeof(expected)) == 0);
+    return 0;
+}
+
+int unsupportedFeatureError(void) {
+    nadam_messageInfo_t info = { .name = "Pisces" };
+    nadam_init(&info, 1, 4);
+    errno = 0;
+    ASSERT(nadam_setFeatures(0x80000000));
+    ASSERT(errno == NADAM_ERROR_INVALID_ARGUMENT);
+    return 0;
+}
+
+int extendedHandshakeRecvNegotiatesCommonFeatures(void) {
+    nadam_messageInfo_t info = { .name = "Pisces" };
+    nadam_init(&info, 1, 2);
+    nadam_setFeatures(NADAM_FEATURE_TIMESTAMP);
+
+    // reserved extension bytes have to be skipped
+    const uint8_t recvContent[] = { 0x83, 6, 0x03, 0, 0, 0x80, 0xAA, 0xBB };
+    fakeRecvContent(recvContent, sizeof(recvContent));
+    mbr.hashLength = 2;
+
+    ASSERT(!handshakeHandleHashLengthRecv());
+    ASSERT(mbr.hashLength == 3);
+    ASSERT(nadam_getNegotiatedFeatures() == NADAM_FEATURE_TIMESTAMP);
+    ASSERT(recvMockupMbr.n == 0);
+    return 0;
+}
+
+int extendedHandshakeWithLimits(void) {
+    nadam_messageInfo_t info = { .name = "Pisces" };
+    nadam_init(&info, 1, 3);
+    nadam_limits_t limits = { .frameMax = 0x10000, .batchPreferred = 16 };
+    ASSERT(!nadam_setLimits(&limits));
+    fakeSendInitiate(sendMockup);
+    mbr.hashLength = 3;
+
+    // limits alone send the extended handshake
+    const uint8_t expected[] = { 0x83, 12, 0, 0, 0, 0, 0, 0, 1, 0, 16, 0, 0, 0 };
+    ASSERT(!handshakeSendHashLength());
+    ASSERT(sendMockupMbr.n == sizeof(expected));
+    ASSERT(memcmp(sendMockupMbr.buf, expected, sizeof(expected)) == 0);
+    return 0;
+}
+
+int extensionWithoutLimitsDoesntBindFrames(void) {
+    nadam_messageInfo_t info = { .name = "Pisces" };
+    nadam_init(&info, 1, 4);
+    nadam_limits_t limits = { .frameMax = 4 };
+    nadam_setLimits(&limits);
+    mbr.peerLimits.frameMax = 2;
+
+    // the peer doesn't know limits - ours aren't enforced, it has none
+    const uint8_t recvContent[] = { 0x84, 4, 0, 0, 0, 0 };
+    fakeRecvContent(recvContent, sizeof(recvContent));
+    ASSERT(!handshakeHandleHashLengthRecv());
+    ASSERT(mbr.recvFrameMax == 0);
+    ASSERT(mbr.peerLimits.frameMax == 0);
+    ASSERT(mbr.fragmentLength == FRAGMENT_LENGTH);
+    return 0;
+}
+
+int plainHandshakeRecvDisablesFeatures(void) {
+    nadam_messageInfo_t info = { .name = "Pisces" };
+    nadam_init(&info, 1, 4);
+    nadam_setFeatures(NADAM_FEATURE_TIMESTAMP);
+
+    const uint8_t recvContent[] = { 2 };
+    fakeRecvContent(recvContent, sizeof(recvContent));
+
+    ASSERT(!handshakeHandleHashLengthRecv());
+    ASSERT(mbr.hashLength == 4);
+    ASSERT(nadam_getNegotiatedFeatures() == 0);
+    return 0;
+}
+
+// timestamp
+int sendWithTimestampFollowingId(void) {
+    nadam_messageInfo_t info = { .name = "Leo", .size = { false, { 2 } }, .hash = "Leo" };
+    nadam_init(&info, 1, 4);
+    fakeSendInitiate(sendMockup);
+    mbr.negotiatedFeatures = NADAM_FEATURE_TIMESTAMP;
+
+    uint64_t before = nadam_timestamp();
+    ASSERT(!nadam_send("Leo", "hi", 0));
+    ASSERT(sendMockupMbr.n == 4 + TIMESTAMP_LENGTH + 2);
+    uint64_t timestamp;
+    memcpy(&timestamp, sendMockupMbr.buf + 4, TIMESTAMP_LENGTH);
+    ASSERT(timestamp >= before && timestamp <= nadam_timestamp());
+    ASSERT(memcmp(sendMockupMbr.buf + 4 + TIMESTAMP_LENGTH, "hi", 2) == 0);
+    return 0;
+}
+
+int recvWithTimestampRecordsLatency(void) {
+    nadam_messageInfo_t info = { .name = "Scorpius", .size = { false, { 2 } }, .hash = "Scor" };
+    nadam_init(&info, 1, 4);
+    nadam_setDelegate("Scorpius", recvDelegateMockup);
+    mbr.negotiatedFeatures = NADAM_FEATURE_TIMESTAMP;
+    ASSERT(!allocateFeatureBuffers(getTables()));
+    ASSERT(getTables()->types[0]->latencies);
+
+    uint8_t recvContent[4 + TIMESTAMP_LENGTH + 2] = "Scor";
+    uint64_t timestamp = nadam_timestamp();
+    memcpy(recvContent + 4, &timestamp, TIMESTAMP_LENGTH);
+    memcpy(recvContent + 4 + TIMESTAMP_LENGTH, "ok", 2);
+    fakeRecvInitiate(recvContent, sizeof(recvContent));
+
+    ASSERT(recvMockupMbr.nRecv == 2);
+    nadam_histogram_t h;
+    ASSERT(!nadam_getLatencyHistogram("Scorpius", NADAM_LATENCY_ONE_WAY, &h));
+    ASSERT(h.count == 1);
+    ASSERT(!nadam_getLatencyHistogram("Scorpius", NADAM_LATENCY_DELEGATE, &h));
+    ASSERT(h.count == 1);
+    ASSERT(!nadam_getLatencyHistogram("Scorpius", NADAM_LATENCY_ROUND_TRIP, &h));
+    ASSERT(h.count == 0);
+    ASSERT(!nadam_recordRoundTrip("Scorpius", timestamp));
+    ASSERT(!nadam_getLatencyHistogram("Scorpius", NADAM_LATENCY_ROUND_TRIP, &h));
+    ASSERT(h.count == 1);
+    return 0;
+}
+
+static void *recordLatenciesWorker(void *arg) {
+    latencyHistograms_t *lh = arg;
+    for (uint64_t i = 0; i < 100000; ++i)
+        recordRecvLatencies(lh, i, i & 0xFF);
+    return NULL;
+}
+
+int latencyExportDuringRecordingIsConsistent(void) {
+    nadam_messageInfo_t info = { .name = "Scorpius", .size = { false, { 2 } }, .hash = "Scor" };
+    nadam_init(&info, 1, 4);
+    mbr.negotiatedFeatures = NADAM_FEATURE_TIMESTAMP;
+    ASSERT(!allocateFeatureBuffers(getTables()));
+
+    pthread_t thread;
+    ASSERT(!pthread_create(&thread, NULL, recordLatenciesWorker, getTables()->types[0]->latencies));
+    nadam_histogram_t h;
+    do {
+        ASSERT(!nadam_getLatencyHistogram("Scorpius", NADAM_LATENCY_ONE_WAY, &h));
+        uint64_t bucketSum = 0;
+        for (size_t i = 0; i < NADAM_HISTOGRAM_BUCKET_COUNT; ++i)
+            bucketSum += h.buckets[i];
+        ASSERT(bucketSum == h.count);
+    } while (h.count < 100000);
+    pthread_join(thread, NULL);
+    return 0;
+}
+
+// wire mockup - records whole frames for a subsequent recv
+static struct {
+    uint8_t buf[4096];
+    size_t n;
+} wireMockupMbr;
+
+static int wireSendMockup(const void *src, uint32_t n) {
+    assert(wireMockupMbr.n + n <= sizeof(wireMockupMbr.buf));
+    memcpy(wireMockupMbr.buf + wireMockupMbr.n, src, n);
+    wireMockupMbr.n += n;
+    return 0;
+}
+// wire mockup - end
+
+// compression
+int compressedSendAndRecv(void) {
+    nadam_messageInfo_t info = { .name = "Hydra", .size = { true, { 1000 } }, .hash = "Hydr" };
+    nadam_init(&info, 1, 4);
+    mbr.negotiatedFeatures = NADAM_FEATURE_COMPRESSION;
+    ASSERT(!allocateFeatureBuffers(getTables()));
+    ASSERT(!nadam_setCompression("Hydra", 64));
+    nadam_setDelegate("Hydra", recvDelegateMockup);
+    fakeSendInitiate(wireSendMockup);
+
+    // below threshold - sent as is
+    wireMockupMbr.n = 0;
+    char msg[60];
+    memset(msg, 'x', sizeof(msg));
+    ASSERT(!nadam_send("Hydra", msg, sizeof(msg)));
+    ASSERT(wireMockupMbr.n == 4 + 4 + sizeof(msg));
+
+    wireMockupMbr.n = 0;
+    char repetitive[64];
+    memset(repetitive, 'y', sizeof(repetitive));
+    ASSERT(!nadam_send("Hydra", repetitive, sizeof(repetitive)));
+    ASSERT(wireMockupMbr.n < 4 + 4 + sizeof(repetitive));
+    uint32_t sizeField;
+    memcpy(&sizeField, wireMockupMbr.buf + 4, 4);
+    ASSERT(sizeField & SIZE_COMPRESSED_FLAG);
+
+    fakeRecvContent(wireMockupMbr.buf, wireMockupMbr.n);
+    fillDispatch(getTables());
+    ASSERT(!recvFrame());
+    ASSERT(recvMockupMbr.nRecv == sizeof(repetitive));
+    ASSERT(memcmp(recvMockupMbr.bufRecv, repetitive, sizeof(repetitive)) == 0);
+    return 0;
+}
+
+int incompressibleMessageIsSentUncompressed(void) {
+    nadam_messageInfo_t info = { .name = "Hydra", .size = { true, { 1000 } }, .hash = "Hydr" };
+    nadam_init(&info, 1, 4);
+    mbr.negotiatedFeatures = NADAM_FEATURE_COMPRESSION;
+    ASSERT(!allocateFeatureBuffers(getTables()));
+    ASSERT(!nadam_setCompression("Hydra", 1));
+    fakeSendInitiate(wireSendMockup);
+
+    wireMockupMbr.n = 0;
+    const char *msg = "no repetition";
+    ASSERT(!nadam_send("Hydra", msg, (uint32_t) strlen(msg)));
+    ASSERT(wireMockupMbr.n == 4 + 4 + strlen(msg));
+    ASSERT(memcmp(wireMockupMbr.buf + 8, msg, strlen(msg)) == 0);
+    return 0;
+}
+
+int compressionOfFixedSizeTypeError(void) {
+    nadam_messageInfo_t info = { .name = "Lynx", .size = { false, { 1000 } } };
+    nadam_init(&info, 1, 4);
+    errno = 0;
+    ASSERT(nadam_setCompression("Lynx", 64));
+    ASSERT(errno == NADAM_ERROR_INVALID_ARGUMENT);
+    return 0;
+}
+
+int corruptCompressedDataError(void) {
+    nadam_messageInfo_t info = { .name = "Lupus", .size = { true, { 16 } }, .hash = "Lupu" };
+    nadam_init(&info, 1, 4);
+    mbr.negotiatedFeatures = NADAM_FEATURE_COMPRESSION;
+    ASSERT(!allocateFeatureBuffers(getTables()));
+    nadam_setDelegate("Lupus", recvDelegateMockup);
+
+    // uncompressed size 16, but the literals make only 3 bytes
+    const char recvContent[] = "Lupu\x08\x00\x00\x80\x10\x00\x00\x00\x30" "abc";
+    fakeRecvInitiate(recvContent, sizeof(recvContent) - 1);
+    ASSERT(recvMockupMbr.error == NADAM_ERROR_DECOMPRESS);
+    ASSERT(!recvMockupMbr.delegateCalled);
+    return 0;
+}
+
+// delta
+int deltaEncodedSendAndRecv(void) {
+    nadam_messageInfo_t info = { .name = "Draco", .size = { false, { 64 } }, .hash = "Drac" };
+    nadam_init(&info, 1, 4);
+    mbr.negotiatedFeatures = NADAM_FEATURE_DELTA;
+    ASSERT(!allocateFeatureBuffers(getTables()));
+    ASSERT(!nadam_setDelta("Draco", 3));
+    uint8_t recvBuffer[64];
+    nadam_setDelegateWithRecvBuffer("Draco", recvDelegateMockup, recvBuffer, NULL);
+    fakeSendInitiate(wireSendMockup);
+
+    uint8_t value[64] = { 0 };
+    wireMockupMbr.n = 0;
+    ASSERT(!nadam_send("Draco", value, 0));
+    ASSERT(wireMockupMbr.n == 4 + 1 + sizeof(value));
+    ASSERT(wireMockupMbr.buf[4] == FRAME_KIND_FULL);
+
+    value[10] = 1;
+    ASSERT(!nadam_send("Draco", value, 0));
+    ASSERT(wireMockupMbr.n < 2 * (4 + 1 + sizeof(value)));
+    // third message - full frame is due
+    value[20] = 2;
+    ASSERT(!nadam_send("Draco", value, 0));
+
+    fakeRecvContent(wireMockupMbr.buf, wireMockupMbr.n);
+    fillDispatch(getTables());
+    ASSERT(!recvFrame());
+    ASSERT(!recvFrame());
+    ASSERT(recvBuffer[10] == 1 && recvBuffer[20] == 0);
+    ASSERT(!recvFrame());
+    ASSERT(memcmp(recvBuffer, value, sizeof(value)) == 0);
+    ASSERT(recvMockupMbr.n == 0);
+    return 0;
+}
+
+int requestedFullFrameIsSent(void) {
+    nadam_messageInfo_t info = { .name = "Draco", .size = { false, { 64 } }, .hash = "Drac" };
+    nadam_init(&info, 1, 4);
+    mbr.negotiatedFeatures = NADAM_FEATURE_DELTA;
+    ASSERT(!allocateFeatureBuffers(getTables()));
+    ASSERT(!nadam_setDelta("Draco", 100));
+    fakeSendInitiate(wireSendMockup);
+
+    uint8_t value[64] = { 0 };
+    wireMockupMbr.n = 0;
+    ASSERT(!nadam_send("Draco", value, 0));
+    ASSERT(!nadam_requestFullFrame("Draco"));
+    ASSERT(!nadam_send("Draco", value, 0));
+    ASSERT(wireMockupMbr.n == 2 * (4 + 1 + sizeof(value)));
+    return 0;
+}
+
+int deltaWithoutBaseError(void) {
+    nadam_messageInfo_t info = { .name = "Draco", .size = { false, { 8 } }, .hash = "Drac" };
+    nadam_init(&info, 1, 4);
+    mbr.negotiatedFeatures = NADAM_FEATURE_DELTA;
+    ASSERT(!allocateFeatureBuffers(getTables()));
+    nadam_setDelegate("Draco", recvDelegateMockup);
+
+    const char recvContent[] = "Drac\x01\x03\x00\x00\x00\x00\x01\xFF";
+    fakeRecvInitiate(recvContent, sizeof(recvContent) - 1);
+    ASSERT(recvMockupMbr.error == NADAM_ERROR_DELTA);
+    ASSERT(!recvMockupMbr.delegateCalled);
+    return 0;
+}
+
+int deltaOfVariableSizeTypeError(void) {
+    nadam_messageInfo_t info = { .name = "Vela", .size = { true, { 8 } } };
+    nadam_init(&info, 1, 4);
+    errno = 0;
+    ASSERT(nadam_setDelta("Vela", 10));
+    ASSERT(errno == NADAM_ERROR_INVALID_ARGUMENT);
+    return 0;
+}
+
+// lanes
+int fragmentedSendAndRecv(void) {
+    nadam_messageInfo_t infos[] = { { .name = "Cetus", .size = { true, { 20 } }, .hash = "Cetu" },
+        { .name = "Musca", .size = { false, { 2 } }, .hash = "Musc" } };
+    nadam_init(infos, 2, 4);
+    mbr.negotiatedFeatures = NADAM_FEATURE_FRAGMENTS;
+    mbr.fragmentLength = 8;
+    ASSERT(!nadam_setLane("Cetus", NADAM_LANE_BULK));
+    nadam_setDelegate("Cetus", recvDelegateMockup);
+    nadam_setDelegate("Musca", recvDelegateMockup);
+    fakeSendInitiate(wireSendMockup);
+
+    wireMockupMbr.n = 0;
+    const char *bulk = "abcdefghijklmnopqrst";
+    ASSERT(!nadam_send("Cetus", bulk, 20));
+    ASSERT(wireMockupMbr.n == 3 * (4 + 4) + 20);
+    uint32_t sizeField;
+    memcpy(&sizeField, wireMockupMbr.buf + 4, 4);
+    ASSERT(sizeField == (8 | SIZE_FRAGMENT_FLAG));
+    memcpy(&sizeField, wireMockupMbr.buf + 2 * (4 + 4 + 8) + 4, 4);
+    ASSERT(sizeField == 4);
+
+    // a priority message overtakes the rest of the bulk message
+    uint8_t wire[128];
+    size_t firstFragment = 4 + 4 + 8;
+    memcpy(wire, wireMockupMbr.buf, firstFragment);
+    memcpy(wire + firstFragment, "Musc!?", 6);
+    memcpy(wire + firstFragment + 6, wireMockupMbr.buf + firstFragment, wireMockupMbr.n - firstFragment);
+
+    fakeRecvContent(wire, wireMockupMbr.n + 6);
+    ASSERT(!allocateFeatureBuffers(getTables()));
+    fillDispatch(getTables());
+    for (int i = 0; i < 4; ++i)
+        ASSERT(!recvFrame());
+    ASSERT(recvMockupMbr.nRecv == 2 + 20);
+    ASSERT(memcmp(recvMockupMbr.bufRecv, "!?abcdefghijklmnopqrst", 22) == 0);
+    return 0;
+}
+
+int bulkMessageWithoutFragmentsIsSentWhole(void) {
+    nadam_messageInfo_t info = { .name = "Cetus", .size = { true, { 20 } }, .hash = "Cetu" };
+    nadam_init(&info, 1, 4);
+    mbr.fragmentLength = 8;
+    ASSERT(!nadam_setLane("Cetus", NADAM_LANE_BULK));
+    fakeSendInitiate(wireSendMockup);
+
+    wireMockupMbr.n = 0;
+    ASSERT(!nadam_send("Cetus", "abcdefghijklmnopqrst", 20));
+    ASSERT(wireMockupMbr.n == 4 + 4 + 20);
+    return 0;
+}
+
+int bulkLaneOfFixedSizeTypeError(void) {
+    nadam_messageInfo_t info = { .name = "Musca", .size = { false, { 2 } } };
+    nadam_init(&info, 1, 4);
+    errno = 0;
+    ASSERT(nadam_setLane("Musca", NADAM_LANE_BULK));
+    ASSERT(errno == NADAM_ERROR_INVALID_ARGUMENT);
+    ASSERT(!nadam_setLane("Musca", NADAM_LANE_PRIORITY));
+    return 0;
+}
+
+int compressedFragmentError(void) {
+    nadam_messageInfo_t info = { .name = "Cetus", .size = { true, { 20 } }, .hash = "Cetu" };
+    nadam_init(&info, 1, 4);
+    mbr.negotiatedFeatures = NADAM_FEATURE_FRAGMENTS | NADAM_FEATURE_COMPRESSION;
+    ASSERT(!allocateFeatureBuffers(getTables()));
+    nadam_setDelegate("Cetus", recvDelegateMockup);
+
+    const char recvContent[] = "Cetu\x02\x00\x00\xC0" "ab";
+    fakeRecvInitiate(recvContent, sizeof(recvContent) - 1);
+    ASSERT(recvMockupMbr.error == NADAM_ERROR_FRAGMENT);
+    ASSERT(!recvMockupMbr.delegateCalled);
+    return 0;
+}
+
+int fragmentsExceedingMaxSizeError(void) {
+    nadam_messageInfo_t info = { .name = "Cetus", .size = { true, { 3 } }, .hash = "Cetu" };
+    nadam_init(&info, 1, 4);
+    mbr.negotiatedFeatures = NADAM_FEATURE_FRAGMENTS;
+    nadam_setDelegate("Cetus", recvDelegateMockup);
+
+    const char recvContent[] = "Cetu\x02\x00\x00\x40" "ab" "Cetu\x02\x00\x00\x00" "cd";
+    fakeRecvInitiate(recvContent, sizeof(recvContent) - 1);
+    ASSERT(recvMockupMbr.error == NADAM_ERROR_VARIABLE_SIZE);
+    ASSERT(!recvMockupMbr.delegateCalled);
+    return 0;
+}
+
+int fragmentBuffersAreAllocatedWithFeatureBuffers(void) {
+    nadam_messageInfo_t infos[] = { { .name = "Cetus", .size = { true, { 20 } }, .hash = "Cetu" },
+        { .name = "Musca", .size = { false, { 2 } }, .hash = "Musc" } };
+    nadam_init(infos, 2, 4);
+    tables_t *t = getTables();
+    ASSERT(!allocateFeatureBuffers(t));
+    ASSERT(t->types[0]->fragmentBuffer == NULL);
+
+    mbr.negotiatedFeatures = NADAM_FEATURE_FRAGMENTS;
+    ASSERT(!allocateFeatureBuffers(t));
+    uint8_t *buffer = t->types[0]->fragmentBuffer;
+    ASSERT(buffer && t->types[1]->fragmentBuffer == NULL);
+    // kept over connections
+    ASSERT(!allocateFeatureBuffers(t));
+    ASSERT(t->types[0]->fragmentBuffer == buffer);
+    ASSERT(!prefaultRecvBuffers(t));
+    mbr.negotiatedFeatures = 0;
+    return 0;
+}
+
+int peerLimitsBoundFrames(void) {
+    nadam_messageInfo_t info = { .name = "Cetus", .size = { true, { 20 } }, .hash = "Cetu" };
+    nadam_init(&info, 1, 4);
+    nadam_setFeatures(NADAM_FEATURE_FRAGMENTS);
+    nadam_limits_t limits = { .frameMax = 4 };
+    nadam_setLimits(&limits);
+
+    const uint8_t recvContent[] = { 0x84, 12, 0x08, 0, 0, 0, 8, 0, 0, 0, 2, 0, 0, 0 };
+    fakeRecvContent(recvContent, sizeof(recvContent));
+    ASSERT(!handshakeHandleHashLengthRecv());
+    nadam_limits_t peerLimits;
+    ASSERT(!nadam_getPeerLimits(&peerLimits));
+    ASSERT(peerLimits.frameMax == 8 && peerLimits.batchPreferred == 2);
+    ASSERT(mbr.fragmentLength == 8);
+    ASSERT(mbr.recvFrameMax == 4);
+
+    // only the bulk lane is fragmented to the peer's frames
+    fakeSendInitiate(wireSendMockup);
+    wireMockupMbr.n = 0;
+    errno = 0;
+    ASSERT(nadam_send("Cetus", "abcdefghijklmnopqrst", 20));
+    ASSERT(errno == NADAM_ERROR_SIZE_ARG);
+    ASSERT(!nadam_setLane("Cetus", NADAM_LANE_BULK));
+    ASSERT(!nadam_send("Cetus", "abcdefghijklmnopqrst", 20));
+    ASSERT(wireMockupMbr.n == 3 * (4 + 4) + 20);
+
+    const char tooLong[] = "Cetu\x05\x00\x00\x00" "abcde";
+    fakeRecvContent(tooLong, sizeof(tooLong) - 1);
+    nadam_setDelegate("Cetus", recvDelegateMockup);
+    fillDispatch(getTables());
+    ASSERT(recvFrame() == NADAM_ERROR_VARIABLE_SIZE);
+    return 0;
+}
+
+// compact size
+int compactSizeOfShortMessageIsOneByte(void) {
+    nadam_messageInfo_t info = { .name = "Corvus", .size = { true, { 200 } }, .hash = "Corv" };
+    nadam_init(&info, 1, 4);
+    mbr.negotiatedFeatures = NADAM_FEATURE_COMPACT_SIZE;
+    nadam_setDelegate("Corvus", recvDelegateMockup);
+    fakeSendInitiate(wireSendMockup);
+
+    wireMockupMbr.n = 0;
+    ASSERT(!nadam_send("Corvus", "Hi", 2));
+    ASSERT(wireMockupMbr.n == 4 + 1 + 2);
+    ASSERT(memcmp(wireMockupMbr.buf, "Corv\x02Hi", 7) == 0);
+
+    uint8_t msg[130] = { [0] = 'a', [129] = 'z' };
+    ASSERT(!nadam_send("Corvus", msg, sizeof(msg)));
+    ASSERT(wireMockupMbr.n == 7 + 4 + 2 + sizeof(msg));
+    ASSERT(wireMockupMbr.buf[11] == (0x80 | 2) && wireMockupMbr.buf[12] == 1);
+
+    fakeRecvContent(wireMockupMbr.buf, wireMockupMbr.n);
+    fillDispatch(getTables());
+    ASSERT(!recvFrame());
+    ASSERT(!recvFrame());
+    ASSERT(recvMockupMbr.nRecv == 2 + sizeof(msg));
+    ASSERT(recvMockupMbr.bufRecv[2] == 'a' && recvMockupMbr.bufRecv[2 + 129] == 'z');
+    return 0;
+}
+
+int compactSizeRoundTrip(void) {
+    const uint32_t sizeFields[] = { 0, 127, 128, 16383, 16384, 8 | SIZE_FRAGMENT_FLAG, UINT32_MAX };
+    const uint32_t lengths[] = { 1, 1, 2, 2, 3, 5, 5 };
+    mbr.negotiatedFeatures = NADAM_FEATURE_COMPACT_SIZE;
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i) {
+        uint8_t compact[COMPACT_SIZE_LENGTH_MAX];
+        ASSERT(encodeCompactSize(sizeFields[i], compact) == lengths[i]);
+
+        fakeRecvContent(compact, lengths[i]);
+        uint32_t sizeField;
+        ASSERT(!recvSizeField(&sizeField));
+        ASSERT(sizeField == sizeFields[i]);
+        ASSERT(recvMockupMbr.n == 0);
+    }
+    return 0;
+}
+
+int malformedCompactSizeError(void) {
+    mbr.negotiatedFeatures = NADAM_FEATURE_COMPACT_SIZE;
+    uint32_t sizeField;
+    const uint8_t tooLong[] = { 0x80, 0x80, 0x80, 0x80, 0x80, 0x00 };
+    fakeRecvContent(tooLong, sizeof(tooLong));
+    ASSERT(recvSizeField(&sizeField) == NADAM_ERROR_VARIABLE_SIZE);
+
+    const uint8_t beyond32Bits[] = { 0xFF, 0xFF, 0xFF, 0xFF, 0x1F };
+    fakeRecvContent(beyond32Bits, sizeof(beyond32Bits));
+    ASSERT(recvSizeField(&sizeField) == NADAM_ERROR_VARIABLE_SIZE);
+
+    const uint8_t truncated[] = { 0x80 };
+    fakeRecvContent(truncated, sizeof(truncated));
+    ASSERT(recvSizeField(&sizeField) == NADAM_ERROR_RECV);
+    return 0;
+}
+
+// reconnect
+static struct {
+    atomic_int handshakesPending;
+    atomic_int errorCount;
+} reconnectMockupMbr;
+
+static int reconnectSendMockup(const void *src, uint32_t n) {
+    return 0;
+}
+
+// provides the handshake, fails afterwards
+static int reconnectRecvMockup(void *dest, uint32_t n) {
+    if (atomic_load(&reconnectMockupMbr.handshakesPending) == 0)
+        return -1;
+
+    atomic_fetch_sub(&reconnectMockupMbr.handshakesPending, 1);
+    memset(dest, 4, n);
+    return 0;
+}
+
+static void reconnectErrorDelegateMockup(int error) {
+    atomic_fetch_add(&reconnectMockupMbr.errorCount, 1);
+}
+
+static bool waitForErrorCount(int count) {
+    for (int i = 0; i < 1000 && atomic_load(&reconnectMockupMbr.errorCount) < count; ++i) {
+        struct timespec ts = { .tv_nsec = 1000000 };
+        nanosleep(&ts, NULL);
+    }
+    return atomic_load(&reconnectMockupMbr.errorCount) == count;
+}
+
+int reconnectReusesParkedRecvThread(void) {
+    nadam_messageInfo_t info = { .name = "Columba", .hash = "Colu" };
+    nadam_init(&info, 1, 4);
+    atomic_store(&reconnectMockupMbr.errorCount, 0);
+
+    atomic_store(&reconnectMockupMbr.handshakesPending, 1);
+    ASSERT(!nadam_initiate(reconnectSendMockup, reconnectRecvMockup, reconnectErrorDelegateMockup));
+    ASSERT(waitForErrorCount(1));
+    pthread_t threadId = mbr.threadId;
+
+    atomic_store(&reconnectMockupMbr.handshakesPending, 1);
+    ASSERT(!nadam_initiate(reconnectSendMockup, reconnectRecvMockup, reconnectErrorDelegateMockup));
+    ASSERT(waitForErrorCount(2));
+    ASSERT(pthread_equal(threadId, mbr.threadId));
+    ASSERT(mbr.isThreadRunning);
+
+    nadam_stop();
+    ASSERT(!mbr.isThreadRunning);
+    return 0;
+}
+
+int dispatchIsKeptForUnchangedHashLength(void) {
+    nadam_messageInfo_t infos[] = { { .name = "Crux", .hash = "Crux" }, { .name = "Ara", .hash = "Ara_" } };
+    nadam_init(infos, 2, 4);
+    tables_t *t = getTables();
+    updateDispatch(t);
+    dispatchEntry_t *entry = findDispatchSlot(t, truncateHash((const uint8_t *) "Ara_"));
+    ASSERT(entry->index == 1);
+
+    // a stale entry proves, that the table wasn't rebuilt
+    entry->size = 42;
+    updateDispatch(t);
+    ASSERT(entry->size == 42);
+
+    mbr.hashLength = 2;
+    updateDispatch(t);
+    ASSERT(findDispatchEntry(t, truncateHash((const uint8_t *) "Ar"))->size == 0);
+    ASSERT(findDispatchEntry(t, truncateHash((const uint8_t *) "Cr"))->index == 0);
+    return 0;
+}
+
+int dispatchEntriesFollowDelegates(void) {
+    nadam_messageInfo_t infos[] = { { .name = "Crux", .size = { false, { 2 } }, .hash = "Crux" },
+        { .name = "Ara", .size = { true, { 9 } }, .hash = "Ara_" } };
+    nadam_init(infos, 2, 4);
+    tables_t *t = getTables();
+    fillDispatch(t);
+
+    const dispatchEntry_t *entry = findDispatchEntry(t, truncateHash((const uint8_t *) "Ara_"));
+    ASSERT((uintptr_t) entry % DISPATCH_ENTRY_SIZE == 0);
+    ASSERT(entry->isVariable && entry->size == 9 && getEntryInfo(t, entry) == t->messageInfos + 1);
+    ASSERT(getEntryState(t, entry) == t->types[1]);
+    ASSERT(entry->delegate == nullDelegate && entry->buffer == t->commonRecvBuffer && !entry->hasRecvStart);
+
+    char buffer[9];
+    volatile bool recvStart = false;
+    ASSERT(!nadam_setDelegateWithRecvBuffer("Ara", recvDelegateMockup, buffer, &recvStart));
+    ASSERT(entry->delegate == recvDelegateMockup && entry->buffer == buffer && entry->hasRecvStart);
+    setRecvStart(t, entry);
+    ASSERT(recvStart);
+
+    ASSERT(!nadam_setDelegate("Ara", NULL));
+    ASSERT(entry->delegate == nullDelegate && entry->buffer == t->commonRecvBuffer && !entry->hasRecvStart);
+    return 0;
+}
+
+int dispatchOfSmallCatalogMatchesIds(void) {
+    nadam_messageInfo_t infos[] = { { .name = "Crux", .hash = "Crux" }, { .name = "Ara", .hash = "Ara_" },
+        { .name = "Lyra", .hash = "Lyra" } };
+    nadam_init(infos, 3, 4);
+    tables_t *t = getTables();
+    fillDispatch(t);
+    ASSERT(t->dispatchIds != NULL && t->dispatchIdCount == 3);
+    ASSERT((uintptr_t) t->dispatchIds % IDMATCH_ALIGNMENT == 0);
+
+    // entries are taken in order
+    ASSERT(findDispatchEntry(t, truncateHash((const uint8_t *) "Lyra")) == t->dispatch + 2);
+    ASSERT(findDispatchEntry(t, truncateHash((const uint8_t *) "Ara_"))->index == 1);
+    ASSERT(findDispatchEntry(t, truncateHash((const uint8_t *) "Lynx")) == NULL);
+    // padding past the ids isn't a match
+    ASSERT(findDispatchEntry(t, 0) == NULL);
+    return 0;
+}
+
+int dispatchOfBigCatalogProbes(void) {
+    nadam_messageInfo_t infos[ID_MATCH_COUNT_MAX + 1];
+    char names[ID_MATCH_COUNT_MAX + 1][8] = { { 0 } };
+    for (uint32_t i = 0; i < ID_MATCH_COUNT_MAX + 1; ++i) {
+        memcpy(names[i], "Cetus", 5);
+        names[i][5] = (char) ('a' + i);
+        infos[i] = (nadam_messageInfo_t) { .name = names[i] };
+        uint32_t id = (i + 1) * 2654435761u;
+        memcpy(infos[i].hash, &id, sizeof(id));
+    }
+    ASSERT(!nadam_init(infos, ID_MATCH_COUNT_MAX + 1, 4));
+    tables_t *t = getTables();
+    fillDispatch(t);
+    ASSERT(t->dispatchIds == NULL);
+    ASSERT(t->dispatchCapacity >= (ID_MATCH_COUNT_MAX + 1) * DISPATCH_SPARSE_LOAD_DIVISOR);
+
+    for (uint32_t i = 0; i < ID_MATCH_COUNT_MAX + 1; ++i)
+        ASSERT(findDispatchEntry(t, truncateHash(infos[i].hash))->index == i);
+    ASSERT(findDispatchEntry(t, 42) == NULL);
+    return 0;
+}
+
+int idmatchAgreesWithLinearSearch(void) {
+    _Alignas(IDMATCH_ALIGNMENT) uint32_t ids[IDMATCH_PADDED_COUNT(21)] = { 0 };
+    for (uint32_t i = 0; i < 21; ++i)
+        ids[i] = i * 2654435761u;
+    // duplicate - the first one is reported
+    ids[17] = ids[9];
+
+    for (uint32_t count = 0; count <= 21; ++count) {
+        for (uint32_t k = 0; k < IDMATCH_PADDED_COUNT(21); ++k) {
+            int expected = -1;
+            for (uint32_t i = 0; i < count && expected < 0; ++i)
+                expected = ids[i] == ids[k] ? (int) i : -1;
+            ASSERT(idmatch_find(ids, count, ids[k]) == expected);
+        }
+        ASSERT(idmatch_find(ids, count, 42) == -1);
+    }
+    return 0;
+}
+
+// nadam_initFromCatalogFile
+static const char *catalogFilePath = "/tmp/nadam_init_catalog_unittest";
+
+int initFromCatalogFileUsesItsTables(void) {
+    nadam_messageInfo_t infos[] = { { "Lyra", 4, { false, { 2 } }, "Lyra" },
+        { "Lynx", 4, { true, { 8 } }, "Lynx" } };
+    ASSERT(!catalog_write(catalogFilePath, infos, 2));
+    ASSERT(!nadam_initFromCatalogFile(catalogFilePath));
+    ASSERT(getTables()->messageCount == 2 && mbr.hashLength == 3);
+    ASSERT(getTables()->messageInfos[1].size.isVariable && getTables()->messageInfos[1].size.max == 8);
+
+    // names come from the mapped pool
+    size_t index;
+    ASSERT(!getIndexForName(getTables(), "Lynx", &index) && index == 1);
+    ASSERT(kh_size(getTables()->nameKeyMap) == 0);
+    errno = 0;
+    ASSERT(nadam_setDelegate("Lyre", recvDelegateDummy));
+    ASSERT(errno == NADAM_ERROR_UNKNOWN_NAME);
+
+    updateDispatch(getTables());
+    ASSERT(findDispatchEntry(getTables(), truncateHash((const uint8_t *) "Lyn"))->index == 1);
+    ASSERT(findDispatchEntry(getTables(), truncateHash((const uint8_t *) "Lyx")) == NULL);
+
+    mbr.hashLength = 4;
+    updateDispatch(getTables());
+    ASSERT(findDispatchEntry(getTables(), truncateHash((const uint8_t *) "Lyra"))->index == 0);
+
+    unlink(catalogFilePath);
+    return 0;
+}
+
+/* gennmi -binary output for "`foo` size = 4 `bar` size_max = 100" -
+   the unittest of nadam/infogen/catalog.d checks makeCatalog() against the same bytes.  */
+static const uint8_t gennmiCatalog[] = {
+    0x4e, 0x41, 0x44, 0x41, 0x4d, 0x43, 0x41, 0x54, 0x01, 0x00, 0x00, 0x00,
+    0x02, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00,
+    0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x88, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x90, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0xa0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xb0, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00,
+    0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xbb, 0x4d, 0x2a, 0x0b,
+    0xe0, 0x66, 0x10, 0x9a, 0xed, 0x2e, 0x3c, 0x5e, 0xe0, 0x65, 0x97, 0x13,
+    0x40, 0x47, 0x61, 0x4a, 0x04, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00,
+    0x64, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x78, 0xb6, 0x54, 0x20,
+    0x83, 0x92, 0xe5, 0xd6, 0x04, 0x2c, 0x0d, 0x20, 0xa0, 0xcf, 0xdd, 0xa0,
+    0x89, 0x95, 0x26, 0x3a, 0x66, 0x6f, 0x6f, 0x00, 0x62, 0x61, 0x72, 0x00,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x01, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff, 0x01, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff };
+
+int initFromGennmiCatalogFile(void) {
+    int fd = open(catalogFilePath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    ASSERT(fd >= 0);
+    ASSERT(write(fd, gennmiCatalog, sizeof(gennmiCatalog)) == sizeof(gennmiCatalog));
+    close(fd);
+
+    ASSERT(!nadam_initFromCatalogFile(catalogFilePath));
+    ASSERT(getTables()->messageCount == 2 && mbr.hashLength == 1);
+    size_t index;
+    ASSERT(!getIndexForName(getTables(), "bar", &index) && index == 1);
+    const nadam_messageInfo_t *bar = getTables()->messageInfos + 1;
+    ASSERT(bar->size.isVariable && bar->size.max == 100);
+
+    // the C writer produces the same bytes from the same definitions
+    nadam_messageInfo_t infos[] = { { .name = "foo", .size = { false, { 4 } } },
+        { .name = "bar", .size = { true, { 100 } } } };
+    ASSERT(!nadam_makeMessageInfos(infos, 2));
+    ASSERT(memcmp(bar->hash, infos[1].hash, sizeof(infos[1].hash)) == 0);
+    ASSERT(!catalog_write(catalogFilePath, infos, 2));
+    uint8_t written[sizeof(gennmiCatalog) + 1];
+    fd = open(catalogFilePath, O_RDONLY);
+    ASSERT(fd >= 0);
+    ASSERT(read(fd, written, sizeof(written)) == sizeof(gennmiCatalog));
+    close(fd);
+    ASSERT(memcmp(written, gennmiCatalog, sizeof(gennmiCatalog)) == 0);
+
+    unlink(catalogFilePath);
+    return 0;
+}
+
+int initFromInvalidCatalogFileError(void) {
+    errno = 0;
+    ASSERT(nadam_initFromCatalogFile("/tmp/nadam_init_catalog_unittest_missing"));
+    ASSERT(errno == NADAM_ERROR_CATALOG);
+    return 0;
+}
+
+// nadam_makeMessageInfos
+int makeMessageInfosComputesGeneratorIds(void) {
+    static const uint8_t lyraHash[] = { 0x7c, 0x35, 0x4b, 0x15, 0x54, 0xd7, 0xba, 0xf3, 0x17, 0xbb,
+        0x98, 0xf2, 0xe6, 0x06, 0xe2, 0x89, 0x7e, 0x87, 0xca, 0x44 };
+    static const uint8_t sensorHash[] = { 0x14, 0x76, 0x46, 0x6a, 0x3d, 0xde, 0x30, 0x7e, 0xc5, 0xc9,
+        0xee, 0xb1, 0x8e, 0x0b, 0xc2, 0x71, 0xc9, 0x4b, 0xab, 0x4c };
+
+    // more than a batch - the last one is partial
+    nadam_messageInfo_t infos[SHA1_LANES + 3];
+    for (size_t i = 0; i < SHA1_LANES + 3; ++i) {
+        bool isSensor = i % 2;
+        infos[i] = (nadam_messageInfo_t) { .name = isSensor ? "Sensor reading" : "Lyra",
+            .size = { isSensor, { isSensor ? 1000 : 2 } } };
+    }
+
+    ASSERT(!nadam_makeMessageInfos(infos, SHA1_LANES + 3));
+    for (size_t i = 0; i < SHA1_LANES + 3; ++i) {
+        bool isSensor = i % 2;
+        ASSERT(infos[i].nameLength == (isSensor ? 14 : 4));
+        ASSERT(memcmp(infos[i].hash, isSensor ? sensorHash : lyraHash, sizeof(lyraHash)) == 0);
+    }
+    return 0;
+}
+
+int makeMessageInfosOfLongNames(void) {
+    char name[ID_INPUTS_STACK_LENGTH];
+    memset(name, 'n', sizeof(name) - 1);
+    name[sizeof(name) - 1] = '\0';
+    nadam_messageInfo_t infos[2] = { { .name = name }, { .name = "Lyra", .size = { false, { 2 } } } };
+    ASSERT(!nadam_makeMessageInfos(infos, 2));
+    ASSERT(infos[1].hash[0] == 0x7c && infos[1].hash[19] == 0x44);
+
+    uint8_t input[sizeof(name) - 1 + ID_SUFFIX_LENGTH] = { 0 };
+    memcpy(input, name, sizeof(name) - 1);
+    uint8_t digest[SHA1_DIGEST_LENGTH];
+    sha1_digest(input, sizeof(input), digest);
+    ASSERT(memcmp(infos[0].hash, digest, sizeof(digest)) == 0);
+
+    infos[1].name = NULL;
+    errno = 0;
+    ASSERT(nadam_makeMessageInfos(infos, 2));
+    ASSERT(errno == NADAM_ERROR_NULL_POINTER);
+    return 0;
+}
+
+// nadam_updateCatalog
+int updateCatalogKeepsDelegates(void) {
+    nadam_messageInfo_t infos[] = { { .name = "Crux", .size = { false, { 2 } }, .hash = "Crux" } };
+    nadam_init(infos, 1, 4);
+    nadam_setDelegate("Crux", recvDelegateMockup);
+    ASSERT(!nadam_setDelta("Crux", 8));
+
+    nadam_messageInfo_t superset[] = { { .name = "Ara", .size = { false, { 3 } }, .hash = "Ara_" },
+        { .name = "Crux", .size = { false, { 2 } }, .hash = "Crux" } };
+    ASSERT(!nadam_updateCatalog(superset, 2));
+    ASSERT(getTables()->messageInfos == superset);
+
+    size_t index;
+    ASSERT(!getIndexForName(getTables(), "Crux", &index) && index == 1);
+    ASSERT(getTables()->types[1]->delegate.delegate == recvDelegateMockup);
+    ASSERT(getTables()->types[1]->deltaSendState->fullInterval == 8);
+    ASSERT(getTables()->types[0]->delegate.delegate == nullDelegate);
+
+    // dispatch table was built for the negotiated length
+    fakeRecvContent("Ara_abcCruxhi", 13);
+    ASSERT(!recvFrame());
+    ASSERT(!recvMockupMbr.delegateCalled);
+    ASSERT(!recvFrame());
+    ASSERT(recvMockupMbr.nRecv == 2 && memcmp(recvMockupMbr.bufRecv, "hi", 2) == 0);
+    return 0;
+}
+
+int updateCatalogWithoutCurrentTypeError(void) {
+    nadam_messageInfo_t infos[] = { { .name = "Crux", .size = { false, { 2 } }, .hash = "Crux" },
+        { .name = "Ara", .size = { false, { 3 } }, .hash = "Ara_" } };
+    nadam_init(infos, 2, 4);
+
+    errno = 0;
+    ASSERT(nadam_updateCatalog(infos, 1));
+    ASSERT(errno == NADAM_ERROR_CATALOG_UPDATE);
+
+    nadam_messageInfo_t resized[] = { { .name = "Crux", .size = { false, { 4 } }, .hash = "Crux" },
+        { .name = "Ara", .size = { false, { 3 } }, .hash = "Ara_" } };
+    errno = 0;
+    ASSERT(nadam_updateCatalog(resized, 2));
+    ASSERT(errno == NADAM_ERROR_CATALOG_UPDATE);
+    ASSERT(getTables()->messageInfos == infos);
     return 0;
 }
 
-int initWithDuplicateName(void) {
-    nadam_messageInfo_t infos[] = { { .name = "foo" }, 
-        { .name = "foo" } };
+int updateCatalogWithCollidingIdError(void) {
+    nadam_messageInfo_t infos[] = { { .name = "Crux", .hash = "Crux" } };
+    nadam_init(infos, 1, 2);
+
+    // unique in 3 bytes, but the negotiated length is 2
+    nadam_messageInfo_t colliding[] = { { .name = "Crux", .hash = "Crux" }, { .name = "Cru", .hash = "Cru_" } };
     errno = 0;
-    ASSERT(nadam_init(infos, 2, 4));
-    ASSERT(errno == NADAM_ERROR_NAME_COLLISION);
+    ASSERT(nadam_updateCatalog(colliding, 2));
+    ASSERT(errno == NADAM_ERROR_CATALOG_UPDATE);
+    ASSERT(getTables()->messageInfos == infos);
     return 0;
 }
 
-// nadam_setDelegateWithRecvBuffer
-// and nadam_setDelegate as long as it simply forwards
-static void recvDelegateDummy(void *msg, uint32_t size, const nadam_messageInfo_t *mi) { }
+static nadam_messageInfo_t updateFromDelegateInfos[] = { { .name = "Pavo", .size = { false, { 1 } }, .hash = "Pavo" } };
+static int updateFromDelegateErrno;
 
-int normalSetDelegateUse(void) {
-    nadam_messageInfo_t infos[] = { { .name = "ZERO" }, { .name = "ONE" } };
-    nadam_init(infos, 2, 4);
+static void updatingRecvDelegate(void *msg, uint32_t size, const nadam_messageInfo_t *mi) {
+    errno = 0;
+    nadam_updateCatalog(updateFromDelegateInfos, 1);
+    updateFromDelegateErrno = errno;
+}
 
-    int buffer;
-    volatile bool recvStart;
-    recvDelegateRelated_t d = { .delegate = recvDelegateDummy, .buffer = &buffer,
-        .recvStart = &recvStart };
-    ASSERT(!nadam_setDelegateWithRecvBuffer("ONE", d.delegate, d.buffer, d.recvStart));
-    recvDelegateRelated_t *verify = &mbr.delegates[1];
-    ASSERT(memcmp(&d, verify, sizeof(recvDelegateRelated_t)) == 0);
+int updateCatalogFromDelegateError(void) {
+    nadam_init(updateFromDelegateInfos, 1, 4);
+    nadam_setDelegate("Pavo", updatingRecvDelegate);
+
+    fakeRecvContent("Pavo!", 5);
+    fillDispatch(getTables());
+    ASSERT(!recvFrame());
+    ASSERT(updateFromDelegateErrno == NADAM_ERROR_BUSY);
+
+    // the section was left - the same update succeeds outside of it
+    ASSERT(!nadam_updateCatalog(updateFromDelegateInfos, 1));
     return 0;
 }
 
-int setDelegateOfUnknownMessageError(void) {
-    nadam_messageInfo_t info = { .name = "[+]" };
-    nadam_init(&info, 1, 4);
+// traffic mockup - endless frames of one type, sends only counted
+static struct {
+    atomic_bool isStopped;
+    atomic_size_t sent;
+    atomic_size_t received;
+    const char *frame;
+    size_t frameLength;
+    size_t recvPosition;
+} trafficMockupMbr;
+
+static int countingSendMockup(const void *src, uint32_t n) {
+    atomic_fetch_add(&trafficMockupMbr.sent, 1);
+    return 0;
+}
 
-    errno = 0;
-    int nonNull;
-    ASSERT(nadam_setDelegateWithRecvBuffer("[-]", recvDelegateDummy, &nonNull, NULL));
-    ASSERT(errno == NADAM_ERROR_UNKNOWN_NAME);
+static int cyclicRecvMockup(void *dest, uint32_t n) {
+    uint8_t *d = dest;
+    for (uint32_t i = 0; i < n; ++i) {
+        d[i] = (uint8_t) trafficMockupMbr.frame[trafficMockupMbr.recvPosition];
+        trafficMockupMbr.recvPosition = (trafficMockupMbr.recvPosition + 1) % trafficMockupMbr.frameLength;
+    }
     return 0;
 }
 
-int nullBufferForNonNullDelegateError(void) {
-    nadam_messageInfo_t info = { .name = "hi there" };
-    nadam_init(&info, 1, 4);
+static void countingDelegateMockup(void *msg, uint32_t size, const nadam_messageInfo_t *mi) {
+    atomic_fetch_add(&trafficMockupMbr.received, 1);
+}
 
-    errno = 0;
-    ASSERT(nadam_setDelegateWithRecvBuffer("hi there", recvDelegateDummy, NULL, NULL));
-    ASSERT(errno == NADAM_ERROR_DELEGATE_BUFFER);
-    return 0;
+static void *sendTrafficWorker(void *arg) {
+    while (!atomic_load(&trafficMockupMbr.isStopped)) {
+        if (nadam_send("Crux", "hi", 0))
+            return arg;
+    }
+    return NULL;
 }
 
-int removingADelegateClearsItsData(void) {
-    nadam_messageInfo_t info = { .name = "brown fox" };
-    nadam_init(&info, 1, 4);
-    recvDelegateRelated_t delegateInit = getDelegateInit();
+static void *recvTrafficWorker(void *arg) {
+    while (!atomic_load(&trafficMockupMbr.isStopped)) {
+        if (recvFrame())
+            return arg;
+    }
+    return NULL;
+}
+// traffic mockup - end
+
+int updateCatalogUnderTraffic(void) {
+    static nadam_messageInfo_t infos[] = { { .name = "Crux", .size = { false, { 2 } }, .hash = "Crux" } };
+    static nadam_messageInfo_t supersets[2][2] = {
+        { { .name = "Ara", .size = { false, { 3 } }, .hash = "Ara_" },
+            { .name = "Crux", .size = { false, { 2 } }, .hash = "Crux" } },
+        { { .name = "Crux", .size = { false, { 2 } }, .hash = "Crux" },
+            { .name = "Ara", .size = { false, { 3 } }, .hash = "Ara_" } } };
+    nadam_init(infos, 1, 4);
+    nadam_setDelegate("Crux", countingDelegateMockup);
+    memset(&trafficMockupMbr, 0, sizeof(trafficMockupMbr));
+    trafficMockupMbr.frame = "Cruxhi";
+    trafficMockupMbr.frameLength = 6;
+    mbr.send = countingSendMockup;
+    mbr.recv = cyclicRecvMockup;
+    mbr.hashLength = 4;
+    fillDispatch(getTables());
+
+    enum { SENDER_COUNT = 3 };
+    pthread_t senders[SENDER_COUNT], receiver;
+    for (size_t i = 0; i < SENDER_COUNT; ++i)
+        ASSERT(!pthread_create(senders + i, NULL, sendTrafficWorker, &trafficMockupMbr));
+    ASSERT(!pthread_create(&receiver, NULL, recvTrafficWorker, &trafficMockupMbr));
+
+    // every update frees tables, which the readers used a moment ago
+    size_t sentBefore = 0, receivedBefore = 0;
+    for (size_t i = 0; i < 200; ++i) {
+        ASSERT(!nadam_updateCatalog(supersets[i % 2], 2));
+        if (i % 50 == 0) {
+            // traffic continues between updates
+            while (atomic_load(&trafficMockupMbr.sent) == sentBefore
+                    || atomic_load(&trafficMockupMbr.received) == receivedBefore)
+                sched_yield();
+            sentBefore = atomic_load(&trafficMockupMbr.sent);
+            receivedBefore = atomic_load(&trafficMockupMbr.received);
+        }
+    }
 
-    recvDelegateRelated_t *delegate = &mbr.delegates[0];
-    memset(delegate, 0xA5, sizeof(recvDelegateRelated_t));
-    ASSERT(!nadam_setDelegateWithRecvBuffer("brown fox", NULL, NULL, NULL));
-    ASSERT(memcmp(delegate, &delegateInit, sizeof(recvDelegateRelated_t)) == 0);
+    atomic_store(&trafficMockupMbr.isStopped, true);
+    void *failed = NULL;
+    for (size_t i = 0; i < SENDER_COUNT; ++i) {
+        void *result;
+        pthread_join(senders[i], &result);
+        failed = failed ? failed : result;
+    }
+    void *result;
+    pthread_join(receiver, &result);
+    ASSERT(failed == NULL && result == NULL);
+
+    size_t index;
+    ASSERT(!getIndexForName(getTables(), "Crux", &index));
+    ASSERT(getTables()->types[index]->delegate.delegate == countingDelegateMockup);
     return 0;
 }
 
-int passingNullForDelegatesRecvStartUsesInitValue(void) {
-    nadam_messageInfo_t info = { .name = "Scorpio" };
-    nadam_init(&info, 1, 4);
+int updateFromCatalogFileKeepsDelegates(void) {
+    nadam_messageInfo_t infos[] = { { "Lyra", 4, { false, { 2 } }, "Lyra" } };
+    nadam_init(infos, 1, 4);
+    nadam_setDelegate("Lyra", recvDelegateMockup);
 
-    int nonNull;
-    ASSERT(!nadam_setDelegateWithRecvBuffer("Scorpio", recvDelegateDummy, &nonNull, NULL));
-    ASSERT(mbr.delegates[0].recvStart != NULL);
+    nadam_messageInfo_t superset[] = { { "Lynx", 4, { true, { 8 } }, "Lynx" }, infos[0] };
+    ASSERT(!catalog_write(catalogFilePath, superset, 2));
+    ASSERT(!nadam_updateFromCatalogFile(catalogFilePath));
+    unlink(catalogFilePath);
+
+    ASSERT(getTables()->hasCatalog);
+    size_t index;
+    ASSERT(!getIndexForName(getTables(), "Lyra", &index) && index == 1);
+    ASSERT(getTables()->types[1]->delegate.delegate == recvDelegateMockup);
+    ASSERT(findDispatchEntry(getTables(), truncateHash((const uint8_t *) "Lynx"))->index == 0);
     return 0;
 }
 
-// nadam_send
+// low latency
 static struct {
-    bool sendWasCalled;
-    size_t n;
-    uint8_t buf[64];
-} sendMockupMbr;
+    const uint8_t *src;
+    uint32_t n;
+    uint32_t chunk;
+    int emptyBetweenChunks;
+    int emptyLeft;
+    int blockingCalls;
+} recvSomeMockupMbr;
+
+// delivers at most chunk bytes, preceded by emptyBetweenChunks calls without data
+static int32_t recvSomeMockup(void *dest, uint32_t n) {
+    if (recvSomeMockupMbr.emptyLeft) {
+        --recvSomeMockupMbr.emptyLeft;
+        return 0;
+    }
+    recvSomeMockupMbr.emptyLeft = recvSomeMockupMbr.emptyBetweenChunks;
+
+    uint32_t count = n < recvSomeMockupMbr.chunk ? n : recvSomeMockupMbr.chunk;
+    count = count < recvSomeMockupMbr.n ? count : recvSomeMockupMbr.n;
+    memcpy(dest, recvSomeMockupMbr.src, count);
+    recvSomeMockupMbr.src += count;
+    recvSomeMockupMbr.n -= count;
+    return (int32_t) count;
+}
 
-static int sendMockup(const void *src, uint32_t n) {
-    assert(sendMockupMbr.n + n <= sizeof(sendMockupMbr.buf));
+static int recvBlockingMockup(void *dest, uint32_t n) {
+    ++recvSomeMockupMbr.blockingCalls;
+    if (n > recvSomeMockupMbr.n)
+        return -1;
 
-    sendMockupMbr.sendWasCalled = true;
-    memcpy(sendMockupMbr.buf + sendMockupMbr.n, src, n);
-    sendMockupMbr.n += n;
+    memcpy(dest, recvSomeMockupMbr.src, n);
+    recvSomeMockupMbr.src += n;
+    recvSomeMockupMbr.n -= n;
     return 0;
 }
 
-static int failingSendMockup(const void *src, uint32_t n) {
-    return -1;
-}
+static void fakeRecvSome(const char *content, uint32_t n, uint32_t chunk, int emptyBetweenChunks) {
+    recvSomeMockupMbr.src = (const uint8_t *) content;
+    recvSomeMockupMbr.n = n;
+    recvSomeMockupMbr.chunk = chunk;
+    recvSomeMockupMbr.emptyBetweenChunks = emptyBetweenChunks;
+    recvSomeMockupMbr.emptyLeft = emptyBetweenChunks;
+    recvSomeMockupMbr.blockingCalls = 0;
 
-static void fakeSendInitiate(nadam_send_t send) {
-    memset(&sendMockupMbr, 0, sizeof(sendMockupMbr));
-    mbr.send = send;
-    mbr.hashLength = 4;
+    mbr.lowLatency.recvSome = recvSomeMockup;
+    mbr.recvBlocking = recvBlockingMockup;
 }
-// nadam_send helper - end
 
-int sendFixedSizeMessageBasic(void) {
-    nadam_messageInfo_t info = { .name = "Aries", .size = { false, { 5 } }, .hash = "Arie" };
-    nadam_init(&info, 1, 4);
-    fakeSendInitiate(sendMockup);
+int recvSpinningAssemblesChunks(void) {
+    const char *content = "Cassiopeia and Andromeda";
+    uint32_t n = (uint32_t) strlen(content);
+    fakeRecvSome(content, n, 5, 3);
+    mbr.lowLatency.spinNs = mbr.spinNs = 1000000000;
 
-    const char *msg = "Hello";
-    const char *expected = "ArieHello";
-    ASSERT(!nadam_send("Aries", msg, 0));
-    ASSERT(sendMockupMbr.n == strlen(expected));
-    ASSERT(memcmp(sendMockupMbr.buf, expected, sendMockupMbr.n) == 0);
+    char dest[32] = { 0 };
+    ASSERT(!recvSpinning(dest, n));
+    ASSERT(memcmp(dest, content, n) == 0);
+    ASSERT(recvSomeMockupMbr.blockingCalls == 0);
     return 0;
 }
 
-int sendVariableSizeMessageBasic(void) {
-    nadam_messageInfo_t info = { .name = "Taurus", .size = { true, { 2 } }, .hash = "Taur" };
-    nadam_init(&info, 1, 4);
-    fakeSendInitiate(sendMockup);
-
-    const char *msg = "Hi";
-    const uint32_t msgLength = 2;
-    const char expected[] = "Taur\x02\x00\x00\x00Hi";
-    size_t expectedSize = sizeof(expected) - 1;
+int recvSpinningBacksOffToBlocking(void) {
+    const char *content = "Orion";
+    fakeRecvSome(content, 5, 5, 1000000000);
+    mbr.lowLatency.spinNs = mbr.spinNs = 4 * SPIN_NS_MIN;
+
+    char dest[8];
+    ASSERT(!recvSpinning(dest, 5));
+    ASSERT(memcmp(dest, content, 5) == 0);
+    ASSERT(recvSomeMockupMbr.blockingCalls == 1);
+    ASSERT(mbr.spinNs == 2 * SPIN_NS_MIN);
+
+    recvSomeMockupMbr.emptyLeft = 1000000000;
+    ASSERT(recvSpinning(dest, 1));
+    ASSERT(mbr.spinNs == SPIN_NS_MIN);
+    ASSERT(recvSpinning(dest, 1));
+    ASSERT(mbr.spinNs == SPIN_NS_MIN);
+    return 0;
+}
 
-    ASSERT(!nadam_send("Taurus", msg, msgLength));
-    ASSERT(sendMockupMbr.n == expectedSize);
-    ASSERT(memcmp(sendMockupMbr.buf, expected, expectedSize) == 0);
+int setLowLatencyArgumentErrors(void) {
+    nadam_messageInfo_t info = { .name = "Lyra", .hash = "Lyra" };
+    nadam_init(&info, 1, 4);
+    nadam_lowLatency_t config = { .cpu = -2 };
+    ASSERT(nadam_setLowLatency(&config) && errno == NADAM_ERROR_INVALID_ARGUMENT);
+    config.cpu = CPU_SETSIZE;
+    ASSERT(nadam_setLowLatency(&config) && errno == NADAM_ERROR_INVALID_ARGUMENT);
+    config.cpu = -1;
+    config.realtimePriority = -1;
+    ASSERT(nadam_setLowLatency(&config) && errno == NADAM_ERROR_INVALID_ARGUMENT);
+    config.realtimePriority = 0;
+    ASSERT(!nadam_setLowLatency(&config));
+    ASSERT(!nadam_setLowLatency(NULL));
+    ASSERT(!mbr.isLowLatency);
     return 0;
 }
 
-int sendUnknownMessageError(void) {
-    nadam_messageInfo_t info = { .name = "Gemini", .size = { false, { 5 } }, .hash = "Gemi" };
+int lowLatencyRecvThreadIsPinned(void) {
+    nadam_messageInfo_t info = { .name = "Vela", .hash = "Vela" };
     nadam_init(&info, 1, 4);
-    fakeSendInitiate(sendMockup);
+    // a CPU this process may run on
+    cpu_set_t cpus;
+    ASSERT(!sched_getaffinity(0, sizeof(cpus), &cpus));
+    int cpu = 0;
+    while (!CPU_ISSET((size_t) cpu, &cpus))
+        ++cpu;
+
+    nadam_lowLatency_t config = { .cpu = cpu };
+    ASSERT(!nadam_setLowLatency(&config));
+    atomic_store(&reconnectMockupMbr.errorCount, 0);
+    atomic_store(&reconnectMockupMbr.handshakesPending, 1);
+    ASSERT(!nadam_initiate(reconnectSendMockup, reconnectRecvMockup, reconnectErrorDelegateMockup));
+
+    cpu_set_t threadCpus;
+    ASSERT(!pthread_getaffinity_np(mbr.threadId, sizeof(threadCpus), &threadCpus));
+    ASSERT(CPU_COUNT(&threadCpus) == 1 && CPU_ISSET((size_t) cpu, &threadCpus));
+
+    nadam_stop();
+    return 0;
+}
 
-    const char *msg = "don't care";
-    errno = 0;
-    ASSERT(nadam_send("something went wrong", msg, 0));
-    ASSERT(errno == NADAM_ERROR_UNKNOWN_NAME);
-    ASSERT(!sendMockupMbr.sendWasCalled);
+int prefaultTouchesEveryPageOfRange(void) {
+    size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    uint8_t *pages = mmap(NULL, 2 * pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT(pages != MAP_FAILED);
+    // not page aligned - the range ends in the second page
+    ASSERT(!prefault(pages + pageSize - 100, 200));
+    unsigned char residency[2];
+    ASSERT(!mincore(pages, 2 * pageSize, residency));
+    munmap(pages, 2 * pageSize);
+    ASSERT((residency[0] & 1) && (residency[1] & 1));
     return 0;
 }
 
-int sendCommunicationError(void) {
-    nadam_messageInfo_t info = { .name = "Virgo" };
-    nadam_init(&info, 1, 4);
-    fakeSendInitiate(failingSendMockup);
+// capture
+static const char *captureTestPath = "/tmp/nadam_unittest.cap";
 
-    const char *msg = "don't care";
-    errno = 0;
-    ASSERT(nadam_send("Virgo", msg, 0));
-    ASSERT(errno == NADAM_ERROR_SEND);
+int captureAndReplayFrames(void) {
+    nadam_messageInfo_t infos[] = { { .name = "Ophiuchus", .size = { true, { 8 } }, .hash = "Ophi" },
+        { .name = "Cetus", .size = { false, { 2 } }, .hash = "Cetu" } };
+    nadam_init(infos, 2, 4);
+    ASSERT(!nadam_startCapture(captureTestPath));
+
+    const char recvContent[] = "Ophi\x03\x00\x00\x00oneCetu42Ophi\x03\x00\x00\x00two";
+    fakeRecvInitiate(recvContent, sizeof(recvContent) - 1);
+    ASSERT(recvMockupMbr.error == NADAM_ERROR_RECV);
+    ASSERT(!nadam_stopCapture());
+
+    nadam_setDelegate("Ophiuchus", recvDelegateMockup);
+    nadam_setDelegate("Cetus", recvDelegateMockup);
+    memset(&recvMockupMbr, 0, sizeof(recvMockupMbr));
+    ASSERT(!nadam_replayCapture(captureTestPath, NULL, 0));
+    ASSERT(recvMockupMbr.nRecv == 8);
+    ASSERT(memcmp(recvMockupMbr.bufRecv, "one42two", 8) == 0);
+
+    memset(&recvMockupMbr, 0, sizeof(recvMockupMbr));
+    ASSERT(!nadam_replayCapture(captureTestPath, "Ophiuchus", 0));
+    ASSERT(recvMockupMbr.nRecv == 6);
+    ASSERT(memcmp(recvMockupMbr.bufRecv, "onetwo", 6) == 0);
+    unlink(captureTestPath);
     return 0;
 }
 
-int sendVariableSizeExceedingLengthError(void) {
-    nadam_messageInfo_t info = { .name = "Libra", .size = { true, { 7 } } };
+int replayOfMissingCaptureError(void) {
+    nadam_messageInfo_t info = { .name = "Cetus" };
     nadam_init(&info, 1, 4);
-    fakeSendInitiate(sendMockup);
-
-    const char msg[] = "size of this message has somehow swollen";
-    const uint32_t msgSize = (uint32_t) sizeof(msg) - 1;
     errno = 0;
-    ASSERT(nadam_send("Libra", msg, msgSize));
-    ASSERT(errno == NADAM_ERROR_SIZE_ARG);
-    ASSERT(!sendMockupMbr.sendWasCalled);
+    ASSERT(nadam_replayCapture("/nonexistent/nadam.cap", NULL, 0));
+    ASSERT(errno == NADAM_ERROR_CAPTURE);
     return 0;
 }
 
-// recvWorker
-static struct {
-    int error;
-    size_t n;
-    uint8_t buf[64];
-    size_t bufIndex;
-    uint32_t nRecv;
-    uint8_t bufRecv[64];
-    bool delegateCalled;
-} recvMockupMbr;
-
-static int recvMockup(void *dest, uint32_t n) {
-    if (n > recvMockupMbr.n)
+// datagram
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// bound to an ephemeral loopback port and connected to itself - receives what it sends
+static int openDatagramLoopback(void) {
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t length = sizeof(addr);
+    struct timeval timeout = { .tv_sec = 1 };
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *) &addr, length)
+            || getsockname(fd, (struct sockaddr *) &addr, &length)
+            || connect(fd, (struct sockaddr *) &addr, length)
+            || setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)))
         return -1;
-
-    memcpy(dest, recvMockupMbr.buf + recvMockupMbr.bufIndex, n);
-    recvMockupMbr.n -= n;
-    recvMockupMbr.bufIndex += n;
-    return 0;
+    return fd;
 }
 
-static void errorDelegateMockup(int error) {
-    recvMockupMbr.error = error;
+static int recvDatagrams(int count) {
+    int delivered = 0;
+    for (int attempt = 0; attempt < 10 && delivered < count; ++attempt) {
+        int n = nadam_datagramRecv();
+        if (n < 0)
+            return -1;
+        delivered += n;
+    }
+    return delivered;
 }
 
-static void fakeRecvInitiate(const void *recvContent, size_t n) {
-    assert(n <= sizeof(recvMockupMbr.buf));
+static nadam_messageInfo_t datagramInfos[] = { { .name = "Lyra", .size = { false, { 2 } }, .hash = "Lyra" },
+    { .name = "Vela", .size = { true, { 8 } }, .hash = "Vela" } };
 
+int datagramSendAndRecv(void) {
+    nadam_init(datagramInfos, 2, 4);
+    // receiving doesn't fill the dispatch
+    ASSERT(getTables()->dispatchHashLength == 4);
+    nadam_setDelegate("Lyra", recvDelegateMockup);
+    nadam_setDelegate("Vela", recvDelegateMockup);
     memset(&recvMockupMbr, 0, sizeof(recvMockupMbr));
-    memcpy(recvMockupMbr.buf, recvContent, n);
-    recvMockupMbr.n = n;
-
-    mbr.recv = recvMockup;
-    mbr.errorDelegate = errorDelegateMockup;
-    mbr.hashLength = 4;
+    int fd = openDatagramLoopback();
+    ASSERT(fd >= 0);
+    ASSERT(!nadam_datagramOpen(fd, 100));
+
+    ASSERT(!nadam_datagramSend("Lyra", "42", 0));
+    ASSERT(!nadam_datagramSend("Vela", "hi", 2));
+    ASSERT(!nadam_datagramSend("Lyra", "07", 0));
+    ASSERT(!nadam_datagramFlush());
+    ASSERT(recvDatagrams(3) == 3);
+    ASSERT(recvMockupMbr.nRecv == 6);
+    ASSERT(memcmp(recvMockupMbr.bufRecv, "42hi07", 6) == 0);
+    ASSERT(nadam_datagramDroppedCount() == 0);
+
+    nadam_datagramClose();
+    close(fd);
+    return 0;
+}
 
-    fillHashMap();
-    recvWorker(NULL);
+int datagramIntoProvidedBuffer(void) {
+    nadam_init(datagramInfos, 2, 4);
+    nadam_setDelegate("Lyra", recvDelegateMockup);
+    setProviderMockup("Vela", -1);
+    memset(&recvMockupMbr, 0, sizeof(recvMockupMbr));
+    int fd = openDatagramLoopback();
+    ASSERT(fd >= 0);
+    ASSERT(!nadam_datagramOpen(fd, 100));
+
+    ASSERT(!nadam_datagramSend("Vela", "hi", 2));
+    ASSERT(!nadam_datagramSend("Lyra", "42", 0));
+    ASSERT(!nadam_datagramFlush());
+    ASSERT(recvDatagrams(2) == 2);
+    ASSERT(providerMockupMbr.acquireCount == 1);
+    ASSERT(providerMockupMbr.acquiredSize == 2);
+    ASSERT(providerMockupMbr.delivered == providerMockupMbr.slots[0]);
+    ASSERT(memcmp(recvMockupMbr.bufRecv, "hi42", 4) == 0);
+
+    nadam_datagramClose();
+    close(fd);
+    return 0;
 }
 
-static void recvDelegateMockup(void *msg, uint32_t size, const nadam_messageInfo_t *mi) {
-    recvMockupMbr.delegateCalled = true;
-    memcpy(recvMockupMbr.bufRecv + recvMockupMbr.nRecv, msg, size);
-    recvMockupMbr.nRecv += size;
+int datagramWithInvalidFrameIsDroppedWhole(void) {
+    nadam_init(datagramInfos, 2, 4);
+    nadam_setDelegate("Lyra", recvDelegateMockup);
+    nadam_setDelegate("Vela", recvDelegateMockup);
+    memset(&recvMockupMbr, 0, sizeof(recvMockupMbr));
+    int fd = openDatagramLoopback();
+    ASSERT(fd >= 0);
+    ASSERT(!nadam_datagramOpen(fd, 100));
+
+    const char unknownId[] = "Lyra42Pyxi42";
+    const char sizeBeyondMax[] = "Lyra42Vela\x09\x00\x00\x00tenletters";
+    const char cutShort[] = "Lyra42Vela\x04\x00\x00\x00" "abc";
+    const char valid[] = "Lyra99";
+    ASSERT(send(fd, unknownId, sizeof(unknownId) - 1, 0) > 0);
+    ASSERT(send(fd, sizeBeyondMax, sizeof(sizeBeyondMax) - 1, 0) > 0);
+    ASSERT(send(fd, cutShort, sizeof(cutShort) - 1, 0) > 0);
+    ASSERT(send(fd, valid, sizeof(valid) - 1, 0) > 0);
+    ASSERT(recvDatagrams(1) == 1);
+    ASSERT(recvMockupMbr.nRecv == 2);
+    ASSERT(memcmp(recvMockupMbr.bufRecv, "99", 2) == 0);
+    ASSERT(nadam_datagramDroppedCount() == 3);
+
+    nadam_datagramClose();
+    close(fd);
+    return 0;
 }
-// recvWorker helper - end
 
-int recvFixedSizeMessageBasic(void) {
-    nadam_messageInfo_t info = { .name = "Sagittarius", .size = { false, { 5 } }, .hash = "Sagi" };
-    nadam_init(&info, 1, 4);
-    nadam_setDelegate("Sagittarius", recvDelegateMockup);
+int datagramSendErrors(void) {
+    nadam_init(datagramInfos, 2, 4);
+    errno = 0;
+    ASSERT(nadam_datagramSend("Lyra", "42", 0));
+    ASSERT(errno == NADAM_ERROR_DATAGRAM);
 
-    const char *recvContent = "Sagi54321";
-    size_t recvContentLength = strlen(recvContent);
-    const char *expected = "54321";
-    size_t expectedLength = strlen(expected);
-    fakeRecvInitiate(recvContent, recvContentLength);
+    int fd = openDatagramLoopback();
+    ASSERT(fd >= 0);
+    ASSERT(!nadam_datagramOpen(fd, 12));
+    errno = 0;
+    ASSERT(nadam_datagramOpen(fd, 12));
+    ASSERT(errno == NADAM_ERROR_BUSY);
 
-    ASSERT(recvMockupMbr.error == NADAM_ERROR_RECV);
-    ASSERT(recvMockupMbr.nRecv == expectedLength);
-    ASSERT(memcmp(recvMockupMbr.bufRecv, expected, expectedLength) == 0);
+    // id, size field and 4 bytes fit, 5 bytes don't
+    ASSERT(!nadam_datagramSend("Vela", "four", 4));
+    errno = 0;
+    ASSERT(nadam_datagramSend("Vela", "five!", 5));
+    ASSERT(errno == NADAM_ERROR_SIZE_ARG);
+    errno = 0;
+    ASSERT(nadam_datagramSend("Vela", "ninechars", 9));
+    ASSERT(errno == NADAM_ERROR_SIZE_ARG);
+
+    nadam_datagramClose();
+    close(fd);
     return 0;
 }
 
-int recvVariableSizeMessageBasic(void) {
-    nadam_messageInfo_t info = { .name = "Capricorn", .size = { true, { 8 } }, .hash = "Capr" };
-    nadam_init(&info, 1, 4);
-    nadam_setDelegate("Capricorn", recvDelegateMockup);
+// multicast
+static const char *multicastTestGroup = "239.255.0.1";
 
-    const char recvContent[] = "Capr\x08\x00\x00\x00hi there";
-    size_t recvContentLength = sizeof(recvContent) - 1;
-    const char *expected = "hi there";
-    size_t expectedLength = strlen(expected);
-    fakeRecvInitiate(recvContent, recvContentLength);
+static int joinMulticastGroup(int fd) {
+    struct ip_mreq membership = { .imr_multiaddr.s_addr = inet_addr(multicastTestGroup),
+        .imr_interface.s_addr = htonl(INADDR_LOOPBACK) };
+    return setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership));
+}
 
-    ASSERT(recvMockupMbr.error == NADAM_ERROR_RECV);
-    ASSERT(recvMockupMbr.nRecv == expectedLength);
-    ASSERT(memcmp(recvMockupMbr.bufRecv, expected, expectedLength) == 0);
-    return 0;
+// fds[0] subscribes (not joined yet), fds[1] publishes over loopback
+static int openMulticastPair(int fds[2]) {
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_ANY) };
+    socklen_t length = sizeof(addr);
+    struct timeval timeout = { .tv_sec = 1 };
+    struct in_addr interface = { htonl(INADDR_LOOPBACK) };
+    int on = 1;
+    fds[0] = socket(AF_INET, SOCK_DGRAM, 0);
+    fds[1] = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fds[0] < 0 || fds[1] < 0 || bind(fds[0], (struct sockaddr *) &addr, length)
+            || getsockname(fds[0], (struct sockaddr *) &addr, &length)
+            || setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout))
+            || setsockopt(fds[1], IPPROTO_IP, IP_MULTICAST_IF, &interface, sizeof(interface))
+            || setsockopt(fds[1], IPPROTO_IP, IP_MULTICAST_LOOP, &on, sizeof(on)))
+        return -1;
+
+    addr.sin_addr.s_addr = inet_addr(multicastTestGroup);
+    return connect(fds[1], (struct sockaddr *) &addr, length);
 }
 
-int recvUnknownHashError(void) {
-    nadam_messageInfo_t info = { .name = "Cancer", .size = { false, { 5 } }, .hash = "Canc" };
-    nadam_init(&info, 1, 4);
-    nadam_setDelegate("Cancer", recvDelegateMockup);
+static void closeMulticastPair(int fds[2]) {
+    nadam_publisherClose();
+    nadam_subscriberClose();
+    close(fds[0]);
+    close(fds[1]);
+}
 
-    const char *recvContent = "wrongHash";
-    size_t recvContentLength = strlen(recvContent);
-    fakeRecvInitiate(recvContent, recvContentLength);
+static int recvPublished(int count) {
+    int delivered = 0;
+    for (int attempt = 0; attempt < 10 && delivered < count; ++attempt) {
+        int n = nadam_subscriberRecv();
+        if (n < 0)
+            return -1;
+        delivered += n;
+    }
+    return delivered;
+}
 
-    ASSERT(recvMockupMbr.error == NADAM_ERROR_UNKNOWN_HASH);
-    ASSERT(!recvMockupMbr.delegateCalled);
+static struct {
+    uint32_t stream;
+    uint64_t first;
+    uint64_t count;
+} gapMockupMbr;
+
+static void gapDelegateMockup(uint32_t stream, uint64_t first, uint64_t count) {
+    gapMockupMbr.stream = stream;
+    gapMockupMbr.first = first;
+    gapMockupMbr.count += count;
+}
+
+static int initMulticastTest(int fds[2]) {
+    nadam_init(datagramInfos, 2, 4);
+    nadam_setDelegate("Lyra", recvDelegateMockup);
+    nadam_setDelegate("Vela", recvDelegateMockup);
+    memset(&recvMockupMbr, 0, sizeof(recvMockupMbr));
+    memset(&gapMockupMbr, 0, sizeof(gapMockupMbr));
+    if (openMulticastPair(fds))
+        return -1;
+    return nadam_subscriberOpen(fds[0], 1000, gapDelegateMockup);
+}
+
+int multicastPublishAndSubscribe(void) {
+    int fds[2];
+    ASSERT(!initMulticastTest(fds));
+    ASSERT(!joinMulticastGroup(fds[0]));
+    nadam_publisherConfig_t config = { .stream = 5, .datagramLength = 1000 };
+    ASSERT(!nadam_publisherOpen(fds[1], &config));
+
+    ASSERT(!nadam_publish("Lyra", "42", 0));
+    ASSERT(!nadam_publish("Vela", "hi", 2));
+    ASSERT(!nadam_publishFlush());
+    ASSERT(!nadam_publish("Lyra", "07", 0));
+    ASSERT(!nadam_publishFlush());
+    ASSERT(recvPublished(3) == 3);
+    ASSERT(recvMockupMbr.nRecv == 6);
+    ASSERT(memcmp(recvMockupMbr.bufRecv, "42hi07", 6) == 0);
+    ASSERT(nadam_subscriberLostCount() == 0);
+    ASSERT(nadam_subscriberDroppedCount() == 0);
+
+    // snapshots weren't requested
+    errno = 0;
+    ASSERT(nadam_publishSnapshot());
+    ASSERT(errno == NADAM_ERROR_INVALID_ARGUMENT);
+    closeMulticastPair(fds);
     return 0;
 }
 
-int recvVariableSizeError(void) {
-    nadam_messageInfo_t info = { .name = "Aquarius", .size = { true, { 5 } }, .hash = "Aqua" };
-    nadam_init(&info, 1, 4);
-    nadam_setDelegate("Aquarius", recvDelegateMockup);
+int multicastGapIsReported(void) {
+    int fds[2];
+    ASSERT(!initMulticastTest(fds));
+    ASSERT(!joinMulticastGroup(fds[0]));
+
+    uint8_t bytes[MULTICAST_HEADER_LENGTH + 6];
+    memcpy(bytes + MULTICAST_HEADER_LENGTH, "Lyra42", 6);
+    const uint64_t sequences[] = { 7, 10, 9 };
+    for (size_t i = 0; i < 3; ++i) {
+        multicastHeader_t h = { .stream = 3, .sequence = sequences[i] };
+        multicast_writeHeader(bytes, &h);
+        ASSERT(send(fds[1], bytes, sizeof(bytes), 0) > 0);
+    }
 
-    const char recvContent[] = "Aqua\x06\x00\x00\x00hello!";
-    size_t recvContentLength = sizeof(recvContent) - 1;
-    fakeRecvInitiate(recvContent, recvContentLength);
+    // the late datagram isn't delivered
+    ASSERT(recvPublished(2) == 2);
+    ASSERT(gapMockupMbr.stream == 3 && gapMockupMbr.first == 8 && gapMockupMbr.count == 2);
+    ASSERT(nadam_subscriberLostCount() == 2);
+    closeMulticastPair(fds);
+    return 0;
+}
 
-    ASSERT(recvMockupMbr.error == NADAM_ERROR_VARIABLE_SIZE);
-    ASSERT(!recvMockupMbr.delegateCalled);
+int multicastRestartedPublisherIsFollowed(void) {
+    int fds[2];
+    ASSERT(!initMulticastTest(fds));
+    ASSERT(!joinMulticastGroup(fds[0]));
+    nadam_publisherConfig_t config = { .stream = 5, .datagramLength = 1000 };
+    ASSERT(!nadam_publisherOpen(fds[1], &config));
+    ASSERT(!nadam_publish("Lyra", "11", 0));
+    ASSERT(!nadam_publishFlush());
+    ASSERT(!nadam_publish("Lyra", "22", 0));
+    ASSERT(!nadam_publishFlush());
+    ASSERT(recvPublished(2) == 2);
+
+    // numbered from 0 again
+    nadam_publisherClose();
+    ASSERT(!nadam_publisherOpen(fds[1], &config));
+    ASSERT(!nadam_publish("Lyra", "33", 0));
+    ASSERT(!nadam_publishFlush());
+    ASSERT(recvPublished(1) == 1);
+    ASSERT(memcmp(recvMockupMbr.bufRecv, "112233", 6) == 0);
+    ASSERT(nadam_subscriberLostCount() == 0);
+    closeMulticastPair(fds);
+    return 0;
+}
+
+int multicastLateJoinerTakesSnapshot(void) {
+    int fds[2];
+    ASSERT(!initMulticastTest(fds));
+    nadam_publisherConfig_t config = { .stream = 5, .datagramLength = 1000, .hasSnapshot = true };
+    ASSERT(!nadam_publisherOpen(fds[1], &config));
+
+    // nobody listens yet
+    ASSERT(!nadam_publish("Lyra", "11", 0));
+    ASSERT(!nadam_publish("Lyra", "22", 0));
+    ASSERT(!nadam_publish("Vela", "xx", 2));
+    ASSERT(!nadam_publishFlush());
+
+    ASSERT(!joinMulticastGroup(fds[0]));
+    ASSERT(!nadam_publishSnapshot());
+    ASSERT(!nadam_publish("Lyra", "33", 0));
+    // a later snapshot isn't taken again
+    ASSERT(!nadam_publishSnapshot());
+    ASSERT(!nadam_publish("Lyra", "44", 0));
+    ASSERT(!nadam_publishFlush());
+
+    ASSERT(recvPublished(3) == 3);
+    ASSERT(recvMockupMbr.nRecv == 6);
+    ASSERT(memcmp(recvMockupMbr.bufRecv, "223344", 6) == 0);
+    ASSERT(nadam_subscriberLostCount() == 0);
+    closeMulticastPair(fds);
     return 0;
 }
 
@@ -750,7 +5705,7 @@ int getIndexForExistingName(void) {
     nadam_init(infos, 4, 4);
     for (int i = 3; i >= 0; --i) {
         size_t index;
-        ASSERT(!getIndexForName(infos[i].name, &index));
+        ASSERT(!getIndexForName(getTables(), infos[i].name, &index));
         ASSERT(index == (size_t) i);
     }
     return 0;
@@ -762,7 +5717,7 @@ int tryGettingIndexForUnknownName(void) {
     nadam_init(infos, 2, 4);
     size_t index;
     errno = 0;
-    ASSERT(getIndexForName("fun", &index));
+    ASSERT(getIndexForName(getTables(), "fun", &index));
     ASSERT(errno == NADAM_ERROR_UNKNOWN_NAME);
     return 0;
 }
@@ -0,0 +1,730 @@
+/*
+Copyright:  Copyright Johannes Teichrieb 2015
+License:    opensource.org/licenses/MIT
+*/
+#define _POSIX_C_SOURCE 200809L
+#include "nadam.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "khash.h"
+
+#include "unittestMacros.h"
+
+#define CALL_ID_LENGTH 4
+// messages up to this length are assembled on the stack
+#define MESSAGE_STACK_LENGTH 1024
+#define NS_PER_MS 1000000u
+#define CALL_ID_ATTEMPTS 16
+
+typedef struct pendingCall {
+    nadam_rpcCompletion_t completion;
+    void *context;
+    // 0 - no timeout
+    uint64_t deadline;
+    struct pendingCall *next;
+} pendingCall_t;
+
+// names are interned - replies held by the handlers and calls in flight keep pointing to them
+typedef struct {
+    const char *responseName;
+    nadam_messageInfo_t request;
+    nadam_messageInfo_t response;
+    nadam_rpcHandler_t handler;
+    void *context;
+} binding_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool isDone;
+    int error;
+    void *response;
+    uint32_t *size;
+} waiter_t;
+
+KHASH_MAP_INIT_INT(calls, pendingCall_t *)
+KHASH_MAP_INIT_STR(bindings, binding_t *)
+KHASH_SET_INIT_STR(names)
+
+// private declarations
+// -----------------------------------------------------------------------------
+static int findRequest(const char *requestName, nadam_messageInfo_t *request);
+static int makeBinding(const char *requestName, const char *responseName, nadam_rpcHandler_t handler,
+        void *context, binding_t **binding);
+static void freeBinding(binding_t *b);
+static const char *internName(const char *name);
+static int sendWithCallId(const char *name, const nadam_messageInfo_t *mi, uint32_t callId,
+        const void *payload, uint32_t size);
+static int addCall(pendingCall_t *call, uint32_t *callId);
+static pendingCall_t *takeCall(uint32_t callId);
+static int startTimer(void);
+static void *expireCalls(void *arg);
+static pendingCall_t *takeExpiredCalls(uint64_t now);
+static void completeAll(pendingCall_t *calls, int error);
+static uint32_t readCallId(const uint8_t *msg);
+static void requestDelegate(void *msg, uint32_t size, const nadam_messageInfo_t *messageInfo);
+static void responseDelegate(void *msg, uint32_t size, const nadam_messageInfo_t *messageInfo);
+static void completeWaiter(int error, const void *response, uint32_t size, void *context);
+static struct timespec toTimespec(uint64_t ns);
+
+/* Calls in flight by id, bindings by request name. The timer thread sleeps until
+   the earliest deadline - a call with an earlier one wakes it.  */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t timerCond;
+    bool hasTimer;
+    uint64_t nextDeadline;
+    uint32_t nextCallId;
+    khash_t(calls) *calls;
+    khash_t(bindings) *bindings;
+    // names of all bindings so far - never freed, a deferred reply or a call may outlive its binding
+    khash_t(names) *names;
+} rpc = { .lock = PTHREAD_MUTEX_INITIALIZER, .nextDeadline = UINT64_MAX };
+
+// interface functions
+// -----------------------------------------------------------------------------
+int nadam_rpcBind(const char *requestName, const char *responseName, nadam_rpcHandler_t handler, void *context) {
+    if (requestName == NULL || responseName == NULL) {
+        errno = NADAM_ERROR_NULL_POINTER;
+        return -1;
+    }
+
+    binding_t *b;
+    if (makeBinding(requestName, responseName, handler, context, &b))
+        return -1;
+
+    if (nadam_setDelegate(responseName, responseDelegate)
+            || (handler && nadam_setDelegate(requestName, requestDelegate))) {
+        freeBinding(b);
+        return -1;
+    }
+
+    pthread_mutex_lock(&rpc.lock);
+    if (rpc.bindings == NULL)
+        rpc.bindings = kh_init(bindings);
+
+    int ret = -1;
+    khiter_t k = rpc.bindings ? kh_put(bindings, rpc.bindings, b->request.name, &ret) : 0;
+    if (ret < 0) {
+        pthread_mutex_unlock(&rpc.lock);
+        freeBinding(b);
+        errno = NADAM_ERROR_ALLOC_FAILED;
+        return -1;
+    }
+
+    // the key is the interned name - the previous binding is replaced
+    if (ret == 0)
+        freeBinding(kh_val(rpc.bindings, k));
+    kh_key(rpc.bindings, k) = b->request.name;
+    kh_val(rpc.bindings, k) = b;
+    pthread_mutex_unlock(&rpc.lock);
+    return 0;
+}
+
+int nadam_rpcCall(const char *requestName, const void *request, uint32_t size, uint32_t timeoutMs,
+        nadam_rpcCompletion_t completion, void *context) {
+    if (requestName == NULL || completion == NULL) {
+        errno = NADAM_ERROR_NULL_POINTER;
+        return -1;
+    }
+
+    // a copy - the binding may be replaced meanwhile
+    nadam_messageInfo_t requestInfo;
+    if (findRequest(requestName, &requestInfo))
+        return -1;
+
+    pendingCall_t *call = malloc(sizeof(pendingCall_t));
+    if (call == NULL) {
+        errno = NADAM_ERROR_ALLOC_FAILED;
+        return -1;
+    }
+
+    *call = (pendingCall_t) { .completion = completion, .context = context,
+        .deadline = timeoutMs ? nadam_timestamp() + timeoutMs * (uint64_t) NS_PER_MS : 0 };
+    uint32_t callId;
+    if (addCall(call, &callId)) {
+        free(call);
+        return -1;
+    }
+
+    // the response might be delegated before sending returns - the call is registered first
+    if (sendWithCallId(requestName, &requestInfo, callId, request, size)) {
+        int error = errno;
+        free(takeCall(callId));
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+int nadam_rpcCallWait(const char *requestName, const void *request, uint32_t size, uint32_t timeoutMs,
+        void *response, uint32_t *responseSize) {
+    if (response == NULL || responseSize == NULL) {
+        errno = NADAM_ERROR_NULL_POINTER;
+        return -1;
+    }
+
+    waiter_t w = { .response = response, .size = responseSize };
+    pthread_mutex_init(&w.lock, NULL);
+    pthread_cond_init(&w.cond, NULL);
+    int ret = nadam_rpcCall(requestName, request, size, timeoutMs, completeWaiter, &w);
+    if (!ret) {
+        pthread_mutex_lock(&w.lock);
+        while (!w.isDone)
+            pthread_cond_wait(&w.cond, &w.lock);
+        pthread_mutex_unlock(&w.lock);
+
+        if (w.error) {
+            errno = w.error;
+            ret = -1;
+        }
+    }
+
+    pthread_cond_destroy(&w.cond);
+    pthread_mutex_destroy(&w.lock);
+    return ret;
+}
+
+int nadam_rpcRespond(nadam_rpcReply_t reply, const void *response, uint32_t size) {
+    if (reply.responseName == NULL) {
+        errno = NADAM_ERROR_NULL_POINTER;
+        return -1;
+    }
+
+    nadam_messageInfo_t mi;
+    if (nadam_getMessageInfo(reply.responseName, &mi))
+        return -1;
+
+    return sendWithCallId(reply.responseName, &mi, reply.callId, response, size);
+}
+
+void nadam_rpcCancelAll(int error) {
+    pendingCall_t *cancelled = NULL;
+    pthread_mutex_lock(&rpc.lock);
+    if (rpc.calls) {
+        for (khiter_t k = kh_begin(rpc.calls); k != kh_end(rpc.calls); ++k) {
+            if (!kh_exist(rpc.calls, k))
+                continue;
+
+            pendingCall_t *call = kh_val(rpc.calls, k);
+            call->next = cancelled;
+            cancelled = call;
+        }
+        kh_clear(calls, rpc.calls);
+    }
+    pthread_mutex_unlock(&rpc.lock);
+    completeAll(cancelled, error);
+}
+
+// private functions
+// -----------------------------------------------------------------------------
+static int findRequest(const char *requestName, nadam_messageInfo_t *request) {
+    bool isBound = false;
+    pthread_mutex_lock(&rpc.lock);
+    if (rpc.bindings) {
+        khiter_t k = kh_get(bindings, rpc.bindings, requestName);
+        isBound = k != kh_end(rpc.bindings);
+        if (isBound)
+            *request = kh_val(rpc.bindings, k)->request;
+    }
+    pthread_mutex_unlock(&rpc.lock);
+
+    if (!isBound) {
+        errno = NADAM_ERROR_UNKNOWN_NAME;
+        return -1;
+    }
+    return 0;
+}
+
+// names are interned - the binding outlives the caller's strings
+static int makeBinding(const char *requestName, const char *responseName, nadam_rpcHandler_t handler,
+        void *context, binding_t **binding) {
+    binding_t *b = calloc(1, sizeof(binding_t));
+    if (b == NULL) {
+        errno = NADAM_ERROR_ALLOC_FAILED;
+        return -1;
+    }
+
+    if (nadam_getMessageInfo(requestName, &b->request) || nadam_getMessageInfo(responseName, &b->response)) {
+        free(b);
+        return -1;
+    }
+
+    if (b->request.size.total < CALL_ID_LENGTH || b->response.size.total < CALL_ID_LENGTH) {
+        free(b);
+        errno = NADAM_ERROR_INVALID_ARGUMENT;
+        return -1;
+    }
+
+    b->request.name = internName(requestName);
+    b->responseName = internName(responseName);
+    b->response.name = b->responseName;
+    b->handler = handler;
+    b->context = context;
+    if (b->request.name == NULL || b->responseName == NULL) {
+        freeBinding(b);
+        errno = NADAM_ERROR_ALLOC_FAILED;
+        return -1;
+    }
+
+    *binding = b;
+    return 0;
+}
+
+static void freeBinding(binding_t *b) {
+    free(b);
+}
+
+// NULL if allocation fails - names already bound are shared
+static const char *internName(const char *name) {
+    pthread_mutex_lock(&rpc.lock);
+    if (rpc.names == NULL)
+        rpc.names = kh_init(names);
+
+    const char *interned = NULL;
+    khiter_t k = rpc.names ? kh_get(names, rpc.names, name) : 0;
+    if (rpc.names && k != kh_end(rpc.names)) {
+        interned = kh_key(rpc.names, k);
+    } else if (rpc.names) {
+        char *copy = strdup(name);
+        int ret = -1;
+        if (copy)
+            kh_put(names, rpc.names, copy, &ret);
+        if (ret < 0)
+            free(copy);
+        else
+            interned = copy;
+    }
+    pthread_mutex_unlock(&rpc.lock);
+    return interned;
+}
+
+// size is ignored for fixed size types, as by nadam_send()
+static int sendWithCallId(const char *name, const nadam_messageInfo_t *mi, uint32_t callId,
+        const void *payload, uint32_t size) {
+    uint32_t capacity = mi->size.total - CALL_ID_LENGTH;
+    if (!mi->size.isVariable)
+        size = capacity;
+    else if (size > capacity) {
+        errno = NADAM_ERROR_SIZE_ARG;
+        return -1;
+    }
+
+    uint8_t stackMessage[MESSAGE_STACK_LENGTH];
+    uint32_t length = CALL_ID_LENGTH + size;
+    uint8_t *message = length <= sizeof(stackMessage) ? stackMessage : malloc(length);
+    if (message == NULL) {
+        errno = NADAM_ERROR_ALLOC_FAILED;
+        return -1;
+    }
+
+    for (size_t i = 0; i < CALL_ID_LENGTH; ++i)
+        message[i] = (uint8_t) (callId >> (i * 8));
+    if (size)
+        memcpy(message + CALL_ID_LENGTH, payload, size);
+
+    int ret = nadam_send(name, message, length);
+    if (message != stackMessage)
+        free(message);
+    return ret;
+}
+
+static int addCall(pendingCall_t *call, uint32_t *callId) {
+    pthread_mutex_lock(&rpc.lock);
+    if (rpc.calls == NULL)
+        rpc.calls = kh_init(calls);
+
+    if (rpc.calls == NULL || (call->deadline && !rpc.hasTimer && startTimer())) {
+        pthread_mutex_unlock(&rpc.lock);
+        errno = NADAM_ERROR_ALLOC_FAILED;
+        return -1;
+    }
+
+    // ids wrap around - one still in flight is skipped
+    int ret = 0;
+    khiter_t k = 0;
+    for (size_t attempt = 0; ret == 0 && attempt < CALL_ID_ATTEMPTS; ++attempt) {
+        *callId = rpc.nextCallId++;
+        k = kh_put(calls, rpc.calls, *callId, &ret);
+    }
+
+    if (ret <= 0) {
+        pthread_mutex_unlock(&rpc.lock);
+        errno = NADAM_ERROR_ALLOC_FAILED;
+        return -1;
+    }
+
+    kh_val(rpc.calls, k) = call;
+    if (call->deadline && call->deadline < rpc.nextDeadline) {
+        rpc.nextDeadline = call->deadline;
+        pthread_cond_signal(&rpc.timerCond);
+    }
+    pthread_mutex_unlock(&rpc.lock);
+    return 0;
+}
+
+// NULL if the call isn't in flight (e.g. it timed out)
+static pendingCall_t *takeCall(uint32_t callId) {
+    pendingCall_t *call = NULL;
+    pthread_mutex_lock(&rpc.lock);
+    if (rpc.calls) {
+        khiter_t k = kh_get(calls, rpc.calls, callId);
+        if (k != kh_end(rpc.calls)) {
+            call = kh_val(rpc.calls, k);
+            kh_del(calls, rpc.calls, k);
+        }
+    }
+    pthread_mutex_unlock(&rpc.lock);
+    return call;
+}
+
+// caller has to hold rpc.lock
+static int startTimer(void) {
+    pthread_condattr_t attr;
+    if (pthread_condattr_init(&attr))
+        return -1;
+
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    int error = pthread_cond_init(&rpc.timerCond, &attr);
+    pthread_condattr_destroy(&attr);
+    if (error)
+        return -1;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, expireCalls, NULL)) {
+        pthread_cond_destroy(&rpc.timerCond);
+        return -1;
+    }
+
+    pthread_detach(thread);
+    rpc.hasTimer = true;
+    return 0;
+}
+
+// the timer thread - runs for the rest of the process
+static void *expireCalls(void *arg) {
+    pthread_mutex_lock(&rpc.lock);
+    while (true) {
+        pendingCall_t *expired = takeExpiredCalls(nadam_timestamp());
+        if (expired) {
+            pthread_mutex_unlock(&rpc.lock);
+            completeAll(expired, NADAM_ERROR_RPC_TIMEOUT);
+            pthread_mutex_lock(&rpc.lock);
+            continue;
+        }
+
+        if (rpc.nextDeadline == UINT64_MAX) {
+            pthread_cond_wait(&rpc.timerCond, &rpc.lock);
+        } else {
+            struct timespec ts = toTimespec(rpc.nextDeadline);
+            pthread_cond_timedwait(&rpc.timerCond, &rpc.lock, &ts);
+        }
+    }
+    return NULL;
+}
+
+// caller has to hold rpc.lock; updates nextDeadline from the calls left
+static pendingCall_t *takeExpiredCalls(uint64_t now) {
+    pendingCall_t *expired = NULL;
+    uint64_t next = UINT64_MAX;
+    for (khiter_t k = kh_begin(rpc.calls); k != kh_end(rpc.calls); ++k) {
+        if (!kh_exist(rpc.calls, k))
+            continue;
+
+        pendingCall_t *call = kh_val(rpc.calls, k);
+        if (call->deadline == 0)
+            continue;
+
+        if (call->deadline <= now) {
+            kh_del(calls, rpc.calls, k);
+            call->next = expired;
+            expired = call;
+        } else if (call->deadline < next) {
+            next = call->deadline;
+        }
+    }
+
+    rpc.nextDeadline = next;
+    return expired;
+}
+
+static void completeAll(pendingCall_t *calls, int error) {
+    while (calls) {
+        pendingCall_t *next = calls->next;
+        calls->completion(error, NULL, 0, calls->context);
+        free(calls);
+        calls = next;
+    }
+}
+
+static uint32_t readCallId(const uint8_t *msg) {
+    uint32_t callId = 0;
+    for (size_t i = 0; i < CALL_ID_LENGTH; ++i)
+        callId |= (uint32_t) msg[i] << (i * 8);
+    return callId;
+}
+
+// malformed requests (shorter than the call id) and requests of removed bindings are dropped
+static void requestDelegate(void *msg, uint32_t size, const nadam_messageInfo_t *messageInfo) {
+    if (size < CALL_ID_LENGTH)
+        return;
+
+    pthread_mutex_lock(&rpc.lock);
+    binding_t *b = NULL;
+    if (rpc.bindings) {
+        khiter_t k = kh_get(bindings, rpc.bindings, messageInfo->name);
+        b = k != kh_end(rpc.bindings) ? kh_val(rpc.bindings, k) : NULL;
+    }
+    nadam_rpcHandler_t handler = b ? b->handler : NULL;
+    void *context = b ? b->context : NULL;
+    nadam_rpcReply_t reply = { b ? b->responseName : NULL, readCallId(msg) };
+    pthread_mutex_unlock(&rpc.lock);
+
+    if (handler)
+        handler(reply, (uint8_t *) msg + CALL_ID_LENGTH, size - CALL_ID_LENGTH, context);
+}
+
+// a response to a call, which isn't in flight anymore, is dropped
+static void responseDelegate(void *msg, uint32_t size, const nadam_messageInfo_t *messageInfo) {
+    if (size < CALL_ID_LENGTH)
+        return;
+
+    pendingCall_t *call = takeCall(readCallId(msg));
+    if (call == NULL)
+        return;
+
+    call->completion(0, (uint8_t *) msg + CALL_ID_LENGTH, size - CALL_ID_LENGTH, call->context);
+    free(call);
+}
+
+static void completeWaiter(int error, const void *response, uint32_t size, void *context) {
+    waiter_t *w = context;
+    if (!error && size > *w->size)
+        error = NADAM_ERROR_SIZE_ARG;
+
+    if (!error) {
+        memcpy(w->response, response, size);
+        *w->size = size;
+    }
+
+    pthread_mutex_lock(&w->lock);
+    w->error = error;
+    w->isDone = true;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+static struct timespec toTimespec(uint64_t ns) {
+    return (struct timespec) { .tv_sec = (time_t) (ns / 1000000000u), .tv_nsec = (long) (ns % 1000000000u) };
+}
+
+// unittest
+// -----------------------------------------------------------------------------
+#ifdef UNITTEST
+#include <unistd.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#define CALL_COUNT 100
+
+// the connection loops back - calls are served by the same process
+typedef struct {
+    int fd[2];
+    atomic_uint completed;
+    int error;
+    uint32_t sum;
+} loopback_t;
+
+static loopback_t loopback;
+
+static int loopbackSend(const void *src, uint32_t n) {
+    return write(loopback.fd[1], src, n) == (ssize_t) n ? 0 : -1;
+}
+
+static int loopbackRecv(void *dest, uint32_t n) {
+    for (uint32_t done = 0; done < n; ) {
+        ssize_t ret = read(loopback.fd[0], (uint8_t *) dest + done, n - done);
+        if (ret <= 0)
+            return -1;
+        done += (uint32_t) ret;
+    }
+    return 0;
+}
+
+static void loopbackErrorDelegate(int error) {
+}
+
+static void doubleHandler(nadam_rpcReply_t reply, const void *request, uint32_t size, void *context) {
+    uint32_t value;
+    memcpy(&value, request, sizeof(value));
+    value *= 2;
+    nadam_rpcRespond(reply, &value, sizeof(value));
+}
+
+static void ignoringHandler(nadam_rpcReply_t reply, const void *request, uint32_t size, void *context) {
+}
+
+static nadam_rpcReply_t deferredReply;
+static atomic_bool isReplyDeferred;
+
+static void deferringHandler(nadam_rpcReply_t reply, const void *request, uint32_t size, void *context) {
+    deferredReply = reply;
+    atomic_store(&isReplyDeferred, true);
+}
+
+static void countingCompletion(int error, const void *response, uint32_t size, void *context) {
+    if (error) {
+        loopback.error = error;
+    } else {
+        uint32_t value;
+        memcpy(&value, response, sizeof(value));
+        loopback.sum += value - 2 * (uint32_t) (uintptr_t) context;
+    }
+    atomic_fetch_add(&loopback.completed, 1);
+}
+
+static void waitForCompletions(uint32_t count) {
+    while (atomic_load(&loopback.completed) < count)
+        sched_yield();
+}
+
+static int initLoopback(nadam_rpcHandler_t handler) {
+    static nadam_messageInfo_t infos[] = { { .name = "Double request", .size = { false, { 8 } } },
+        { .name = "Double response", .size = { true, { 8 } } } };
+    loopback = (loopback_t) { .error = 0 };
+    if (nadam_makeMessageInfos(infos, 2) || nadam_init(infos, 2, 4) || pipe(loopback.fd))
+        return -1;
+
+    if (nadam_rpcBind("Double request", "Double response", handler, NULL)
+            || nadam_initiate(loopbackSend, loopbackRecv, loopbackErrorDelegate))
+        return -1;
+    return 0;
+}
+
+static void stopLoopback(void) {
+    nadam_stop();
+    close(loopback.fd[0]);
+    close(loopback.fd[1]);
+}
+
+int pipelinedCallsMatchResponses(void) {
+    ASSERT(!initLoopback(doubleHandler));
+    // every response is twice its request - the sum of differences stays 0 if responses match calls
+    for (uint32_t i = 0; i < CALL_COUNT; ++i)
+        ASSERT(!nadam_rpcCall("Double request", &i, sizeof(i), 0, countingCompletion, (void *) (uintptr_t) i));
+
+    waitForCompletions(CALL_COUNT);
+    stopLoopback();
+    ASSERT(loopback.error == 0);
+    ASSERT(loopback.sum == 0);
+    return 0;
+}
+
+int callWaitReturnsResponse(void) {
+    ASSERT(!initLoopback(doubleHandler));
+    uint32_t request = 21, response = 0, size = sizeof(response);
+    int ret = nadam_rpcCallWait("Double request", &request, sizeof(request), 1000, &response, &size);
+    stopLoopback();
+    ASSERT(!ret);
+    ASSERT(size == 4 && response == 42);
+    return 0;
+}
+
+int unansweredCallTimesOut(void) {
+    ASSERT(!initLoopback(ignoringHandler));
+    uint32_t request = 1, response, size = sizeof(response);
+    errno = 0;
+    int ret = nadam_rpcCallWait("Double request", &request, sizeof(request), 10, &response, &size);
+    stopLoopback();
+    ASSERT(ret);
+    ASSERT(errno == NADAM_ERROR_RPC_TIMEOUT);
+    return 0;
+}
+
+int cancelAllCompletesCalls(void) {
+    ASSERT(!initLoopback(ignoringHandler));
+    for (uint32_t i = 0; i < 3; ++i)
+        ASSERT(!nadam_rpcCall("Double request", &i, sizeof(i), 0, countingCompletion, NULL));
+
+    nadam_rpcCancelAll(NADAM_ERROR_RECV);
+    stopLoopback();
+    ASSERT(atomic_load(&loopback.completed) == 3);
+    ASSERT(loopback.error == NADAM_ERROR_RECV);
+    return 0;
+}
+
+int deferredReplyOutlivesRebind(void) {
+    atomic_store(&isReplyDeferred, false);
+    ASSERT(!initLoopback(deferringHandler));
+    uint32_t request = 5;
+    ASSERT(!nadam_rpcCall("Double request", &request, sizeof(request), 0, countingCompletion,
+                (void *) (uintptr_t) request));
+    while (!atomic_load(&isReplyDeferred))
+        sched_yield();
+
+    // the binding holding the reply's name is replaced
+    ASSERT(!nadam_rpcBind("Double request", "Double response", ignoringHandler, NULL));
+    uint32_t response = 2 * request;
+    ASSERT(!nadam_rpcRespond(deferredReply, &response, sizeof(response)));
+    waitForCompletions(1);
+    stopLoopback();
+    ASSERT(loopback.error == 0 && loopback.sum == 0);
+    ASSERT(strcmp(deferredReply.responseName, "Double response") == 0);
+    return 0;
+}
+
+static atomic_bool isRebinding;
+
+static void *rebindRepeatedly(void *arg) {
+    while (atomic_load(&isRebinding))
+        nadam_rpcBind("Double request", "Double response", doubleHandler, NULL);
+    return NULL;
+}
+
+int callsInFlightDuringRebind(void) {
+    ASSERT(!initLoopback(doubleHandler));
+    atomic_store(&isRebinding, true);
+    pthread_t thread;
+    ASSERT(!pthread_create(&thread, NULL, rebindRepeatedly, NULL));
+    uint32_t failed = 0;
+    for (uint32_t i = 0; i < CALL_COUNT; ++i) {
+        if (nadam_rpcCall("Double request", &i, sizeof(i), 0, countingCompletion, (void *) (uintptr_t) i))
+            ++failed;
+    }
+
+    waitForCompletions(CALL_COUNT - failed);
+    atomic_store(&isRebinding, false);
+    pthread_join(thread, NULL);
+    stopLoopback();
+    ASSERT(failed == 0);
+    ASSERT(loopback.error == 0 && loopback.sum == 0);
+    return 0;
+}
+
+int bindOfTypeWithoutRoomForCallIdError(void) {
+    nadam_messageInfo_t infos[] = { { .name = "Tiny request", .size = { false, { 3 } } },
+        { .name = "Tiny response", .size = { false, { 8 } } } };
+    ASSERT(!nadam_makeMessageInfos(infos, 2));
+    ASSERT(!nadam_init(infos, 2, 4));
+    errno = 0;
+    ASSERT(nadam_rpcBind("Tiny request", "Tiny response", ignoringHandler, NULL));
+    ASSERT(errno == NADAM_ERROR_INVALID_ARGUMENT);
+    errno = 0;
+    ASSERT(nadam_rpcBind("Tiny request", "Unknown", ignoringHandler, NULL));
+    ASSERT(errno == NADAM_ERROR_UNKNOWN_NAME);
+    return 0;
+}
+
+int callOfUnboundTypeError(void) {
+    uint32_t request = 0;
+    errno = 0;
+    ASSERT(nadam_rpcCall("Not bound", &request, sizeof(request), 0, countingCompletion, NULL));
+    ASSERT(errno == NADAM_ERROR_UNKNOWN_NAME);
+    return 0;
+}
+#endif
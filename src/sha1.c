@@ -0,0 +1,428 @@
+/*
+Copyright:  Copyright Johannes Teichrieb 2015
+License:    opensource.org/licenses/MIT
+*/
+#include "sha1.h"
+
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SHA1_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#include "unittestMacros.h"
+
+#define BLOCK_LENGTH 64
+
+typedef enum {
+    IMPLEMENTATION_PORTABLE,
+    IMPLEMENTATION_AVX2, // several inputs side by side, single ones are hashed by the portable code
+    IMPLEMENTATION_SHA_EXTENSIONS
+} implementation_t;
+
+typedef void (*compress_t)(uint32_t state[5], const uint8_t *blocks, size_t blockCount);
+
+static const uint32_t stateInit[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+// private declarations
+// -----------------------------------------------------------------------------
+static implementation_t getImplementation(void);
+static void detectImplementation(void);
+static bool isSupported(implementation_t implementation);
+static compress_t getCompress(implementation_t implementation);
+static void digestWith(compress_t compress, const uint8_t *data, size_t length, uint8_t *digest);
+static void digestLanesWith(implementation_t implementation, const uint8_t *const data[],
+        const size_t lengths[], size_t count, uint8_t digests[][SHA1_DIGEST_LENGTH]);
+static size_t makeTail(const uint8_t *data, size_t length, uint8_t tail[2 * BLOCK_LENGTH]);
+static void writeDigest(const uint32_t state[5], uint8_t *digest);
+static uint32_t readBigEndian32(const uint8_t *src);
+static uint32_t rotateLeft(uint32_t x, unsigned n);
+static void compressPortable(uint32_t state[5], const uint8_t *blocks, size_t blockCount);
+#ifdef SHA1_X86
+static void compressShaExtensions(uint32_t state[5], const uint8_t *blocks, size_t blockCount);
+static void digestLanesAvx2(const uint8_t *const data[], const size_t lengths[], size_t count,
+        uint8_t digests[][SHA1_DIGEST_LENGTH]);
+static void compressLanesAvx2(uint32_t states[5][SHA1_LANES], const uint8_t *blocks, const uint32_t active[SHA1_LANES]);
+#endif
+
+static pthread_once_t detectOnce = PTHREAD_ONCE_INIT;
+static implementation_t detected;
+
+// interface functions
+// -----------------------------------------------------------------------------
+void sha1_digest(const void *data, size_t length, uint8_t digest[SHA1_DIGEST_LENGTH]) {
+    digestWith(getCompress(getImplementation()), data, length, digest);
+}
+
+void sha1_digestLanes(const uint8_t *const data[], const size_t lengths[], size_t count,
+        uint8_t digests[][SHA1_DIGEST_LENGTH]) {
+    digestLanesWith(getImplementation(), data, lengths, count, digests);
+}
+
+// private functions
+// -----------------------------------------------------------------------------
+static implementation_t getImplementation(void) {
+    pthread_once(&detectOnce, detectImplementation);
+    return detected;
+}
+
+static void detectImplementation(void) {
+    if (isSupported(IMPLEMENTATION_SHA_EXTENSIONS))
+        detected = IMPLEMENTATION_SHA_EXTENSIONS;
+    else if (isSupported(IMPLEMENTATION_AVX2))
+        detected = IMPLEMENTATION_AVX2;
+    else
+        detected = IMPLEMENTATION_PORTABLE;
+}
+
+static bool isSupported(implementation_t implementation) {
+    if (implementation == IMPLEMENTATION_PORTABLE)
+        return true;
+
+#ifdef SHA1_X86
+    __builtin_cpu_init();
+    if (implementation == IMPLEMENTATION_AVX2)
+        return __builtin_cpu_supports("avx2");
+
+    unsigned a, b, c, d;
+    return __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & bit_SHA) && __builtin_cpu_supports("sse4.1");
+#else
+    return false;
+#endif
+}
+
+static compress_t getCompress(implementation_t implementation) {
+#ifdef SHA1_X86
+    if (implementation == IMPLEMENTATION_SHA_EXTENSIONS)
+        return compressShaExtensions;
+#endif
+    return compressPortable;
+}
+
+static void digestWith(compress_t compress, const uint8_t *data, size_t length, uint8_t *digest) {
+    uint32_t state[5];
+    memcpy(state, stateInit, sizeof(state));
+
+    size_t fullBlocks = length / BLOCK_LENGTH;
+    if (fullBlocks)
+        compress(state, data, fullBlocks);
+
+    uint8_t tail[2 * BLOCK_LENGTH];
+    compress(state, tail, makeTail(data, length, tail));
+    writeDigest(state, digest);
+}
+
+static void digestLanesWith(implementation_t implementation, const uint8_t *const data[],
+        const size_t lengths[], size_t count, uint8_t digests[][SHA1_DIGEST_LENGTH]) {
+#ifdef SHA1_X86
+    if (implementation == IMPLEMENTATION_AVX2 && count > 1) {
+        digestLanesAvx2(data, lengths, count, digests);
+        return;
+    }
+#endif
+
+    compress_t compress = getCompress(implementation);
+    for (size_t i = 0; i < count; ++i)
+        digestWith(compress, data[i], lengths[i], digests[i]);
+}
+
+// padding: 0x80, zeros, 8 byte big-endian bit length - returns count of the tail blocks (1 or 2)
+static size_t makeTail(const uint8_t *data, size_t length, uint8_t tail[2 * BLOCK_LENGTH]) {
+    size_t rest = length % BLOCK_LENGTH;
+    size_t tailLength = (rest + 1 + 8 <= BLOCK_LENGTH) ? BLOCK_LENGTH : 2 * BLOCK_LENGTH;
+    memset(tail, 0, tailLength);
+    if (rest)
+        memcpy(tail, data + length - rest, rest);
+
+    tail[rest] = 0x80;
+    uint64_t bitLength = (uint64_t) length * 8;
+    for (size_t i = 0; i < 8; ++i)
+        tail[tailLength - 1 - i] = (uint8_t) (bitLength >> (8 * i));
+
+    return tailLength / BLOCK_LENGTH;
+}
+
+static void writeDigest(const uint32_t state[5], uint8_t *digest) {
+    for (size_t i = 0; i < SHA1_DIGEST_LENGTH; ++i)
+        digest[i] = (uint8_t) (state[i / 4] >> (24 - 8 * (i % 4)));
+}
+
+static uint32_t readBigEndian32(const uint8_t *src) {
+    return (uint32_t) src[0] << 24 | (uint32_t) src[1] << 16 | (uint32_t) src[2] << 8 | src[3];
+}
+
+static uint32_t rotateLeft(uint32_t x, unsigned n) {
+    return x << n | x >> (32 - n);
+}
+
+static void compressPortable(uint32_t state[5], const uint8_t *blocks, size_t blockCount) {
+    for (; blockCount; --blockCount, blocks += BLOCK_LENGTH) {
+        uint32_t w[16];
+        for (size_t i = 0; i < 16; ++i)
+            w[i] = readBigEndian32(blocks + 4 * i);
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+        for (size_t i = 0; i < 80; ++i) {
+            if (i >= 16)
+                w[i & 15] = rotateLeft(w[(i - 3) & 15] ^ w[(i - 8) & 15] ^ w[(i - 14) & 15] ^ w[i & 15], 1);
+
+            uint32_t f, k;
+            if (i < 20) {
+                f = d ^ (b & (c ^ d));
+                k = 0x5A827999;
+            } else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            } else if (i < 60) {
+                f = (b & c) | (d & (b | c));
+                k = 0x8F1BBCDC;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+
+            uint32_t temp = rotateLeft(a, 5) + f + e + k + w[i & 15];
+            e = d;
+            d = c;
+            c = rotateLeft(b, 30);
+            b = a;
+            a = temp;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+    }
+}
+
+#ifdef SHA1_X86
+/* 4 rounds of group g. Message words of the group are in msg[g % 4], schedule of the following
+   groups is computed alongside: msg1, xor and msg2 complete a group's words 3 groups in advance.  */
+#define SHA_EXTENSIONS_GROUP(g, eCurrent, eNext) do { \
+        if ((g) == 0) \
+            eCurrent = _mm_add_epi32(eCurrent, msg[0]); \
+        else \
+            eCurrent = _mm_sha1nexte_epu32(eCurrent, msg[(g) % 4]); \
+        eNext = abcd; \
+        if ((g) >= 3 && (g) <= 18) \
+            msg[((g) + 1) % 4] = _mm_sha1msg2_epu32(msg[((g) + 1) % 4], msg[(g) % 4]); \
+        abcd = _mm_sha1rnds4_epu32(abcd, eCurrent, (g) / 5); \
+        if ((g) >= 1 && (g) <= 16) \
+            msg[((g) + 3) % 4] = _mm_sha1msg1_epu32(msg[((g) + 3) % 4], msg[(g) % 4]); \
+        if ((g) >= 2 && (g) <= 17) \
+            msg[((g) + 2) % 4] = _mm_xor_si128(msg[((g) + 2) % 4], msg[(g) % 4]); \
+    } while (0)
+
+__attribute__((target("sha,sse4.1")))
+static void compressShaExtensions(uint32_t state[5], const uint8_t *blocks, size_t blockCount) {
+    const __m128i byteSwap = _mm_set_epi64x(0x0001020304050607, 0x08090a0b0c0d0e0f);
+    // a in the highest lane
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) state), 0x1B);
+    __m128i e0 = _mm_set_epi32((int) state[4], 0, 0, 0);
+    __m128i e1;
+
+    for (; blockCount; --blockCount, blocks += BLOCK_LENGTH) {
+        __m128i abcdSaved = abcd;
+        __m128i eSaved = e0;
+        __m128i msg[4];
+        for (size_t i = 0; i < 4; ++i)
+            msg[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (blocks + 16 * i)), byteSwap);
+
+        SHA_EXTENSIONS_GROUP(0, e0, e1);
+        SHA_EXTENSIONS_GROUP(1, e1, e0);
+        SHA_EXTENSIONS_GROUP(2, e0, e1);
+        SHA_EXTENSIONS_GROUP(3, e1, e0);
+        SHA_EXTENSIONS_GROUP(4, e0, e1);
+        SHA_EXTENSIONS_GROUP(5, e1, e0);
+        SHA_EXTENSIONS_GROUP(6, e0, e1);
+        SHA_EXTENSIONS_GROUP(7, e1, e0);
+        SHA_EXTENSIONS_GROUP(8, e0, e1);
+        SHA_EXTENSIONS_GROUP(9, e1, e0);
+        SHA_EXTENSIONS_GROUP(10, e0, e1);
+        SHA_EXTENSIONS_GROUP(11, e1, e0);
+        SHA_EXTENSIONS_GROUP(12, e0, e1);
+        SHA_EXTENSIONS_GROUP(13, e1, e0);
+        SHA_EXTENSIONS_GROUP(14, e0, e1);
+        SHA_EXTENSIONS_GROUP(15, e1, e0);
+        SHA_EXTENSIONS_GROUP(16, e0, e1);
+        SHA_EXTENSIONS_GROUP(17, e1, e0);
+        SHA_EXTENSIONS_GROUP(18, e0, e1);
+        SHA_EXTENSIONS_GROUP(19, e1, e0);
+
+        e0 = _mm_sha1nexte_epu32(e0, eSaved);
+        abcd = _mm_add_epi32(abcd, abcdSaved);
+    }
+
+    _mm_storeu_si128((__m128i *) state, _mm_shuffle_epi32(abcd, 0x1B));
+    state[4] = (uint32_t) _mm_extract_epi32(e0, 3);
+}
+
+/* Each lane hashes its own input - block by block, until the longest one is done.
+   Blocks of a step are copied side by side, so that the message words can be gathered.  */
+__attribute__((target("avx2")))
+static void digestLanesAvx2(const uint8_t *const data[], const size_t lengths[], size_t count,
+        uint8_t digests[][SHA1_DIGEST_LENGTH]) {
+    uint8_t tails[SHA1_LANES][2 * BLOCK_LENGTH];
+    size_t fullBlocks[SHA1_LANES];
+    size_t blockCounts[SHA1_LANES];
+    size_t maxBlockCount = 0;
+    for (size_t lane = 0; lane < count; ++lane) {
+        fullBlocks[lane] = lengths[lane] / BLOCK_LENGTH;
+        blockCounts[lane] = fullBlocks[lane] + makeTail(data[lane], lengths[lane], tails[lane]);
+        if (blockCounts[lane] > maxBlockCount)
+            maxBlockCount = blockCounts[lane];
+    }
+
+    uint32_t states[5][SHA1_LANES];
+    for (size_t i = 0; i < 5; ++i) {
+        for (size_t lane = 0; lane < SHA1_LANES; ++lane)
+            states[i][lane] = stateInit[i];
+    }
+
+    _Alignas(32) uint8_t blocks[SHA1_LANES * BLOCK_LENGTH] = { 0 };
+    for (size_t block = 0; block < maxBlockCount; ++block) {
+        uint32_t active[SHA1_LANES] = { 0 };
+        for (size_t lane = 0; lane < count; ++lane) {
+            if (block >= blockCounts[lane])
+                continue;
+
+            const uint8_t *src = block < fullBlocks[lane] ? data[lane] + block * BLOCK_LENGTH
+                : tails[lane] + (block - fullBlocks[lane]) * BLOCK_LENGTH;
+            memcpy(blocks + lane * BLOCK_LENGTH, src, BLOCK_LENGTH);
+            active[lane] = UINT32_MAX;
+        }
+        compressLanesAvx2(states, blocks, active);
+    }
+
+    for (size_t lane = 0; lane < count; ++lane) {
+        uint32_t state[5];
+        for (size_t i = 0; i < 5; ++i)
+            state[i] = states[i][lane];
+        writeDigest(state, digests[lane]);
+    }
+}
+
+#define ROTATE_LEFT_256(x, n) _mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - (n)))
+
+// state of inactive lanes is kept
+__attribute__((target("avx2")))
+static void compressLanesAvx2(uint32_t states[5][SHA1_LANES], const uint8_t *blocks, const uint32_t active[SHA1_LANES]) {
+    const __m256i offsets = _mm256_setr_epi32(0, BLOCK_LENGTH, 2 * BLOCK_LENGTH, 3 * BLOCK_LENGTH,
+            4 * BLOCK_LENGTH, 5 * BLOCK_LENGTH, 6 * BLOCK_LENGTH, 7 * BLOCK_LENGTH);
+    const __m256i byteSwap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    __m256i w[16];
+    for (size_t i = 0; i < 16; ++i) {
+        __m256i words = _mm256_i32gather_epi32((const int *) (const void *) (blocks + 4 * i), offsets, 1);
+        w[i] = _mm256_shuffle_epi8(words, byteSwap);
+    }
+
+    __m256i saved[5];
+    for (size_t i = 0; i < 5; ++i)
+        saved[i] = _mm256_loadu_si256((const __m256i *) states[i]);
+
+    __m256i a = saved[0], b = saved[1], c = saved[2], d = saved[3], e = saved[4];
+    for (size_t i = 0; i < 80; ++i) {
+        if (i >= 16) {
+            __m256i x = _mm256_xor_si256(_mm256_xor_si256(w[(i - 3) & 15], w[(i - 8) & 15]),
+                    _mm256_xor_si256(w[(i - 14) & 15], w[i & 15]));
+            w[i & 15] = ROTATE_LEFT_256(x, 1);
+        }
+
+        __m256i f, k;
+        if (i < 20) {
+            f = _mm256_xor_si256(d, _mm256_and_si256(b, _mm256_xor_si256(c, d)));
+            k = _mm256_set1_epi32(0x5A827999);
+        } else if (i < 40) {
+            f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+            k = _mm256_set1_epi32(0x6ED9EBA1);
+        } else if (i < 60) {
+            f = _mm256_or_si256(_mm256_and_si256(b, c), _mm256_and_si256(d, _mm256_or_si256(b, c)));
+            k = _mm256_set1_epi32((int) 0x8F1BBCDC);
+        } else {
+            f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+            k = _mm256_set1_epi32((int) 0xCA62C1D6);
+        }
+
+        __m256i temp = _mm256_add_epi32(_mm256_add_epi32(ROTATE_LEFT_256(a, 5), f),
+                _mm256_add_epi32(_mm256_add_epi32(e, k), w[i & 15]));
+        e = d;
+        d = c;
+        c = ROTATE_LEFT_256(b, 30);
+        b = a;
+        a = temp;
+    }
+
+    __m256i mask = _mm256_loadu_si256((const __m256i *) active);
+    __m256i result[5] = { a, b, c, d, e };
+    for (size_t i = 0; i < 5; ++i) {
+        __m256i updated = _mm256_add_epi32(saved[i], result[i]);
+        _mm256_storeu_si256((__m256i *) states[i], _mm256_blendv_epi8(saved[i], updated, mask));
+    }
+}
+#endif
+
+// unittest
+// -----------------------------------------------------------------------------
+#ifdef UNITTEST
+static const char *twoBlockInput = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+static const uint8_t twoBlockDigest[] = { 0x84, 0x98, 0x3e, 0x44, 0x1c, 0x3b, 0xd2, 0x6e, 0xba, 0xae,
+    0x4a, 0xa1, 0xf9, 0x51, 0x29, 0xe5, 0xe5, 0x46, 0x70, 0xf1 };
+
+int sha1KnownDigests(void) {
+    static const uint8_t abcDigest[] = { 0xa9, 0x99, 0x3e, 0x36, 0x47, 0x06, 0x81, 0x6a, 0xba, 0x3e,
+        0x25, 0x71, 0x78, 0x50, 0xc2, 0x6c, 0x9c, 0xd0, 0xd8, 0x9d };
+    static const uint8_t emptyDigest[] = { 0xda, 0x39, 0xa3, 0xee, 0x5e, 0x6b, 0x4b, 0x0d, 0x32, 0x55,
+        0xbf, 0xef, 0x95, 0x60, 0x18, 0x90, 0xaf, 0xd8, 0x07, 0x09 };
+
+    uint8_t digest[SHA1_DIGEST_LENGTH];
+    sha1_digest("abc", 3, digest);
+    ASSERT(memcmp(digest, abcDigest, sizeof(digest)) == 0);
+    sha1_digest(NULL, 0, digest);
+    ASSERT(memcmp(digest, emptyDigest, sizeof(digest)) == 0);
+    sha1_digest(twoBlockInput, strlen(twoBlockInput), digest);
+    ASSERT(memcmp(digest, twoBlockDigest, sizeof(digest)) == 0);
+    return 0;
+}
+
+// every implementation the CPU supports has to agree with the portable one
+int sha1ImplementationsAgree(void) {
+    uint8_t input[300];
+    uint32_t x = 2463534242u;
+    for (size_t i = 0; i < sizeof(input); ++i) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        input[i] = (uint8_t) x;
+    }
+
+    // lengths around the block and padding boundaries, lanes of different block counts
+    for (size_t start = 0; start + SHA1_LANES <= 140; start += SHA1_LANES) {
+        const uint8_t *data[SHA1_LANES];
+        size_t lengths[SHA1_LANES];
+        for (size_t lane = 0; lane < SHA1_LANES; ++lane) {
+            data[lane] = input + lane;
+            lengths[lane] = start + lane * 17 % 7 + (lane & 1) * 64;
+        }
+
+        size_t count = 2 + start % (SHA1_LANES - 1);
+        uint8_t expected[SHA1_LANES][SHA1_DIGEST_LENGTH];
+        digestLanesWith(IMPLEMENTATION_PORTABLE, data, lengths, count, expected);
+        for (implementation_t i = IMPLEMENTATION_AVX2; i <= IMPLEMENTATION_SHA_EXTENSIONS; ++i) {
+            if (!isSupported(i))
+                continue;
+
+            uint8_t digests[SHA1_LANES][SHA1_DIGEST_LENGTH];
+            digestLanesWith(i, data, lengths, count, digests);
+            ASSERT(memcmp(digests, expected, count * SHA1_DIGEST_LENGTH) == 0);
+        }
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,19 @@
+/*
+Copyright:  Copyright Johannes Teichrieb 2015
+License:    opensource.org/licenses/MIT
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA1_DIGEST_LENGTH 20
+// most inputs hashed side by side by sha1_digestLanes()
+#define SHA1_LANES 8
+
+/* SHA-1 using the SHA extensions or AVX2 if the CPU has them, portable code otherwise.
+   The implementation is chosen on first use - results don't depend on it.  */
+void sha1_digest(const void *data, size_t length, uint8_t digest[SHA1_DIGEST_LENGTH]);
+// digests of count (at most SHA1_LANES) independent inputs
+void sha1_digestLanes(const uint8_t *const data[], const size_t lengths[], size_t count,
+        uint8_t digests[][SHA1_DIGEST_LENGTH]);
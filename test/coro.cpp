@@ -0,0 +1,163 @@
+/*
+Copyright:  Copyright Johannes Teichrieb 2015
+License:    opensource.org/licenses/MIT
+*/
+// nadam_coro.hpp over a connection looping back through a pipe - run by the nadamcoro_t target
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <thread>
+#include <unistd.h>
+
+#include "nadam_coro.hpp"
+
+#include "unittestMacros.h"
+
+namespace {
+
+struct Count : nadam::fixed<uint32_t> { static constexpr std::string_view name = "Count"; };
+struct Text : nadam::variable<char, 16> { static constexpr std::string_view name = "Text"; };
+
+// starts at once, destroyed at the end
+struct task {
+    struct promise_type {
+        task get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+nadam::coro::connection<Count, Text> conn;
+int loopback[2];
+// called once from within the next send - e.g. to queue another send behind it
+std::function<void()> sendHook;
+
+int loopbackSend(const void *src, uint32_t n) {
+    if (sendHook) {
+        auto hook = std::move(sendHook);
+        sendHook = nullptr;
+        hook();
+    }
+    return write(loopback[1], src, n) == static_cast<ssize_t>(n) ? 0 : -1;
+}
+
+int loopbackRecv(void *dest, uint32_t n) {
+    for (uint32_t done = 0; done < n;) {
+        ssize_t ret = read(loopback[0], static_cast<uint8_t *>(dest) + done, n - done);
+        if (ret <= 0)
+            return -1;
+        done += static_cast<uint32_t>(ret);
+    }
+    return 0;
+}
+
+void loopbackErrorDelegate(int) {
+}
+
+int startLoopback() {
+    if (pipe(loopback) || conn.init(4))
+        return -1;
+    return conn.initiate(loopbackSend, loopbackRecv, loopbackErrorDelegate);
+}
+
+void stopLoopback() {
+    conn.stop();
+    close(loopback[0]);
+    close(loopback[1]);
+}
+
+struct {
+    std::atomic_bool isDone;
+    uint32_t count;
+    char text[17];
+    int sendError;
+} roundTrip;
+
+task receiveCountAndText() {
+    roundTrip.count = co_await conn.next<Count>();
+    auto text = co_await conn.next<Text>();
+    std::memcpy(roundTrip.text, text.data(), text.size());
+    roundTrip.text[text.size()] = '\0';
+    roundTrip.isDone = true;
+}
+
+task sendCountAndText() {
+    roundTrip.sendError = co_await conn.send<Count>(42);
+    if (!roundTrip.sendError)
+        roundTrip.sendError = co_await conn.send<Text>("hello", 5);
+}
+
+struct {
+    int bSends;
+    int bSendsBeforeA;
+} fairness;
+
+task sendThrice() {
+    for (uint32_t i = 0; i < 3; ++i) {
+        co_await conn.send<Count>(i);
+        ++fairness.bSends;
+    }
+}
+
+task sendOnceNoting() {
+    co_await conn.send<Count>(100);
+    fairness.bSendsBeforeA = fairness.bSends;
+}
+
+} // namespace
+
+int nextAndSendRoundTrip() {
+    roundTrip.isDone = false;
+    receiveCountAndText();
+    ASSERT(!startLoopback());
+    sendCountAndText();
+    while (!roundTrip.isDone)
+        std::this_thread::yield();
+    stopLoopback();
+    ASSERT(roundTrip.sendError == 0);
+    ASSERT(roundTrip.count == 42 && std::strcmp(roundTrip.text, "hello") == 0);
+    return 0;
+}
+
+int sendOfInvalidSizeCompletesAtOnce() {
+    ASSERT(!startLoopback());
+    int error = -1;
+    [](int &e) -> task { e = co_await conn.send<Text>("seventeen chars!!", 17); }(error);
+    stopLoopback();
+    ASSERT(error == NADAM_ERROR_SIZE_ARG);
+    return 0;
+}
+
+// a coroutine queued during a send goes first, but sending again it doesn't hold up the sending one
+int sendingCoroutineIsResumedInTurn() {
+    fairness = {};
+    ASSERT(!startLoopback());
+    sendHook = [] { std::thread(sendThrice).join(); };
+    sendOnceNoting();
+    stopLoopback();
+    ASSERT(fairness.bSends == 3);
+    ASSERT(fairness.bSendsBeforeA == 1);
+    return 0;
+}
+
+int main() {
+    int (*const tests[])() = { nextAndSendRoundTrip, sendOfInvalidSizeCompletesAtOnce,
+        sendingCoroutineIsResumedInTurn };
+    const char *const names[] = { "nextAndSendRoundTrip", "sendOfInvalidSizeCompletesAtOnce",
+        "sendingCoroutineIsResumedInTurn" };
+
+    int failed = 0;
+    for (size_t i = 0; i < std::size(tests); ++i) {
+        if (tests[i]()) {
+            std::printf("FAILED: %s\n", names[i]);
+            ++failed;
+        }
+    }
+    std::printf("%zu tests, %d failed\n", std::size(tests), failed);
+    return failed != 0;
+}